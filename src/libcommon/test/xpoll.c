@@ -0,0 +1,140 @@
+/************************************************************\
+ * Copyright (C) 2004 The Regents of the University of California.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of PowerMan, a remote power management program.
+ * For details, see https://github.com/chaos/powerman.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "tap.h"
+
+#include "xpoll.h"
+
+static xpollfd_t pfd;
+static int calls;
+static short last_revents;
+static int pair[2];
+static int survivor = -1;
+
+static void
+_count_cb(int fd, short revents, void *arg)
+{
+    calls++;
+    last_revents = revents;
+    if (arg)
+        *(int *)arg = fd;
+}
+
+/* Unregister the other fd of the pair from within a callback.
+ */
+static void
+_del_cb(int fd, short revents, void *arg)
+{
+    calls++;
+    if (survivor == -1) {
+        xpollfd_del(pfd, fd == pair[0] ? pair[1] : pair[0]);
+        survivor = fd;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timeval tv = { 0, 0 };
+    int p1[2], p2[2];
+    int seen = -1;
+    FILE *f;
+
+    plan(NO_PLAN);
+
+    if (pipe(p1) < 0 || pipe(p2) < 0)
+        BAIL_OUT("pipe failed");
+
+    /* legacy interface still works */
+    pfd = xpollfd_create();
+    xpollfd_set(pfd, p1[1], XPOLLOUT);
+    ok (xpoll(pfd, &tv) == 1,
+        "xpollfd_set: pipe write end is ready");
+    ok (xpollfd_revents(pfd, p1[1]) == XPOLLOUT,
+        "xpollfd_revents reports XPOLLOUT");
+    xpollfd_destroy(pfd);
+
+    /* persistent registration */
+    pfd = xpollfd_create();
+    xpollfd_add(pfd, p1[0], XPOLLIN, _count_cb, &seen);
+    ok (xpoll(pfd, &tv) == 0,
+        "xpollfd_add: empty pipe is not ready");
+    ok (xpollfd_dispatch(pfd) == 0 && calls == 0,
+        "xpollfd_dispatch makes no callbacks");
+
+    ok (write(p1[1], "x", 1) == 1,
+        "wrote to pipe");
+    ok (xpoll(pfd, &tv) == 1,
+        "registered fd is ready after write");
+    ok (xpollfd_revents(pfd, p1[0]) == XPOLLIN,
+        "xpollfd_revents reports XPOLLIN");
+    ok (xpollfd_dispatch(pfd) == 1 && calls == 1 && seen == p1[0]
+        && last_revents == XPOLLIN,
+        "xpollfd_dispatch calls back with fd and revents");
+
+    ok (xpoll(pfd, &tv) == 1,
+        "fd stays registered across xpoll calls");
+
+    xpollfd_mod(pfd, p1[0], 0);
+    ok (xpoll(pfd, &tv) == 0,
+        "xpollfd_mod with no events suspends polling");
+    ok (xpollfd_revents(pfd, p1[0]) == 0,
+        "xpollfd_revents is cleared");
+    xpollfd_mod(pfd, p1[0], XPOLLIN);
+    ok (xpoll(pfd, &tv) == 1,
+        "xpollfd_mod restores polling");
+
+    xpollfd_add(pfd, p2[1], XPOLLOUT, _count_cb, NULL);
+    ok (xpoll(pfd, &tv) == 2,
+        "second registered fd is also ready");
+    xpollfd_del(pfd, p2[1]);
+    ok (xpoll(pfd, &tv) == 1,
+        "xpollfd_del removes fd");
+
+    /* callback removes an fd that is ready later in the same dispatch */
+    xpollfd_del(pfd, p1[0]);
+    pair[0] = p1[0];
+    pair[1] = p2[1];
+    xpollfd_add(pfd, pair[0], XPOLLIN, _del_cb, NULL);
+    xpollfd_add(pfd, pair[1], XPOLLOUT, _del_cb, NULL);
+    ok (xpoll(pfd, &tv) == 2,
+        "two fds are ready");
+    calls = 0;
+    ok (xpollfd_dispatch(pfd) == 1 && calls == 1,
+        "fd deleted by an earlier callback is skipped");
+    xpollfd_del(pfd, survivor);
+
+    /* regular files are always ready, as with poll(2) */
+    if (!(f = tmpfile()))
+        BAIL_OUT("tmpfile failed");
+    calls = 0;
+    xpollfd_add(pfd, fileno(f), XPOLLIN, _count_cb, NULL);
+    ok (xpoll(pfd, NULL) == 1,
+        "regular file is ready");
+    ok (xpollfd_dispatch(pfd) == 1 && calls == 1,
+        "regular file callback is made");
+    xpollfd_del(pfd, fileno(f));
+    fclose(f);
+
+    xpollfd_destroy(pfd);
+
+    done_testing();
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -12,6 +12,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/types.h>
+#include <regex.h>
 
 #include "tap.h"
 
@@ -158,10 +160,142 @@ _check_substr_match(void)
         "xregex_match_strlen returned expected length");
     xfree(s);
 
+    /* match results do not refer back to the input buffer */
+    xregex_match_recycle(rm);
+    s = xstrdup("xxxfoo3bar4yyy");
+    ok (xregex_exec(re, s, rm) == true,
+        "regex matches xxxfoo3bar4yyy");
+    memset(s, 'z', strlen(s));
+    xfree(s);
+
+    s = xregex_match_sub_strdup(rm, 2);
+    is (s, "4",
+        "substring 2 is 4 after input was overwritten");
+    xfree(s);
+
+    s = xregex_match_strdup(rm);
+    is (s, "xxxfoo3bar4",
+        "overall match is xxxfoo3bar4 after input was overwritten");
+    xfree(s);
+
     xregex_match_destroy(rm);
     xregex_destroy(re);
 }
 
+/* Return true if xregex_exec() gives the same result and match offsets
+ * as regexec() for regex [r] on [s].
+ */
+static bool
+_same_as_posix(char *r, char *s)
+{
+    xregex_t re;
+    xregex_match_t rm;
+    regex_t preg;
+    regmatch_t pmatch[3];
+    bool xres, pres, same = true;
+    int i;
+
+    re = xregex_create();
+    rm = xregex_match_create(2);
+    xregex_compile(re, r, true);
+    xres = xregex_exec(re, s, rm);
+
+    if (regcomp(&preg, r, REG_EXTENDED) != 0)
+        BAIL_OUT("regcomp %s failed", r);
+    pres = (regexec(&preg, s, 3, pmatch, REG_NOTEOL) == 0);
+    regfree(&preg);
+
+    if (xres != pres)
+        same = false;
+    for (i = 0; same && pres && i < 3; i++) {
+        char *sub;
+
+        /* xregex_match_sub_strdup() doesn't allow empty matches */
+        if (pmatch[i].rm_so == pmatch[i].rm_eo)
+            continue;
+        sub = xregex_match_sub_strdup(rm, i);
+        same = (sub != NULL
+                && strlen(sub) == pmatch[i].rm_eo - pmatch[i].rm_so
+                && !strncmp(sub, s + pmatch[i].rm_so, strlen(sub)));
+        if (sub)
+            xfree(sub);
+    }
+    if (same && pres)
+        same = (xregex_match_strlen(rm) == pmatch[0].rm_eo);
+    xregex_match_destroy(rm);
+    xregex_destroy(re);
+
+    return same;
+}
+
+static bool
+_method_is(char *r, char *method)
+{
+    xregex_t re = xregex_create();
+    bool res;
+
+    xregex_compile(re, r, false);
+    res = !strcmp(xregex_method(re), method);
+    xregex_destroy(re);
+
+    return res;
+}
+
+static void
+_check_methods(void)
+{
+    char *in[] = {
+        "", "> ", "abc> ", "RPC-28A>", "xRPC-28AA> RPC-28>", "on\n", "xon\n",
+        "node12: on\nnode13: off\n", "aa> bb> ", "iSCB-12:3> ", "(config-if)#",
+        NULL,
+    };
+    char *re[] = {
+        "> ", "^on\n", ".*> ", "RPC-28[A]*>", ".*RPC-28[A]*>",
+        "node([0-9]+): (on|off|n/a)", "iSCB-[0-9]+:[0-9]> ", ".*\\(config-if\\)#",
+        "a+> ", "on|off", "b\\<", "xy?", ".[A-Z]-28A>", "[0-9]+: (on|off)",
+        "(RPC|iSCB)-[0-9]+", NULL,
+    };
+    int i, j;
+
+    ok (_method_is("> ", "literal"),
+        "plain string uses literal method");
+    ok (_method_is("to continue...", "prefix"),
+        "string with metacharacters uses prefix method");
+    ok (_method_is("^on\n", "anchored"),
+        "^string uses anchored method");
+    ok (_method_is(".*RPC-22>", "greedy"),
+        ".*string uses greedy method");
+    ok (_method_is(".*\\(config-if\\)#", "greedy"),
+        "escaped metacharacters are literals");
+    ok (_method_is("node([0-9]+): (on|off|n/a)", "prefix"),
+        "string followed by subexpressions uses prefix method");
+    ok (_method_is("on|off", "posix"),
+        "top level alternation uses posix method");
+    ok (_method_is("xy*", "prefix"),
+        "quantified character is not part of the prefix");
+    ok (_method_is("x\\<", "posix"),
+        "GNU word boundary uses posix method");
+    ok (_method_is(".AA6[^\n]*\n", "prefix"),
+        "string at fixed offset uses prefix method");
+    ok (_method_is("[0-9]+>", "filter"),
+        "string at variable offset uses filter method");
+    ok (_method_is("([0-9]+)", "posix"),
+        "regex without top level string uses posix method");
+
+    for (i = 0; re[i] != NULL; i++) {
+        bool same = true;
+
+        for (j = 0; in[j] != NULL; j++) {
+            if (!_same_as_posix(re[i], in[j])) {
+                diag("regex '%s' input '%s' differs from regexec", re[i], in[j]);
+                same = false;
+            }
+        }
+        ok (same,
+            "regex %d matches the same as regexec", i);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -179,6 +313,7 @@ main(int argc, char *argv[])
         "regex foo does NOT match bar");
 
     _check_substr_match();
+    _check_methods();
 
     /* verify that \\n and \\r are converted into \r and \r */
     ok (!_match("foo\\r\\n", "foo\\r\\n"),
@@ -0,0 +1,110 @@
+/************************************************************\
+ * Copyright (C) 2004 The Regents of the University of California.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of PowerMan, a remote power management program.
+ * For details, see https://github.com/chaos/powerman.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "tap.h"
+
+#include "xtimer.h"
+
+static int fired[4];
+static int order[4];
+static int norder;
+
+static void
+_cb(void *arg)
+{
+    int i = *(int *)arg;
+
+    fired[i]++;
+    order[norder++] = i;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timeval tv, t1, t2, left;
+    xtimerq_t q;
+    xtimer_t t[4];
+    int id[4] = { 0, 1, 2, 3 };
+    int i;
+
+    plan(NO_PLAN);
+
+    xtimer_gettime(&t1);
+    usleep(1000);
+    xtimer_gettime(&t2);
+    ok (timercmp(&t2, &t1, >),
+        "xtimer_gettime advances");
+
+    q = xtimerq_create();
+    ok (xtimerq_next(q, &left) == false,
+        "xtimerq_next returns false with no timers armed");
+    for (i = 0; i < 4; i++)
+        t[i] = xtimer_create(q, _cb, &id[i]);
+    ok (!xtimer_armed(t[0]),
+        "new timer is not armed");
+
+    /* arm out of order: 3 at 40ms, 1 at 20ms, 2 at 30ms, 0 at 10s */
+    tv.tv_sec = 0;
+    tv.tv_usec = 40000;
+    xtimer_arm(t[3], &tv);
+    tv.tv_usec = 20000;
+    xtimer_arm(t[1], &tv);
+    tv.tv_usec = 30000;
+    xtimer_arm(t[2], &tv);
+    tv.tv_sec = 10;
+    tv.tv_usec = 0;
+    xtimer_arm(t[0], &tv);
+    ok (xtimer_armed(t[0]) && xtimer_armed(t[3]),
+        "xtimer_arm arms timers");
+    ok (xtimerq_next(q, &left) == true
+        && left.tv_sec == 0 && left.tv_usec <= 20000,
+        "xtimerq_next returns time until earliest timer");
+    ok (xtimerq_run(q) == 0,
+        "xtimerq_run does nothing before expiration");
+
+    xtimer_cancel(t[2]);
+    ok (!xtimer_armed(t[2]),
+        "xtimer_cancel disarms timer");
+
+    usleep(50000);
+    ok (xtimerq_run(q) == 2,
+        "xtimerq_run fires the two expired timers");
+    ok (fired[1] == 1 && fired[3] == 1 && fired[2] == 0 && fired[0] == 0,
+        "canceled and unexpired timers did not fire");
+    ok (norder == 2 && order[0] == 1 && order[1] == 3,
+        "timers fired in order of expiration");
+    ok (!xtimer_armed(t[1]) && xtimer_armed(t[0]),
+        "fired timers are disarmed");
+
+    /* re-arming moves the expiration */
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    xtimer_arm(t[0], &tv);
+    ok (xtimerq_run(q) == 1 && fired[0] == 1,
+        "re-armed timer fires at its new time");
+    ok (xtimerq_next(q, &left) == false,
+        "no timers remain armed");
+
+    for (i = 0; i < 4; i++)
+        xtimer_destroy(t[i]);
+    xtimerq_destroy(q);
+
+    done_testing();
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -28,6 +28,11 @@
 #if HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
+#if HAVE_EPOLL && HAVE_SYS_EPOLL_H
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+#include <stdbool.h>
 #include <assert.h>
 
 #include "xtime.h"
@@ -41,6 +46,28 @@
 
 #define XPOLLFD_ALLOC_CHUNK  16
 
+/* poll() ignores negative fds, so a registered fd with no interest is
+ * parked in the pollfd array in this encoded form.
+ */
+#define HIDE_FD(fd)     (-(fd) - 1)
+#define UNHIDE_FD(fd)   ((fd) < 0 ? -(fd) - 1 : (fd))
+
+/* Persistent registration, indexed by fd.
+ */
+struct xpollreg {
+    bool            used;       /* fd is registered */
+    short           events;     /* XPOLL interest (0 = not polled) */
+    short           revents;    /* XPOLL result of last xpoll() */
+    xpoll_cb_f      cb;
+    void           *arg;
+#if USE_EPOLL
+    bool            active;     /* fd is in the epoll set */
+    bool            always;     /* fd can't be epolled (e.g. regular file) */
+#elif HAVE_POLL
+    int             ix;         /* index of fd in ufds */
+#endif
+};
+
 struct xpollfd {
 #if HAVE_POLL
     unsigned int    nfds;
@@ -50,6 +77,18 @@ struct xpollfd {
     int             maxfd;
     fd_set          rset;
     fd_set          wset;
+#endif
+    struct xpollreg *regs;      /* fd-indexed registrations */
+    int             regs_size;
+    int             nregs;      /* number of registered fds */
+    int            *ready;      /* fds with revents after xpoll() */
+    int             nready;
+    int             ready_size;
+#if USE_EPOLL
+    int             epfd;
+    struct epoll_event *evs;
+    int             evs_size;
+    int             nalways;    /* active fds that are always ready */
 #endif
 };
 
@@ -93,6 +132,141 @@ flag2xflag(short f)
 }
 #endif
 
+#if USE_EPOLL
+static uint32_t
+xflag2eflag(short x)
+{
+    uint32_t f = 0;
+
+    if ((x & XPOLLIN))
+        f |= EPOLLIN;
+    if ((x & XPOLLOUT))
+        f |= EPOLLOUT;
+    return f;
+}
+
+static short
+eflag2xflag(uint32_t f)
+{
+    short x = 0;
+
+    if ((f & EPOLLIN))
+        x |= XPOLLIN;
+    if ((f & EPOLLOUT))
+        x |= XPOLLOUT;
+    if ((f & EPOLLHUP))
+        x |= XPOLLHUP;
+    if ((f & EPOLLERR))
+        x |= XPOLLERR;
+    return x;
+}
+#endif
+
+#if HAVE_POLL
+/* Convert timeval to msec for poll/epoll_wait, rounding up so a short
+ * timeout doesn't degenerate into a non-blocking poll.
+ */
+static int
+_tv2msec(struct timeval *tvp)
+{
+    if (!tvp)
+        return -1;
+    return tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000;
+}
+#endif
+
+static int
+_wait(xpollfd_t pfd, struct timeval *tvp)
+{
+#if USE_EPOLL
+    if (pfd->nregs > 0) {
+        if (pfd->evs_size < pfd->nregs) {
+            pfd->evs_size = pfd->nregs;
+            pfd->evs = (struct epoll_event *)xrealloc((char *)pfd->evs,
+                                sizeof(struct epoll_event) * pfd->evs_size);
+        }
+        return epoll_wait(pfd->epfd, pfd->evs, pfd->evs_size,
+                          pfd->nalways > 0 ? 0 : _tv2msec(tvp));
+    }
+#elif !HAVE_POLL
+    if (pfd->nregs > 0) {
+        int fd;
+
+        FD_ZERO(&pfd->rset);
+        FD_ZERO(&pfd->wset);
+        pfd->maxfd = 0;
+        for (fd = 0; fd < pfd->regs_size; fd++) {
+            if (pfd->regs[fd].used && pfd->regs[fd].events) {
+                assert(fd < FD_SETSIZE);
+                if ((pfd->regs[fd].events & XPOLLIN))
+                    FD_SET(fd, &pfd->rset);
+                if ((pfd->regs[fd].events & XPOLLOUT))
+                    FD_SET(fd, &pfd->wset);
+                pfd->maxfd = MAX(pfd->maxfd, fd);
+            }
+        }
+    }
+#endif
+#if HAVE_POLL
+    return poll(pfd->ufds, pfd->nfds, _tv2msec(tvp));
+#else
+    return select(pfd->maxfd + 1, &pfd->rset, &pfd->wset, NULL, tvp);
+#endif
+}
+
+static void
+_ready_add(xpollfd_t pfd, int fd, short revents)
+{
+    if (!revents || fd >= pfd->regs_size || !pfd->regs[fd].used)
+        return;
+    if (pfd->nready == pfd->ready_size) {
+        pfd->ready_size += XPOLLFD_ALLOC_CHUNK;
+        pfd->ready = (int *)xrealloc((char *)pfd->ready,
+                                     sizeof(int) * pfd->ready_size);
+    }
+    pfd->ready[pfd->nready++] = fd;
+    pfd->regs[fd].revents = revents;
+}
+
+/* Build the ready list for registered fds from the result of _wait().
+ */
+static void
+_ready_collect(xpollfd_t pfd, int n)
+{
+    int i;
+
+    for (i = 0; i < pfd->nready; i++) {
+        if (pfd->ready[i] < pfd->regs_size)
+            pfd->regs[pfd->ready[i]].revents = 0;
+    }
+    pfd->nready = 0;
+    if (pfd->nregs == 0 || n < 0)
+        return;
+#if USE_EPOLL
+    for (i = 0; i < n; i++)
+        _ready_add(pfd, pfd->evs[i].data.fd, eflag2xflag(pfd->evs[i].events));
+    for (i = 0; pfd->nalways > 0 && i < pfd->regs_size; i++) {
+        if (pfd->regs[i].used && pfd->regs[i].always && pfd->regs[i].active)
+            _ready_add(pfd, i, pfd->regs[i].events);
+    }
+#elif HAVE_POLL
+    for (i = 0; i < pfd->nfds; i++) {
+        if (pfd->ufds[i].fd >= 0)
+            _ready_add(pfd, pfd->ufds[i].fd, flag2xflag(pfd->ufds[i].revents));
+    }
+#else
+    for (i = 0; i <= pfd->maxfd; i++) {
+        short revents = 0;
+
+        if (FD_ISSET(i, &pfd->rset))
+            revents |= XPOLLIN;
+        if (FD_ISSET(i, &pfd->wset))
+            revents |= XPOLLOUT;
+        _ready_add(pfd, i, revents);
+    }
+#endif
+}
+
 /* a null tv means no timeout (could block forever) */
 int
 xpoll(xpollfd_t pfd, struct timeval *tv)
@@ -110,16 +284,7 @@ xpoll(xpollfd_t pfd, struct timeval *tv)
 
     /* repeat poll if interrupted */
     do {
-#if HAVE_POLL
-        int tv_msec = -1;
-
-        if (tvp)
-            tv_msec = tvp->tv_sec * 1000 + tvp->tv_usec / 1000;
-
-        n = poll(pfd->ufds, pfd->nfds, tv_msec);
-#else
-        n = select(pfd->maxfd + 1, &pfd->rset, &pfd->wset, NULL, tvp);
-#endif
+        n = _wait(pfd, tvp);
         if (n < 0 && errno != EINTR)
             err_exit(true, "select/poll");
         if (n < 0 && tv != NULL) {
@@ -127,9 +292,12 @@ xpoll(xpollfd_t pfd, struct timeval *tv)
                 err_exit(true, "gettimeofday");
             timersub(&end, &start, &delta);     /* delta = end - start */
             timersub(tv, &delta, tvp);          /* *tvp = tv - delta */
+            if (tvp->tv_sec < 0)
+                timerclear(tvp);
         }
     } while (n < 0);
-    return n;
+    _ready_collect(pfd, n);
+    return pfd->nregs > 0 ? pfd->nready : n;
 }
 
 #if HAVE_POLL
@@ -157,6 +325,9 @@ xpollfd_create(void)
     FD_ZERO(&pfd->rset);
     FD_ZERO(&pfd->wset);
 #endif
+#if USE_EPOLL
+    pfd->epfd = -1;
+#endif
 
     return pfd;
 }
@@ -168,12 +339,23 @@ xpollfd_destroy(xpollfd_t pfd)
     if (pfd->ufds != NULL)
         xfree(pfd->ufds);
 #endif
+#if USE_EPOLL
+    if (pfd->epfd >= 0)
+        (void)close(pfd->epfd);
+    if (pfd->evs != NULL)
+        xfree(pfd->evs);
+#endif
+    if (pfd->regs != NULL)
+        xfree(pfd->regs);
+    if (pfd->ready != NULL)
+        xfree(pfd->ready);
     xfree(pfd);
 }
 
 void
 xpollfd_zero(xpollfd_t pfd)
 {
+    assert(pfd->nregs == 0);
 #if HAVE_POLL
     pfd->nfds = 0;
     /*memset(pfd->ufds, 0, sizeof(struct pollfd) * pfd->ufds_size);*/
@@ -189,7 +371,10 @@ xpollfd_set(xpollfd_t pfd, int fd, short events)
 {
 #if HAVE_POLL
     int i;
+#endif
 
+    assert(pfd->nregs == 0);
+#if HAVE_POLL
     for (i = 0; i < pfd->nfds; i++) {
         if (pfd->ufds[i].fd == fd) {
             pfd->ufds[i].events |= xflag2flag(events);
@@ -224,7 +409,7 @@ xpollfd_str(xpollfd_t pfd, char *str, int len)
         int fd = pfd->ufds[i].fd;
         short revents = pfd->ufds[i].revents;
 
-        if (fd < len - 1) {
+        if (fd >= 0 && fd < len - 1) {
             if (revents) {
                 if (revents & (POLLNVAL | POLLERR | POLLHUP))
                     str[fd] = 'E';
@@ -260,6 +445,11 @@ xpollfd_revents(xpollfd_t pfd, int fd)
     short flags = 0;
 #if HAVE_POLL
     int i;
+#endif
+
+    if (fd >= 0 && fd < pfd->regs_size && pfd->regs[fd].used)
+        return pfd->regs[fd].revents;
+#if HAVE_POLL
 
     for (i = 0; i < pfd->nfds; i++) {
         if (pfd->ufds[i].fd == fd) {
@@ -276,6 +466,151 @@ xpollfd_revents(xpollfd_t pfd, int fd)
     return flags;
 }
 
+/* Push the interest set for registered [fd] down to the kernel (epoll)
+ * or the pollfd array.  An fd with no interest is withdrawn entirely so
+ * that a hung up peer doesn't keep returning XPOLLHUP while nobody is
+ * listening.
+ */
+static void
+_sync(xpollfd_t pfd, int fd)
+{
+    struct xpollreg *r = &pfd->regs[fd];
+#if USE_EPOLL
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = xflag2eflag(r->events);
+    ev.data.fd = fd;
+    if (r->events && !r->active) {
+        if (!r->always && epoll_ctl(pfd->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            /* poll(2) reports regular files as always ready - do the same */
+            if (errno == EPERM)
+                r->always = true;
+            else if (errno != EEXIST
+                    || epoll_ctl(pfd->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+                err_exit(true, "epoll_ctl ADD %d", fd);
+        }
+        if (r->always)
+            pfd->nalways++;
+        r->active = true;
+    } else if (r->events && r->active) {
+        if (!r->always && epoll_ctl(pfd->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+            err_exit(true, "epoll_ctl MOD %d", fd);
+    } else if (!r->events && r->active) {
+        /* fd may already be closed, which removes it from the set */
+        if (r->always)
+            pfd->nalways--;
+        else if (epoll_ctl(pfd->epfd, EPOLL_CTL_DEL, fd, &ev) < 0
+                && errno != EBADF && errno != ENOENT)
+            err_exit(true, "epoll_ctl DEL %d", fd);
+        r->active = false;
+    }
+#elif HAVE_POLL
+    pfd->ufds[r->ix].fd = r->events ? fd : HIDE_FD(fd);
+    pfd->ufds[r->ix].events = xflag2flag(r->events);
+    pfd->ufds[r->ix].revents = 0;
+#endif
+}
+
+/* Register [fd] for the lifetime of the connection.  [cb] is called by
+ * xpollfd_dispatch() when [fd] is ready.  The persistent interface may
+ * not be mixed with xpollfd_zero()/xpollfd_set() on the same pfd.
+ */
+void
+xpollfd_add(xpollfd_t pfd, int fd, short events, xpoll_cb_f cb, void *arg)
+{
+    struct xpollreg *r;
+
+    assert(fd >= 0);
+    if (fd >= pfd->regs_size) {
+        int size = fd + XPOLLFD_ALLOC_CHUNK;
+
+        pfd->regs = (struct xpollreg *)xrealloc((char *)pfd->regs,
+                                            sizeof(struct xpollreg) * size);
+        memset(&pfd->regs[pfd->regs_size], 0,
+               sizeof(struct xpollreg) * (size - pfd->regs_size));
+        pfd->regs_size = size;
+    }
+    r = &pfd->regs[fd];
+    assert(!r->used);
+    memset(r, 0, sizeof(*r));
+    r->used = true;
+    r->cb = cb;
+    r->arg = arg;
+#if USE_EPOLL
+    if (pfd->epfd < 0) {
+        if ((pfd->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+            err_exit(true, "epoll_create1");
+    }
+#elif HAVE_POLL
+    if (pfd->nregs == 0)
+        pfd->nfds = 0;
+    r->ix = pfd->nfds;
+    _grow_pollfd(pfd, ++pfd->nfds);
+#endif
+    pfd->nregs++;
+    r->events = events;
+    _sync(pfd, fd);
+}
+
+/* Change the interest set of registered [fd].
+ */
+void
+xpollfd_mod(xpollfd_t pfd, int fd, short events)
+{
+    assert(fd >= 0 && fd < pfd->regs_size && pfd->regs[fd].used);
+    if (pfd->regs[fd].events != events) {
+        pfd->regs[fd].events = events;
+        _sync(pfd, fd);
+    }
+}
+
+/* Unregister [fd].  Call this before closing [fd].
+ */
+void
+xpollfd_del(xpollfd_t pfd, int fd)
+{
+    struct xpollreg *r;
+
+    assert(fd >= 0 && fd < pfd->regs_size && pfd->regs[fd].used);
+    r = &pfd->regs[fd];
+    r->events = 0;
+    _sync(pfd, fd);
+#if !USE_EPOLL && HAVE_POLL
+    if (r->ix != pfd->nfds - 1) {
+        pfd->ufds[r->ix] = pfd->ufds[pfd->nfds - 1];
+        pfd->regs[UNHIDE_FD(pfd->ufds[r->ix].fd)].ix = r->ix;
+    }
+    pfd->nfds--;
+#endif
+    memset(r, 0, sizeof(*r));
+    pfd->nregs--;
+}
+
+/* Call the registered callback of each fd that became ready in the last
+ * xpoll().  Callbacks may add or delete registrations, including their own;
+ * an fd deleted before its turn is skipped.  Returns the number of
+ * callbacks made.
+ */
+int
+xpollfd_dispatch(xpollfd_t pfd)
+{
+    int i, count = 0;
+
+    for (i = 0; i < pfd->nready; i++) {
+        int fd = pfd->ready[i];
+        short revents;
+
+        if (fd >= pfd->regs_size || !pfd->regs[fd].used)
+            continue;
+        if (!(revents = pfd->regs[fd].revents) || !pfd->regs[fd].cb)
+            continue;
+        pfd->regs[fd].cb(fd, revents, pfd->regs[fd].arg);
+        count++;
+    }
+    return count;
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
@@ -13,6 +13,8 @@
 
 typedef struct xpollfd *xpollfd_t;
 
+typedef void (*xpoll_cb_f)(int fd, short revents, void *arg);
+
 int         xpoll(xpollfd_t pfd, struct timeval *timeout);
 xpollfd_t   xpollfd_create(void);
 void        xpollfd_destroy(xpollfd_t pfd);
@@ -21,6 +23,15 @@ void        xpollfd_set(xpollfd_t pfd, int fd, short events);
 short       xpollfd_revents(xpollfd_t pfd, int fd);
 char       *xpollfd_str(xpollfd_t pfd, char *str, int len);
 
+/* Persistent registration: fds stay in the set across xpoll() calls and
+ * interest is changed incrementally.  Uses epoll(7) where available.
+ */
+void        xpollfd_add(xpollfd_t pfd, int fd, short events,
+                        xpoll_cb_f cb, void *arg);
+void        xpollfd_mod(xpollfd_t pfd, int fd, short events);
+void        xpollfd_del(xpollfd_t pfd, int fd);
+int         xpollfd_dispatch(xpollfd_t pfd);
+
 #define XPOLLIN      1
 #define XPOLLOUT     2
 #define XPOLLHUP     4
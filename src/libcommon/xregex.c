@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <regex.h>
 
@@ -22,9 +23,31 @@
 #include "xregex.h"
 #include "xmalloc.h"
 
+/* Most expect and interp regexes in device scripts are plain strings,
+ * or nearly so.  When a regex is compiled, it is classified so that such
+ * patterns can be matched with string functions instead of regexec().
+ * Every regex is also compiled with regcomp(), which is used for the
+ * patterns that don't fit a special case and to match whatever follows
+ * a literal prefix.
+ */
+typedef enum {
+    XR_POSIX,                   /* regexec() */
+    XR_LITERAL,                 /* "lit" - strstr() */
+    XR_ANCHORED,                /* "^lit" - strncmp() at start of string */
+    XR_GREEDY,                  /* ".*lit" - last occurrence of lit */
+    XR_PREFIX,                  /* "..lit..." - strstr() to find where to
+                                   start regexec(), given lit's offset */
+    XR_FILTER,                  /* "...lit..." - strstr() to rule out a
+                                   match before regexec() */
+} xr_method_t;
+
 struct xregex_struct {
     int         xr_cflags;
     regex_t    *xr_regex;
+    xr_method_t xr_method;
+    char       *xr_lit;         /* literal string (or required substring) */
+    int         xr_litlen;
+    int         xr_litoff;      /* XR_PREFIX: offset of xr_lit in match */
 };
 struct xregex_match_struct {
     int         xm_nmatch;
@@ -40,6 +63,8 @@ xregex_create(void)
     xregex_t xrp = (xregex_t)xmalloc(sizeof(struct xregex_struct));
 
     xrp->xr_regex = NULL;
+    xrp->xr_method = XR_POSIX;
+    xrp->xr_lit = NULL;
 
     return xrp;
 }
@@ -51,6 +76,8 @@ xregex_destroy(xregex_t xrp)
         regfree(xrp->xr_regex);
         xfree(xrp->xr_regex);
     }
+    if (xrp->xr_lit)
+        xfree(xrp->xr_lit);
     xfree(xrp);
 }
 
@@ -71,6 +98,235 @@ _str_subst(char *s1, int len, const char *s2, const char *s3)
     }
 }
 
+/* Return true if backslash followed by 'c' is an escaped literal.
+ * GNU regex gives special meaning to \ + alphanumeric and to \< \> \` \'
+ */
+static bool
+_escaped_literal(char c)
+{
+    return c != '\0' && ispunct((unsigned char)c) && !strchr("<>`'", c);
+}
+
+/* Copy the literal characters at the start of regex 'r' to 'buf'
+ * (which must be at least as long as 'r') and return the number of
+ * regex characters they occupy.  Stop at the first metacharacter.
+ * A literal followed by a quantifier is not included.
+ */
+static int
+_literal_prefix(const char *r, char *buf, int *buflen)
+{
+    int i = 0, n = 0;
+
+    while (r[i] != '\0') {
+        int start = i;
+        char c;
+
+        if (r[i] == '\\') {
+            if (!_escaped_literal(r[i + 1]))
+                break;
+            c = r[i + 1];
+            i += 2;
+        } else if (strchr(".[]()*+?{}|^$", r[i]))
+            break;
+        else
+            c = r[i++];
+        if (r[i] != '\0' && strchr("*+?{", r[i])) {
+            i = start;
+            break;
+        }
+        buf[n++] = c;
+    }
+    buf[n] = '\0';
+    *buflen = n;
+    return i;
+}
+
+/* Return a pointer just past the bracket expression starting at 'r',
+ * or NULL if it is not terminated.
+ */
+static const char *
+_skip_bracket(const char *r)
+{
+    r++;
+    if (*r == '^')
+        r++;
+    if (*r == ']')
+        r++;
+    while (*r != '\0' && *r != ']') {
+        if (*r == '[' && (r[1] == ':' || r[1] == '=' || r[1] == '.')) {
+            char d = r[1];
+
+            r += 2;
+            while (*r != '\0' && !(r[0] == d && r[1] == ']'))
+                r++;
+            if (*r != '\0')
+                r += 2;
+        } else
+            r++;
+    }
+    return *r == ']' ? r + 1 : NULL;
+}
+
+/* Return a pointer just past the quantifier (if any) at 'r'.
+ */
+static const char *
+_skip_quantifier(const char *r)
+{
+    while (*r == '*' || *r == '+' || *r == '?' || *r == '{') {
+        if (*r == '{') {
+            while (*r != '\0' && *r != '}')
+                r++;
+            if (*r == '\0')
+                break;
+        }
+        r++;
+    }
+    return r;
+}
+
+/* Return true if 'r' is a candidate for literal string search, i.e. there
+ * is no top level alternation, and nothing in 'r' depends on text before
+ * the start of the match (anchors, GNU word boundaries).
+ */
+static bool
+_literal_search_ok(const char *r)
+{
+    int depth = 0;
+
+    while (*r != '\0') {
+        if (*r == '\\') {
+            if (!_escaped_literal(r[1]))
+                return false;
+            r += 2;
+            continue;
+        }
+        if (*r == '[') {
+            if (!(r = _skip_bracket(r)))
+                return false;
+            continue;
+        }
+        if (*r == '(')
+            depth++;
+        else if (*r == ')')
+            depth--;
+        else if ((*r == '|' && depth == 0) || *r == '^' || *r == '$')
+            return false;
+        r++;
+    }
+    return true;
+}
+
+/* Find a string that must appear in every match of 'r' (which has passed
+ * _literal_search_ok()), preferring the first one that is a fixed
+ * number of characters from the start of the match, else the longest.
+ * Only top level literals are considered.  Copy it to 'buf' (which must
+ * be at least as long as 'r'), and return its offset from the start of
+ * the match, or -1 if the offset is not fixed.
+ */
+static int
+_required_literal(const char *r, char *buf, int *buflen)
+{
+    char *run = xmalloc(strlen(r) + 1);
+    int n = 0, runoff = -1;
+    int width = 0;                  /* width of regex so far, if fixed */
+    bool fixed = true;
+    int off = -1;
+
+    *buflen = 0;
+    for (;;) {
+        const char *next, *q;
+        char c = '\0';
+
+        if (*r == '\\') {                           /* escaped literal */
+            c = r[1];
+            next = r + 2;
+        } else if (*r == '[') {
+            next = _skip_bracket(r);
+        } else if (*r == '(') {                     /* skip group */
+            int depth = 0;
+
+            next = r;
+            do {
+                if (*next == '\\' && next[1] != '\0')
+                    next += 2;
+                else if (*next == '[')
+                    next = _skip_bracket(next);
+                else {
+                    if (*next == '(')
+                        depth++;
+                    else if (*next == ')')
+                        depth--;
+                    next++;
+                }
+            } while (next != NULL && *next != '\0' && depth > 0);
+        } else if (*r != '\0' && !strchr(".*+?{})", *r)) {
+            c = *r;
+            next = r + 1;
+        } else
+            next = r + (*r != '\0');
+        if (next == NULL)
+            break;
+        q = _skip_quantifier(next);
+
+        if (c != '\0' && q == next) {               /* extend run */
+            if (n == 0)
+                runoff = fixed ? width : -1;
+            run[n++] = c;
+            width++;
+        } else {                                    /* end run */
+            if (n > 0 && off < 0 && (runoff >= 0 || n > *buflen)) {
+                memcpy(buf, run, n);
+                buf[n] = '\0';
+                *buflen = n;
+                off = runoff;
+            }
+            n = 0;
+            if (*r == '\0')
+                break;
+            if (q == next && (*r == '.' || *r == '['))
+                width++;
+            else
+                fixed = false;
+        }
+        r = q;
+    }
+    xfree(run);
+    return off;
+}
+
+/* Choose a matching method for regex 'r' (see xr_method_t).
+ */
+static void
+_classify(xregex_t xrp, const char *r)
+{
+    char *buf = xmalloc(strlen(r) + 1);
+    int n, len = 0;
+
+    if (r[0] == '^') {
+        n = _literal_prefix(r + 1, buf, &len);
+        if (r[1 + n] == '\0' && len > 0)
+            xrp->xr_method = XR_ANCHORED;
+    } else if (r[0] == '.' && r[1] == '*') {
+        n = _literal_prefix(r + 2, buf, &len);
+        if (r[2 + n] == '\0' && len > 0)
+            xrp->xr_method = XR_GREEDY;
+    } else {
+        n = _literal_prefix(r, buf, &len);
+        if (r[n] == '\0' && len > 0)
+            xrp->xr_method = XR_LITERAL;
+    }
+    if (xrp->xr_method == XR_POSIX && _literal_search_ok(r)) {
+        xrp->xr_litoff = _required_literal(r, buf, &len);
+        if (len > 0)
+            xrp->xr_method = xrp->xr_litoff >= 0 ? XR_PREFIX : XR_FILTER;
+    }
+    if (xrp->xr_method != XR_POSIX) {
+        xrp->xr_lit = buf;
+        xrp->xr_litlen = len;
+    } else
+        xfree(buf);
+}
+
 void
 xregex_compile(xregex_t xrp, const char *regex, bool withsub)
 {
@@ -98,12 +354,91 @@ xregex_compile(xregex_t xrp, const char *regex, bool withsub)
     _str_subst(cpy, strlen(cpy) + 1, "\\r", "\r");
     _str_subst(cpy, strlen(cpy) + 1, "\\n", "\n");
     n = regcomp(xrp->xr_regex, cpy, xrp->xr_cflags);
-    xfree(cpy);
 
     if (n != 0) {
         regerror(n, xrp->xr_regex, tmpstr, sizeof(tmpstr));
         err_exit(false, "regcomp failed: %s", tmpstr);
     }
+    _classify(xrp, cpy);
+    xfree(cpy);
+}
+
+const char *
+xregex_method(xregex_t xrp)
+{
+    switch (xrp->xr_method) {
+        case XR_LITERAL:
+            return "literal";
+        case XR_ANCHORED:
+            return "anchored";
+        case XR_GREEDY:
+            return "greedy";
+        case XR_PREFIX:
+            return "prefix";
+        case XR_FILTER:
+            return "filter";
+        case XR_POSIX:
+            break;
+    }
+    return "posix";
+}
+
+/* Match 's' using the method chosen by _classify().
+ * Like regexec(), fill in up to 'nmatch' elements of 'pmatch' and
+ * return 0 on a match.
+ */
+static int
+_match(xregex_t xrp, const char *s, int nmatch, regmatch_t *pmatch,
+       int eflags)
+{
+    const char *p = NULL, *q;
+    int i, res;
+
+    switch (xrp->xr_method) {
+        case XR_POSIX:
+            return regexec(xrp->xr_regex, s, nmatch, pmatch, eflags);
+        case XR_FILTER:
+            if (!strstr(s, xrp->xr_lit))
+                return REG_NOMATCH;
+            return regexec(xrp->xr_regex, s, nmatch, pmatch, eflags);
+        case XR_PREFIX:
+            /* no match can start before the first occurrence of the
+             * literal, less its offset within the match */
+            if (!(p = strstr(s, xrp->xr_lit)))
+                return REG_NOMATCH;
+            p = (p - s > xrp->xr_litoff) ? p - xrp->xr_litoff : s;
+            res = regexec(xrp->xr_regex, p, nmatch, pmatch,
+                          p > s ? eflags | REG_NOTBOL : eflags);
+            if (res == 0 && !(xrp->xr_cflags & REG_NOSUB)) {
+                for (i = 0; i < nmatch; i++) {
+                    if (pmatch[i].rm_so != -1) {
+                        pmatch[i].rm_so += p - s;
+                        pmatch[i].rm_eo += p - s;
+                    }
+                }
+            }
+            return res;
+        case XR_LITERAL:
+            p = strstr(s, xrp->xr_lit);
+            break;
+        case XR_ANCHORED:
+            if (strncmp(s, xrp->xr_lit, xrp->xr_litlen) == 0)
+                p = s;
+            break;
+        case XR_GREEDY:
+            for (q = s; (q = strstr(q, xrp->xr_lit)); q++)
+                p = q;
+            break;
+    }
+    if (p == NULL)
+        return REG_NOMATCH;
+    if (nmatch > 0) {
+        pmatch[0].rm_so = xrp->xr_method == XR_GREEDY ? 0 : p - s;
+        pmatch[0].rm_eo = p - s + xrp->xr_litlen;
+        for (i = 1; i < nmatch; i++)
+            pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+    }
+    return 0;
 }
 
 bool
@@ -117,15 +452,23 @@ xregex_exec(xregex_t xrp, const char *s, xregex_match_t xm)
         assert(xm->xm_used == false);
     }
 
-    res = regexec(xrp->xr_regex, s, xm ? xm->xm_nmatch : 0,
-                                    xm ? xm->xm_pmatch : NULL, eflags);
+    res = _match(xrp, s, xm ? xm->xm_nmatch : 0,
+                         xm ? xm->xm_pmatch : NULL, eflags);
     if (xm != NULL) {
         xm->xm_result = res;
         xm->xm_used = true;
         if (res == 0) {
+            /* Only text up to the end of the match can be referenced
+             * later, so don't copy the rest of a (potentially large)
+             * input buffer.
+             */
+            int len = (xrp->xr_cflags & REG_NOSUB) ? strlen(s)
+                                                   : xm->xm_pmatch[0].rm_eo;
             if (xm->xm_str)
                 xfree(xm->xm_str);
-            xm->xm_str = xstrdup(s);
+            xm->xm_str = (char *)xmalloc(len + 1);
+            memcpy(xm->xm_str, s, len);
+            xm->xm_str[len] = '\0';
         }
     }
     return res == 0 ? true : false;
@@ -34,8 +34,16 @@ void xregex_destroy(xregex_t x);
  */
 void xregex_compile(xregex_t x, const char *s, bool withsub);
 
+/* Return the name of the method chosen to match a compiled regex:
+ * "literal", "anchored", "greedy", "prefix", "filter", or "posix"
+ * (see xregex.c).
+ */
+const char *xregex_method(xregex_t x);
+
 /* Execute a compiled regex against the provided string 's'.
- * If xm is non-NULL, place match info there.
+ * If xm is non-NULL, place match info there.  The match object keeps a
+ * copy of 's' up to the end of the match, so 's' may be modified or freed
+ * after the call.
  * Returns true on a match.
  */
 bool xregex_exec(xregex_t x, const char *s, xregex_match_t xm);
@@ -0,0 +1,226 @@
+/************************************************************\
+ * Copyright (C) 2001 The Regents of the University of California.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of PowerMan, a remote power management program.
+ * For details, see https://github.com/chaos/powerman.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <time.h>
+#include <sys/time.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "xtime.h"
+#include "xmalloc.h"
+#include "error.h"
+#include "xtimer.h"
+
+#define XTIMERQ_ALLOC_CHUNK  64
+
+struct xtimer {
+    xtimerq_t       q;
+    struct timeval  expire;     /* absolute CLOCK_MONOTONIC time */
+    int             ix;         /* index in q->heap, or -1 if not armed */
+    xtimer_cb_f     cb;
+    void           *arg;
+};
+
+struct xtimerq {
+    xtimer_t       *heap;
+    int             len;
+    int             size;
+};
+
+/* Get the current time from a clock that isn't affected by changes
+ * to the system time.
+ */
+void
+xtimer_gettime(struct timeval *tv)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        err_exit(true, "clock_gettime");
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+static void
+_swap(xtimerq_t q, int i, int j)
+{
+    xtimer_t tmp = q->heap[i];
+
+    q->heap[i] = q->heap[j];
+    q->heap[j] = tmp;
+    q->heap[i]->ix = i;
+    q->heap[j]->ix = j;
+}
+
+static void
+_up(xtimerq_t q, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!timercmp(&q->heap[i]->expire, &q->heap[parent]->expire, <))
+            break;
+        _swap(q, i, parent);
+        i = parent;
+    }
+}
+
+static void
+_down(xtimerq_t q, int i)
+{
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, min = i;
+
+        if (l < q->len && timercmp(&q->heap[l]->expire,
+                                   &q->heap[min]->expire, <))
+            min = l;
+        if (r < q->len && timercmp(&q->heap[r]->expire,
+                                   &q->heap[min]->expire, <))
+            min = r;
+        if (min == i)
+            break;
+        _swap(q, i, min);
+        i = min;
+    }
+}
+
+xtimerq_t
+xtimerq_create(void)
+{
+    xtimerq_t q = (xtimerq_t)xmalloc(sizeof(struct xtimerq));
+
+    q->heap = NULL;
+    q->len = 0;
+    q->size = 0;
+    return q;
+}
+
+/* Timers must be destroyed before the queue.
+ */
+void
+xtimerq_destroy(xtimerq_t q)
+{
+    assert(q->len == 0);
+    if (q->heap)
+        xfree(q->heap);
+    xfree(q);
+}
+
+/* Call back each timer that has expired, disarming it first so the
+ * callback may re-arm it.  Return the number of callbacks made.
+ */
+int
+xtimerq_run(xtimerq_t q)
+{
+    struct timeval now;
+    int count = 0;
+
+    xtimer_gettime(&now);
+    while (q->len > 0 && !timercmp(&now, &q->heap[0]->expire, <)) {
+        xtimer_t t = q->heap[0];
+
+        xtimer_cancel(t);
+        t->cb(t->arg);
+        count++;
+    }
+    return count;
+}
+
+/* Set [timeleft] to the time until the next timer expires and return
+ * true, or return false if no timers are armed.  An overdue timer
+ * yields a small nonzero [timeleft] so it can't be mistaken for "none".
+ */
+bool
+xtimerq_next(xtimerq_t q, struct timeval *timeleft)
+{
+    struct timeval now;
+
+    if (q->len == 0)
+        return false;
+    xtimer_gettime(&now);
+    if (timercmp(&q->heap[0]->expire, &now, >))
+        timersub(&q->heap[0]->expire, &now, timeleft);
+    else {
+        timerclear(timeleft);
+        timeleft->tv_usec = 1;
+    }
+    return true;
+}
+
+xtimer_t
+xtimer_create(xtimerq_t q, xtimer_cb_f cb, void *arg)
+{
+    xtimer_t t = (xtimer_t)xmalloc(sizeof(struct xtimer));
+
+    t->q = q;
+    t->ix = -1;
+    t->cb = cb;
+    t->arg = arg;
+    return t;
+}
+
+void
+xtimer_destroy(xtimer_t t)
+{
+    xtimer_cancel(t);
+    xfree(t);
+}
+
+/* Arm (or re-arm) [t] to expire [timeleft] from now.
+ */
+void
+xtimer_arm(xtimer_t t, struct timeval *timeleft)
+{
+    xtimerq_t q = t->q;
+    struct timeval now;
+
+    xtimer_gettime(&now);
+    timeradd(&now, timeleft, &t->expire);
+    if (t->ix < 0) {
+        if (q->len == q->size) {
+            q->size += XTIMERQ_ALLOC_CHUNK;
+            q->heap = (xtimer_t *)xrealloc((char *)q->heap,
+                                           sizeof(xtimer_t) * q->size);
+        }
+        t->ix = q->len++;
+        q->heap[t->ix] = t;
+    }
+    _up(q, t->ix);
+    _down(q, t->ix);
+}
+
+void
+xtimer_cancel(xtimer_t t)
+{
+    xtimerq_t q = t->q;
+    int i = t->ix;
+
+    if (i < 0)
+        return;
+    if (i != --q->len) {
+        _swap(q, i, q->len);
+        _up(q, i);
+        _down(q, i);
+    }
+    t->ix = -1;
+}
+
+bool
+xtimer_armed(xtimer_t t)
+{
+    return (t->ix >= 0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,42 @@
+/************************************************************\
+ * Copyright (C) 2001 The Regents of the University of California.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of PowerMan, a remote power management program.
+ * For details, see https://github.com/chaos/powerman.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+#ifndef PM_XTIMER_H
+#define PM_XTIMER_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+/* One-shot timers on CLOCK_MONOTONIC, kept in a min-heap so the next
+ * expiration is found in O(1) and arm/cancel are O(log n).
+ */
+typedef struct xtimerq *xtimerq_t;
+typedef struct xtimer *xtimer_t;
+
+typedef void (*xtimer_cb_f)(void *arg);
+
+void        xtimer_gettime(struct timeval *tv);
+
+xtimerq_t   xtimerq_create(void);
+void        xtimerq_destroy(xtimerq_t q);
+int         xtimerq_run(xtimerq_t q);
+bool        xtimerq_next(xtimerq_t q, struct timeval *timeleft);
+
+xtimer_t    xtimer_create(xtimerq_t q, xtimer_cb_f cb, void *arg);
+void        xtimer_destroy(xtimer_t t);
+void        xtimer_arm(xtimer_t t, struct timeval *timeleft);
+void        xtimer_cancel(xtimer_t t);
+bool        xtimer_armed(xtimer_t t);
+
+#endif /* PM_XTIMER_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
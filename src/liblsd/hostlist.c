@@ -2374,6 +2374,10 @@ int hostlist_remove(hostlist_iterator_t i)
         i->depth = -1;
     } else if (hostrange_empty(i->hr)) {
         hostlist_delete_range(i->hl, i->idx);
+        /* iterator was moved back to the previous range: position it
+         * at the end of that range so the next host is not repeated */
+        if (i->depth >= 0)
+            i->depth = i->hr->hi - i->hr->lo;
     } else
         i->depth--;
 
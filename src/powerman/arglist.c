@@ -10,10 +10,10 @@
 
 /* Args used to be stored in a List, but gprof showed that very large
  * configurations spent a lot of time doing linear search of arg list for
- * each arg->state update.  The List was traded for a hash, but as we still
- * want to iterate through args in the client in order, we keep the hostlist
- * representation of the nodes in the ArgList, and use it to implement an
- * 'iterator' interface.
+ * each arg->state update.  The List was traded for a hash keyed by node
+ * name, and later for an array indexed by node ID (node names are interned
+ * when the config file is parsed, see conf_node_id()), so that lookups do
+ * not hash strings and iteration does not allocate.
  */
 
 #if HAVE_CONFIG_H
@@ -29,43 +29,44 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "list.h"
 #include "xmalloc.h"
 #include "hostlist.h"
-#include "hash.h"
+#include "parse_util.h"
 #include "arglist.h"
 
 struct arglist_iterator {
-    hostlist_iterator_t itr;
     ArgList arglist;
+    int pos;
 };
 
 struct arglist {
-    hash_t args;
-    hostlist_t hl;
+    Arg *args;                  /* one Arg per distinct node */
+    int nargs;                  /* number of entries in 'args' */
+    Arg **byid;                 /* node ID -> Arg, or NULL if not targeted */
+    Arg **order;                /* Args in hostlist order */
+    int count;                  /* number of entries in 'order' */
     int refcount;               /* free when refcount == 0 */
 };
 
-static void _destroy_arg(Arg * arg)
-{
-    assert(arg != NULL);
-    assert(arg->node != NULL);
-    xfree(arg->node);
-    if (arg->val)
-        xfree(arg->val);
-    xfree(arg);
-}
-
-static Arg *_create_arg(char *node)
+static void _destroy_arglist(ArgList arglist)
 {
-    Arg *arg = (Arg *) xmalloc(sizeof(Arg));
-
-    arg->node = xstrdup(node);
-    arg->state = ST_UNKNOWN;
-    arg->val = NULL;
-
-    return arg;
+    if (arglist->args) {
+        int i;
+
+        for (i = 0; i < arglist->nargs; i++) {
+            if (arglist->args[i].val)
+                xfree(arglist->args[i].val);
+        }
+        xfree(arglist->args);
+    }
+    if (arglist->byid)
+        xfree(arglist->byid);
+    if (arglist->order)
+        xfree(arglist->order);
+    xfree(arglist);
 }
 
 ArgList arglist_create(hostlist_t hl)
@@ -73,51 +74,64 @@ ArgList arglist_create(hostlist_t hl)
     ArgList new = (ArgList) xmalloc(sizeof(struct arglist));
     hostlist_iterator_t itr;
     char *node;
-    int hash_size;
+    int size;
 
     new->refcount = 1;
-    hash_size = hostlist_count(hl); /* reasonable? */
-    new->args = hash_create(hash_size, (hash_key_f)hash_key_string,
-            (hash_cmp_f)strcmp, (hash_del_f)_destroy_arg);
+    size = hostlist_count(hl);
+    new->args = (Arg *) xmalloc(sizeof(Arg) * (size + 1));
+    new->order = (Arg **) xmalloc(sizeof(Arg *) * (size + 1));
+    new->byid = (Arg **) xmalloc(sizeof(Arg *) * (conf_node_count() + 1));
 
     if ((itr = hostlist_iterator_create(hl)) == NULL) {
         arglist_unlink(new);
         return NULL;
     }
     while ((node = hostlist_next(itr)) != NULL) {
-        Arg *arg = _create_arg(node);
+        int id = conf_node_id(node);
 
-        hash_insert(new->args, arg->node, arg);
         free(node); /* hostlist_next strdups returned string */
+        if (id == -1) {
+            hostlist_iterator_destroy(itr);
+            arglist_unlink(new);
+            return NULL;
+        }
+        if (new->byid[id] == NULL) {
+            Arg *arg = &new->args[new->nargs++];
+
+            arg->node = conf_node_name(id);
+            arg->nodeid = id;
+            arg->state = ST_UNKNOWN;
+            arg->result = RT_NONE;
+            arg->val = NULL;
+            new->byid[id] = arg;
+        }
+        new->order[new->count++] = new->byid[id];
     }
     hostlist_iterator_destroy(itr);
-    new->hl = hostlist_copy(hl);
 
     return new;
 }
 
 void arglist_unlink(ArgList arglist)
 {
-    if (--arglist->refcount == 0) {
-        hash_destroy(arglist->args);
-        hostlist_destroy(arglist->hl);
-        xfree(arglist);
-    }
+    /* device threads may drop references concurrently */
+    if (__sync_sub_and_fetch(&arglist->refcount, 1) == 0)
+        _destroy_arglist(arglist);
 }
 
 ArgList arglist_link(ArgList arglist)
 {
-    arglist->refcount++;
+    __sync_add_and_fetch(&arglist->refcount, 1);
 
     return arglist;
 }
 
-Arg *arglist_find(ArgList arglist, char *node)
+Arg *arglist_find(ArgList arglist, int nodeid)
 {
     Arg *arg = NULL;
 
-    if (node != NULL)
-        arg = hash_find(arglist->args, node);
+    if (nodeid >= 0 && nodeid < conf_node_count())
+        arg = arglist->byid[nodeid];
 
     return arg;
 }
@@ -127,27 +141,22 @@ ArgListIterator arglist_iterator_create(ArgList arglist)
     ArgListIterator itr = (ArgListIterator)xmalloc(sizeof(struct arglist_iterator));
 
     itr->arglist = arglist;
-    itr->itr = hostlist_iterator_create(arglist->hl);
+    itr->pos = 0;
 
     return itr;
 }
 
 void arglist_iterator_destroy(ArgListIterator itr)
 {
-    hostlist_iterator_destroy(itr->itr);
     xfree(itr);
 }
 
 Arg *arglist_next(ArgListIterator itr)
 {
     Arg *arg = NULL;
-    char *node;
 
-    node = hostlist_next(itr->itr);
-    if (node != NULL) {
-        arg = hash_find(itr->arglist->args, node);
-        free(node); /* hostlist_next strdups returned string */
-    }
+    if (itr->pos < itr->arglist->count)
+        arg = itr->arglist->order[itr->pos++];
 
     return arg;
 }
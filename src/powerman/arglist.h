@@ -24,6 +24,7 @@ typedef enum { RT_NONE, RT_UNKNOWN, RT_SUCCESS } InterpResult;
 
 typedef struct {
     char *node;                 /* node name (in) */
+    int nodeid;                 /* node ID, see conf_node_id() (in) */
     char *val;                  /* value as returned by the device (out) */
     InterpState state;          /* interpreted value, if appropriate (out) */
     InterpResult result;        /* interpreted result, if appropriate (out) */
@@ -33,6 +34,7 @@ typedef struct arglist_iterator *ArgListIterator;
 typedef struct arglist *ArgList;
 
 /* Create an ArgList with an Arg entry for each node in hl (refcount == 1).
+ * All nodes must be configured, else NULL is returned.
  */
 ArgList          arglist_create(hostlist_t hl);
 
@@ -45,13 +47,15 @@ ArgList          arglist_link(ArgList arglist);
  */
 void             arglist_unlink(ArgList arglist);
 
-/* Search ArgList for an Arg entry that matches node.
+/* Search ArgList for an Arg entry that matches node ID.
  * Return pointer to Arg on success (points to actual list entry),
  * or NULL on search failure.
  */
-Arg *            arglist_find(ArgList arglist, char *node);
+Arg *            arglist_find(ArgList arglist, int nodeid);
 
 /* An iterator interface for ArgLists, similar to the iterators in list.h.
+ * Args are returned in the order of the hostlist the ArgList was created
+ * from.
  */
 ArgListIterator  arglist_iterator_create(ArgList arglist);
 void             arglist_iterator_destroy(ArgListIterator itr);
@@ -36,6 +36,7 @@
 #include "xmalloc.h"
 #include "xpoll.h"
 #include "xregex.h"
+#include "xtimer.h"
 #include "hostlist.h"
 #include "list.h"
 #include "parse_util.h"
@@ -60,12 +61,17 @@ typedef int socklen_t;                  /* socklen_t is uint32_t in Posix.1g */
 #define MIN_CLIENT_BUF     1024
 #define MAX_CLIENT_BUF     1024*1024
 
+#define MAX_CLIENT_CMDS    256  /* max outstanding commands in tagged mode */
+
 typedef struct {
+    int id;                     /* identifies command to device layer */
+    char *tag;                  /* client's tag (tagged mode) or NULL */
     int com;                    /* script index */
     hostlist_t hl;              /* target nodes */
     int pending;                /* count of pending device actions */
     bool error;                 /* cumulative error flag for actions */
     ArgList arglist;            /* argument for query commands */
+    char *streamed;             /* results sent, by node ID (streaming) */
 } Command;
 
 typedef struct {
@@ -76,23 +82,34 @@ typedef struct {
     char *host;                 /* host name of client host */
     cbuf_t to;                  /* out buffer */
     cbuf_t from;                /* in buffer */
-    Command *cmd;               /* command (there can be only one) */
+    List cmds;                  /* outstanding commands */
     int client_id;              /* client identifier */
     bool telemetry;             /* client wants telemetry debugging info */
     bool exprange;              /* client wants host ranges expanded */
+    bool tagged;                /* client tags commands, many outstanding */
+    bool stream;                /* client wants query results as they come */
+    char *tag;                  /* tag prefixed to response lines, or NULL */
+    char *watch;                /* watched nodes, by node ID, or NULL */
+    char *watch_tag;            /* tag of the watch command (tagged mode) */
     bool client_quit;           /* set true after client quit command */
+    bool client_gone;           /* set true if the connection is lost */
 } Client;
 
 /* prototypes for internal functions */
 static Command *_create_command(Client * c, int com, char *arg1);
 static void _destroy_command(Command * cmd);
-static int _match_client(Client * c, void *key);
-static Client *_find_client(int client_id);
+static Command *_find_command(int id, Client **cp);
+static int _match_command(Command *cmd, void *key);
+static int _match_command_ptr(Command *cmd, Command *key);
 static hostlist_t _hostlist_create_validated(Client * c, char *str);
 static void _client_query_nodes_reply(Client * c);
 static void _client_query_device_reply(Client * c, char *arg);
-static void _client_query_status_reply(Client * c, bool error);
-static void _client_query_status_reply_nointerp(Client * c, bool error);
+static void _client_query_latency_reply(Client * c, char *arg);
+static void _client_watch(Client *c, char *arg);
+static void _client_unwatch(Client *c);
+static void _client_query_status_reply(Client * c, Command *cmd);
+static void _client_query_status_reply_nointerp(Client * c, Command *cmd);
+static void _client_query_stream_reply(Client * c, Command *cmd);
 static void _handle_read(Client * c);
 static void _handle_write(Client * c);
 static void _handle_input(Client *c);
@@ -101,9 +118,16 @@ static void _parse_input(Client * c, char *input);
 static void _destroy_client(Client * c);
 static void _create_client_socket(int fd);
 static void _create_client_stdio(void);
-static void _act_finish(int client_id, ActError acterr, const char *fmt, ...);
-static void _telemetry_printf(int client_id, const char *fmt, ...);
-static void _diag_printf(int client_id, const char *fmt, ...);
+static void _act_finish(int id, ActError acterr, const char *fmt, ...);
+static void _cmd_complete(Client *c, Command *cmd);
+static void _telemetry_printf(int id, const char *fmt, ...);
+static void _diag_printf(int id, const char *fmt, ...);
+static void _act_result(int id, int nodeid, InterpState state,
+                        const char *val);
+static void _state_changed(int nodeid, InterpState state);
+static void _client_update_poll(Client *c);
+static void _client_ready(int fd, short flags, void *arg);
+static void _listen_ready(int fd, short flags, void *arg);
 #if HAVE_TCP_WRAPPERS
 /* tcp wrappers support */
 extern int hosts_ctl(char *daemon, char *client_name, char *client_addr,
@@ -115,6 +139,7 @@ int deny_severity = LOG_WARNING;/* logging level for rejected reqs */
 static int *listen_fds;         /* powermand listen sockets */
 static int listen_fds_len = 0;  /* count of above sockets */
 static List cli_clients = NULL; /* list of clients */
+static xpollfd_t cli_pfd = NULL;/* poll set client fds are registered with */
 static bool one_client = false; /* terminate after first client */
 static bool server_done = false;/* true when stdio client exits */
 
@@ -145,8 +170,42 @@ static char *_xhostlist_ranged_string(hostlist_t hl)
     return str;
 }
 
+/*
+ * Helper for _tag_lines.  Return pointer to the start of the line after 'p'.
+ */
+static const char *_next_line(const char *p)
+{
+    const char *eol = strstr(p, CP_EOL);
+
+    return eol ? eol + strlen(CP_EOL) : p + strlen(p);
+}
+
+/*
+ * Prefix each line of 'str' with 'tag'.  Result must be xfree()'d.
+ */
+static char *_tag_lines(const char *tag, const char *str)
+{
+    const char *p, *next;
+    char *res, *q;
+    int lines = 0;
+
+    for (p = str; *p != '\0'; p = _next_line(p))
+        lines++;
+    res = xmalloc(strlen(str) + lines * (strlen(tag) + 1) + 1);
+    q = res;
+    for (p = str; *p != '\0'; p = next) {
+        next = _next_line(p);
+        q += sprintf(q, "%s ", tag);
+        memcpy(q, p, next - p);
+        q += next - p;
+    }
+    *q = '\0';
+    return res;
+}
+
 /*
  * printf-like function which writes to the output cbuf.
+ * In tagged mode, each line gets the tag of the command it belongs to.
  */
 static void _client_printf(Client *c, const char *fmt, ...)
 {
@@ -158,6 +217,13 @@ static void _client_printf(Client *c, const char *fmt, ...)
     str = hvsprintf(fmt, ap);
     va_end(ap);
 
+    if (c->tag) {
+        char *tagged = _tag_lines(c->tag, str);
+
+        xfree(str);
+        str = tagged;
+    }
+
     /* Write to the client buffer */
     written = cbuf_write(c->to, str, strlen(str), &dropped);
     if (written < 0)
@@ -167,13 +233,31 @@ static void _client_printf(Client *c, const char *fmt, ...)
 
     /* Free the tmp string */
     xfree(str);
+
+    _client_update_poll(c);
+}
+
+/*
+ * Prompt the client for the next command (there is no prompt in tagged mode).
+ */
+static void _client_prompt(Client *c)
+{
+    char *tag = c->tag;
+
+    if (!c->tagged) {
+        c->tag = NULL;          /* not part of the response to a command */
+        _client_printf(c, CP_PROMPT);
+        c->tag = tag;
+    }
 }
 
 /*
  * Initialize module.
  */
-void cli_init(void)
+void cli_init(xpollfd_t pfd)
 {
+    cli_pfd = pfd;
+
     /* create cli_clients list */
     cli_clients = list_create((ListDelF) _destroy_client);
 }
@@ -364,21 +448,62 @@ static void _client_query_device_reply(Client * c, char *arg)
     _client_printf(c, CP_RSP_QRY_COMPLETE);
 }
 
+static double _tvtodouble(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static double _tvavg(struct timeval *tv, int count)
+{
+    return count > 0 ? _tvtodouble(tv) / count : 0.0;
+}
+
+/*
+ * Reply to client request for action latency of devices, by priority class.
+ */
+static void _client_query_latency_reply(Client * c, char *arg)
+{
+    List devs = dev_getdevices();
+    Device *dev;
+    ListIterator itr;
+    LatencyStat stat;
+    int prio;
+
+    if (devs) {
+        itr = list_iterator_create(devs);
+        while ((dev = list_next(itr))) {
+            if (arg && !_device_matches_targets(dev, arg))
+                continue;
+            for (prio = 0; prio < NUM_PRIOS; prio++) {
+                dev_get_latency(dev, prio, &stat);
+                _client_printf(c, CP_INFO_LATENCY,
+                        dev->name,
+                        dev_prio_name(prio),
+                        stat.count,
+                        _tvavg(&stat.wait_total, stat.count),
+                        _tvtodouble(&stat.wait_max),
+                        _tvavg(&stat.total, stat.count),
+                        _tvtodouble(&stat.max));
+            }
+        }
+        list_iterator_destroy(itr);
+    }
+    _client_printf(c, CP_RSP_QRY_COMPLETE);
+}
+
 /*
  * Reply to client power command (on/off/cycle/reset/beacon on/beacon off)
  */
-static void _client_power_status_reply(Client * c, bool error)
+static void _client_power_status_reply(Client * c, Command *cmd)
 {
     Arg *arg;
     ArgListIterator itr;
     int error_found = 0;
 
-    assert(c->cmd != NULL);
-
     /* N.B. if result is RT_NONE, device script does not
      * specify setresult interpretation.
      */
-    itr = arglist_iterator_create(c->cmd->arglist);
+    itr = arglist_iterator_create(cmd->arglist);
     while ((arg = arglist_next(itr))) {
         if (arg->result == RT_UNKNOWN) {
             error_found++;
@@ -387,7 +512,7 @@ static void _client_power_status_reply(Client * c, bool error)
     }
     arglist_iterator_destroy(itr);
 
-    if (c->cmd->error || error_found)
+    if (cmd->error || error_found)
         _client_printf(c, CP_ERR_COM_COMPLETE);
     else
         _client_printf(c, CP_RSP_COM_COMPLETE);
@@ -396,15 +521,13 @@ static void _client_power_status_reply(Client * c, bool error)
 /*
  * Reply to client request for plug/soft status.
  */
-static void _client_query_status_reply(Client * c, bool error)
+static void _client_query_status_reply(Client * c, Command *cmd)
 {
     Arg *arg;
     ArgListIterator itr;
 
-    assert(c->cmd != NULL);
-
     if (c->exprange) {
-        itr = arglist_iterator_create(c->cmd->arglist);
+        itr = arglist_iterator_create(cmd->arglist);
         while ((arg = arglist_next(itr))) {
             _client_printf(c, CP_INFO_XSTATUS, arg->node,
                     arg->state == ST_ON ? "on"
@@ -420,7 +543,7 @@ static void _client_query_status_reply(Client * c, bool error)
         hl_off = hostlist_create(NULL);
         hl_unknown = hostlist_create(NULL);
 
-        itr = arglist_iterator_create(c->cmd->arglist);
+        itr = arglist_iterator_create(cmd->arglist);
         while ((arg = arglist_next(itr))) {
             switch (arg->state) {
                 case ST_UNKNOWN:
@@ -455,7 +578,7 @@ static void _client_query_status_reply(Client * c, bool error)
         xfree (off);
     }
 
-    if (error)
+    if (cmd->error)
         _client_printf(c, CP_ERR_QRY_COMPLETE);
     else
         _client_printf(c, CP_RSP_QRY_COMPLETE);
@@ -464,16 +587,14 @@ static void _client_query_status_reply(Client * c, bool error)
 /*
  * Reply to client request for temperature/beacon status.
  */
-static void _client_query_status_reply_nointerp(Client * c, bool error)
+static void _client_query_status_reply_nointerp(Client * c, Command *cmd)
 {
     Arg *arg;
     ArgListIterator itr;
     hostlist_t hl = hostlist_create(NULL);
     char *tmpstr;
 
-    assert(c->cmd != NULL);
-
-    itr = arglist_iterator_create(c->cmd->arglist);
+    itr = arglist_iterator_create(cmd->arglist);
     while ((arg = arglist_next(itr))) {
         _client_printf(c, CP_INFO_XSTATUS, arg->node, arg->val);
         if (!arg->val)
@@ -487,13 +608,118 @@ static void _client_query_status_reply_nointerp(Client * c, bool error)
         _client_printf(c, CP_INFO_XSTATUS, tmpstr, "unknown");
         xfree (tmpstr);
     }
-    if (error)
+    if (cmd->error)
         _client_printf(c, CP_ERR_QRY_COMPLETE);
     else
         _client_printf(c, CP_RSP_QRY_COMPLETE);
     hostlist_destroy(hl);
 }
 
+/*
+ * Helper for streaming replies.  Format the result for a node.
+ */
+static const char *_result_str(int com, InterpState state, const char *val)
+{
+    if (com == PM_STATUS_TEMP)
+        return val;
+    return state == ST_ON ? "on" : state == ST_OFF ? "off" : "unknown";
+}
+
+/*
+ * Finish reply to a query in streaming mode with the results not yet sent,
+ * those of nodes whose device failed to answer (or answered unknown).
+ */
+static void _client_query_stream_reply(Client * c, Command *cmd)
+{
+    Arg *arg;
+    ArgListIterator itr;
+    hostlist_t hl = hostlist_create(NULL);
+    char *tmpstr;
+
+    itr = arglist_iterator_create(cmd->arglist);
+    while ((arg = arglist_next(itr))) {
+        if (cmd->streamed[arg->nodeid])
+            continue;
+        if (cmd->com == PM_STATUS_TEMP && !arg->val)
+            hostlist_push(hl, arg->node);
+        else
+            _client_printf(c, CP_INFO_XSTATUS, arg->node,
+                           _result_str(cmd->com, arg->state, arg->val));
+    }
+    arglist_iterator_destroy(itr);
+
+    if (!hostlist_is_empty(hl)) {
+        hostlist_sort(hl);
+        tmpstr = _xhostlist_ranged_string(hl);
+        _client_printf(c, CP_INFO_XSTATUS, tmpstr, "unknown");
+        xfree (tmpstr);
+    }
+    if (cmd->error)
+        _client_printf(c, CP_ERR_QRY_COMPLETE);
+    else
+        _client_printf(c, CP_RSP_QRY_COMPLETE);
+    hostlist_destroy(hl);
+}
+
+/*
+ * Stop sending plug state changes to the client.
+ */
+static void _client_unwatch(Client *c)
+{
+    if (c->watch) {
+        xfree(c->watch);
+        c->watch = NULL;
+    }
+    if (c->watch_tag) {
+        xfree(c->watch_tag);
+        c->watch_tag = NULL;
+    }
+    _client_printf(c, CP_RSP_UNWATCH);
+}
+
+/*
+ * Send the client a line whenever the plug state of one of 'arg' (or of
+ * any node, if NULL) changes, in place of any nodes watched before.
+ * In tagged mode, the lines carry the tag of the watch command.
+ */
+static void _client_watch(Client *c, char *arg)
+{
+    hostlist_t hl;
+    hostlist_iterator_t itr;
+    char *node, *str;
+    int id;
+
+    if (arg) {
+        /* Note: this can send CP_ERR_HOSTLIST to client */
+        if (!(hl = _hostlist_create_validated(c, arg)))
+            return;
+    } else
+        hl = hostlist_copy(conf_getnodes());
+    if (!c->watch)
+        c->watch = xmalloc(conf_node_count());
+    memset(c->watch, 0, conf_node_count());
+    if (!(itr = hostlist_iterator_create(hl))) {
+        hostlist_destroy(hl);
+        _internal_error_response(c);
+        return;
+    }
+    while ((node = hostlist_next(itr))) {
+        if ((id = conf_node_id(node)) != -1)
+            c->watch[id] = 1;
+        free(node); /* hostlist_next strdups returned string */
+    }
+    hostlist_iterator_destroy(itr);
+    if (c->watch_tag)
+        xfree(c->watch_tag);
+    c->watch_tag = c->tag ? xstrdup(c->tag) : NULL;
+
+    hostlist_sort(hl);
+    str = _xhostlist_ranged_string(hl);
+    _client_printf(c, CP_RSP_WATCH, str);
+    xfree(str);
+    hostlist_destroy(hl);
+}
+
 /*
  * Create Command.
  * On error, return an error to the client and NULL to the caller.
@@ -502,11 +728,14 @@ static Command *_create_command(Client * c, int com, char *arg1)
 {
     Command *cmd = (Command *) xmalloc(sizeof(Command));
 
+    cmd->id = _next_cli_id();
+    cmd->tag = c->tag ? xstrdup(c->tag) : NULL;
     cmd->com = com;
     cmd->error = false;
     cmd->pending = 0;
     cmd->hl = NULL;
     cmd->arglist = NULL;
+    cmd->streamed = NULL;
 
     if (arg1) {
         /* Note: this can send CP_ERR_HOSTLIST to client */
@@ -518,11 +747,6 @@ static Command *_create_command(Client * c, int com, char *arg1)
     } else
         cmd->hl = hostlist_copy(conf_getnodes());
 
-    if (cmd && !dev_check_actions(cmd->com, cmd->hl)) {
-        _destroy_command(cmd);
-        _client_printf(c, CP_ERR_UNIMPL);
-        cmd = NULL;
-    }
     /* NOTE 1: cmd->arglist has a reference count and can persist after we
      * unlink from it in _destroy_command().  If client goes away prematurely,
      * actions that write to arglist will still have valid pointers.
@@ -537,6 +761,14 @@ static Command *_create_command(Client * c, int com, char *arg1)
             cmd = NULL;
         }
     }
+    if (cmd && !dev_check_actions(cmd->com, cmd->arglist)) {
+        _destroy_command(cmd);
+        _client_printf(c, CP_ERR_UNIMPL);
+        cmd = NULL;
+    }
+    if (cmd && c->stream && (com == PM_STATUS_PLUGS || com == PM_STATUS_TEMP
+                                                || com == PM_STATUS_BEACON))
+        cmd->streamed = xmalloc(conf_node_count());
     return cmd;
 }
 
@@ -545,10 +777,14 @@ static Command *_create_command(Client * c, int com, char *arg1)
  */
 static void _destroy_command(Command * cmd)
 {
+    if (cmd->tag)
+        xfree(cmd->tag);
     if (cmd->hl)
         hostlist_destroy(cmd->hl);
     if (cmd->arglist)
         arglist_unlink(cmd->arglist);
+    if (cmd->streamed)
+        xfree(cmd->streamed);
     xfree(cmd);
 }
 
@@ -566,12 +802,11 @@ static char *_strip_whitespace(char *str)
 }
 
 /*
- * Parse a line of input and create a Command (and enqueue device actions)
+ * Parse a command and create a Command (and enqueue device actions)
  * if needed.
  */
-static void _parse_input(Client * c, char *input)
+static void _parse_command(Client * c, char *str)
 {
-    char *str = _strip_whitespace(input);
     char arg1[CP_LINEMAX];
     Command *cmd = NULL;
 
@@ -581,7 +816,8 @@ static void _parse_input(Client * c, char *input)
 
     if (strlen(str) >= CP_LINEMAX) {
         _client_printf(c, CP_ERR_TOOLONG);              /* error: too long */
-    } else if (c->cmd != NULL) {
+    } else if (!list_is_empty(c->cmds)
+            && (!c->tagged || list_count(c->cmds) >= MAX_CLIENT_CMDS)) {
         _client_printf(c, CP_ERR_CLIBUSY);              /* error: busy */
         return;                                         /* no prompt */
     } else if (!strncasecmp(str, CP_HELP, strlen(CP_HELP))) {
@@ -595,6 +831,12 @@ static void _parse_input(Client * c, char *input)
     } else if (!strncasecmp(str, CP_EXPRANGE, strlen(CP_EXPRANGE))) {
         c->exprange = !c->exprange;                     /* exprange */
         _client_printf(c, CP_RSP_EXPRANGE, c->exprange ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_STREAM, strlen(CP_STREAM))) {
+        c->stream = !c->stream;                         /* stream */
+        _client_printf(c, CP_RSP_STREAM, c->stream ? "ON" : "OFF");
+    } else if (!strncasecmp(str, CP_TAGGED, strlen(CP_TAGGED))) {
+        c->tagged = !c->tagged;                         /* tagged */
+        _client_printf(c, CP_RSP_TAGGED, c->tagged ? "ON" : "OFF");
     } else if (!strncasecmp(str, CP_QUIT, strlen(CP_QUIT))) {
         c->client_quit = true;
         _client_printf(c, CP_RSP_QUIT);                 /* quit */
@@ -623,49 +865,97 @@ static void _parse_input(Client * c, char *input)
         cmd = _create_command(c, PM_STATUS_BEACON, arg1);
     } else if (!strncasecmp(str, CP_BEACON_ALL, strlen(CP_BEACON_ALL))) {
         cmd = _create_command(c, PM_STATUS_BEACON, NULL);
+    } else if (sscanf(str, CP_WATCH, arg1) == 1) {      /* watch [hostlist] */
+        _client_watch(c, arg1);
+    } else if (!strncasecmp(str, CP_WATCH_ALL, strlen(CP_WATCH_ALL))) {
+        _client_watch(c, NULL);
+    } else if (!strncasecmp(str, CP_UNWATCH, strlen(CP_UNWATCH))) {
+        _client_unwatch(c);                             /* unwatch */
     } else if (sscanf(str, CP_DEVICE, arg1) == 1) {     /* device [hostlist] */
         _client_query_device_reply(c, arg1);
     } else if (!strncasecmp(str, CP_DEVICE_ALL, strlen(CP_DEVICE_ALL))) {
         _client_query_device_reply(c, NULL);
+    } else if (sscanf(str, CP_LATENCY, arg1) == 1) {    /* latency [hostlist] */
+        _client_query_latency_reply(c, arg1);
+    } else if (!strncasecmp(str, CP_LATENCY_ALL, strlen(CP_LATENCY_ALL))) {
+        _client_query_latency_reply(c, NULL);
     } else {                                            /* error: unknown */
         _client_printf(c, CP_ERR_UNKNOWN);
     }
 
     /* enqueue device actions and tie up the client if necessary */
     if (cmd) {
+        bool cached;
+
         assert(cmd->hl != NULL);
-        dbg(DBG_CLIENT, "_parse_input: enqueuing actions");
-        cmd->pending = dev_enqueue_actions(cmd->com, cmd->hl, _act_finish,
+        list_append(c->cmds, cmd);      /* cached results are passed now */
+        dbg(DBG_CLIENT, "_parse_command: enqueuing actions");
+        cmd->pending = dev_enqueue_actions(cmd->com, _act_finish,
                 c->telemetry ? _telemetry_printf : NULL,
-                _diag_printf, c->client_id, cmd->arglist);
-        if (cmd->pending == 0) {
+                _diag_printf, cmd->streamed ? _act_result : NULL,
+                cmd->id, cmd->arglist, &cached);
+        if (cmd->pending == 0 && !cached) {
             _client_printf(c, CP_ERR_UNIMPL);
-            _destroy_command(cmd);
+            list_delete_all(c->cmds, (ListFindF) _match_command_ptr, cmd);
             cmd = NULL;
         }
-        assert(c->cmd == NULL);
-        c->cmd = cmd;
+
+        /* query answered entirely from the status cache */
+        if (cmd && cmd->pending == 0) {
+            _cmd_complete(c, cmd);
+            return;
+        }
     }
 
     /* reissue prompt if we didn't queue up any device actions */
     if (cmd == NULL && !c->client_quit)
-        _client_printf(c, CP_PROMPT);
+        _client_prompt(c);
+}
+
+/*
+ * Parse a line of input.  In tagged mode, the first word is the tag,
+ * which is prefixed to each line of the response.
+ */
+static void _parse_input(Client * c, char *input)
+{
+    char *str = _strip_whitespace(input);
+
+    if (c->tagged) {
+        char *tag = str;
+
+        if (*str == '\0')                               /* ignore blank line */
+            return;
+        while (*str && !isspace(*str))
+            str++;
+        if (*str) {
+            *str++ = '\0';
+            while (*str && isspace(*str))
+                str++;
+        }
+        c->tag = tag;
+        _parse_command(c, str);
+        c->tag = NULL;
+    } else
+        _parse_command(c, str);
 }
 
 /*
  * Callback for device debugging printfs (sent to client if --telemetry)
  */
-static void _telemetry_printf(int client_id, const char *fmt, ...)
+static void _telemetry_printf(int id, const char *fmt, ...)
 {
     va_list ap;
     Client *c;
+    Command *cmd;
     char *str;
 
-    if ((c = _find_client(client_id))) {
+    if ((cmd = _find_command(id, &c))) {
         va_start(ap, fmt);
         str = hvsprintf(fmt, ap);
         va_end(ap);
+        c->tag = cmd->tag;
         _client_printf(c, CP_INFO_TELEMETRY, str);
+        c->tag = NULL;
         xfree(str);
     }
 }
@@ -673,33 +963,84 @@ static void _telemetry_printf(int client_id, const char *fmt, ...)
 /*
  * Callback for device diagnostics
  */
-static void _diag_printf(int client_id, const char *fmt, ...)
+static void _diag_printf(int id, const char *fmt, ...)
 {
     va_list ap;
     Client *c;
+    Command *cmd;
     char *str;
 
-    if ((c = _find_client(client_id))) {
+    if ((cmd = _find_command(id, &c))) {
         va_start(ap, fmt);
         str = hvsprintf(fmt, ap);
         va_end(ap);
+        c->tag = cmd->tag;
         _client_printf(c, CP_INFO_DIAG, str);
+        c->tag = NULL;
         xfree(str);
     }
 }
 
+/*
+ * Callback for a node's query result (sent to client in streaming mode)
+ */
+static void _act_result(int id, int nodeid, InterpState state,
+                        const char *val)
+{
+    Client *c;
+    Command *cmd;
+    Arg *arg;
+    char *tag;
+
+    if (!(cmd = _find_command(id, &c)) || !cmd->streamed)
+        return;
+    if (!(arg = arglist_find(cmd->arglist, nodeid)) || cmd->streamed[nodeid])
+        return;
+    cmd->streamed[nodeid] = 1;
+    tag = c->tag;
+    c->tag = cmd->tag;
+    _client_printf(c, CP_INFO_XSTATUS, arg->node,
+                   _result_str(cmd->com, state, val));
+    c->tag = tag;
+}
+
+/*
+ * Callback for plug state changes: tell the clients watching the node.
+ * A client at the prompt gets a fresh one.
+ */
+static void _state_changed(int nodeid, InterpState state)
+{
+    ListIterator itr;
+    Client *c;
+    char *tag;
+
+    itr = list_iterator_create(cli_clients);
+    while ((c = list_next(itr))) {
+        if (!c->watch || !c->watch[nodeid] || c->client_quit)
+            continue;
+        tag = c->tag;
+        c->tag = c->watch_tag;
+        _client_printf(c, CP_INFO_EVENT, conf_node_name(nodeid),
+                       _result_str(PM_STATUS_PLUGS, state, NULL));
+        c->tag = tag;
+        if (list_is_empty(c->cmds))
+            _client_prompt(c);
+    }
+    list_iterator_destroy(itr);
+}
+
 /* See chaos/powerman#138.
  * We don't want these messages syslogged when we run the test suite,
  * so send them to stderr and when powerman is run as a system service,
  * systemd redirects stderr to the journal which also usually goes to syslog.
  */
-static void log_state_change(Client *c)
+static void log_state_change(Command *cmd)
 {
     int level = conf_get_plug_log_level();
     const char *action;
     char *hosts;
 
-    switch (c->cmd->com) {
+    switch (cmd->com) {
         case PM_POWER_ON:
             action = "powered on";
             break;
@@ -715,69 +1056,85 @@ static void log_state_change(Client *c)
         default:
             return;
     }
-    hosts = _xhostlist_ranged_string(c->cmd->hl);
+    hosts = _xhostlist_ranged_string(cmd->hl);
     // N.B. systemd journal groks <level> prefix
     fprintf(stderr, "<%d>%s %s%s\n", level, action, hosts,
-        (c->cmd->error == true ? " with errors" : ""));
+        (cmd->error == true ? " with errors" : ""));
     xfree(hosts);
 }
 
 /*
  * Callback for device action completion.
  */
-static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
+static void _act_finish(int id, ActError acterr, const char *fmt, ...)
 {
     va_list ap;
     Client *c;
+    Command *cmd;
     char *str;
 
     /* if client has gone away do nothing */
-    if (!(c = _find_client(client_id)))
+    if (!(cmd = _find_command(id, &c)))
         return;
-    assert(c->cmd != NULL);
 
     /* handle errors immediately */
     if (acterr != ACT_ESUCCESS) {
         va_start(ap, fmt);
         str = hvsprintf(fmt, ap);
         va_end(ap);
+        c->tag = cmd->tag;
         _client_printf(c, CP_INFO_ACTERROR, str);
+        c->tag = NULL;
         xfree(str);
 
-        c->cmd->error = true;       /* when done say "completed with errors" */
+        cmd->error = true;          /* when done say "completed with errors" */
     }
 
     /* all actions have called back - return response to client */
-    if (--c->cmd->pending == 0) {
-        log_state_change(c);
-
-        switch (c->cmd->com) {
-        case PM_STATUS_PLUGS:      /* status */
-        case PM_STATUS_BEACON:     /* beacon */
-            _client_query_status_reply(c, c->cmd->error);
-            break;
-        case PM_STATUS_TEMP:       /* temp */
-            _client_query_status_reply_nointerp(c, c->cmd->error);
-            break;
-        case PM_POWER_ON:          /* on */
-        case PM_POWER_OFF:         /* off */
-        case PM_BEACON_ON:         /* flash */
-        case PM_BEACON_OFF:        /* unflash */
-        case PM_POWER_CYCLE:       /* cycle */
-        case PM_RESET:             /* reset */
-            _client_power_status_reply(c, c->cmd->error);
-            break;
-        default:
-            assert(false);
-            _internal_error_response(c);
-            break;
-        }
+    if (--cmd->pending == 0)
+        _cmd_complete(c, cmd);
+}
 
-        /* clean up and re-prompt */
-        _destroy_command(c->cmd);
-        c->cmd = NULL;
-        _client_printf(c, CP_PROMPT);
+/*
+ * Send the response to the client's command and re-prompt.
+ */
+static void _cmd_complete(Client *c, Command *cmd)
+{
+    log_state_change(cmd);
+
+    c->tag = cmd->tag;
+    switch (cmd->com) {
+    case PM_STATUS_PLUGS:      /* status */
+    case PM_STATUS_BEACON:     /* beacon */
+        if (cmd->streamed)
+            _client_query_stream_reply(c, cmd);
+        else
+            _client_query_status_reply(c, cmd);
+        break;
+    case PM_STATUS_TEMP:       /* temp */
+        if (cmd->streamed)
+            _client_query_stream_reply(c, cmd);
+        else
+            _client_query_status_reply_nointerp(c, cmd);
+        break;
+    case PM_POWER_ON:          /* on */
+    case PM_POWER_OFF:         /* off */
+    case PM_BEACON_ON:         /* flash */
+    case PM_BEACON_OFF:        /* unflash */
+    case PM_POWER_CYCLE:       /* cycle */
+    case PM_RESET:             /* reset */
+        _client_power_status_reply(c, cmd);
+        break;
+    default:
+        assert(false);
+        _internal_error_response(c);
+        break;
     }
+    c->tag = NULL;
+
+    /* clean up and re-prompt */
+    list_delete_all(c->cmds, (ListFindF) _match_command_ptr, cmd);
+    _client_prompt(c);
 }
 
 /*
@@ -786,12 +1143,14 @@ static void _act_finish(int client_id, ActError acterr, const char *fmt, ...)
 static void _destroy_client(Client *c)
 {
     if (c->fd != NO_FD) {
+        xpollfd_del(cli_pfd, c->fd);
         dbg(DBG_CLIENT, "_destroy_client: closing fd %d", c->fd);
         if (close(c->fd) < 0)
             err(true, "close fd %d", c->fd);
         c->fd = NO_FD;
     }
     if (c->ofd != NO_FD) {
+        xpollfd_del(cli_pfd, c->ofd);
         dbg(DBG_CLIENT, "_destroy_client: closing fd %d", c->ofd);
         if (close(c->ofd) < 0)
             err(true, "close fd %d", c->ofd);
@@ -801,8 +1160,19 @@ static void _destroy_client(Client *c)
         cbuf_destroy(c->to);
     if (c->from)
         cbuf_destroy(c->from);
-    if (c->cmd)
-        _destroy_command(c->cmd);
+    if (c->cmds) {
+        Command *cmd;
+
+        while ((cmd = list_pop(c->cmds))) {
+            dev_cancel_actions(cmd->id);    /* nobody wants the result */
+            _destroy_command(cmd);
+        }
+        list_destroy(c->cmds);
+    }
+    if (c->watch)
+        xfree(c->watch);
+    if (c->watch_tag)
+        xfree(c->watch_tag);
     if (c->ip)
         xfree(c->ip);
     if (c->host)
@@ -812,18 +1182,37 @@ static void _destroy_client(Client *c)
         server_done = true;
 }
 
-/* helper for _find_client */
-static int _match_client(Client *c, void *key)
+/* helper for _find_command */
+static int _match_command(Command *cmd, void *key)
 {
-    return (c->client_id == *(int *) key);
+    return (cmd->id == *(int *) key);
+}
+
+/* helper for _cmd_complete */
+static int _match_command_ptr(Command *cmd, Command *key)
+{
+    return (cmd == key);
 }
 
 /*
- * Test if a client still exists (by sequence).
+ * Find an outstanding command (by id) and the client that issued it.
+ * Return NULL if the command has completed or its client has gone away.
  */
-static Client *_find_client(int seq)
+static Command *_find_command(int id, Client **cp)
 {
-    return list_find_first(cli_clients, (ListFindF) _match_client, &seq);
+    ListIterator itr;
+    Client *c;
+    Command *cmd = NULL;
+
+    itr = list_iterator_create(cli_clients);
+    while ((c = list_next(itr))) {
+        if ((cmd = list_find_first(c->cmds, (ListFindF) _match_command, &id)))
+            break;
+    }
+    list_iterator_destroy(itr);
+    if (cmd && cp)
+        *cp = c;
+    return cmd;
 }
 
 /*
@@ -906,6 +1295,7 @@ static void _listen_client(void)
                 continue;
             }
             listen_fds[i] = fd;
+            xpollfd_add(cli_pfd, fd, XPOLLIN, _listen_ready, NULL);
             count++;
         }
 
@@ -937,12 +1327,18 @@ static void _create_client_socket(int fd)
     c = (Client *) xmalloc(sizeof(Client));
     c->to = NULL;
     c->from = NULL;
-    c->cmd = NULL;
+    c->cmds = list_create((ListDelF) _destroy_command);
     c->client_id = _next_cli_id();
     c->telemetry = false;
     c->exprange = false;
+    c->tagged = false;
+    c->stream = false;
+    c->tag = NULL;
+    c->watch = NULL;
+    c->watch_tag = NULL;
     c->ofd = NO_FD;
     c->client_quit = false;
+    c->client_gone = false;
 
     c->fd = accept(fd, (struct sockaddr *)&addr, &addr_size);
     if (c->fd < 0){
@@ -957,6 +1353,7 @@ static void _create_client_socket(int fd)
         }
         err_exit(true, "accept");
     }
+    xpollfd_add(cli_pfd, c->fd, 0, _client_ready, c);
 
     if ((error = getnameinfo((struct sockaddr *)&addr, addr_size,
                              hbuf, sizeof(hbuf), pbuf, sizeof(pbuf),
@@ -1012,11 +1409,17 @@ static void _create_client_stdio(void)
 
     /* create client data structure */
     c = (Client *) xmalloc(sizeof(Client));
-    c->cmd = NULL;
+    c->cmds = list_create((ListDelF) _destroy_command);
     c->client_id = _next_cli_id();
     c->telemetry = false;
     c->exprange = false;
+    c->tagged = false;
+    c->stream = false;
+    c->tag = NULL;
+    c->watch = NULL;
+    c->watch_tag = NULL;
     c->client_quit = false;
+    c->client_gone = false;
     c->fd = STDIN_FILENO;
     c->ofd = STDOUT_FILENO;
     c->host = xstrdup("localhost");
@@ -1027,6 +1430,8 @@ static void _create_client_stdio(void)
 
     nonblock_set(c->fd);
     nonblock_set(c->ofd);
+    xpollfd_add(cli_pfd, c->fd, 0, _client_ready, c);
+    xpollfd_add(cli_pfd, c->ofd, 0, _client_ready, c);
 
     /* append to the list of clients */
     list_append(cli_clients, c);
@@ -1047,6 +1452,7 @@ static void _handle_read(Client * c)
     n = cbuf_write_from_fd(c->from, c->fd, -1, &dropped);
     if (n < 0) {
         c->client_quit = true;
+        c->client_gone = true;
         err(true, "client read error");
         return;
     }
@@ -1073,6 +1479,7 @@ static void _handle_write(Client * c)
     if (n < 0) {
         err(true, "write error on client");
         c->client_quit = true;
+        c->client_gone = true;
     }
 }
 
@@ -1088,101 +1495,93 @@ static void _handle_input(Client *c)
 }
 
 /*
- * Prep rset/wset/maxfd for the main poll call.
+ * Update poll interest for client fds after its buffers or state change.
  */
-void cli_pre_poll(xpollfd_t pfd)
+static void _client_update_poll(Client *c)
 {
-    ListIterator itr;
-    Client *client;
-    int i;
+    short flags = 0;
+    short oflags = 0;
 
-    for (i = 0; i < listen_fds_len; i++) {
-        if (listen_fds[i] != NO_FD) {
-            assert(listen_fds[i] >= 0);
-            xpollfd_set(pfd, listen_fds[i], XPOLLIN);
-        }
-    }
-
-    itr = list_iterator_create(cli_clients);
-    while ((client = list_next(itr))) {
-        if (client->fd < 0)
-            continue;
+    /* poll for reading so we notice if the connection is dropped */
+    if (!c->client_quit)
+        flags |= XPOLLIN;
 
-        /* set read set bits so select will unblock if the
-         * connection is dropped.
-         */
-        if (!client->client_quit)
-            xpollfd_set(pfd, client->fd, XPOLLIN);
-
-        /* need to be in the write set if we are sending anything */
-        if (!cbuf_is_empty(client->to)) {
-            if (client->ofd != NO_FD)
-                xpollfd_set(pfd, client->ofd, XPOLLOUT);
-            else
-                xpollfd_set(pfd, client->fd, XPOLLOUT);
-        }
+    /* poll for writing only if we are sending anything */
+    if (!cbuf_is_empty(c->to)) {
+        if (c->ofd != NO_FD)
+            oflags |= XPOLLOUT;
+        else
+            flags |= XPOLLOUT;
     }
-    list_iterator_destroy(itr);
+    if (c->fd != NO_FD)
+        xpollfd_mod(cli_pfd, c->fd, flags);
+    if (c->ofd != NO_FD)
+        xpollfd_mod(cli_pfd, c->ofd, oflags);
+}
+
+/* helper for _client_ready */
+static int _match_client_ptr(Client *c, Client *key)
+{
+    return (c == key);
 }
 
 /*
- * Handle any client activity (new connection or read/write).
+ * Handle client activity (read/write) on one of its fds.
  */
-void cli_post_poll(xpollfd_t pfd)
+static void _client_ready(int fd, short flags, void *arg)
 {
-    ListIterator itr;
-    Client *c;
-    int i;
-
-    for (i = 0; i < listen_fds_len; i++) {
-        if (listen_fds[i] != NO_FD)
-            if ((xpollfd_revents(pfd, listen_fds[i]) & XPOLLIN))
-                _create_client_socket(listen_fds[i]);
+    Client *c = arg;
+
+    if (fd == c->ofd) {
+        if (flags & XPOLLERR)
+            err(false, "client poll: error");
+        if (flags & XPOLLHUP)
+            err(false, "client poll: hangup");
+        if (flags & XPOLLNVAL)
+            err(false, "client poll: fd not open");
+        if (flags & (XPOLLERR | XPOLLHUP | XPOLLNVAL))
+            goto client_dead;
+        if (c->fd == NO_FD)
+            goto client_dead;
+        if ((flags & XPOLLOUT))
+            _handle_write(c);
+    } else {
+        if (flags & XPOLLERR)
+            err(false, "client poll: error");
+        if (flags & XPOLLNVAL)
+            err(false, "client poll: fd not open");
+        if (flags & (XPOLLERR | XPOLLNVAL))
+            goto client_dead;
+        if (flags & (XPOLLIN | XPOLLHUP))
+            _handle_read(c);
+        if ((flags & XPOLLOUT))
+            _handle_write(c);
     }
 
-    itr = list_iterator_create(cli_clients);
-    while ((c = list_next(itr))) {
-        if (c->fd != NO_FD) {
-            short flags = xpollfd_revents(pfd, c->fd);
-
-            if (flags & XPOLLERR)
-                err(false, "client poll: error");
-            if (flags & XPOLLNVAL)
-                err(false, "client poll: fd not open");
-            if (flags & (XPOLLERR | XPOLLNVAL))
-                goto client_dead;
-            if (flags & (XPOLLIN | XPOLLHUP))
-                _handle_read(c);
-            if ((flags & XPOLLOUT))
-                _handle_write(c);
-        }
-        if (c->ofd != NO_FD) {
-            short flags = xpollfd_revents(pfd, c->ofd);
-
-            if (flags & XPOLLERR)
-                err(false, "client poll: error");
-            if (flags & XPOLLHUP)
-                err(false, "client poll: hangup");
-            if (flags & XPOLLNVAL)
-                err(false, "client poll: fd not open");
-            if (flags & (XPOLLERR | XPOLLHUP | XPOLLNVAL))
-                goto client_dead;
-            if (c->fd == NO_FD)
-                goto client_dead;
-            if ((flags & XPOLLOUT))
-                _handle_write(c);
-        }
+    _handle_input(c);
 
-        _handle_input(c);
-
-        if (c->client_quit && c->cmd == NULL)
-            goto client_dead;
-        continue;
+    /* a client that quit or closed its input still gets the response to
+     * its commands, but if the connection is lost, nobody is left to hear
+     * it, and _destroy_client() cancels the pending device actions
+     */
+    if (c->client_gone)
+        goto client_dead;
+    if (c->client_quit && list_is_empty(c->cmds))
+        goto client_dead;
+    _client_update_poll(c);
+    return;
 
 client_dead:
-        list_delete(itr);
-    }
-    list_iterator_destroy(itr);
+    list_delete_all(cli_clients, (ListFindF) _match_client_ptr, c);
+}
+
+/*
+ * Handle new connection on a listen socket.
+ */
+static void _listen_ready(int fd, short flags, void *arg)
+{
+    if ((flags & XPOLLIN))
+        _create_client_socket(fd);
 }
 
 /* hook so daemonization function can avoid closing our fd */
@@ -1199,6 +1598,7 @@ bool cli_server_done(void)
 
 void cli_start(bool use_stdio)
 {
+    dev_watch_states(_state_changed);
     if (use_stdio) {
         _create_client_stdio();
         one_client = true;
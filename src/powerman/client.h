@@ -11,16 +11,13 @@
 #ifndef PM_CLIENT_H
 #define PM_CLIENT_H
 
-void cli_init(void);
+void cli_init(xpollfd_t pfd);
 void cli_fini(void);
 
 void cli_start(bool use_stdio);
 void cli_listen_fds(int **fds, int *len);
 bool cli_server_done(void);
 
-void cli_post_poll(xpollfd_t pfd);
-void cli_pre_poll(xpollfd_t pfd);
-
 #endif /* PM_CLIENT_H */
 
 /*
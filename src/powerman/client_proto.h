@@ -19,6 +19,16 @@
  * 4. client sends command
  * 5. server sends response (see note under Responses below)
  * If not quit, goto 3
+ *
+ * After the "tagged" command, the client prefixes each request with a tag
+ * (a word of its choosing) and the server prefixes each line of the response
+ * with the tag of the request.  No prompt is sent, the client may send
+ * more requests without waiting for responses, and responses to different
+ * requests may complete out of order (their lines may be interleaved).
+ *
+ * After the "watch" command, the server sends a line whenever the plug
+ * state of a watched node changes, between or within responses (tagged
+ * with the tag of the watch command in tagged mode).
  */
 
 #define CP_LINEMAX  131072              /* max request/response line length */
@@ -38,6 +48,8 @@
 #define CP_NODES      "nodes"
 #define CP_DEVICE     "device %s"
 #define CP_DEVICE_ALL "device"
+#define CP_LATENCY    "latency %s"
+#define CP_LATENCY_ALL "latency"
 #define CP_STATUS     "status %s"
 #define CP_STATUS_ALL "status"
 #define CP_TEMP       "temp %s"
@@ -48,6 +60,11 @@
 #define CP_BEACON_OFF "unflash %s"
 #define CP_TELEMETRY  "telemetry"
 #define CP_EXPRANGE   "exprange"
+#define CP_TAGGED     "tagged"
+#define CP_STREAM     "stream"
+#define CP_WATCH      "watch %s"
+#define CP_WATCH_ALL  "watch"
+#define CP_UNWATCH    "unwatch"
 
 /*
  * Responses -
@@ -67,6 +84,10 @@
 #define CP_RSP_QRY_COMPLETE "103 Query complete"                    CP_EOL
 #define CP_RSP_TELEMETRY    "104 Telemetry %s"                      CP_EOL
 #define CP_RSP_EXPRANGE     "105 Hostrange expansion %s"            CP_EOL
+#define CP_RSP_TAGGED       "106 Tagged mode %s"                    CP_EOL
+#define CP_RSP_STREAM       "107 Result streaming %s"               CP_EOL
+#define CP_RSP_WATCH        "108 Watching %s"                       CP_EOL
+#define CP_RSP_UNWATCH      "109 Watch cancelled"                   CP_EOL
 
 /* failure 2xx */
 #define CP_ERR_UNKNOWN      "201 Unknown command"                   CP_EOL
@@ -84,6 +105,7 @@
 #define CP_INFO_HELP  \
  "301 nodes              - query node list"                         CP_EOL \
  "301 device [<nodes>]   - query power control device status"       CP_EOL \
+ "301 latency [<nodes>]  - query device action latency"             CP_EOL \
  "301 status [<nodes>]   - query power status"                      CP_EOL \
  "301 on <nodes>         - power on"                                CP_EOL \
  "301 off <nodes>        - power off"                               CP_EOL \
@@ -95,12 +117,19 @@
  "301 unflash <nodes>    - set beacon to OFF (if available)"        CP_EOL \
  "301 telemetry          - toggle telemetry display"                CP_EOL \
  "301 exprange           - toggle host range expansion"             CP_EOL \
+ "301 tagged             - toggle tagged (concurrent) command mode" CP_EOL \
+ "301 stream             - toggle streaming of query results"       CP_EOL \
+ "301 watch [<nodes>]    - report power status changes"             CP_EOL \
+ "301 unwatch            - stop reporting power status changes"     CP_EOL \
  "301 help               - display help"                            CP_EOL \
  "301 quit               - logout"                                  CP_EOL
 #define CP_INFO_STATUS \
  "302 on:      %s"                                                  CP_EOL \
  "302 off:     %s"                                                  CP_EOL \
  "302 unknown: %s"                                                  CP_EOL
+/* In streaming mode, queries return a 303 line per node as soon as its
+ * device answers, instead of one response when all devices have answered.
+ */
 #define CP_INFO_XSTATUS     "303 %s: %s"                            CP_EOL
 #define CP_INFO_DEVICE  \
  "304 %s: state=%s reconnects=%-3.3d actions=%-3.3d type=%s hosts=%s" CP_EOL
@@ -109,6 +138,9 @@
 #define CP_INFO_XNODES      "307 %s"                                CP_EOL
 #define CP_INFO_ACTERROR    "308 %s"                                CP_EOL
 #define CP_INFO_DIAG        "309 %s"                                CP_EOL
+#define CP_INFO_LATENCY \
+ "310 %s: class=%s actions=%d wait_avg=%.3f wait_max=%.3f latency_avg=%.3f latency_max=%.3f" CP_EOL
+#define CP_INFO_EVENT       "311 %s: %s"                            CP_EOL
 
 #endif  /* PM_CLIENT_PROTO_H */
 
@@ -50,10 +50,10 @@ static char *_channel_name(unsigned long channel)
     return (tab[i].chan == 0 ? "<unknown>" : tab[i].desc);
 }
 
-static char *_time(void)
+static char *_time(char *buf)
 {
     time_t now = time(NULL);
-    char *str = ctime(&now);
+    char *str = ctime_r(&now, buf);
 
     str[strlen(str) - 1] = '\0'; /* lose trailing \n */
 
@@ -70,13 +70,14 @@ void dbg_wrapped(unsigned long channel, const char *fmt, ...)
 
     if ((channel & dbg_channel_mask) == channel) {
         char buf[DBG_BUFLEN];
+        char tbuf[26];          /* size required by ctime_r(3) */
 
         va_start(ap, fmt);
         vsnprintf(buf, DBG_BUFLEN, fmt, ap); /* overflow ignored on purpose */
         va_end(ap);
 
         fprintf(stderr, "%s %s: %s\n",
-                _time(), _channel_name(channel), buf);
+                _time(tbuf), _channel_name(channel), buf);
     }
 }
 
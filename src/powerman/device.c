@@ -25,11 +25,28 @@
  * this module is all done operating on its behalf and can respond to the
  * user.
  *
- * select - the select/poll loop calls the dev_pre_poll() and dev_post_poll()
- * functions, the former to make a list of file descriptors which when ready
- * should unblock select/poll; the latter to move data between device cbufs
- * and the device file descriptors, to manage timeouts, and to move
- * device scripts along when new state develops (e.g. data in cbufs).
+ * select - device fds are registered with the poll set when a connection
+ * is initiated and unregistered when it is torn down; interest in writing
+ * is updated as the outgoing cbuf fills and drains.  When an fd is ready,
+ * the poll loop calls back into this module to move data between device
+ * cbufs and the device file descriptors.  dev_post_poll() then manages
+ * timeouts and moves device scripts along when new state develops
+ * (e.g. data in cbufs).
+ *
+ * scheduling - dev_post_poll() only visits "runnable" devices: those whose
+ * fd was ready, that had actions enqueued, or that had a timer expire.
+ * Each device has monotonic clock timers for the action timeout, scripted
+ * delays, the ping period, and reconnect backoff; the poll timeout is the
+ * time until the earliest one expires.
+ *
+ * threads - devices are partitioned into shards, each with its own poll
+ * set, timer queue, and runnable list.  By default there is one shard and
+ * it is run from the main poll loop.  With powermand --threads=N, each of
+ * N shards is run by a worker thread and owns its devices outright: the
+ * main thread never touches device connection or script state.  Actions
+ * from clients are passed to a shard through its inbox, and completion,
+ * telemetry, and diagnostic callbacks to the client module are passed back
+ * to the main thread as notices.  Each side wakes the other with a pipe.
  *
  * FIXME: the Device type is not externally opaque as it ought to be:
  * - parser creates Device with dev_create() but then initializes lots
@@ -50,6 +67,10 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "list.h"
 #include "hostlist.h"
@@ -58,6 +79,7 @@
 #include "xpoll.h"
 #include "xmalloc.h"
 #include "xregex.h"
+#include "xtimer.h"
 #include "pluglist.h"
 #include "device.h"
 #include "arglist.h"
@@ -67,80 +89,191 @@
 #include "client_proto.h"
 #include "hprintf.h"
 #include "xtime.h"
-
-/* ExecCtx's are the state for the execution of a block of statements.
- * They are stacked on the Action (new ExecCtx pushed when executing an
- * inner block).
- */
-typedef struct {
-    List plugs;                 /* name(s) used for send "%s" (NULL=all) */
-    List block;                 /* List of stmts */
-    ListIterator stmtitr;       /* next stmt in block */
-    Stmt *cur;                  /* current stmt */
-    PlugListIterator plugitr;   /* used by foreach */
-    PlugList pluglist;          /* pluglist if foreach is ranged */
-    bool processing;            /* flag used by stmts, ifon/ifoff */
-} ExecCtx;
+#include "fdutil.h"
 
 /* Actions are queued on a device and executed one at a time.  Each action
  * represents a request to run a particular script on a device, for a set of
  * plugs.  Actions can be enqueued by the client or internally (e.g. login).
+ * The queue is ordered by priority class: power control, then client
+ * queries, then internal actions.  Login always goes first.
+ * The position in the script and the state of foreach blocks being executed
+ * are kept here, so stepping through the script does not allocate.
  */
-#define MAX_LEVELS 2
+typedef struct {
+    Plug *plug;                 /* plug for current pass through the block */
+    int next;                   /* position of next plug to consider */
+} LoopState;
+
 typedef struct {
     int com;                    /* one of the PM_* above */
-    List exec;                  /* stack of ExecCtxs (outer block is first) */
+    ActPrio prio;               /* priority class */
+    Script *script;             /* script being executed */
+    int pc;                     /* index of current stmt in script */
+    bool processing;            /* current stmt has started (send, delay) */
+    LoopState *loops;           /* one per level of foreach nesting */
+    Plug **plugs;               /* name(s) used for send "%s" */
+    int nplugs;                 /*   (nplugs == 0 means all) */
     ActionCB complete_fun;      /* callback for action completion */
     VerbosePrintf vpf_fun;      /* callback for device telemetry */
     DiagPrintf dpf_fun;         /* callback for device diagnostics */
+    ResultCB result_fun;        /* callback for each node's result (query) */
     int client_id;              /* client id so completion can find client */
     ActError errnum;            /* errno for action */
+    struct timeval queued;      /* time stamp for latency */
     struct timeval time_stamp;  /* time stamp for timeouts */
     struct timeval delay_start; /* time stamp for delay completion */
     ArgList arglist;            /* argument for query actions (list of Arg's) */
+    List waiters;               /* Actions sharing this query's result */
+    List reports;               /* Reports of query, passed on to waiters */
 } Action;
 
+/* A value reported by setplugstate during a query action.  Waiters may
+ * ask for nodes the action's own ArgList lacks, or attach after the value
+ * was reported, so reports are kept until the action completes.
+ */
+typedef struct {
+    int nodeid;
+    InterpState state;
+    char *val;
+} Report;
+
+/* The last value reported for a node by a query script, kept for the
+ * status_cache_ttl configured in powerman.conf.  There is one per kind of
+ * query.  Entries are written by the threads running devices, so they are
+ * protected by dev_cache_lock.
+ */
+#define CACHE_STATUS    0
+#define CACHE_TEMP      1
+#define CACHE_BEACON    2
+#define NUM_CACHES      3
+typedef struct {
+    struct timeval time;        /* time of report (cleared if invalid) */
+    InterpState state;
+    char *val;
+} CacheEntry;
 
-static bool _process_stmt(Device *dev, Action *act, ExecCtx *e,
-        struct timeval *timeout);
-static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e);
-static bool _process_foreach(Device *dev, Action *act, ExecCtx *e);
-static bool _process_setplugstate(Device * dev, Action *act, ExecCtx *e);
-static bool _process_setresult(Device * dev, Action *act, ExecCtx *e);
-static bool _process_expect(Device * dev, Action *act, ExecCtx *e);
-static bool _process_send(Device * dev, Action *act, ExecCtx *e);
-static bool _process_delay(Device * dev, Action *act, ExecCtx *e,
-        struct timeval *timeout);
+/* A NodeRef locates the plug that controls a node.  The config file
+ * parser rejects duplicate node names, so there is one per node ID.
+ */
+typedef struct {
+    Device *dev;
+    Plug *plug;
+    unsigned long stamp;        /* last command that targeted the node */
+    CacheEntry cache[NUM_CACHES];
+    InterpState state;          /* last plug state seen (see _note_state) */
+} NodeRef;
+
+/* A Shard runs a subset of devices.  Members other than those protected
+ * by 'lock' belong to the thread running the shard.
+ */
+typedef struct dev_shard {
+    xpollfd_t pfd;              /* poll set for device fds */
+    xtimerq_t timers;           /* device timers */
+    List runnable;              /* devices needing a visit */
+    List devices;               /* devices in this shard (not owned) */
+    bool threaded;              /* shard is run by a worker thread */
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects 'inbox', 'cancels' and 'done' */
+    List inbox;                 /* Submissions from the main thread */
+    List cancels;               /* IDs of departed clients (int *) */
+    bool done;                  /* worker thread should exit */
+    int wakefds[2];             /* pipe to wake the worker's poll loop */
+} Shard;
+
+/* Actions enqueued by the main thread for a device in a worker shard.
+ */
+typedef struct {
+    Device *dev;
+    List acts;                  /* list of Actions */
+} Submission;
+
+/* Client callback made on behalf of an action.  Worker shards queue these
+ * for delivery by the main thread.
+ */
+typedef enum { NOTICE_COMPLETE, NOTICE_TELEMETRY, NOTICE_DIAG,
+               NOTICE_RESULT, NOTICE_STATE } NoticeType;
+typedef struct {
+    NoticeType type;
+    ActionCB complete_fun;
+    VerbosePrintf vpf_fun;
+    DiagPrintf dpf_fun;
+    ResultCB result_fun;
+    int client_id;
+    ActError errnum;
+    int nodeid;                 /* NOTICE_RESULT/STATE node */
+    InterpState state;          /* NOTICE_RESULT/STATE interpreted value */
+    char *msg;                  /* formatted message or value (may be NULL) */
+} Notice;
+
+
+static bool _process_stmt(Device *dev, Action *act, int *next);
+static bool _process_ifonoff(Device *dev, Action *act, Stmt *s, int *next);
+static bool _process_foreach(Device *dev, Action *act, Stmt *s, int *next);
+static bool _process_loop(Device *dev, Action *act, Stmt *s, int *next);
+static bool _process_setplugstate(Device * dev, Action *act, Stmt *s);
+static bool _process_setresult(Device * dev, Action *act, Stmt *s);
+static bool _process_expect(Device * dev, Action *act, Stmt *s);
+static bool _process_send(Device * dev, Action *act, Stmt *s);
+static bool _process_delay(Device * dev, Action *act, Stmt *s);
 static int _match_name(Device * dev, void *key);
 static bool _handle_read(Device * dev);
 static bool _handle_write(Device * dev);
-static void _process_action(Device * dev, struct timeval *timeout);
+static void _process_action(Device * dev);
 static bool _timeout(struct timeval *timestamp, struct timeval *timeout,
                      struct timeval *timeleft);
 static int _get_all_script(Device * dev, int com);
 static int _get_ranged_script(Device * dev, int com);
-static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
-                            ActionCB complete_fun, VerbosePrintf vpf_fun,
-                            DiagPrintf dpf_fun, int client_id, ArgList arglist);
+static int _enqueue_actions(Device * dev, int com);
 static Action *_create_action(Device * dev, int com, List plugs,
                               ActionCB complete_fun, VerbosePrintf vpf_fun,
                               DiagPrintf dpf_fun, int client_id, ArgList arglist);
-static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
+static int _enqueue_targeted_actions(Device * dev, int com,
                                      ActionCB complete_fun,
                                      VerbosePrintf vpf_fun,
                                      DiagPrintf dpf_fun,
-                                     int client_id, ArgList arglist);
-static char *_getregex_buf(cbuf_t b, xregex_t re, xregex_match_t xm);
-static bool _command_needs_device(Device * dev, hostlist_t hl);
-static void _enqueue_ping(Device * dev, struct timeval *timeout);
+                                     int client_id, ArgList arglist,
+                                     List acts);
+static bool _getregex_buf(Device *dev, xregex_t re, xregex_match_t xm);
+static List _target_devices(ArgList arglist, int kind, bool *cached,
+                            ResultCB result_fun, int client_id);
+static bool _is_query_action(int com);
+static void _destroy_report(Report *r);
+static void _finish_action(Device *dev, Action *act);
+static void _act_completion(Action *act, Device *dev);
+static void _enqueue_ping(Device * dev);
+static void _enqueue_refresh(Device *dev);
 static void _enqueue_login(Device *dev);
 static void _disconnect(Device * dev);
 static bool _connect(Device * dev);
-static bool _reconnect(Device * dev, struct timeval *timeout);
-static bool _time_to_reconnect(Device * dev, struct timeval *timeout);
+static bool _reconnect(Device * dev);
+static bool _time_to_reconnect(Device * dev);
+static void _update_poll(Device * dev);
+static void _unregister_poll(Device * dev);
+static void _set_runnable(Device * dev);
+static void _timer_expired(void *arg);
+static void _act_telemetry(Device *dev, Action *act, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+static void _act_diag(Device *dev, Action *act, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
 
 static List dev_devices = NULL;
+static int dev_ndevices = 0;
+static NodeRef *dev_nodes = NULL;       /* node ID -> NodeRef */
+static int dev_nnodes = 0;
+static unsigned long dev_stamp = 0;     /* current command (see NodeRef) */
 static bool short_circuit_delay = false;
+static xpollfd_t dev_pfd = NULL;        /* main thread poll set */
+static int dev_nthreads = 0;            /* worker threads (0 = none) */
+static Shard **dev_shards = NULL;
+static int dev_nshards = 0;
+
+static pthread_mutex_t dev_notice_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dev_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dev_stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timeval dev_cache_ttl;    /* status cache TTL (0 = disabled) */
+static List dev_notices = NULL;         /* Notices for the main thread */
+static int dev_notice_fds[2] = { NO_FD, NO_FD };
+static StateCB dev_state_fun = NULL;    /* plug state change callback */
 
 static void _dbg_actions(Device * dev)
 {
@@ -171,90 +304,90 @@ static void _memtrans(char *m, int len, char from, char to)
 }
 
 /*
- * Apply regular expression to the contents of a cbuf_t.
- * If there is a match, return (and consume) from the beginning
- * of the buffer to the last character of the match.
+ * Move new input from dev->from to the end of dev->scan, which holds
+ * input that has been examined by expect but not yet consumed.  Each byte
+ * is copied once, instead of the whole buffer being peeked every time
+ * input arrives.  Like dev->from, dev->scan is limited to MAX_DEV_BUF
+ * bytes; the oldest input is dropped if it would overflow.
  * NOTE: embedded \0 chars are converted to \377 because libc regex
  * functions would treat these as string terminators.  As a result,
  * \0 chars cannot be matched explicitly.
- *  b (IN)   buffer to apply regex to
- *  re (IN)  regular expression
- *  xm (OUT) subexpression matches
- *  RETURN  String match (caller must free) or NULL if no match
+ * Return the number of bytes moved.
  */
-static char *_getregex_buf(cbuf_t b, xregex_t re, xregex_match_t xm)
+static int _scan_input(Device *dev)
 {
-    int bytes_peeked, dropped, matchlen;
-    char *str;
-    int maxpeeksize = cbuf_used(b);
-
-    str = xmalloc(maxpeeksize + 1);
-    bytes_peeked = cbuf_peek(b, str, maxpeeksize);
-    if (bytes_peeked <= 0) {            /* FIXME: any -1 handling needed? */
-        if (bytes_peeked < 0)
-            err(true, "_getregex_buf: cbuf_peek returned %d", bytes_peeked);
-        xfree(str);
-        return NULL;
+    int n = cbuf_used(dev->from);
+    int lost;
+
+    if (n <= 0)
+        return 0;
+    if ((lost = dev->scanlen + n - MAX_DEV_BUF) > 0) {
+        assert(lost <= dev->scanlen);
+        memmove(dev->scan, dev->scan + lost, dev->scanlen - lost);
+        dev->scanlen -= lost;
+        err(false, "%s lost %d chars due to buffer wrap", dev->name, lost);
     }
-    assert(bytes_peeked <= maxpeeksize);
-    _memtrans(str, bytes_peeked, '\0', '\377');
-    str[bytes_peeked] = '\0';
-    if (!xregex_exec(re, str, xm)) {
-        xfree(str);
-        return NULL;
+    if (dev->scanlen + n + 1 > dev->scansize) {
+        int size = dev->scansize > 0 ? dev->scansize : MIN_DEV_BUF;
+
+        while (size < dev->scanlen + n + 1)
+            size *= 2;
+        if (size > MAX_DEV_BUF + 1)
+            size = MAX_DEV_BUF + 1;
+        dev->scan = xrealloc(dev->scan, size);
+        dev->scansize = size;
     }
-    matchlen = xregex_match_strlen(xm);
-    dropped = cbuf_drop(b, matchlen);
-    if (dropped != matchlen)
-        err((dropped < 0), "_getregex_buf: cbuf_drop returned %d", dropped);
-
-    return str;
+    n = cbuf_read(dev->from, dev->scan + dev->scanlen, n);
+    if (n <= 0) {
+        if (n < 0)
+            err(true, "_scan_input: cbuf_read returned %d", n);
+        return 0;
+    }
+    _memtrans(dev->scan + dev->scanlen, n, '\0', '\377');
+    dev->scanlen += n;
+    dev->scan[dev->scanlen] = '\0';
+    return n;
 }
 
-static ExecCtx *_create_exec_ctx(Device *dev, List block, List plugs)
+/*
+ * Apply regular expression to device input.
+ * If there is a match, consume from the beginning of the input
+ * to the last character of the match.  The regex is not re-run if it
+ * already failed to match and no input has arrived since.
+ *  dev (IN) device whose input is matched
+ *  re (IN)  regular expression
+ *  xm (OUT) subexpression matches
+ *  RETURN  true on match
+ */
+static bool _getregex_buf(Device *dev, xregex_t re, xregex_match_t xm)
 {
-    ExecCtx *new = (ExecCtx *)xmalloc(sizeof(ExecCtx));
-
-    new->stmtitr = list_iterator_create(block);
-    new->cur = list_next(new->stmtitr);
-    new->block = block;
-    new->plugs = plugs;
-    new->plugitr = NULL;
-    new->processing = false;
-
-    return new;
-}
+    int matchlen;
+
+    if (_scan_input(dev) > 0)
+        dev->scanfail = NULL;
+    if (dev->scanlen == 0 || dev->scanfail == re)
+        return false;
+    if (!xregex_exec(re, dev->scan, xm)) {
+        dev->scanfail = re;
+        return false;
+    }
+    matchlen = xregex_match_strlen(xm);
+    assert(matchlen <= dev->scanlen);
+    memmove(dev->scan, dev->scan + matchlen, dev->scanlen - matchlen + 1);
+    dev->scanlen -= matchlen;
 
-static void _destroy_exec_ctx(ExecCtx *e)
-{
-    if (e->stmtitr != NULL)
-        list_iterator_destroy(e->stmtitr);
-    e->stmtitr = NULL;
-    e->cur = NULL;
-    if (e->plugs)
-        list_destroy(e->plugs);
-    if (e->pluglist)
-        pluglist_destroy(e->pluglist);
-    e->plugs = NULL;
-    xfree(e);
+    return true;
 }
 
 static void _rewind_action(Action *act)
 {
-    ExecCtx *e;
+    act->pc = 0;
+    act->processing = false;
+    if (act->reports) {
+        Report *r;
 
-    /* get back to the context for the outer block */
-    while ((e = list_pop(act->exec))) {
-        if (list_is_empty(act->exec)) {
-            list_push(act->exec, e);
-            break;
-        }
-        _destroy_exec_ctx(e);
-    }
-    /* reset outer block iterator and current pointer */
-    if (e) {
-        list_iterator_reset(e->stmtitr);
-        e->cur = list_next(e->stmtitr);
+        while ((r = list_pop(act->reports)))
+            _destroy_report(r);
     }
 }
 
@@ -263,7 +396,6 @@ static Action *_create_action(Device * dev, int com, List plugs,
                               DiagPrintf dpf_fun, int client_id, ArgList arglist)
 {
     Action *act;
-    ExecCtx *e;
 
     dbg(DBG_ACTION, "_create_action: %d", com);
     act = (Action *) xmalloc(sizeof(Action));
@@ -271,14 +403,50 @@ static Action *_create_action(Device * dev, int com, List plugs,
     act->complete_fun = complete_fun;
     act->vpf_fun = vpf_fun;
     act->dpf_fun = dpf_fun;
+    act->result_fun = NULL;
     act->client_id = client_id;
 
-    act->exec = list_create((ListDelF)_destroy_exec_ctx);
-    e = _create_exec_ctx(dev, dev->scripts[act->com], plugs);
-    list_push(act->exec, e);
+    /* internal actions (login, ping, refresh) have no client to answer */
+    if (!complete_fun)
+        act->prio = PRIO_BACKGROUND;
+    else if (_is_query_action(com))
+        act->prio = PRIO_QUERY;
+    else
+        act->prio = PRIO_CONTROL;
+
+    act->script = dev->scripts->script[com];
+    assert(act->script != NULL);
+    _rewind_action(act);
+    if (act->script->depth > 0)
+        act->loops = (LoopState *)xmalloc(act->script->depth
+                                          * sizeof(LoopState));
+    else
+        act->loops = NULL;
+
+    /* take ownership of the plugs, keeping them in an array */
+    act->plugs = NULL;
+    act->nplugs = 0;
+    if (plugs) {
+        if (list_count(plugs) > 0) {
+            ListIterator itr = list_iterator_create(plugs);
+            Plug *plug;
+
+            act->plugs = (Plug **)xmalloc(list_count(plugs) * sizeof(Plug *));
+            while ((plug = list_next(itr)))
+                act->plugs[act->nplugs++] = plug;
+            list_iterator_destroy(itr);
+        }
+        list_destroy(plugs);
+    }
 
     act->errnum = ACT_ESUCCESS;
     act->arglist = arglist ? arglist_link(arglist) : NULL;
+    act->waiters = NULL;
+    if (_is_query_action(com))
+        act->reports = list_create((ListDelF) _destroy_report);
+    else
+        act->reports = NULL;
+    xtimer_gettime(&act->queued);
     timerclear(&act->time_stamp);
     return act;
 }
@@ -286,34 +454,890 @@ static Action *_create_action(Device * dev, int com, List plugs,
 static void _destroy_action(Action * act)
 {
     dbg(DBG_ACTION, "_destroy_action: %d", act->com);
-    if (act->exec)
-        list_destroy(act->exec);
-    act->exec = NULL;
+    if (act->loops)
+        xfree(act->loops);
+    if (act->plugs)
+        xfree(act->plugs);
     if (act->arglist)
         arglist_unlink(act->arglist);
     act->arglist = NULL;
+    if (act->waiters)
+        list_destroy(act->waiters);
+    if (act->reports)
+        list_destroy(act->reports);
     xfree(act);
 }
 
+static void _destroy_report(Report *r)
+{
+    xfree(r->val);
+    xfree(r);
+}
+
+/* Remember a value reported by a query action for its waiters.
+ */
+static void _add_report(Action *act, int nodeid, InterpState state, char *val)
+{
+    Report *r = (Report *) xmalloc(sizeof(Report));
+
+    r->nodeid = nodeid;
+    r->state = state;
+    r->val = xstrdup(val);
+    list_append(act->reports, r);
+}
+
+/* Copy the values reported by 'act' into the ArgList of a waiter.
+ */
+static void _apply_reports(Action *act, Action *w)
+{
+    ListIterator itr = list_iterator_create(act->reports);
+    Report *r;
+    Arg *arg;
+
+    while ((r = list_next(itr))) {
+        if ((arg = arglist_find(w->arglist, r->nodeid))) {
+            arg->state = r->state;
+            xfree(arg->val);
+            arg->val = xstrdup(r->val);
+        }
+    }
+    list_iterator_destroy(itr);
+}
+
+/* Return a queued or running query action whose result 'act' can share:
+ * one that runs the same script on the same plugs, enqueued by a client
+ * or by a background refresh.
+ * Queries ahead of a power control action may report the old state, so
+ * only those queued after the last such action are considered.  A refresh
+ * that has not started would make 'act' wait at background priority, so
+ * it is not shared.
+ */
+static Action *_find_shared_action(Device *dev, Action *act)
+{
+    ListIterator itr;
+    Action *a;
+    Action *shared = NULL;
+
+    if (!act->reports)
+        return NULL;
+    itr = list_iterator_create(dev->acts);
+    while ((a = list_next(itr))) {
+        if (a->prio == PRIO_CONTROL)
+            shared = NULL;
+        else if (!shared && a->reports && a->com == act->com
+                && (a->prio <= act->prio || timerisset(&a->time_stamp))
+                && a->nplugs == act->nplugs
+                && (act->nplugs == 0 || !memcmp(a->plugs, act->plugs,
+                                         act->nplugs * sizeof(Plug *))))
+            shared = a;
+    }
+    list_iterator_destroy(itr);
+    return shared;
+}
+
+/* Add an action to the device queue, ahead of actions of a lower priority
+ * class that have not started yet.  A running action is never preempted,
+ * and nothing is queued ahead of a login, which the other scripts rely on.
+ */
+static void _queue_action(Device *dev, Action *act)
+{
+    ListIterator itr = list_iterator_create(dev->acts);
+    Action *a;
+
+    while ((a = list_next(itr))) {
+        if (a->prio > act->prio && !timerisset(&a->time_stamp)
+                                && a->com != PM_LOG_IN)
+            break;
+    }
+    list_insert(itr, act);
+    list_iterator_destroy(itr);
+}
+
+static void _destroy_submission(Submission *sub)
+{
+    list_destroy(sub->acts);
+    xfree(sub);
+}
+
+static void _destroy_notice(Notice *n)
+{
+    if (n->msg)
+        xfree(n->msg);
+    xfree(n);
+}
+
+/* Write a byte to a wakeup pipe.  The pipe is nonblocking; if it is full,
+ * the reader has not run yet and will find our work anyway.
+ */
+static void _wake(int fd)
+{
+    char c = 0;
+
+    if (write(fd, &c, 1) < 0 && errno != EAGAIN && errno != EINTR)
+        err_exit(true, "write to wakeup pipe");
+}
+
+/* Empty a wakeup pipe.
+ */
+static void _drain(int fd)
+{
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static void _create_wakefds(int fds[2])
+{
+    if (pipe(fds) < 0)
+        err_exit(true, "pipe");
+    nonblock_set(fds[0]);
+    nonblock_set(fds[1]);
+}
+
+static void _close_wakefds(int fds[2])
+{
+    close(fds[0]);
+    close(fds[1]);
+    fds[0] = fds[1] = NO_FD;
+}
+
+static Shard *_shard_create(bool threaded)
+{
+    Shard *sh = (Shard *) xmalloc(sizeof(Shard));
+
+    sh->threaded = threaded;
+    sh->pfd = threaded ? xpollfd_create() : dev_pfd;
+    sh->timers = xtimerq_create();
+    sh->runnable = list_create(NULL);
+    sh->devices = list_create(NULL);
+    sh->inbox = list_create((ListDelF) _destroy_submission);
+    sh->cancels = list_create((ListDelF) xfree);
+    sh->done = false;
+    sh->wakefds[0] = sh->wakefds[1] = NO_FD;
+    if (threaded) {
+        pthread_mutex_init(&sh->lock, NULL);
+        _create_wakefds(sh->wakefds);
+    }
+    return sh;
+}
+
+/* Devices must already have been destroyed.
+ */
+static void _shard_destroy(Shard *sh)
+{
+    list_destroy(sh->runnable);
+    list_destroy(sh->devices);
+    list_destroy(sh->inbox);
+    list_destroy(sh->cancels);
+    xtimerq_destroy(sh->timers);
+    if (sh->threaded) {
+        xpollfd_del(sh->pfd, sh->wakefds[0]);
+        _close_wakefds(sh->wakefds);
+        xpollfd_destroy(sh->pfd);
+        pthread_mutex_destroy(&sh->lock);
+    }
+    xfree(sh);
+}
+
+/* Make device part of shard.  Device timers belong to the shard's queue.
+ */
+static void _shard_add(Shard *sh, Device *dev)
+{
+    dev->shard = sh;
+    dev->retry_timer = xtimer_create(sh->timers, _timer_expired, dev);
+    dev->ping_timer = xtimer_create(sh->timers, _timer_expired, dev);
+    dev->refresh_timer = xtimer_create(sh->timers, _timer_expired, dev);
+    dev->action_timer = xtimer_create(sh->timers, _timer_expired, dev);
+    dev->delay_timer = xtimer_create(sh->timers, _timer_expired, dev);
+    list_append(sh->devices, dev);
+}
+
 /* initialize this module */
-void dev_init(bool Sopt)
+void dev_init(xpollfd_t pfd, bool Sopt, int nthreads)
 {
     dev_devices = list_create((ListDelF) dev_destroy);
     short_circuit_delay = Sopt;
+    dev_pfd = pfd;
+    dev_nthreads = nthreads;
 }
 
 /* tear down this module */
 void dev_fini(void)
 {
+    int i;
+
+    /* worker threads must exit before their devices are destroyed */
+    for (i = 0; i < dev_nshards; i++) {
+        Shard *sh = dev_shards[i];
+
+        if (sh->threaded) {
+            pthread_mutex_lock(&sh->lock);
+            sh->done = true;
+            pthread_mutex_unlock(&sh->lock);
+            _wake(sh->wakefds[1]);
+            pthread_join(sh->thread, NULL);
+        }
+    }
+    if (dev_nodes) {
+        int j;
+
+        for (i = 0; i < dev_nnodes; i++)
+            for (j = 0; j < NUM_CACHES; j++)
+                if (dev_nodes[i].cache[j].val)
+                    xfree(dev_nodes[i].cache[j].val);
+        xfree(dev_nodes);
+    }
+    dev_nodes = NULL;
     list_destroy(dev_devices);
+    for (i = 0; i < dev_nshards; i++)
+        _shard_destroy(dev_shards[i]);
+    if (dev_shards)
+        xfree(dev_shards);
+    dev_shards = NULL;
+    dev_nshards = 0;
+    if (dev_notices) {
+        xpollfd_del(dev_pfd, dev_notice_fds[0]);
+        _close_wakefds(dev_notice_fds);
+        list_destroy(dev_notices);
+        dev_notices = NULL;
+    }
+}
+
+/*
+ * Schedule device for a visit on the next dev_post_poll().
+ */
+static void _set_runnable(Device *dev)
+{
+    if (!dev->runnable) {
+        dev->runnable = true;
+        list_append(dev->shard->runnable, dev);
+    }
+}
+
+/* Add actions to the device queue.  Called in the thread running the
+ * device's shard.  A query that duplicates one already in the queue
+ * waits for that action instead of running the script again.
+ */
+static int _accept_actions(Device *dev, List acts)
+{
+    Action *act;
+    int count = 0;
+
+    while ((act = list_dequeue(acts))) {
+        Action *shared = _find_shared_action(dev, act);
+
+        if (shared) {
+            dbg(DBG_ACTION, "%s: action %d shares result of queued action",
+                dev->name, act->com);
+            if (!shared->waiters)
+                shared->waiters = list_create((ListDelF) _destroy_action);
+            list_append(shared->waiters, act);
+        } else
+            _queue_action(dev, act);
+        count++;
+    }
+    if (count > 0) {
+        if (dev->connect_state != DEV_CONNECTED)
+            dev->retry_count = 0;   /* expedite retries on this device since */
+        _set_runnable(dev);         /*   the user is beating on us... */
+    }
+    return count;
+}
+
+/* Hand actions created by the main thread to the device's shard.
+ * Takes ownership of 'acts'.
+ */
+static void _submit_actions(Device *dev, List acts)
+{
+    Shard *sh = dev->shard;
+    Submission *sub;
+
+    if (!sh->threaded) {
+        _accept_actions(dev, acts);
+        list_destroy(acts);
+        return;
+    }
+    sub = (Submission *) xmalloc(sizeof(Submission));
+    sub->dev = dev;
+    sub->acts = acts;
+    pthread_mutex_lock(&sh->lock);
+    list_append(sh->inbox, sub);
+    pthread_mutex_unlock(&sh->lock);
+    _wake(sh->wakefds[1]);
+}
+
+static int _match_client_id(Action *act, int *client_id)
+{
+    return act->client_id == *client_id;
+}
+
+/* Remove the actions of a departed client from the device queue.  Queries
+ * that have not started are dropped.  Other actions run to completion,
+ * since a device script must not be abandoned part way, and a power
+ * control action has been requested even if nobody hears the result.
+ * Queries shared with other clients keep running for them.
+ */
+static void _cancel_actions(Device *dev, int client_id)
+{
+    ListIterator itr = list_iterator_create(dev->acts);
+    Action *act;
+    int count = 0;
+
+    while ((act = list_next(itr))) {
+        if (act->waiters)
+            count += list_delete_all(act->waiters,
+                                     (ListFindF) _match_client_id, &client_id);
+        if (act->client_id != client_id || act->prio != PRIO_QUERY)
+            continue;
+        if (timerisset(&act->time_stamp)
+                || (act->waiters && !list_is_empty(act->waiters))) {
+            act->complete_fun = NULL;
+            act->vpf_fun = NULL;
+            act->dpf_fun = NULL;
+            act->result_fun = NULL;
+        } else {
+            list_remove(itr);
+            _destroy_action(act);
+            count++;
+        }
+    }
+    list_iterator_destroy(itr);
+    if (count > 0)
+        dbg(DBG_ACTION, "%s: cancelled %d actions of client %d",
+            dev->name, count, client_id);
+}
+
+/* Cancel the actions of a departed client on the devices of a shard.
+ * Called in the thread running the shard.
+ */
+static void _shard_cancel(Shard *sh, int client_id)
+{
+    ListIterator itr = list_iterator_create(sh->devices);
+    Device *dev;
+
+    while ((dev = list_next(itr)))
+        _cancel_actions(dev, client_id);
+    list_iterator_destroy(itr);
+}
+
+/* Poll callback (worker thread): pick up submissions, cancellations
+ * and exit request.  Cancellations are handled after submissions, which
+ * the main thread made earlier.
+ */
+static void _inbox_ready(int fd, short flags, void *arg)
+{
+    Shard *sh = arg;
+    Submission *sub;
+    List subs = list_create((ListDelF) _destroy_submission);
+    List cancels = list_create((ListDelF) xfree);
+    int *client_id;
+
+    _drain(fd);
+    pthread_mutex_lock(&sh->lock);
+    while ((sub = list_dequeue(sh->inbox)))
+        list_append(subs, sub);
+    while ((client_id = list_dequeue(sh->cancels)))
+        list_append(cancels, client_id);
+    pthread_mutex_unlock(&sh->lock);
+
+    while ((sub = list_dequeue(subs))) {
+        _accept_actions(sub->dev, sub->acts);
+        _destroy_submission(sub);
+    }
+    list_destroy(subs);
+    while ((client_id = list_dequeue(cancels))) {
+        _shard_cancel(sh, *client_id);
+        xfree(client_id);
+    }
+    list_destroy(cancels);
+}
+
+/* Register a callback (main thread) for changes in the plug state of any
+ * node, as seen by scripts of any kind or set by power control.
+ * Call before devices are started.
+ */
+void dev_watch_states(StateCB state_fun)
+{
+    dev_state_fun = state_fun;
+}
+
+/* A client has gone away: cancel its pending device actions, or have the
+ * worker threads cancel them (called by client.c).
+ */
+void dev_cancel_actions(int client_id)
+{
+    int i;
+
+    for (i = 0; i < dev_nshards; i++) {
+        Shard *sh = dev_shards[i];
+        int *id;
+
+        if (!sh->threaded) {
+            _shard_cancel(sh, client_id);
+            continue;
+        }
+        id = (int *) xmalloc(sizeof(int));
+        *id = client_id;
+        pthread_mutex_lock(&sh->lock);
+        list_append(sh->cancels, id);
+        pthread_mutex_unlock(&sh->lock);
+        _wake(sh->wakefds[1]);
+    }
+}
+
+static bool _shard_done(Shard *sh)
+{
+    bool done;
+
+    pthread_mutex_lock(&sh->lock);
+    done = sh->done;
+    pthread_mutex_unlock(&sh->lock);
+    return done;
+}
+
+static void _deliver_notice(Notice *n)
+{
+    switch (n->type) {
+    case NOTICE_COMPLETE:
+        if (n->msg)
+            n->complete_fun(n->client_id, n->errnum, "%s", n->msg);
+        else
+            n->complete_fun(n->client_id, n->errnum, NULL);
+        break;
+    case NOTICE_TELEMETRY:
+        n->vpf_fun(n->client_id, "%s", n->msg);
+        break;
+    case NOTICE_DIAG:
+        n->dpf_fun(n->client_id, "%s", n->msg);
+        break;
+    case NOTICE_RESULT:
+        n->result_fun(n->client_id, n->nodeid, n->state, n->msg);
+        break;
+    case NOTICE_STATE:
+        dev_state_fun(n->nodeid, n->state);
+        break;
+    }
+}
+
+static Notice *_create_notice(Action *act, NoticeType type, char *msg)
+{
+    Notice *n = (Notice *) xmalloc(sizeof(Notice));
+
+    n->type = type;
+    n->complete_fun = act->complete_fun;
+    n->vpf_fun = act->vpf_fun;
+    n->dpf_fun = act->dpf_fun;
+    n->result_fun = act->result_fun;
+    n->client_id = act->client_id;
+    n->errnum = act->errnum;
+    n->nodeid = -1;
+    n->state = ST_UNKNOWN;
+    n->msg = msg;
+    return n;
+}
+
+/* Make a client callback, or have the main thread make it if the device
+ * is run by a worker.
+ */
+static void _send_notice(Device *dev, Notice *n)
+{
+    if (!dev->shard->threaded) {
+        _deliver_notice(n);
+        _destroy_notice(n);
+        return;
+    }
+    pthread_mutex_lock(&dev_notice_lock);
+    list_append(dev_notices, n);
+    pthread_mutex_unlock(&dev_notice_lock);
+    _wake(dev_notice_fds[1]);
+}
+
+/* Make a client callback on behalf of an action.  Takes ownership of 'msg'.
+ */
+static void _post_notice(Device *dev, Action *act, NoticeType type, char *msg)
+{
+    _send_notice(dev, _create_notice(act, type, msg));
+}
+
+/* Pass the values reported by query 'act' for the nodes 'target' asked
+ * about to the client of 'target', if it wants them as they arrive.
+ * The values travel in the notices, since the ArgList they were stored
+ * in may be written again by a worker before the main thread gets them.
+ */
+static void _post_results(Device *dev, Action *act, Action *target)
+{
+    ListIterator itr;
+    Report *r;
+    Notice *n;
+
+    if (!target->result_fun || !act->reports || !target->arglist)
+        return;
+    itr = list_iterator_create(act->reports);
+    while ((r = list_next(itr))) {
+        if (!arglist_find(target->arglist, r->nodeid))
+            continue;
+        n = _create_notice(target, NOTICE_RESULT, xstrdup(r->val));
+        n->nodeid = r->nodeid;
+        n->state = r->state;
+        _send_notice(dev, n);
+    }
+    list_iterator_destroy(itr);
+}
+
+/* Record the plug state of a node seen by a script, and tell the
+ * dev_state_fun callback if it changed.  Nodes are only written by the
+ * thread running their device, so the last state needs no lock.
+ */
+static void _note_state(Device *dev, int nodeid, InterpState state)
+{
+    Notice *n;
+
+    if (nodeid == -1 || dev_nodes[nodeid].state == state)
+        return;
+    dev_nodes[nodeid].state = state;
+    if (!dev_state_fun)
+        return;
+    n = (Notice *) xmalloc(sizeof(Notice));
+    n->type = NOTICE_STATE;
+    n->client_id = 0;
+    n->nodeid = nodeid;
+    n->state = state;
+    n->msg = NULL;
+    _send_notice(dev, n);
+}
+
+/* Record the plug states set by a successful power control action.
+ */
+static void _note_action_states(Device *dev, Action *act)
+{
+    InterpState state;
+    Plug *plug;
+    int i;
+
+    switch (act->com) {
+        case PM_POWER_ON:
+        case PM_POWER_ON_RANGED:
+        case PM_POWER_ON_ALL:
+        case PM_POWER_CYCLE:
+        case PM_POWER_CYCLE_RANGED:
+        case PM_POWER_CYCLE_ALL:
+            state = ST_ON;
+            break;
+        case PM_POWER_OFF:
+        case PM_POWER_OFF_RANGED:
+        case PM_POWER_OFF_ALL:
+            state = ST_OFF;
+            break;
+        default:
+            return;
+    }
+    if (act->nplugs > 0) {
+        for (i = 0; i < act->nplugs; i++)
+            _note_state(dev, act->plugs[i]->nodeid, state);
+    } else {
+        for (i = 0; (plug = pluglist_nth(dev->plugs, i)); i++)
+            _note_state(dev, plug->nodeid, state);
+    }
+}
+
+/* Poll callback (main thread): deliver notices from worker shards.
+ */
+static void _notices_ready(int fd, short flags, void *arg)
+{
+    List notices = list_create((ListDelF) _destroy_notice);
+    Notice *n;
+
+    _drain(fd);
+    pthread_mutex_lock(&dev_notice_lock);
+    while ((n = list_dequeue(dev_notices)))
+        list_append(notices, n);
+    pthread_mutex_unlock(&dev_notice_lock);
+
+    while ((n = list_dequeue(notices))) {
+        _deliver_notice(n);
+        _destroy_notice(n);
+    }
+    list_destroy(notices);
+}
+
+/* Return true if the action or one of its waiters wants telemetry.
+ */
+static bool _act_wants_telemetry(Action *act)
+{
+    ListIterator itr;
+    Action *w;
+    bool wants = (act->vpf_fun != NULL);
+
+    if (!wants && act->waiters) {
+        itr = list_iterator_create(act->waiters);
+        while ((w = list_next(itr)) && !wants)
+            wants = (w->vpf_fun != NULL);
+        list_iterator_destroy(itr);
+    }
+    return wants;
+}
+
+static void _act_telemetry(Device *dev, Action *act, const char *fmt, ...)
+{
+    va_list ap;
+    char *msg;
+    ListIterator itr;
+    Action *w;
+
+    va_start(ap, fmt);
+    msg = hvsprintf(fmt, ap);
+    va_end(ap);
+    if (act->waiters) {
+        itr = list_iterator_create(act->waiters);
+        while ((w = list_next(itr))) {
+            if (w->vpf_fun)
+                _post_notice(dev, w, NOTICE_TELEMETRY, xstrdup(msg));
+        }
+        list_iterator_destroy(itr);
+    }
+    if (act->vpf_fun)
+        _post_notice(dev, act, NOTICE_TELEMETRY, msg);
+    else
+        xfree(msg);
+}
+
+static void _act_diag(Device *dev, Action *act, const char *fmt, ...)
+{
+    va_list ap;
+    char *msg;
+    ListIterator itr;
+    Action *w;
+
+    va_start(ap, fmt);
+    msg = hvsprintf(fmt, ap);
+    va_end(ap);
+    if (act->waiters) {
+        itr = list_iterator_create(act->waiters);
+        while ((w = list_next(itr))) {
+            if (w->dpf_fun)
+                _post_notice(dev, w, NOTICE_DIAG, xstrdup(msg));
+        }
+        list_iterator_destroy(itr);
+    }
+    if (act->dpf_fun)
+        _post_notice(dev, act, NOTICE_DIAG, msg);
+    else
+        xfree(msg);
+}
+
+/* Timer callback: a device timer expired. */
+static void _timer_expired(void *arg)
+{
+    _set_runnable((Device *)arg);
 }
 
 /* add a device to the device list (called from config file parser) */
 void dev_add(Device * dev)
 {
+    dev->index = dev_ndevices++;
     list_append(dev_devices, dev);
 }
 
+/* Return the status cache for the results of script 'com', or -1.
+ */
+static int _cache_kind(int com)
+{
+    switch (com) {
+        case PM_STATUS_PLUGS:
+        case PM_STATUS_PLUGS_ALL:
+            return CACHE_STATUS;
+        case PM_STATUS_TEMP:
+        case PM_STATUS_TEMP_ALL:
+            return CACHE_TEMP;
+        case PM_STATUS_BEACON:
+        case PM_STATUS_BEACON_ALL:
+            return CACHE_BEACON;
+        default:
+            return -1;
+    }
+    /*NOTREACHED*/
+}
+
+/* Fill in 'arg' from the status cache if its entry is fresh.
+ */
+static bool _cache_lookup(NodeRef *ref, int kind, Arg *arg,
+                          struct timeval *now)
+{
+    CacheEntry *entry = &ref->cache[kind];
+    struct timeval expire;
+    bool fresh = false;
+
+    pthread_mutex_lock(&dev_cache_lock);
+    if (timerisset(&entry->time)) {
+        timeradd(&entry->time, &dev_cache_ttl, &expire);
+        if (timercmp(now, &expire, <)) {
+            arg->state = entry->state;
+            if (arg->val)
+                xfree(arg->val);
+            arg->val = xstrdup(entry->val);
+            fresh = true;
+        }
+    }
+    pthread_mutex_unlock(&dev_cache_lock);
+    return fresh;
+}
+
+/* Record a value reported for a node by a query script.
+ */
+static void _cache_store(int com, int nodeid, InterpState state, char *val)
+{
+    int kind = _cache_kind(com);
+    CacheEntry *entry;
+
+    if (kind == -1 || nodeid == -1 || !timerisset(&dev_cache_ttl))
+        return;
+    entry = &dev_nodes[nodeid].cache[kind];
+    pthread_mutex_lock(&dev_cache_lock);
+    xtimer_gettime(&entry->time);
+    entry->state = state;
+    if (entry->val)
+        xfree(entry->val);
+    entry->val = xstrdup(val);
+    pthread_mutex_unlock(&dev_cache_lock);
+}
+
+/* Forget cached values for a node whose state may be changing.
+ */
+static void _cache_invalidate(int nodeid)
+{
+    int i;
+
+    if (nodeid == -1 || !timerisset(&dev_cache_ttl))
+        return;
+    pthread_mutex_lock(&dev_cache_lock);
+    for (i = 0; i < NUM_CACHES; i++)
+        timerclear(&dev_nodes[nodeid].cache[i].time);
+    pthread_mutex_unlock(&dev_cache_lock);
+}
+
+/* Forget cached values for the plugs targeted by an action.  This is done
+ * when a power control action ends, since query actions queued ahead of it
+ * may have run after the cache was invalidated at enqueue time.
+ */
+static void _cache_invalidate_action(Device *dev, Action *act)
+{
+    int i;
+
+    if (act->nplugs > 0) {
+        for (i = 0; i < act->nplugs; i++)
+            _cache_invalidate(act->plugs[i]->nodeid);
+    } else {
+        Plug *plug;
+
+        for (i = 0; (plug = pluglist_nth(dev->plugs, i)); i++)
+            _cache_invalidate(plug->nodeid);
+    }
+}
+
+/*
+ * Assign node IDs to plugs and build the index of nodes to plugs
+ * (called from config file parser once all devices and nodes are defined).
+ */
+void dev_index_nodes(void)
+{
+    ListIterator itr;
+    Device *dev;
+
+    dev_nnodes = conf_node_count();
+    dev_nodes = (NodeRef *) xmalloc(sizeof(NodeRef) * (dev_nnodes + 1));
+    conf_get_status_cache_ttl(&dev_cache_ttl);
+
+    itr = list_iterator_create(dev_devices);
+    while ((dev = list_next(itr))) {
+        PlugListIterator pitr = pluglist_iterator_create(dev->plugs);
+        Plug *plug;
+
+        while ((plug = pluglist_next(pitr))) {
+            NodeRef *ref;
+
+            if (plug->node == NULL)
+                continue;
+            if ((plug->nodeid = conf_node_id(plug->node)) == -1)
+                err_exit(false, "node %s is not defined", plug->node);
+            ref = &dev_nodes[plug->nodeid];
+            if (ref->dev != NULL)
+                err_exit(false, "node %s is mapped more than once", plug->node);
+            ref->dev = dev;
+            ref->plug = plug;
+            ref->stamp = 0;
+            ref->state = ST_UNKNOWN;
+        }
+        pluglist_iterator_destroy(pitr);
+    }
+    list_iterator_destroy(itr);
+}
+
+static int _cmp_index(Device *dev1, Device *dev2)
+{
+    return dev1->index - dev2->index;
+}
+
+/*
+ * Look up the nodes targeted by a command in the node index, marking them
+ * as targets of the current command (see _targeted()).  Return the devices
+ * that control them, in configuration order.  Unmapped nodes are ignored.
+ * If 'kind' is not -1, nodes with a fresh value in that status cache are
+ * answered from it instead of being targeted, and '*cached' is set.
+ * Such values are passed to 'result_fun' (if set) right away, before any
+ * action is submitted to a worker that could write the ArgList.
+ */
+static List _target_devices(ArgList arglist, int kind, bool *cached,
+                            ResultCB result_fun, int client_id)
+{
+    List devs = list_create(NULL);
+    bool *seen = (bool *) xmalloc(sizeof(bool) * (dev_ndevices + 1));
+    ArgListIterator itr;
+    Arg *arg;
+    struct timeval now;
+
+    assert(dev_nodes != NULL);
+
+    if (kind != -1)
+        xtimer_gettime(&now);
+
+    dev_stamp++;
+    itr = arglist_iterator_create(arglist);
+    while ((arg = arglist_next(itr))) {
+        NodeRef *ref = &dev_nodes[arg->nodeid];
+
+        if (kind != -1 && _cache_lookup(ref, kind, arg, &now)) {
+            *cached = true;
+            if (result_fun)
+                result_fun(client_id, arg->nodeid, arg->state, arg->val);
+            continue;
+        }
+        if (ref->dev) {
+            ref->stamp = dev_stamp;
+            if (!seen[ref->dev->index]) {
+                seen[ref->dev->index] = true;
+                list_append(devs, ref->dev);
+            }
+        }
+    }
+    arglist_iterator_destroy(itr);
+    xfree(seen);
+    list_sort(devs, (ListCmpF) _cmp_index);
+    return devs;
+}
+
+/* Return true if plug's node was targeted by _target_devices().
+ */
+static bool _targeted(Plug *plug)
+{
+    NodeRef *ref;
+
+    if (plug->nodeid == -1)
+        return false;
+    ref = &dev_nodes[plug->nodeid];
+    return ref->stamp == dev_stamp && ref->plug == plug;
+}
+
 /*
  * Client needs access to device list to process "devices" query.
  */
@@ -338,8 +1362,7 @@ static bool _timeout(struct timeval *time_stamp, struct timeval *timeout,
     /* limit = time_stamp + timeout */
     timeradd(time_stamp, timeout, &limit);
 
-    if (gettimeofday(&now, NULL) < 0)
-        err_exit(true, "gettimeofday");
+    xtimer_gettime(&now);
 
     if (timercmp(&now, &limit, >=))      /* if now >= limit */
         result = true;
@@ -352,21 +1375,12 @@ static bool _timeout(struct timeval *time_stamp, struct timeval *timeout,
     return result;
 }
 
-/*
- * If tv is less than timeout, or timeout is zero, set timeout = tv.
- */
-void _update_timeout(struct timeval *timeout, struct timeval *tv)
-{
-    if (timercmp(tv, timeout, <) || !timerisset(timeout))
-        *timeout = *tv;
-}
-
 /*
  * Helper for _reconnect().
- * Return true if OK to attempt reconnect.  If false, put the time left
- * in timeout if it is less than timeout or if timeout is zero.
+ * Return true if OK to attempt reconnect.  If false, arm the retry timer
+ * for the time left.
  */
-static bool _time_to_reconnect(Device * dev, struct timeval *timeout)
+static bool _time_to_reconnect(Device * dev)
 {
     static int rtab[] = { 1, 2, 4, 8, 15, 30, 60 };
     int max_rtab_index = sizeof(rtab) / sizeof(int) - 1;
@@ -379,10 +1393,10 @@ static bool _time_to_reconnect(Device * dev, struct timeval *timeout)
         timerclear(&retry);
         retry.tv_sec = rtab[rix > max_rtab_index ? max_rtab_index : rix];
 
-        if (!_timeout(&dev->last_retry, &retry, &timeleft))
+        if (!_timeout(&dev->last_retry, &retry, &timeleft)) {
             reconnect = false;
-        if (timeout && !reconnect)
-            _update_timeout(timeout, &timeleft);
+            xtimer_arm(dev->retry_timer, &timeleft);
+        }
     }
     return reconnect;
 }
@@ -393,8 +1407,7 @@ static bool _connect(Device * dev)
 
     assert(dev->connect != NULL);
 
-    if (gettimeofday(&dev->last_retry, NULL) < 0)
-        err_exit(true, "gettimeofday");
+    xtimer_gettime(&dev->last_retry);
     dev->retry_count++;
 
     connected = dev->connect(dev);
@@ -405,99 +1418,110 @@ static bool _connect(Device * dev)
     return connected;
 }
 
-static bool _reconnect(Device *dev, struct timeval *timeout)
+static bool _reconnect(Device *dev)
 {
     bool connected = false;
 
     if (dev->connect_state != DEV_NOT_CONNECTED)
         _disconnect(dev);
 
-    if (_time_to_reconnect(dev, timeout))
+    if (_time_to_reconnect(dev))
         connected = _connect(dev);
 
     return connected;
 }
 
 /* helper for dev_check_actions/dev_enqueue_actions */
-static bool _command_needs_device(Device * dev, hostlist_t hl)
-{
-    bool needed = false;
-    PlugListIterator itr;
-    Plug *plug;
-
-    itr = pluglist_iterator_create(dev->plugs);
-    while ((plug = pluglist_next(itr))) {
-        if (plug->node != NULL && hostlist_find(hl, plug->node) != -1) {
-            needed = true;
-            break;
-        }
-    }
-    pluglist_iterator_destroy(itr);
-    return needed;
-}
-
-/*
- * Return true if all devices targeted by hostlist implement the
- * specified action.
- */
-bool dev_check_actions(int com, hostlist_t hl)
+bool dev_check_actions(int com, ArgList arglist)
 {
     Device *dev;
-    ListIterator itr;
+    List devs;
     bool valid = true;
 
-    assert(hl != NULL);
+    assert(arglist != NULL);
 
-    itr = list_iterator_create(dev_devices);
-    while ((dev = list_next(itr))) {
-        if (_command_needs_device(dev, hl)) {
-            if (!dev->scripts[com] && _get_all_script(dev, com) == -1
-                                   && _get_ranged_script(dev, com) == -1)  {
-                valid = false;
-                break;
-            }
+    devs = _target_devices(arglist, -1, NULL, NULL, 0);
+    while ((dev = list_dequeue(devs))) {
+        if (!dev->scripts->script[com] && _get_all_script(dev, com) == -1
+                               && _get_ranged_script(dev, com) == -1)  {
+            valid = false;
+            break;
         }
     }
-    list_iterator_destroy(itr);
+    list_destroy(devs);
     return valid;
 }
 
 /*
  * Translate a command from a client into actions for devices.
  * Return an action count so the client be notified when all the
- * actions "check in".
+ * actions "check in".  Queries may be answered in part or in whole from
+ * the status cache, in which case '*cached' is set.  Other commands
+ * invalidate the cache for the nodes they target.
  */
-int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
+int dev_enqueue_actions(int com, ActionCB complete_fun,
                         VerbosePrintf vpf_fun, DiagPrintf dpf_fun,
-                        int client_id, ArgList arglist)
+                        ResultCB result_fun, int client_id, ArgList arglist,
+                        bool *cached)
 {
     Device *dev;
-    ListIterator itr;
+    List devs;
     int total = 0;
+    int kind = -1;
 
-    itr = list_iterator_create(dev_devices);
-    while ((dev = list_next(itr))) {
+    assert(arglist != NULL);
+
+    *cached = false;
+    if (timerisset(&dev_cache_ttl)) {
+        if (_is_query_action(com))
+            kind = _cache_kind(com);
+        else {
+            ArgListIterator itr = arglist_iterator_create(arglist);
+            Arg *arg;
+
+            while ((arg = arglist_next(itr)))
+                _cache_invalidate(arg->nodeid);
+            arglist_iterator_destroy(itr);
+        }
+    }
+
+    devs = _target_devices(arglist, kind, cached, result_fun, client_id);
+    while ((dev = list_dequeue(devs))) {
+        List acts;
         int count;
 
-        if (!dev->scripts[com] && _get_all_script(dev, com) == -1
+        if (!dev->scripts->script[com] && _get_all_script(dev, com) == -1
                                && _get_ranged_script(dev, com) == -1)
             continue;                               /* unimplemented script */
-        if (hl && !_command_needs_device(dev, hl))
-            continue;                               /* uninvolved device */
-        count = _enqueue_actions(dev, com, hl, complete_fun, vpf_fun, dpf_fun,
-                client_id, arglist);
-        if (count > 0 && dev->connect_state != DEV_CONNECTED)
-            dev->retry_count = 0;   /* expedite retries on this device since */
-        total += count;             /*   the user is beating on us... */
+        /* Actions are built here but the device's shard enqueues them,
+         * since a worker thread may be running the device.
+         */
+        acts = list_create((ListDelF) _destroy_action);
+        count = _enqueue_targeted_actions(dev, com, complete_fun, vpf_fun,
+                                          dpf_fun, client_id, arglist, acts);
+        if (result_fun) {
+            ListIterator itr = list_iterator_create(acts);
+            Action *act;
+
+            while ((act = list_next(itr)))
+                act->result_fun = result_fun;
+            list_iterator_destroy(itr);
+        }
+        if (count > 0)
+            _submit_actions(dev, acts);
+        else
+            list_destroy(acts);
+        total += count;
     }
-    list_iterator_destroy(itr);
+    list_destroy(devs);
 
     return total;
 }
 
-static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
-                            ActionCB complete_fun, VerbosePrintf vpf_fun,
-                            DiagPrintf dpf_fun, int client_id, ArgList arglist)
+/*
+ * Enqueue an internally generated action (login, logout, ping).
+ */
+static int _enqueue_actions(Device * dev, int com)
 {
     Action *act;
     int count = 0;
@@ -510,35 +1534,22 @@ static int _enqueue_actions(Device * dev, int com, hostlist_t hl,
             _rewind_action(act);
             dbg(DBG_ACTION, "resetting iterator for non-login action");
         }
-        act = _create_action(dev, com, NULL, complete_fun, vpf_fun, dpf_fun,
-                client_id, arglist);
+        act = _create_action(dev, com, NULL, NULL, NULL, NULL, 0, NULL);
         list_prepend(dev->acts, act);
         count++;
         break;
     case PM_LOG_OUT:
     case PM_PING:
-        act = _create_action(dev, com, NULL, complete_fun, vpf_fun, dpf_fun,
-                             client_id, arglist);
+        act = _create_action(dev, com, NULL, NULL, NULL, NULL, 0, NULL);
         list_append(dev->acts, act);
         count++;
         break;
-
-    case PM_POWER_ON:
-    case PM_POWER_OFF:
-    case PM_BEACON_ON:
-    case PM_BEACON_OFF:
-    case PM_POWER_CYCLE:
-    case PM_RESET:
-    case PM_STATUS_PLUGS:
-    case PM_STATUS_TEMP:
-    case PM_STATUS_BEACON:
-        count += _enqueue_targeted_actions(dev, com, hl, complete_fun,
-                                           vpf_fun, dpf_fun, client_id, arglist);
-        break;
     default:
         assert(false);
     }
 
+    if (count > 0)
+        _set_runnable(dev);
     return count;
 }
 
@@ -549,31 +1560,31 @@ static int _get_all_script(Device * dev, int com)
 
     switch (com) {
     case PM_POWER_ON:
-        if (dev->scripts[PM_POWER_ON_ALL])
+        if (dev->scripts->script[PM_POWER_ON_ALL])
             new = PM_POWER_ON_ALL;
         break;
     case PM_POWER_OFF:
-        if (dev->scripts[PM_POWER_OFF_ALL])
+        if (dev->scripts->script[PM_POWER_OFF_ALL])
             new = PM_POWER_OFF_ALL;
         break;
     case PM_POWER_CYCLE:
-        if (dev->scripts[PM_POWER_CYCLE_ALL])
+        if (dev->scripts->script[PM_POWER_CYCLE_ALL])
             new = PM_POWER_CYCLE_ALL;
         break;
     case PM_RESET:
-        if (dev->scripts[PM_RESET_ALL])
+        if (dev->scripts->script[PM_RESET_ALL])
             new = PM_RESET_ALL;
         break;
     case PM_STATUS_PLUGS:
-        if (dev->scripts[PM_STATUS_PLUGS_ALL])
+        if (dev->scripts->script[PM_STATUS_PLUGS_ALL])
             new = PM_STATUS_PLUGS_ALL;
         break;
     case PM_STATUS_TEMP:
-        if (dev->scripts[PM_STATUS_TEMP_ALL])
+        if (dev->scripts->script[PM_STATUS_TEMP_ALL])
             new = PM_STATUS_TEMP_ALL;
         break;
     case PM_STATUS_BEACON:
-        if (dev->scripts[PM_STATUS_BEACON_ALL])
+        if (dev->scripts->script[PM_STATUS_BEACON_ALL])
             new = PM_STATUS_BEACON_ALL;
         break;
     default:
@@ -589,27 +1600,27 @@ static int _get_ranged_script(Device * dev, int com)
 
     switch (com) {
     case PM_POWER_ON:
-        if (dev->scripts[PM_POWER_ON_RANGED])
+        if (dev->scripts->script[PM_POWER_ON_RANGED])
             new = PM_POWER_ON_RANGED;
         break;
     case PM_POWER_OFF:
-        if (dev->scripts[PM_POWER_OFF_RANGED])
+        if (dev->scripts->script[PM_POWER_OFF_RANGED])
             new = PM_POWER_OFF_RANGED;
         break;
     case PM_POWER_CYCLE:
-        if (dev->scripts[PM_POWER_CYCLE_RANGED])
+        if (dev->scripts->script[PM_POWER_CYCLE_RANGED])
             new = PM_POWER_CYCLE_RANGED;
         break;
     case PM_RESET:
-        if (dev->scripts[PM_RESET_RANGED])
+        if (dev->scripts->script[PM_RESET_RANGED])
             new = PM_RESET_RANGED;
         break;
     case PM_BEACON_ON:
-        if (dev->scripts[PM_BEACON_ON_RANGED])
+        if (dev->scripts->script[PM_BEACON_ON_RANGED])
             new = PM_BEACON_ON_RANGED;
         break;
     case PM_BEACON_OFF:
-        if (dev->scripts[PM_BEACON_OFF_RANGED])
+        if (dev->scripts->script[PM_BEACON_OFF_RANGED])
             new = PM_BEACON_OFF_RANGED;
         break;
     default:
@@ -618,6 +1629,22 @@ static int _get_ranged_script(Device * dev, int com)
     return new;
 }
 
+static bool _is_ranged_action(int com)
+{
+    switch (com) {
+        case PM_POWER_ON_RANGED:
+        case PM_POWER_OFF_RANGED:
+        case PM_POWER_CYCLE_RANGED:
+        case PM_RESET_RANGED:
+        case PM_BEACON_ON_RANGED:
+        case PM_BEACON_OFF_RANGED:
+            return true;
+        default:
+            return false;
+    }
+    /*NOTREACHED*/
+}
+
 static bool _is_query_action(int com)
 {
     switch (com) {
@@ -635,11 +1662,16 @@ static bool _is_query_action(int com)
 }
 
 
-static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
+/*
+ * Create actions for the plugs of 'dev' targeted by the current command
+ * (see _target_devices()) and append them to 'acts'.
+ */
+static int _enqueue_targeted_actions(Device * dev, int com,
                                      ActionCB complete_fun,
                                      VerbosePrintf vpf_fun,
                                      DiagPrintf dpf_fun,
-                                     int client_id, ArgList arglist)
+                                     int client_id, ArgList arglist,
+                                     List acts)
 {
     List new_acts = list_create((ListDelF) _destroy_action);
     bool all = true;
@@ -650,8 +1682,6 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
     List ranged_plugs = NULL;
     int used_ranged_plugs = 0;
 
-    assert(hl != NULL);
-
     if (!(ranged_plugs = list_create((ListDelF)NULL)))
         goto cleanup;
 
@@ -665,7 +1695,7 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
         }
 
         /* check if node name for plug matches the target */
-        if (hostlist_find(hl, plug->node) == -1) {
+        if (!_targeted(plug)) {
             all = false;
             continue;
         }
@@ -674,7 +1704,7 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
             goto cleanup;
 
         /* append action to 'new_acts' */
-        if (dev->scripts[com] != NULL) { /* maybe we only have _ALL... */
+        if (dev->scripts->script[com] != NULL) { /* maybe we only have _ALL... */
             List plugs;
 
             if (!(plugs = list_create((ListDelF)NULL)))
@@ -695,9 +1725,9 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
      * targeting one plug, use singlet script over other possible
      * choices below.
      */
-    if (dev->scripts[com] != NULL && list_count(new_acts) == 1) {
+    if (dev->scripts->script[com] != NULL && list_count(new_acts) == 1) {
         while ((act = list_pop(new_acts))) {
-            list_append(dev->acts, act);
+            list_append(acts, act);
             count++;
         }
     }
@@ -709,13 +1739,13 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
      *   version)
      */
     if (count == 0) {
-        if (all || (_is_query_action(com) && dev->scripts[com] == NULL)) {
+        if (all || (_is_query_action(com) && dev->scripts->script[com] == NULL)) {
             int ncom = _get_all_script(dev, com);
 
             if (ncom != -1) {
                 act = _create_action(dev, ncom, NULL, complete_fun,
                                      vpf_fun, dpf_fun, client_id, arglist);
-                list_append(dev->acts, act);
+                list_append(acts, act);
                 count++;
             }
         }
@@ -729,7 +1759,7 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
         if (ncom != -1) {
             act = _create_action(dev, ncom, ranged_plugs, complete_fun,
                                  vpf_fun, dpf_fun, client_id, arglist);
-            list_append(dev->acts, act);
+            list_append(acts, act);
             used_ranged_plugs++;
             count++;
         }
@@ -739,7 +1769,7 @@ static int _enqueue_targeted_actions(Device * dev, int com, hostlist_t hl,
      */
     if (count == 0) {
         while ((act = list_pop(new_acts))) {
-            list_append(dev->acts, act);
+            list_append(acts, act);
             count++;
         }
     }
@@ -755,7 +1785,7 @@ cleanup:
  */
 static void _enqueue_login(Device *dev)
 {
-    _enqueue_actions(dev, PM_LOG_IN, NULL, NULL, NULL, NULL, 0, NULL);
+    _enqueue_actions(dev, PM_LOG_IN);
 }
 
 
@@ -764,11 +1794,16 @@ static void _disconnect(Device * dev)
     Action *act;
 
     assert(dev->disconnect != NULL);
+    _unregister_poll(dev);
+    xtimer_cancel(dev->ping_timer);
+    xtimer_cancel(dev->refresh_timer);
     dev->disconnect(dev);
 
     /* empty buffers */
     cbuf_flush(dev->from);
     cbuf_flush(dev->to);
+    dev->scanlen = 0;
+    dev->scanfail = NULL;
 
     /* update state */
     dev->connect_state = DEV_NOT_CONNECTED;
@@ -779,56 +1814,140 @@ static void _disconnect(Device * dev)
         _destroy_action(list_dequeue(dev->acts));
 }
 
+static void _add_latency(struct timeval *total, struct timeval *max,
+                         struct timeval *start, struct timeval *end)
+{
+    struct timeval t;
+
+    timersub(end, start, &t);
+    timeradd(total, &t, total);
+    if (timercmp(&t, max, >))
+        *max = t;
+}
+
+/* Account for the time an action spent queued and running.  The action
+ * may not have started if it was aborted.
+ */
+static void _record_latency(Device *dev, Action *act)
+{
+    LatencyStat *stat = &dev->stat_latency[act->prio];
+    struct timeval now, start;
+
+    xtimer_gettime(&now);
+    start = timerisset(&act->time_stamp) ? act->time_stamp : now;
+
+    pthread_mutex_lock(&dev_stat_lock);
+    stat->count++;
+    _add_latency(&stat->wait_total, &stat->wait_max, &act->queued, &start);
+    _add_latency(&stat->total, &stat->max, &act->queued, &now);
+    pthread_mutex_unlock(&dev_stat_lock);
+}
+
+/* Copy the latency counters of a priority class (called by client.c).
+ */
+void dev_get_latency(Device *dev, ActPrio prio, LatencyStat *stat)
+{
+    pthread_mutex_lock(&dev_stat_lock);
+    *stat = dev->stat_latency[prio];
+    pthread_mutex_unlock(&dev_stat_lock);
+}
+
+const char *dev_prio_name(ActPrio prio)
+{
+    switch (prio) {
+        case PRIO_CONTROL:
+            return "control";
+        case PRIO_QUERY:
+            return "query";
+        case PRIO_BACKGROUND:
+            return "background";
+    }
+    return "unknown";
+}
+
+/* An action has ended: make client callbacks, record its latency and
+ * destroy it.  The action must already be off the device queue.
+ */
+static void _finish_action(Device *dev, Action *act)
+{
+    if (act->errnum == ACT_ESUCCESS)
+        _note_action_states(dev, act);
+    if (act->complete_fun || act->waiters)
+        _act_completion(act, dev);
+    _record_latency(dev, act);
+    _destroy_action(act);
+}
+
 static void _act_completion(Action *act, Device *dev)
 {
-    assert(act->complete_fun != NULL);
+    char *msg = NULL;
+
+    assert(act->complete_fun != NULL || act->waiters != NULL);
+
+    if (!_is_query_action(act->com))
+        _cache_invalidate_action(dev, act);
 
     switch (act->errnum) {
     case ACT_ECONNECTTIMEOUT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: connect timeout", dev->name);
+        msg = hsprintf("%s: connect timeout", dev->name);
         break;
     case ACT_ELOGINTIMEOUT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: login timeout", dev->name);
+        msg = hsprintf("%s: login timeout", dev->name);
         break;
     case ACT_EEXPFAIL:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: action timed out waiting for expected response", dev->name);
+        msg = hsprintf("%s: action timed out waiting for expected response",
+                dev->name);
         break;
     case ACT_EABORT:
-        act->complete_fun(act->client_id, act->errnum,
-                "%s: action aborted due to previous action timeout", dev->name);
+        msg = hsprintf("%s: action aborted due to previous action timeout",
+                dev->name);
         break;
     case ACT_ESUCCESS:
-        act->complete_fun(act->client_id, act->errnum, NULL);
         break;
     }
+
+    /* pass the result on to clients that were waiting for it */
+    if (act->waiters) {
+        Action *w;
+
+        while ((w = list_dequeue(act->waiters))) {
+            w->errnum = act->errnum;
+            _apply_reports(act, w);
+            _post_results(dev, act, w);
+            if (timercmp(&act->time_stamp, &w->queued, >))
+                w->time_stamp = act->time_stamp;
+            else
+                w->time_stamp = w->queued;
+            _finish_action(dev, w);
+        }
+    }
+    if (act->complete_fun) {
+        _post_results(dev, act, act);
+        _post_notice(dev, act, NOTICE_COMPLETE, msg);
+    } else if (msg)
+        xfree(msg);
 }
 
 /*
  * Process the script for the current action for this device.
- * Update timeout and return if one of the script elements stalls.
+ * Arm the action timer and return if one of the script elements stalls.
  * Start the next action if we complete this one.
  */
-static void _process_action(Device * dev, struct timeval *timeout)
+static void _process_action(Device * dev)
 {
     bool stalled = false;
     Action *act;
 
     while ((act = list_peek(dev->acts)) && !stalled) {
         struct timeval timeleft;
-        ExecCtx *e = list_peek(act->exec);
-
-        assert(e != NULL);
+        int next = act->pc + 1;
 
         dbg(DBG_ACTION, "_process_action: processing action %d", act->com);
         _dbg_actions(dev);
 
         /* initialize timeout (action is brand new) */
         if (!timerisset(&act->time_stamp))
-            if (gettimeofday(&act->time_stamp, NULL) < 0)
-                err_exit(true, "gettimeofday");
+            xtimer_gettime(&act->time_stamp);
 
         /* timeout exceeded? */
         if (_timeout(&act->time_stamp, &dev->timeout, &timeleft)) {
@@ -839,18 +1958,26 @@ static void _process_action(Device * dev, struct timeval *timeout)
             } else
                 act->errnum = ACT_EEXPFAIL;
 
-            if (act->vpf_fun) {
-                static char mem[MAX_DEV_BUF];
-                int len = cbuf_peek(dev->from, mem, MAX_DEV_BUF);
-                char *memstr = dbg_memstr(mem, len);
+            if (_act_wants_telemetry(act)) {
+                char *mem = xmalloc(dev->scanlen + MAX_DEV_BUF);
+                int len = dev->scanlen;
+                int n;
+                char *memstr;
+
+                if (dev->scanlen > 0)
+                    memcpy(mem, dev->scan, dev->scanlen);
+                if ((n = cbuf_peek(dev->from, mem + len, MAX_DEV_BUF)) > 0)
+                    len += n;
+                memstr = dbg_memstr(mem, len);
 
                 if (!(dev->connect_state == DEV_CONNECTED))
-                    act->vpf_fun(act->client_id, "connect(%s): timeout",
+                    _act_telemetry(dev, act, "connect(%s): timeout",
                             dev->name);
                 else
-                    act->vpf_fun(act->client_id, "recv(%s): '%s'",
+                    _act_telemetry(dev, act, "recv(%s): '%s'",
                             dev->name, memstr);
                 xfree(memstr);
+                xfree(mem);
             }
 
         /* not connected but timeout not yet exceeded */
@@ -859,248 +1986,199 @@ static void _process_action(Device * dev, struct timeval *timeout)
 
         /* connected - process statements */
         } else {
-            /* If a statement has an inner block to execute, it pushes a new
-             * ExecCtx onto the action's exec stack and returns.  We notice
-             * the top of the exec stack has changed and try to exec the next
-             * stmt (now of the new context) and so on.  When the inner block
-             * is done, the stack is popped and the "current" stmt is back to
-             * the one that initiated the inner block.
+            /* Stmts that alter the flow of the script (foreach, ifon/ifoff)
+             * set 'next' to the stmt to run after them.
              */
-            do {
-                e = list_peek(act->exec);
-                stalled = !_process_stmt(dev, act, e, timeout);
-            } while (e != list_peek(act->exec));
+            assert(act->pc < act->script->len);
+            stalled = !_process_stmt(dev, act, &next);
         }
 
-        /* stalled - update timeout for select */
+        /* stalled - arm timer so we notice if the action times out */
         if (stalled) {
-            _update_timeout(timeout, &timeleft);
+            xtimer_arm(dev->action_timer, &timeleft);
 
         /* most recently attempted stmt completed successfully */
         } else if (act->errnum == ACT_ESUCCESS) {
-            e->cur = list_next(e->stmtitr);     /* next stmt this block */
-            if (!e->cur) {                  /* ...or new block */
-                ExecCtx *e2 = list_pop(act->exec);
-
-                assert(e2 == e);
-                _destroy_exec_ctx(e2);
-                e = list_peek(act->exec);
-            }
+            act->pc = next;
 
             /* completed action successfully! */
-            if (e == NULL) {
+            if (act->pc == act->script->len) {
                 if (act->com == PM_LOG_IN)
                     dev->logged_in = true;
-                if (act->complete_fun)
-                    _act_completion(act, dev);
-                _destroy_action(list_dequeue(dev->acts));
+                _finish_action(dev, list_dequeue(dev->acts));
                 dev->stat_successful_actions++;
             }
 
         /* most recently attempted stmt completed with error */
         } else {
-            ActError res = act->errnum; /* save for ref after _destroy_action */
+            ActError res = act->errnum; /* save for ref after _finish_action */
 
-            if (act->complete_fun)
-                _act_completion(act, dev);
-            _destroy_action(list_dequeue(dev->acts));
+            _finish_action(dev, list_dequeue(dev->acts));
 
             /* if one action failed, abort the rest in the device queue
              * in preparation for reconnect.
              */
             while ((act = list_dequeue(dev->acts)) != NULL) {
                 act->errnum = (res == ACT_EEXPFAIL ? ACT_EABORT : res);
-                if (act->complete_fun)
-                    _act_completion(act, dev);
-                _destroy_action(act);
+                _finish_action(dev, act);
             }
 
             /* reconnect/login if expect timed out */
             if ((dev->connect_state == DEV_CONNECTED)) {
                 dbg(DBG_DEVICE, "_process_action: disconnecting due to error");
-                _reconnect(dev, timeout);
+                _reconnect(dev);
                 break;
             }
         }
     } /* while loop */
+
+    if (list_is_empty(dev->acts))
+        xtimer_cancel(dev->action_timer);
+}
+
+/* Return the plugs targeted by stmt 's' of the action: the plug of the
+ * current pass through the innermost enclosing foreach block, else the
+ * plugs of the action.  Return NULL if the action targets all plugs.
+ */
+static Plug **_target_plugs(Action *act, Stmt *s, int *nplugs)
+{
+    if (s->depth > 0) {
+        *nplugs = 1;
+        return &act->loops[s->depth - 1].plug;
+    }
+    *nplugs = act->nplugs;
+    return act->nplugs > 0 ? act->plugs : NULL;
 }
 
-bool _process_stmt(Device *dev, Action *act, ExecCtx *e,
-        struct timeval *timeout)
+static bool _process_stmt(Device *dev, Action *act, int *next)
 {
+    Stmt *s = &act->script->stmts[act->pc];
     bool finished = 0;
 
-    switch (e->cur->type)
+    switch (s->type)
     {
     case STMT_EXPECT:
-        finished = _process_expect(dev, act, e);
+        finished = _process_expect(dev, act, s);
         break;
     case STMT_SEND:
-        finished = _process_send(dev, act, e);
+        finished = _process_send(dev, act, s);
         break;
     case STMT_SETPLUGSTATE:
-        finished = _process_setplugstate(dev, act, e);
+        finished = _process_setplugstate(dev, act, s);
         break;
     case STMT_SETRESULT:
-        finished = _process_setresult(dev, act, e);
+        finished = _process_setresult(dev, act, s);
         break;
     case STMT_DELAY:
-        finished = _process_delay(dev, act, e, timeout);
+        finished = _process_delay(dev, act, s);
         break;
     case STMT_FOREACHPLUG:
     case STMT_FOREACHNODE:
-        finished = _process_foreach(dev, act, e);
+        finished = _process_foreach(dev, act, s, next);
+        break;
+    case STMT_LOOP:
+        finished = _process_loop(dev, act, s, next);
         break;
     case STMT_IFON:
     case STMT_IFOFF:
-        finished = _process_ifonoff(dev, act, e);
+        finished = _process_ifonoff(dev, act, s, next);
         break;
     }
     return finished;
 }
 
-static bool _process_foreach(Device *dev, Action *act, ExecCtx *e)
+/* Pick the plug for the next pass through the foreach block headed by
+ * 'head'.  Ranged scripts loop over the targeted plugs, others loop over
+ * all the plugs of the device.  Return NULL when the plugs are exhausted.
+ */
+static Plug *_loop_next(Device *dev, Action *act, Stmt *head)
 {
-    bool finished = true;
-    ExecCtx *new;
-    Plug *plug = NULL;
-
-    /* we store a plug iterator in the ExecCtx */
-    if (e->plugitr == NULL) {
-        if (act->com == PM_POWER_ON_RANGED
-            || act->com == PM_POWER_OFF_RANGED
-            || act->com == PM_POWER_CYCLE_RANGED
-            || act->com == PM_RESET_RANGED
-            || act->com == PM_BEACON_ON_RANGED
-            || act->com == PM_BEACON_OFF_RANGED) {
-            assert(e->plugs);
-            if (!e->pluglist) {
-                if (!(e->pluglist = pluglist_copy_from_list(e->plugs)))
-                    goto cleanup;
-            }
-            e->plugitr = pluglist_iterator_create(e->pluglist);
-        }
-        else
-            e->plugitr = pluglist_iterator_create(dev->plugs);
-    }
-
-    /* Each time the inner block is executed, its argument will be
-     * a new plug name.  Pick that up here.
-     */
-    if (e->cur->type == STMT_FOREACHPLUG) {
-        plug = pluglist_next(e->plugitr);
-    } else if (e->cur->type == STMT_FOREACHNODE) {
-        do {
-            plug = pluglist_next(e->plugitr);
-        } while (plug && plug->node == NULL);
-    } else {
-        assert(0);
-    }
-
-    /* plug list not exhausted? start a new execution context for this block */
-    if (plug != NULL) {
-        List plugs;
-
-        if (!(plugs = list_create((ListDelF)NULL)))
-            goto cleanup;
-        if (!list_append(plugs, plug)) {
-            list_destroy(plugs);
-            goto cleanup;
-        }
+    LoopState *loop = &act->loops[head->depth];
+    Plug **plugs = NULL;
+    int nplugs = 0;
+    Plug *plug;
 
-        new = _create_exec_ctx(dev, e->cur->u.foreach.stmts, plugs);
-        list_push(act->exec, new);
-    } else {
-        pluglist_iterator_destroy(e->plugitr);
-        e->plugitr = NULL;
+    if (_is_ranged_action(act->com)) {
+        plugs = _target_plugs(act, head, &nplugs);
+        assert(plugs != NULL);
     }
+    do {
+        if (plugs)
+            plug = loop->next < nplugs ? plugs[loop->next] : NULL;
+        else
+            plug = pluglist_nth(dev->plugs, loop->next);
+        if (plug)
+            loop->next++;
+    } while (plug && head->type == STMT_FOREACHNODE && plug->node == NULL);
 
-    /* we won't be called again if we don't push a new context */
- cleanup:
-    return finished;
+    loop->plug = plug;
+    return plug;
 }
 
-static bool _process_ifonoff(Device *dev, Action *act, ExecCtx *e)
+static bool _process_foreach(Device *dev, Action *act, Stmt *s, int *next)
 {
-    bool finished = true;
-
-    if (e->processing) { /* if returning from subblock, we are done */
-        e->processing = false;
-
-    } else {
-        InterpState state = ST_UNKNOWN;
-        bool condition = false;
-        ExecCtx *new;
-
-        if (e->plugs && list_count(e->plugs) > 0) {
-            Plug *plug = list_peek(e->plugs);
-            Arg *arg = arglist_find(act->arglist, plug->node);
-
-            if (arg)
-                state = arg->state;
-        }
+    act->loops[s->depth].next = 0;
+    if (_loop_next(dev, act, s) == NULL)
+        *next = s->u.foreach.end;   /* no plugs, skip the block */
+    return true;
+}
 
-        if (e->cur->type == STMT_IFON && state == ST_ON)
-            condition = true;
-        else if (e->cur->type == STMT_IFOFF && state == ST_OFF)
-            condition = true;
-        else if (state == ST_UNKNOWN) {
-            act->errnum = ACT_EEXPFAIL; /* FIXME */
-        }
+static bool _process_loop(Device *dev, Action *act, Stmt *s, int *next)
+{
+    int start = s->u.loop.start;
 
-        /* condition met? start a new execution context for this block */
-        if (condition) {
-            List plugs;
-            ListIterator itr;
-            Plug *plug;
+    if (_loop_next(dev, act, &act->script->stmts[start]) != NULL)
+        *next = start + 1;          /* run the block again */
+    return true;
+}
 
-            e->processing = true;
+static bool _process_ifonoff(Device *dev, Action *act, Stmt *s, int *next)
+{
+    InterpState state = ST_UNKNOWN;
+    bool condition = false;
+    Plug **plugs;
+    int nplugs;
 
-            /* achu: previous context's plugs could get destroy,
-             * so must copy plugs to a new list.
-             */
-            if (!(plugs = list_create((ListDelF)NULL)))
-                goto cleanup;
-            if (!(itr = list_iterator_create(e->plugs))) {
-                list_destroy(plugs);
-                goto cleanup;
-            }
+    if ((plugs = _target_plugs(act, s, &nplugs))) {
+        Arg *arg = arglist_find(act->arglist, plugs[0]->nodeid);
 
-            while ((plug = list_next(itr))) {
-                if (!list_append(plugs, plug)) {
-                    list_destroy(plugs);
-                    list_iterator_destroy(itr);
-                    goto cleanup;
-                }
-            }
+        if (arg)
+            state = arg->state;
+    }
 
-            new = _create_exec_ctx(dev, e->cur->u.ifonoff.stmts, plugs);
-            list_push(act->exec, new);
-            list_iterator_destroy(itr);
-        }
+    if (s->type == STMT_IFON && state == ST_ON)
+        condition = true;
+    else if (s->type == STMT_IFOFF && state == ST_OFF)
+        condition = true;
+    else if (state == ST_UNKNOWN) {
+        act->errnum = ACT_EEXPFAIL; /* FIXME */
     }
 
- cleanup:
-    return finished;
+    /* condition not met? skip the block */
+    if (!condition)
+        *next = s->u.ifonoff.end;
+    return true;
 }
 
-static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
+static bool _process_setplugstate(Device *dev, Action *act, Stmt *s)
 {
     bool finished = true;
     char *plug_name = NULL;
+    Plug **plugs;
+    int nplugs;
 
     /*
      * Usage: setplugstate [plug] status [interps]
      * plug can be literal plug name, or regex match, or omitted,
      * (implying target plug name).
      */
-    if (e->cur->u.setplugstate.plug_name)    /* literal */
-        plug_name = xstrdup(e->cur->u.setplugstate.plug_name);
+    if (s->u.setplugstate.plug_name)    /* literal */
+        plug_name = xstrdup(s->u.setplugstate.plug_name);
     if (!plug_name)                         /* regex match */
         plug_name = xregex_match_sub_strdup(dev->xmatch,
-                                            e->cur->u.setplugstate.plug_mp);
-    if (!plug_name && (e->plugs && list_count(e->plugs) > 0)) {
-        Plug *plug = list_peek(e->plugs);
+                                            s->u.setplugstate.plug_mp);
+    if (!plug_name && (plugs = _target_plugs(act, s, &nplugs))) {
+        Plug *plug = plugs[0];
         if (plug->name)
             plug_name = xstrdup(plug->name);/* use action target */
     }
@@ -1108,7 +2186,7 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
 
     if (plug_name) {
         char *str = xregex_match_sub_strdup(dev->xmatch,
-                                            e->cur->u.setplugstate.stat_mp);
+                                            s->u.setplugstate.stat_mp);
         Plug *plug = pluglist_find(dev->plugs, plug_name);
 
         if (str && plug && plug->node) {
@@ -1117,7 +2195,7 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
             StateInterp *i;
             Arg *arg;
 
-            itr = list_iterator_create(e->cur->u.setplugstate.interps);
+            itr = list_iterator_create(s->u.setplugstate.interps);
             while ((i = list_next(itr))) {
                 if (xregex_exec(i->re, str, NULL)) {
                     state = i->state;
@@ -1126,11 +2204,18 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
             }
             list_iterator_destroy(itr);
 
-            if ((arg = arglist_find(act->arglist, plug->node))) {
+            if (act->arglist
+                    && (arg = arglist_find(act->arglist, plug->nodeid))) {
                 arg->state = state;
                 xfree(arg->val);
                 arg->val = xstrdup(str);
             }
+            _cache_store(act->com, plug->nodeid, state, str);
+            if (_cache_kind(act->com) != CACHE_TEMP
+                    && _cache_kind(act->com) != CACHE_BEACON)
+                _note_state(dev, plug->nodeid, state);
+            if (act->reports)
+                _add_report(act, plug->nodeid, state, str);
         }
         xfree(str);
         /* if no match, do nothing */
@@ -1140,7 +2225,7 @@ static bool _process_setplugstate(Device *dev, Action *act, ExecCtx *e)
     return finished;
 }
 
-static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
+static bool _process_setresult(Device *dev, Action *act, Stmt *s)
 {
     bool finished = true;
     char *plug_name;
@@ -1149,12 +2234,12 @@ static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
      * Usage: setresult regex regexstatus interps
      */
     plug_name = xregex_match_sub_strdup(dev->xmatch,
-                                        e->cur->u.setresult.plug_mp);
+                                        s->u.setresult.plug_mp);
 
     /* if no plug name, do nothing */
     if (plug_name) {
         char *str = xregex_match_sub_strdup(dev->xmatch,
-                                            e->cur->u.setresult.stat_mp);
+                                            s->u.setresult.stat_mp);
         Plug *plug = pluglist_find(dev->plugs, plug_name);
 
         if (str && plug && plug->node) {
@@ -1163,7 +2248,7 @@ static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
             ResultInterp *i;
             Arg *arg;
 
-            itr = list_iterator_create(e->cur->u.setresult.interps);
+            itr = list_iterator_create(s->u.setresult.interps);
             while ((i = list_next(itr))) {
                 if (xregex_exec(i->re, str, NULL)) {
                     result = i->result;
@@ -1172,7 +2257,7 @@ static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
             }
             list_iterator_destroy(itr);
 
-            if ((arg = arglist_find(act->arglist, plug->node))) {
+            if ((arg = arglist_find(act->arglist, plug->nodeid))) {
                 arg->result = result;
                 xfree(arg->val);
                 arg->val = xstrdup(str);
@@ -1183,7 +2268,7 @@ static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
                 snprintf(strbuf, sizeof(strbuf), "%s", arg->val);
                 /* remove trailing carriage return or newline */
                 strbuf[strcspn(strbuf, "\r\n")] = '\0';
-                act->dpf_fun(act->client_id, "%s: %s", arg->node, strbuf);
+                _act_diag(dev, act, "%s: %s", arg->node, strbuf);
             }
         }
         xfree(str);
@@ -1195,23 +2280,21 @@ static bool _process_setresult(Device *dev, Action *act, ExecCtx *e)
 }
 
 /* return true if expect is finished */
-static bool _process_expect(Device *dev, Action *act, ExecCtx *e)
+static bool _process_expect(Device *dev, Action *act, Stmt *s)
 {
     bool finished = false;
-    char *str;
 
     xregex_match_recycle(dev->xmatch);
-    if ((str = _getregex_buf(dev->from, e->cur->u.expect.exp, dev->xmatch))) {
-        if (act->vpf_fun) {
+    if (_getregex_buf(dev, s->u.expect.exp, dev->xmatch)) {
+        if (_act_wants_telemetry(act)) {
             char *matchstr = xregex_match_strdup(dev->xmatch);
             char *memstr = dbg_memstr(matchstr, strlen(matchstr));
 
-            act->vpf_fun(act->client_id, "recv(%s): '%s'", dev->name, memstr);
+            _act_telemetry(dev, act, "recv(%s): '%s'", dev->name, memstr);
 
             xfree(memstr);
             xfree(matchstr);
         }
-        xfree(str);
         finished = true;
     }
     return finished;
@@ -1235,35 +2318,31 @@ static char *_xhostlist_ranged_string(hostlist_t hl)
     return str;
 }
 
-static bool _process_send(Device *dev, Action *act, ExecCtx *e)
+static bool _process_send(Device *dev, Action *act, Stmt *s)
 {
     bool finished = false;
 
     /* first time through? */
-    if (!e->processing) {
+    if (!act->processing) {
         int dropped = 0;
         int written;
         char *str = NULL;
+        Plug **plugs;
+        int nplugs;
 
-        if (e->plugs && list_count(e->plugs) > 0) {
-            if (list_count(e->plugs) > 1) {
+        if ((plugs = _target_plugs(act, s, &nplugs))) {
+            if (nplugs > 1) {
                 char *names;
-                ListIterator itr = NULL;
                 hostlist_t hl = NULL;
-                Plug *plug;
+                int i;
 
                 if (!(hl = hostlist_create(NULL))) {
                     err(true, "_process_send(%s): hostlist_create", dev->name);
                     goto range_cleanup;
                 }
 
-                if (!(itr = list_iterator_create(e->plugs))) {
-                    err(true, "_process_send(%s): list_iterator_create", dev->name);
-                    goto range_cleanup;
-                }
-
-                while ((plug = list_next(itr))) {
-                    if (!hostlist_push(hl, plug->name)) {
+                for (i = 0; i < nplugs; i++) {
+                    if (!hostlist_push(hl, plugs[i]->name)) {
                         err(true, "_process_send(%s): hostlist_push", dev->name);
                         goto range_cleanup;
                     }
@@ -1271,21 +2350,19 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
 
                 hostlist_sort(hl);
                 names = _xhostlist_ranged_string(hl);
-                str = hsprintf(e->cur->u.send.fmt, names);
+                str = hsprintf(s->u.send.fmt, names);
                 xfree (names);
             range_cleanup:
-                if (itr)
-                    list_iterator_destroy(itr);
                 if (hl)
                     hostlist_destroy(hl);
             }
             else {
-                Plug *plug = list_peek(e->plugs);
-                str = hsprintf(e->cur->u.send.fmt, (plug->name ? plug->name : "[unresolved]"));
+                Plug *plug = plugs[0];
+                str = hsprintf(s->u.send.fmt, (plug->name ? plug->name : "[unresolved]"));
             }
         }
         else
-            str = hsprintf(e->cur->u.send.fmt, NULL);
+            str = hsprintf(s->u.send.fmt, NULL);
 
         if (str) {
             written = cbuf_write(dev->to, str, strlen(str), &dropped);
@@ -1299,21 +2376,21 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
             else {
                 char *memstr = dbg_memstr(str, strlen(str));
 
-                if (act->vpf_fun)
-                    act->vpf_fun(act->client_id, "send(%s): '%s'",
-                                 dev->name, memstr);
+                if (_act_wants_telemetry(act))
+                    _act_telemetry(dev, act, "send(%s): '%s'",
+                                   dev->name, memstr);
                 xfree(memstr);
             }
             assert(written < 0 || (dropped == strlen(str) - written));
         }
 
-        e->processing = true;
+        act->processing = true;
 
         xfree(str);
     }
 
     if (cbuf_is_empty(dev->to)) {           /* finished! */
-        e->processing = false;
+        act->processing = false;
         finished = true;
     }
 
@@ -1321,43 +2398,121 @@ static bool _process_send(Device *dev, Action *act, ExecCtx *e)
 }
 
 /* return true if delay is finished */
-static bool _process_delay(Device *dev, Action *act, ExecCtx *e,
-        struct timeval *timeout)
+static bool _process_delay(Device *dev, Action *act, Stmt *s)
 {
     bool finished = false;
     struct timeval delay, timeleft;
 
-    delay = e->cur->u.delay.tv;
+    delay = s->u.delay.tv;
 
     /* first time */
-    if (!e->processing) {
-        if (act->vpf_fun)
-            act->vpf_fun(act->client_id, "delay(%s): %ld.%-6.6ld", dev->name,
+    if (!act->processing) {
+        if (_act_wants_telemetry(act))
+            _act_telemetry(dev, act, "delay(%s): %ld.%-6.6ld", dev->name,
                     delay.tv_sec, delay.tv_usec);
-        e->processing = true;
-        if (gettimeofday(&act->delay_start, NULL) < 0)
-            err_exit(true, "gettimeofday");
+        act->processing = true;
+        xtimer_gettime(&act->delay_start);
     }
 
     /* timeout expired? */
     if (short_circuit_delay || _timeout(&act->delay_start, &delay, &timeleft)) {
-        e->processing = false;
+        act->processing = false;
         finished = true;
     } else
-        _update_timeout(timeout, &timeleft);
+        xtimer_arm(dev->delay_timer, &timeleft);
 
     return finished;
 }
 
+/*
+ * Scripts and script sets are created by the parser, which compiles the
+ * scripts of a specification once and links the set to each device that
+ * uses it.
+ */
+Script *dev_script_create(int len)
+{
+    Script *new = (Script *) xmalloc(sizeof(Script));
+
+    assert(len > 0);
+    new->stmts = (Stmt *) xmalloc(len * sizeof(Stmt));
+    new->len = len;
+    new->depth = 0;
+    return new;
+}
+
+void dev_script_destroy(Script *script)
+{
+    int i;
+
+    for (i = 0; i < script->len; i++) {
+        Stmt *stmt = &script->stmts[i];
+
+        switch (stmt->type) {
+        case STMT_SEND:
+            xfree(stmt->u.send.fmt);
+            break;
+        case STMT_EXPECT:
+            xregex_destroy(stmt->u.expect.exp);
+            break;
+        case STMT_SETPLUGSTATE:
+            list_destroy(stmt->u.setplugstate.interps);
+            if (stmt->u.setplugstate.plug_name)
+                xfree(stmt->u.setplugstate.plug_name);
+            break;
+        case STMT_SETRESULT:
+            list_destroy(stmt->u.setresult.interps);
+            break;
+        default:
+            break;
+        }
+    }
+    xfree(script->stmts);
+    xfree(script);
+}
+
+ScriptSet *dev_scriptset_create(void)
+{
+    ScriptSet *new = (ScriptSet *) xmalloc(sizeof(ScriptSet));
+
+    new->refcount = 1;
+    return new;
+}
+
+ScriptSet *dev_scriptset_link(ScriptSet *scripts)
+{
+    scripts->refcount++;
+    return scripts;
+}
+
+void dev_scriptset_unlink(ScriptSet *scripts)
+{
+    int i;
+
+    if (--scripts->refcount == 0) {
+        for (i = 0; i < NUM_SCRIPTS; i++)
+            if (scripts->script[i] != NULL)
+                dev_script_destroy(scripts->script[i]);
+        xfree(scripts);
+    }
+}
+
 Device *dev_create(const char *name)
 {
     Device *dev;
-    int i;
 
     dev = (Device *) xmalloc(sizeof(Device));
     dev->name = xstrdup(name);
     dev->connect_state = DEV_NOT_CONNECTED;
     dev->fd = NO_FD;
+    dev->poll_fd = NO_FD;
+    dev->ioerr = false;
+    dev->runnable = false;
+    dev->shard = NULL;          /* timers are created with shard */
+    dev->retry_timer = NULL;
+    dev->ping_timer = NULL;
+    dev->refresh_timer = NULL;
+    dev->action_timer = NULL;
+    dev->delay_timer = NULL;
     dev->acts = list_create((ListDelF) _destroy_action);
     dev->xmatch = xregex_match_create(MAX_MATCH_POS);
     dev->data = NULL;
@@ -1366,17 +2521,23 @@ Device *dev_create(const char *name)
     timerclear(&dev->last_retry);
     timerclear(&dev->last_ping);
     timerclear(&dev->ping_period);
+    timerclear(&dev->last_refresh);
+    timerclear(&dev->refresh_period);
 
     dev->to = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
     dev->from = cbuf_create(MIN_DEV_BUF, MAX_DEV_BUF);
+    dev->scan = NULL;
+    dev->scanlen = 0;
+    dev->scansize = 0;
+    dev->scanfail = NULL;
 
-    for (i = 0; i < NUM_SCRIPTS; i++)
-        dev->scripts[i] = NULL;
+    dev->scripts = NULL;
 
     dev->plugs = NULL;
     dev->retry_count = 0;
     dev->stat_successful_connects = 0;
     dev->stat_successful_actions = 0;
+    memset(dev->stat_latency, 0, sizeof(dev->stat_latency));
     return dev;
 }
 
@@ -1386,6 +2547,11 @@ static int _match_name(Device * dev, void *key)
     return (strcmp(dev->name, (char *) key) == 0);
 }
 
+static int _match_ptr(Device * dev, void *key)
+{
+    return (dev == key);
+}
+
 Device *dev_findbyname(char *name)
 {
     return list_find_first(dev_devices, (ListFindF) _match_name, name);
@@ -1393,8 +2559,16 @@ Device *dev_findbyname(char *name)
 
 void dev_destroy(Device * dev)
 {
-    int i;
-
+    _unregister_poll(dev);
+    if (dev->shard) {
+        xtimer_destroy(dev->retry_timer);
+        xtimer_destroy(dev->ping_timer);
+        xtimer_destroy(dev->refresh_timer);
+        xtimer_destroy(dev->action_timer);
+        xtimer_destroy(dev->delay_timer);
+        list_delete_all(dev->shard->runnable, (ListFindF) _match_ptr, dev);
+        list_delete_all(dev->shard->devices, (ListFindF) _match_ptr, dev);
+    }
     if (dev->connect_state == DEV_CONNECTED)
         dev->disconnect(dev);
 
@@ -1407,45 +2581,169 @@ void dev_destroy(Device * dev)
     list_destroy(dev->acts);
     if (dev->plugs)
         pluglist_destroy(dev->plugs);
-    for (i = 0; i < NUM_SCRIPTS; i++)
-        if (dev->scripts[i] != NULL)
-            list_destroy(dev->scripts[i]);
+    if (dev->scripts)
+        dev_scriptset_unlink(dev->scripts);
 
     cbuf_destroy(dev->to);
     cbuf_destroy(dev->from);
+    if (dev->scan)
+        xfree(dev->scan);
     xregex_match_destroy(dev->xmatch);
     xfree(dev);
 }
 
-static void _enqueue_ping(Device * dev, struct timeval *timeout)
+static void _enqueue_ping(Device * dev)
 {
     struct timeval timeleft;
 
-    if (dev->scripts[PM_PING] != NULL && timerisset(&dev->ping_period)) {
-        if (_timeout(&dev->last_ping, &dev->ping_period, &timeleft)) {
-            _enqueue_actions(dev, PM_PING, NULL, NULL, NULL, NULL, 0, NULL);
-            if (gettimeofday(&dev->last_ping, NULL) < 0)
-                err_exit(true, "gettimeofday");
+    if (dev->scripts->script[PM_PING] != NULL && timerisset(&dev->ping_period)) {
+        if (!timerisset(&dev->last_ping)
+                || _timeout(&dev->last_ping, &dev->ping_period, &timeleft)) {
+            _enqueue_actions(dev, PM_PING);
+            xtimer_gettime(&dev->last_ping);
+            xtimer_arm(dev->ping_timer, &dev->ping_period);
             dbg(DBG_ACTION, "%s: enqeuuing ping", dev->name);
-        } else
-            _update_timeout(timeout, &timeleft);
+        } else if (!xtimer_armed(dev->ping_timer))
+            xtimer_arm(dev->ping_timer, &timeleft);
     }
 }
 
 /*
- * Called prior to the select loop to initiate connects to all devices.
+ * Refresh the status cache in the background by running the status_all
+ * script, or the status script for each plug, at most once per refresh
+ * period.  The refresh waits until the device is idle, so it never delays
+ * actions enqueued by clients.
  */
-void dev_initial_connect(void)
+static void _enqueue_refresh(Device *dev)
+{
+    struct timeval timeleft;
+    Action *act;
+    int com = PM_STATUS_PLUGS_ALL;
+
+    if (!timerisset(&dev->refresh_period) || !timerisset(&dev_cache_ttl))
+        return;
+    if (dev->connect_state != DEV_CONNECTED || !dev->logged_in)
+        return;
+    if (timerisset(&dev->last_refresh)
+            && !_timeout(&dev->last_refresh, &dev->refresh_period, &timeleft)) {
+        if (!xtimer_armed(dev->refresh_timer))
+            xtimer_arm(dev->refresh_timer, &timeleft);
+        return;
+    }
+    if (!list_is_empty(dev->acts))
+        return;                     /* try again when the device is idle */
+
+    if (dev->scripts->script[com] != NULL) {
+        act = _create_action(dev, com, NULL, NULL, NULL, NULL, 0, NULL);
+        list_append(dev->acts, act);
+    } else if (dev->scripts->script[PM_STATUS_PLUGS] != NULL) {
+        PlugListIterator itr = pluglist_iterator_create(dev->plugs);
+        Plug *plug;
+
+        while ((plug = pluglist_next(itr))) {
+            List plugs;
+
+            if (plug->node == NULL)
+                continue;
+            plugs = list_create(NULL);
+            list_append(plugs, plug);
+            act = _create_action(dev, PM_STATUS_PLUGS, plugs, NULL, NULL,
+                                 NULL, 0, NULL);
+            list_append(dev->acts, act);
+        }
+        pluglist_iterator_destroy(itr);
+    } else
+        return;
+
+    xtimer_gettime(&dev->last_refresh);
+    xtimer_arm(dev->refresh_timer, &dev->refresh_period);
+    dbg(DBG_ACTION, "%s: enqueuing status refresh", dev->name);
+    _set_runnable(dev);
+}
+
+/*
+ * Initiate connects to all devices in a shard.
+ */
+static void _shard_connect(Shard *sh)
 {
     Device *dev;
     ListIterator itr;
 
-    itr = list_iterator_create(dev_devices);
+    itr = list_iterator_create(sh->devices);
     while ((dev = list_next(itr))) {
         assert(dev->connect_state == DEV_NOT_CONNECTED);
         _connect(dev);
+        _update_poll(dev);
+        _set_runnable(dev);
+    }
+    list_iterator_destroy(itr);
+}
+
+static void _shard_post_poll(Shard *sh, struct timeval *timeout);
+
+/*
+ * Worker thread: run a shard's poll loop until dev_fini() says stop.
+ */
+static void *_shard_main(void *arg)
+{
+    Shard *sh = arg;
+    struct timeval tmout;
+
+    _shard_connect(sh);
+    _shard_post_poll(sh, &tmout);
+    while (!_shard_done(sh)) {
+        xpoll(sh->pfd, timerisset(&tmout) ? &tmout : NULL);
+        xpollfd_dispatch(sh->pfd);
+        _shard_post_poll(sh, &tmout);
     }
+    return NULL;
+}
+
+/*
+ * Called prior to the select loop to assign devices to shards
+ * and initiate connects to all devices.
+ */
+void dev_initial_connect(void)
+{
+    Device *dev;
+    ListIterator itr;
+    sigset_t all, saved;
+    int i = 0;
+
+    dev_nshards = dev_nthreads > 0 ? dev_nthreads : 1;
+    dev_shards = (Shard **) xmalloc(dev_nshards * sizeof(Shard *));
+    for (i = 0; i < dev_nshards; i++)
+        dev_shards[i] = _shard_create(dev_nthreads > 0);
+
+    i = 0;
+    itr = list_iterator_create(dev_devices);
+    while ((dev = list_next(itr)))
+        _shard_add(dev_shards[i++ % dev_nshards], dev);
     list_iterator_destroy(itr);
+
+    if (dev_nthreads == 0) {
+        _shard_connect(dev_shards[0]);
+        return;
+    }
+
+    dev_notices = list_create((ListDelF) _destroy_notice);
+    _create_wakefds(dev_notice_fds);
+    xpollfd_add(dev_pfd, dev_notice_fds[0], XPOLLIN, _notices_ready, NULL);
+
+    /* signals are handled by the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (i = 0; i < dev_nshards; i++) {
+        Shard *sh = dev_shards[i];
+        int e;
+
+        xpollfd_add(sh->pfd, sh->wakefds[0], XPOLLIN, _inbox_ready, sh);
+        if ((e = pthread_create(&sh->thread, NULL, _shard_main, sh)) != 0) {
+            errno = e;
+            err_exit(true, "pthread_create");
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
 }
 
 /*
@@ -1517,6 +2815,7 @@ _handle_ready_device(Device *dev, short flags)
     if (flags & XPOLLOUT) {
         if (dev->connect_state == DEV_CONNECTING) {
             assert(dev->finish_connect != NULL);
+            _unregister_poll(dev);  /* fd may be closed and replaced */
             if (!dev->finish_connect(dev))
                 goto ioerr;
             if (dev->connect_state == DEV_CONNECTED)
@@ -1542,82 +2841,150 @@ ioerr:
 }
 
 /*
- * Called before poll to ready pfd.
+ * Remove device fd from the poll set.  This must be called before
+ * the fd is closed.
  */
-void dev_pre_poll(xpollfd_t pfd)
+static void _unregister_poll(Device *dev)
 {
-    Device *dev;
-    ListIterator itr;
+    if (dev->poll_fd != NO_FD) {
+        xpollfd_del(dev->shard->pfd, dev->poll_fd);
+        dev->poll_fd = NO_FD;
+    }
+}
 
-    itr = list_iterator_create(dev_devices);
-    while ((dev = list_next(itr))) {
-        short flags = 0;
+/* Poll callback: device is ready for I/O or has an error. */
+static void _device_ready(int fd, short flags, void *arg)
+{
+    Device *dev = arg;
 
-        if (dev->fd < 0)
-            continue;
+    assert(fd == dev->poll_fd);
+    if (_handle_ready_device(dev, flags))
+        dev->ioerr = true;
+    _set_runnable(dev);
+}
 
-        /* always set read set bits so select will unblock if the
-         * connection is dropped.
-         */
-        flags |= XPOLLIN;
+/*
+ * Register device fd with the poll set if it isn't already, and update
+ * poll interest to reflect connection state and the outgoing buffer.
+ */
+static void _update_poll(Device *dev)
+{
+    int fd = dev->connect_state != DEV_NOT_CONNECTED ? dev->fd : NO_FD;
+    short flags;
 
-        /* need to be in the write set if we are sending anything */
-        if (dev->connect_state == DEV_CONNECTED) {
-            if (!cbuf_is_empty(dev->to))
-                flags |= XPOLLOUT;
-        }
+    if (dev->poll_fd != fd)
+        _unregister_poll(dev);
+    if (fd == NO_FD)
+        return;
 
-        /* descriptor will become writable after a connect */
-        if (dev->connect_state == DEV_CONNECTING)
-            flags |= XPOLLOUT;
+    /* always poll for reading so we notice if the connection is dropped */
+    flags = XPOLLIN;
 
-        xpollfd_set(pfd, dev->fd, flags);
+    /* poll for writing if we are sending anything */
+    if (dev->connect_state == DEV_CONNECTED) {
+        if (!cbuf_is_empty(dev->to))
+            flags |= XPOLLOUT;
     }
-    list_iterator_destroy(itr);
+
+    /* descriptor will become writable after a connect */
+    if (dev->connect_state == DEV_CONNECTING)
+        flags |= XPOLLOUT;
+
+    if (dev->poll_fd == NO_FD) {
+        xpollfd_add(dev->shard->pfd, fd, flags, _device_ready, dev);
+        dev->poll_fd = fd;
+    } else
+        xpollfd_mod(dev->shard->pfd, fd, flags);
+}
+
+/*
+ * Visit one device: handle I/O errors, reconnect, ping, and script
+ * processing.  Device timers are armed for anything that must happen later.
+ */
+static void _run_device(Device *dev)
+{
+    bool ioerr = dev->ioerr;
+
+    dev->ioerr = false;
+
+    /* Either initiate reconnect or arm the retry timer (for backoff)
+     * so poll will unblock then.  If successful, _reconnect()
+     * will enqueue a login action which will need processing below.
+     */
+    if (ioerr || dev->connect_state == DEV_NOT_CONNECTED)
+        _reconnect(dev); /* can update dev->connect_state */
+
+    /* If we are periodically "pinging" this device, we may need to
+     * enqueue a ping action, or arm the ping timer so poll will
+     * unblock when it is time to enqueue one.
+     */
+    if (dev->connect_state == DEV_CONNECTED)
+        _enqueue_ping(dev);
+
+    /* If any actions are enqueued, process them.  This is state machine
+     * activity and I/O to/from cbufs, not device I/O.  Timers are armed so
+     * poll will unblock to handle non-responsive devices, or processing
+     * of scripted delays.  Note that we are not necessarily connected
+     * to the device - users may enqueue actions on an unconnected device,
+     * which expedites a reconnect;  if the reconnect then times out,
+     * we have to time out the actions (e.g. tell the user).
+     */
+    _process_action(dev);
+
+    /* If the status cache is refreshed in the background and the device
+     * is now idle, we may need to enqueue a refresh, or arm the refresh
+     * timer so poll will unblock when it is time to enqueue one.
+     */
+    _enqueue_refresh(dev);
+
+    /* Script processing may have queued data for the device,
+     * or the connection may have changed state.
+     */
+    _update_poll(dev);
 }
 
 /*
- * Called after select to process ready file descriptors, timeouts, etc.
+ * Called after poll callbacks have run.  Visit devices that are runnable
+ * or had a timer expire, and set timeout to the time until the next timer
+ * expires.
  */
-void dev_post_poll(xpollfd_t pfd, struct timeval *timeout)
+static void _shard_post_poll(Shard *sh, struct timeval *timeout)
 {
     Device *dev;
-    ListIterator itr;
 
-    itr = list_iterator_create(dev_devices);
-    while ((dev = list_next(itr))) {
-        short flags = dev->fd != NO_FD ? xpollfd_revents(pfd, dev->fd) : 0;
-        bool ioerr = false;
+    /* devices with expired timers become runnable */
+    xtimerq_run(sh->timers);
 
-        /* A device is "ready", e.g. it can be read/written or has an error */
-        if (flags)
-            ioerr = _handle_ready_device(dev, flags);
+    /* A device stays flagged runnable while it is being visited, so
+     * actions it enqueues on itself don't queue it again.
+     */
+    while ((dev = list_dequeue(sh->runnable))) {
+        Action *act;
 
-        /* Either initiate reconnect or recalculate timeout (for backoff)
-         * so poll will unblock then.  If successful, _reconnect()
-         * will enqueue a login action which will need processing below.
-         */
-        if (ioerr || dev->connect_state == DEV_NOT_CONNECTED)
-            _reconnect(dev, timeout); /* can update dev->connect_state */
+        _run_device(dev);
+        dev->runnable = false;
 
-        /* If we are periodically "pinging" this device, we may need to
-         * enqueue a ping action, or update the timeout so poll will
-         * unblock when it is time to enqueue one.
-         */
-        if (dev->connect_state == DEV_CONNECTED)
-            _enqueue_ping(dev, timeout);
-
-        /* If any actions are enqueued, process them.  This is state machine
-         * activity and I/O to/from cbufs, not device I/O.  Update timeout so
-         * poll will unblock to handle non-responsive devices, or processing
-         * of scripted delays.  Note that we are not necessarily connected
-         * to the device - users may enqueue actions on an unconnected device,
-         * which expedites a reconnect;  if the reconnect then times out,
-         * we have to time out the actions (e.g. tell the user).
+        /* _process_action() bails out after a reconnect, possibly leaving
+         * a fresh login action that hasn't been started yet.
          */
-         _process_action(dev, timeout);
+        if ((act = list_peek(dev->acts)) && !timerisset(&act->time_stamp))
+            _set_runnable(dev);
     }
-    list_iterator_destroy(itr);
+
+    if (!xtimerq_next(sh->timers, timeout))
+        timerclear(timeout);
+}
+
+/*
+ * Called from the main poll loop.  Worker threads run their own shards,
+ * so there is nothing to do here unless the main thread runs the devices.
+ */
+void dev_post_poll(struct timeval *timeout)
+{
+    if (dev_nthreads == 0 && dev_nshards > 0)
+        _shard_post_poll(dev_shards[0], timeout);
+    else
+        timerclear(timeout);
 }
 
 /*
@@ -11,12 +11,11 @@
 #ifndef PM_DEVICE_H
 #define PM_DEVICE_H
 
-void dev_init(bool short_circuit_delay);
+void dev_init(xpollfd_t pfd, bool short_circuit_delay, int nthreads);
 void dev_fini(void);
 void dev_initial_connect(void);
 
-void dev_pre_poll(xpollfd_t pfd);
-void dev_post_poll(xpollfd_t pfd, struct timeval *tv);
+void dev_post_poll(struct timeval *tv);
 
 #endif /* PM_DEVICE_H */
 
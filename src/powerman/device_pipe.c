@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "hostlist.h"
 #include "list.h"
@@ -36,6 +37,7 @@
 #include "pluglist.h"
 #include "arglist.h"
 #include "xregex.h"
+#include "xtimer.h"
 #include "device_private.h"
 #include "device_pipe.h"
 #include "error.h"
@@ -78,6 +80,7 @@ bool pipe_connect(Device * dev)
 {
     int fd[2];
     pid_t pid;
+    sigset_t all, saved;
     PipeDev *pd = (PipeDev *)dev->data;
 
     assert(dev->connect_state == DEV_NOT_CONNECTED);
@@ -85,10 +88,24 @@ bool pipe_connect(Device * dev)
 
     if (socketpair(PF_LOCAL, SOCK_STREAM, 0, fd) < 0)
         err_exit(true, "_pipe_connect(%s): socketpair", dev->name);
+    /* A SIGTERM from pipe_disconnect() that lands before the child has
+     * restored default dispositions would run our handler and be lost.
+     * Hold signals across the fork so it is delivered after exec instead.
+     */
+    sigfillset(&all);
+    (void)pthread_sigmask(SIG_SETMASK, &all, &saved);
     pid = fork();
     if (pid < 0) {
         err_exit(true, "_pipe_connect(%s): fork", dev->name);
     } else if (pid == 0) {      /* child */
+        sigset_t none;
+
+        (void)signal(SIGTERM, SIG_DFL);
+        (void)signal(SIGINT, SIG_DFL);
+        (void)signal(SIGHUP, SIG_DFL);
+        /* device worker threads block signals - don't pass that on */
+        sigemptyset(&none);
+        (void)sigprocmask(SIG_SETMASK, &none, NULL);
         (void)dup2(fd[1], STDIN_FILENO);
         (void)dup2(fd[1], STDOUT_FILENO);
         (void)close(fd[1]);
@@ -96,6 +113,7 @@ bool pipe_connect(Device * dev)
         execv(pd->argv[0], pd->argv);
         err_exit(true, "exec %s", pd->argv[0]);
     } else {                    /* parent */
+        (void)pthread_sigmask(SIG_SETMASK, &saved, NULL);
         (void)close(fd[1]);
 
         nonblock_set(fd[0]);
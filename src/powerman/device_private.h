@@ -59,7 +59,11 @@ typedef struct {
 } ResultInterp;
 
 /*
- * A Script is a list of Stmts.
+ * A Script is compiled into a flat array of Stmts, which is stepped through
+ * by a program counter.  Blocks become jumps: a foreach stmt jumps past its
+ * block once the plugs are exhausted and the block ends with a STMT_LOOP
+ * back to the foreach; ifon/ifoff jump past their block if the condition
+ * is not met.
  */
 typedef enum {
     STMT_SEND,
@@ -71,10 +75,12 @@ typedef enum {
     STMT_FOREACHNODE,
     STMT_IFOFF,
     STMT_IFON,
+    STMT_LOOP,
 } StmtType;
 
 typedef struct {
     StmtType type;
+    int depth;                  /* number of enclosing foreach blocks */
     union {
         struct {                /* SEND */
             char *fmt;          /* printf(fmt, ...) style format string */
@@ -97,20 +103,55 @@ typedef struct {
             struct timeval tv;  /* delay at this point in the script */
         } delay;
         struct {                /* FOREACHPLUG | FOREACHNODE */
-            List stmts;         /* list of statements to exec in a loop */
+            int end;            /* index of stmt following the block */
         } foreach;
+        struct {                /* LOOP */
+            int start;          /* index of foreach stmt heading the block */
+        } loop;
         struct {                /* IFON | IFOFF */
-            List stmts;         /* list of statements to exec conditionally */
+            int end;            /* index of stmt following the block */
         } ifonoff;
     } u;
 } Stmt;
-typedef List Script;
+
+typedef struct {
+    Stmt *stmts;                /* array of stmts */
+    int len;                    /* number of stmts */
+    int depth;                  /* deepest nesting of foreach blocks */
+} Script;
+
+/*
+ * The compiled scripts of a device specification, shared by all devices
+ * created from it.  Scripts are not modified once compiled; the state of
+ * a running script is kept in its Action.
+ */
+typedef struct {
+    Script *script[NUM_SCRIPTS];/* array of scripts (NULL if undefined) */
+    int refcount;
+} ScriptSet;
 
 /*
  * Device
  */
 typedef enum { DEV_NOT_CONNECTED, DEV_CONNECTING, DEV_CONNECTED } ConnectState;
 
+/* Priority classes of actions.  A device runs queued actions of a higher
+ * class (lower value) first.
+ */
+typedef enum { PRIO_CONTROL, PRIO_QUERY, PRIO_BACKGROUND } ActPrio;
+#define NUM_PRIOS       3
+
+/* Latency of the actions of one priority class completed by a device,
+ * measured from when the action was enqueued.
+ */
+typedef struct {
+    int count;                  /* actions completed */
+    struct timeval wait_total;  /* time spent queued before starting */
+    struct timeval wait_max;
+    struct timeval total;       /* time until completion */
+    struct timeval max;
+} LatencyStat;
+
 typedef struct _device {
     char *name;                 /* name of device */
 
@@ -122,6 +163,11 @@ typedef struct _device {
     xregex_match_t xmatch;      /* cache regex matches for future $N ref */
 
     int fd;                     /* socket, serial device, or pty */
+    int poll_fd;                /* fd registered with poll set (or NO_FD) */
+    bool ioerr;                 /* I/O error seen in poll callback */
+    bool runnable;              /* queued for a visit by dev_post_poll */
+    struct dev_shard *shard;    /* poll loop that runs this device */
+    int index;                  /* position in config file */
 
     List acts;                  /* queue of Actions */
 
@@ -129,9 +175,13 @@ typedef struct _device {
 
     cbuf_t to;                  /* buffer -> device */
     cbuf_t from;                /* buffer <- device */
+    char *scan;                 /* input moved from 'from' for expect */
+    int scanlen;                /* bytes of input in 'scan' */
+    int scansize;               /* allocated size of 'scan' */
+    xregex_t scanfail;          /* last regex that didn't match 'scan' */
 
     PlugList plugs;             /* list of Plugs (node name <-> plug name) */
-    Script scripts[NUM_SCRIPTS]; /* array of scripts */
+    ScriptSet *scripts;         /* scripts shared with devices of same spec */
 
     struct timeval last_retry;  /* time of last reconnect retry */
     int retry_count;            /* number of retries attempted */
@@ -139,8 +189,18 @@ typedef struct _device {
     struct timeval last_ping;   /* time of last ping (if any) */
     struct timeval ping_period; /* configurable ping period (0.0 = none) */
 
+    struct timeval last_refresh;   /* time of last background refresh */
+    struct timeval refresh_period; /* configurable refresh period (0 = none) */
+
+    xtimer_t retry_timer;       /* reconnect backoff */
+    xtimer_t ping_timer;        /* next ping */
+    xtimer_t refresh_timer;     /* next background refresh */
+    xtimer_t action_timer;      /* timeout of current action */
+    xtimer_t delay_timer;       /* scripted delay */
+
     int stat_successful_connects;
     int stat_successful_actions;
+    LatencyStat stat_latency[NUM_PRIOS];
                                 /* network (e.g. tcp/serial)-specific methods */
     bool (*connect)(struct _device *dev);
     bool (*finish_connect)(struct _device *dev);
@@ -159,15 +219,31 @@ typedef void (*VerbosePrintf) (int client_id, const char *fmt, ...)
     __attribute__ ((format (printf, 2, 3)));
 typedef void (*DiagPrintf) (int client_id, const char *fmt, ...)
     __attribute__ ((format (printf, 2, 3)));
+typedef void (*ResultCB) (int client_id, int nodeid, InterpState state,
+                          const char *val);
+typedef void (*StateCB) (int nodeid, InterpState state);
 
 #define MIN_DEV_BUF     1024
 #define MAX_DEV_BUF     1024*64
 
 void dev_add(Device * dev);
-int dev_enqueue_actions(int com, hostlist_t hl, ActionCB complete_fun,
+void dev_index_nodes(void);
+int dev_enqueue_actions(int com, ActionCB complete_fun,
                         VerbosePrintf vpf_fun, DiagPrintf dpf_fun,
-                        int client_id, ArgList arglist);
-bool dev_check_actions(int com, hostlist_t hl);
+                        ResultCB result_fun, int client_id, ArgList arglist,
+                        bool *cached);
+bool dev_check_actions(int com, ArgList arglist);
+void dev_cancel_actions(int client_id);
+void dev_watch_states(StateCB state_fun);
+
+Script *dev_script_create(int len);
+void dev_script_destroy(Script *script);
+ScriptSet *dev_scriptset_create(void);
+ScriptSet *dev_scriptset_link(ScriptSet *scripts);
+void dev_scriptset_unlink(ScriptSet *scripts);
+
+void dev_get_latency(Device *dev, ActPrio prio, LatencyStat *stat);
+const char *dev_prio_name(ActPrio prio);
 
 Device *dev_create(const char *name);
 void dev_destroy(Device * dev);
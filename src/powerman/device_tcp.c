@@ -44,6 +44,7 @@
 #include "pluglist.h"
 #include "arglist.h"
 #include "xregex.h"
+#include "xtimer.h"
 #include "device_private.h"
 #include "error.h"
 #include "debug.h"
@@ -375,12 +376,17 @@ static void _telnet_init(Device * dev)
  */
 static void _telnet_preprocess(Device * dev)
 {
-    static unsigned char peek[MAX_DEV_BUF];
-    static unsigned char device[MAX_DEV_BUF];
+    unsigned char *peek;
+    unsigned char *device;
     TcpDev *tcp = (TcpDev *)dev->data;
     int len, i, k;
 
-    len = cbuf_peek(dev->from, peek, MAX_DEV_BUF);
+    /* not static: devices may be run by concurrent threads */
+    if ((len = cbuf_used(dev->from)) <= 0)
+        return;
+    peek = (unsigned char *)xmalloc(len);
+    device = (unsigned char *)xmalloc(len);
+    len = cbuf_peek(dev->from, peek, len);
     for (i = 0, k = 0; i < len; i++) {
         switch (tcp->tstate) {
         case TELNET_NONE:
@@ -425,6 +431,8 @@ static void _telnet_preprocess(Device * dev)
         if (n < k)
             err((n < 0), "_telnet_preprocess: cbuf_write returned %d", n);
     }
+    xfree(peek);
+    xfree(device);
 }
 
 /*
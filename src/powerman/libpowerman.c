@@ -37,6 +37,13 @@
 
 struct pm_handle_struct {
     int         pmh_fd;
+    int         pmh_tagged;     /* server is in tagged mode */
+    unsigned    pmh_seq;        /* tag for next request */
+    char *      pmh_buf;        /* unparsed input (tagged mode) */
+    int         pmh_buflen;
+    int         pmh_count;
+    struct pm_request_struct *pmh_reqs; /* requests not yet waited for */
+    struct list_struct *pmh_events; /* watch events not yet returned */
 };
 
 
@@ -52,10 +59,22 @@ struct pm_node_iterator_struct {
     struct list_struct *pmi_pos;
 };
 
+struct pm_request_struct {
+    pm_handle_t         req_pmh;        /* handle (NULL once waited for) */
+    unsigned            req_tag;
+    int                 req_complete;
+    pm_err_t            req_err;        /* result, once complete */
+    pm_request_type_t   req_type;
+    struct list_struct *req_resp;       /* response lines, minus the tag */
+    struct pm_request_struct *req_next;
+};
+
+/* request line for each pm_request_type_t */
+static char *req_cmd[] = { CP_STATUS, CP_ON, CP_OFF, CP_CYCLE };
+
 static pm_err_t _list_add(struct list_struct **head, char *s,
                                 list_free_t freefun);
 static void     _list_free(struct list_struct **head);
-static int      _list_search(struct list_struct *head, char *s);
 
 static int      _strncmpend(char *s1, char *s2, int len);
 static char *   _strndup(char *s, int len);
@@ -66,9 +85,20 @@ static pm_err_t _parse_response(char *buf, int len,
                                 struct list_struct **respp);
 static pm_err_t _server_recv_response(pm_handle_t pmh,
                                 struct list_struct **respp);
-static pm_err_t _server_send_command(pm_handle_t pmh, char *cmd, char *arg);
+static pm_err_t _server_send_command(pm_handle_t pmh, pm_request_t req,
+                                char *cmd, char *arg);
 static pm_err_t _server_command(pm_handle_t pmh, char *cmd, char *arg,
                                 struct list_struct **respp);
+static pm_err_t _server_read(pm_handle_t pmh, int flags);
+static pm_err_t _server_buf_line(pm_handle_t pmh, char **linep);
+static pm_err_t _server_recv_line(pm_handle_t pmh, char **linep);
+static pm_err_t _request_create(pm_handle_t pmh, char *cmd, char *arg,
+                                pm_request_t *reqp);
+static pm_err_t _request_wait(pm_handle_t pmh, pm_request_t want,
+                                pm_request_t *reqp);
+static pm_err_t _event_add(pm_handle_t pmh, char *line);
+static int      _parse_node_state(char *line, char *code, char **nodep,
+                                int *lenp, pm_node_state_t *statep);
 
 
 /* Add [s] to the list referenced by [head], registering [freefun] to
@@ -104,20 +134,6 @@ _list_free(struct list_struct **head)
     *head = NULL;
 }
 
-/* Scan the list referenced by [head] looking for an element containing
- * exactly the string [s], returning true if found.
- */
-static int
-_list_search(struct list_struct *head, char *s)
-{
-    struct list_struct *lp;
-
-    for (lp = head; lp != NULL; lp = lp->next)
-        if (strcmp(lp->data, s) == 0)
-            return 1;
-    return 0;
-}
-
 /* Test if [s2] is a terminating substring of [s1].
  */
 static int
@@ -179,6 +195,7 @@ _connect_to_server_tcp(pm_handle_t pmh, char *server, int family)
             continue;
         if (connect(pmh->pmh_fd, r->ai_addr, r->ai_addrlen) < 0) {
             close(pmh->pmh_fd);
+            pmh->pmh_fd = -1;
             continue;
         }
         err = PM_ESUCCESS;
@@ -236,6 +253,10 @@ _server_retcode(struct list_struct *resp)
                 case 103:   /* query complete */
                 case 104:   /* telemetry on|off */
                 case 105:   /* hostrange expansion on|off */
+                case 106:   /* tagged mode on|off */
+                case 107:   /* result streaming on|off */
+                case 108:   /* watching */
+                case 109:   /* watch cancelled */
                     err = PM_ESUCCESS;
                     break;
                 case PM_EUNKNOWN:
@@ -260,7 +281,8 @@ _server_retcode(struct list_struct *resp)
 }
 
 /* Read response from server handle [pmh] and store it in
- * [resp], an array of lines.  Caller must free [resp].
+ * [resp], an array of lines.  Caller must free [resp], which is
+ * returned even if the server reported an error.
  */
 static pm_err_t
 _server_recv_response(pm_handle_t pmh, struct list_struct **respp)
@@ -295,7 +317,7 @@ _server_recv_response(pm_handle_t pmh, struct list_struct **respp)
         err = _parse_response(buf, count, &resp);
         if (err == PM_ESUCCESS) {
             err = _server_retcode(resp);
-            if (err == PM_ESUCCESS && respp != NULL)
+            if (respp != NULL)
                 *respp = resp;
             else
                 _list_free(&resp);
@@ -308,16 +330,18 @@ _server_recv_response(pm_handle_t pmh, struct list_struct **respp)
 
 /* Send command [cmd] with argument [arg] to server handle [pmh].
  * [cmd] is treated as a printf format string with [arg] as the
- * first printf argument (can be NULL).
+ * first printf argument (can be NULL).  If [req] is non-NULL,
+ * the command is prefixed with its tag.
  */
 static pm_err_t
-_server_send_command(pm_handle_t pmh, char *cmd, char *arg)
+_server_send_command(pm_handle_t pmh, pm_request_t req, char *cmd, char *arg)
 {
     char buf[CP_LINEMAX];
     int count, len, n;
     pm_err_t err = PM_ESUCCESS;
 
-    snprintf(buf, sizeof(buf), cmd, arg);
+    count = req ? snprintf(buf, sizeof(buf), "%u ", req->req_tag) : 0;
+    snprintf(buf + count, sizeof(buf) - count, cmd, arg);
     snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), CP_EOL);
     count = 0;
     len = strlen(buf);
@@ -334,20 +358,326 @@ _server_send_command(pm_handle_t pmh, char *cmd, char *arg)
 
 /* Send command [cmd] with argument [arg] to server handle [pmh].
  * If [respp] is non-NULL, return list of response lines which
- * the caller must free.
+ * the caller must free (even if the server reported an error).
  */
 static pm_err_t
 _server_command(pm_handle_t pmh, char *cmd, char *arg, struct list_struct **respp)
 {
+    pm_request_t req;
     pm_err_t err;
 
-    if ((err = _server_send_command(pmh, cmd, arg)) != PM_ESUCCESS)
+    if (respp != NULL)
+        *respp = NULL;
+    if (pmh->pmh_tagged) {
+        if ((err = _request_create(pmh, cmd, arg, &req)) != PM_ESUCCESS)
+            return err;
+        if ((err = _request_wait(pmh, req, NULL)) == PM_ESUCCESS) {
+            err = req->req_err;
+            if (respp != NULL) {
+                *respp = req->req_resp;
+                req->req_resp = NULL;
+            }
+        }
+        pm_request_destroy(req);
+        return err;
+    }
+    if ((err = _server_send_command(pmh, NULL, cmd, arg)) != PM_ESUCCESS)
         return err;
     if ((err = _server_recv_response(pmh, respp)) != PM_ESUCCESS)
         return err;
     return PM_ESUCCESS;
 }
 
+/* Append whatever server handle [pmh] has to say to the handle's input
+ * buffer, passing [flags] to recv().  With MSG_DONTWAIT, having nothing
+ * to read is not an error.
+ */
+static pm_err_t
+_server_read(pm_handle_t pmh, int flags)
+{
+    int n;
+    char *buf;
+
+    if (pmh->pmh_buflen - pmh->pmh_count == 0) {
+        buf = realloc(pmh->pmh_buf, pmh->pmh_buflen + CP_LINEMAX);
+        if (buf == NULL)
+            return PM_ENOMEM;
+        pmh->pmh_buf = buf;
+        pmh->pmh_buflen += CP_LINEMAX;
+    }
+    n = recv(pmh->pmh_fd, pmh->pmh_buf + pmh->pmh_count,
+             pmh->pmh_buflen - pmh->pmh_count, flags);
+    if (n == 0)
+        return PM_ESERVEREOF;
+    if (n < 0) {
+        if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return PM_ESUCCESS;
+        return PM_ERRNOVALID;
+    }
+    pmh->pmh_count += n;
+    return PM_ESUCCESS;
+}
+
+/* Remove the first complete line from the input buffer of server handle
+ * [pmh] and return it in [linep], or set [linep] to NULL if there is no
+ * complete line yet.  Caller must free [linep].
+ */
+static pm_err_t
+_server_buf_line(pm_handle_t pmh, char **linep)
+{
+    int i, l = strlen(CP_EOL);
+
+    *linep = NULL;
+    for (i = 0; i <= pmh->pmh_count - l; i++)
+        if (strncmp(&pmh->pmh_buf[i], CP_EOL, l) == 0)
+            break;
+    if (i > pmh->pmh_count - l)
+        return PM_ESUCCESS;
+    if (!(*linep = _strndup(pmh->pmh_buf, i + l)))
+        return PM_ENOMEM;
+    pmh->pmh_count -= i + l;
+    memmove(pmh->pmh_buf, pmh->pmh_buf + i + l, pmh->pmh_count);
+    return PM_ESUCCESS;
+}
+
+/* Read one line from server handle [pmh] in tagged mode, where responses
+ * are not followed by a prompt.  Data read past the end of the line is
+ * kept in the handle for the next call.  Caller must free [linep].
+ */
+static pm_err_t
+_server_recv_line(pm_handle_t pmh, char **linep)
+{
+    pm_err_t err;
+
+    for (;;) {
+        if ((err = _server_buf_line(pmh, linep)) != PM_ESUCCESS)
+            return err;
+        if (*linep != NULL)
+            return PM_ESUCCESS;
+        if ((err = _server_read(pmh, 0)) != PM_ESUCCESS)
+            return err;
+    }
+}
+
+/* Put server handle [pmh] in tagged mode.
+ */
+static pm_err_t
+_server_tagged_mode(pm_handle_t pmh)
+{
+    struct list_struct *resp = NULL;
+    char *line;
+    int code;
+    pm_err_t err;
+
+    if ((err = _server_send_command(pmh, NULL, CP_TAGGED, NULL)) != PM_ESUCCESS)
+        return err;
+    if ((err = _server_recv_line(pmh, &line)) != PM_ESUCCESS)
+        return err;
+    if ((err = _list_add(&resp, line, (list_free_t)free)) != PM_ESUCCESS) {
+        free(line);
+        return err;
+    }
+    if ((err = _server_retcode(resp)) == PM_ESUCCESS) {
+        if (sscanf(line, "%d ", &code) == 1 && code == 106)
+            pmh->pmh_tagged = 1;
+        else
+            err = PM_ESERVERPARSE;
+    }
+    _list_free(&resp);
+    return err;
+}
+
+/* Create request for command [cmd] with argument [arg], send it to
+ * server handle [pmh], and add it to the handle's outstanding requests.
+ */
+static pm_err_t
+_request_create(pm_handle_t pmh, char *cmd, char *arg, pm_request_t *reqp)
+{
+    pm_request_t req, *rp;
+    pm_err_t err;
+
+    if (!(req = malloc(sizeof(struct pm_request_struct))))
+        return PM_ENOMEM;
+    req->req_pmh = pmh;
+    req->req_tag = pmh->pmh_seq++;
+    req->req_complete = 0;
+    req->req_err = PM_EINPROGRESS;
+    req->req_type = PM_REQ_STATUS;
+    req->req_resp = NULL;
+    req->req_next = NULL;
+    if ((err = _server_send_command(pmh, req, cmd, arg)) != PM_ESUCCESS) {
+        free(req);
+        return err;
+    }
+    for (rp = &pmh->pmh_reqs; *rp != NULL; rp = &(*rp)->req_next)
+        ;
+    *rp = req;
+    *reqp = req;
+    return PM_ESUCCESS;
+}
+
+/* Remove request [req] from its handle's list.
+ */
+static void
+_request_unlink(pm_request_t req)
+{
+    pm_request_t *rp;
+
+    if (req->req_pmh == NULL)
+        return;
+    for (rp = &req->req_pmh->pmh_reqs; *rp != NULL; rp = &(*rp)->req_next) {
+        if (*rp == req) {
+            *rp = req->req_next;
+            break;
+        }
+    }
+    req->req_pmh = NULL;
+    req->req_next = NULL;
+}
+
+/* Queue watch event [line] on server handle [pmh] for pm_event_wait().
+ * Takes ownership of [line].
+ */
+static pm_err_t
+_event_add(pm_handle_t pmh, char *line)
+{
+    struct list_struct **lp;
+
+    for (lp = &pmh->pmh_events; *lp != NULL; lp = &(*lp)->next)
+        ;
+    if (_list_add(lp, line, (list_free_t)free) != PM_ESUCCESS) {
+        free(line);
+        return PM_ENOMEM;
+    }
+    return PM_ESUCCESS;
+}
+
+/* Add tagged response [line] from server handle [pmh] to its request,
+ * completing the request if it is the final line of the response.
+ * Watch events, which carry the tag of a completed request, are queued
+ * on the handle instead.  Takes ownership of [line].
+ */
+static pm_err_t
+_request_dispatch(pm_handle_t pmh, char *line)
+{
+    pm_request_t req;
+    unsigned tag;
+    int code, n;
+    char *cpy;
+    pm_err_t err;
+
+    if (sscanf(line, "%u %n", &tag, &n) != 1) {
+        free(line);
+        return PM_ESERVERPARSE;
+    }
+    for (req = pmh->pmh_reqs; req != NULL; req = req->req_next)
+        if (req->req_tag == tag && !req->req_complete)
+            break;
+    cpy = strdup(line + n);
+    free(line);
+    if (cpy == NULL)
+        return PM_ENOMEM;
+    if (sscanf(cpy, "%d ", &code) == 1 && code == 311)
+        return _event_add(pmh, cpy);
+    if (req == NULL) {              /* request was destroyed (or bogus) */
+        free(cpy);
+        return PM_ESUCCESS;
+    }
+    if ((err = _list_add(&req->req_resp, cpy, (list_free_t)free))
+                                                            != PM_ESUCCESS) {
+        free(cpy);
+        return err;
+    }
+    if (sscanf(cpy, "%d ", &code) == 1 && CP_IS_ALLDONE(code)) {
+        req->req_err = _server_retcode(req->req_resp);
+        req->req_complete = 1;
+    }
+    return PM_ESUCCESS;
+}
+
+/* Read responses from server handle [pmh] until request [want] completes,
+ * or if [want] is NULL, until any request completes and return it in [reqp].
+ */
+static pm_err_t
+_request_wait(pm_handle_t pmh, pm_request_t want, pm_request_t *reqp)
+{
+    pm_request_t req;
+    char *line;
+    pm_err_t err;
+
+    for (;;) {
+        for (req = pmh->pmh_reqs; req != NULL; req = req->req_next) {
+            if (req->req_complete && (want == NULL || req == want)) {
+                if (reqp)
+                    *reqp = req;
+                return PM_ESUCCESS;
+            }
+        }
+        if (pmh->pmh_reqs == NULL)
+            return PM_ENOREQUEST;
+        if ((err = _server_recv_line(pmh, &line)) != PM_ESUCCESS)
+            return err;
+        if ((err = _request_dispatch(pmh, line)) != PM_ESUCCESS)
+            return err;
+    }
+}
+
+/* Dispatch the complete lines already read from server handle [pmh]
+ * without reading any more.
+ */
+static pm_err_t
+_request_dispatch_buffered(pm_handle_t pmh)
+{
+    char *line;
+    pm_err_t err;
+
+    for (;;) {
+        if ((err = _server_buf_line(pmh, &line)) != PM_ESUCCESS)
+            return err;
+        if (line == NULL)
+            return PM_ESUCCESS;
+        if ((err = _request_dispatch(pmh, line)) != PM_ESUCCESS)
+            return err;
+    }
+}
+
+/* Build a result array from status response [resp], in the order the
+ * server listed the nodes.  [err] is the result of the whole query:
+ * if it is PM_EQUERY, nodes whose state is unknown get that error.
+ */
+static pm_err_t
+_results_status(struct list_struct *resp, pm_err_t err,
+                pm_node_result_t **resultsp, int *countp)
+{
+    struct list_struct *lp;
+    pm_node_result_t *results;
+    pm_node_state_t state;
+    char *name;
+    int i, len, n = 0;
+
+    for (lp = resp; lp != NULL; lp = lp->next)
+        if (_parse_node_state(lp->data, "303 ", &name, &len, &state))
+            n++;
+    if (!(results = calloc(n > 0 ? n : 1, sizeof(pm_node_result_t))))
+        return PM_ENOMEM;
+    i = n;
+    for (lp = resp; lp != NULL; lp = lp->next) {  /* resp is newest first */
+        if (!_parse_node_state(lp->data, "303 ", &name, &len, &state))
+            continue;
+        i--;
+        if (!(results[i].node = _strndup(name, len))) {
+            pm_results_free(results, n);
+            return PM_ENOMEM;
+        }
+        results[i].state = state;
+        results[i].err = (state == PM_UNKNOWN && err == PM_EQUERY)
+                         ? PM_EQUERY : PM_ESUCCESS;
+    }
+    *resultsp = results;
+    *countp = n;
+    return PM_ESUCCESS;
+}
+
 pm_err_t
 pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
 {
@@ -358,27 +688,32 @@ pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags)
         return PM_EBADARG;
     if ((pmh = (pm_handle_t)malloc(sizeof(struct pm_handle_struct))) == NULL)
         return PM_ENOMEM;
+    pmh->pmh_fd = -1;
+    pmh->pmh_tagged = 0;
+    pmh->pmh_seq = 1;
+    pmh->pmh_buf = NULL;
+    pmh->pmh_buflen = pmh->pmh_count = 0;
+    pmh->pmh_reqs = NULL;
+    pmh->pmh_events = NULL;
 
     if ((err = _connect_to_server_tcp(pmh, server, (flags & PM_CONN_INET6)
-                                ? PF_INET6 : PF_UNSPEC)) != PM_ESUCCESS) {
-        (void)close(pmh->pmh_fd);
-        free(pmh);
-        return err;
-    }
-    if ((err = _server_recv_response(pmh, NULL)) != PM_ESUCCESS) {
-        (void)close(pmh->pmh_fd);
-        free(pmh);
-        return err;
-    }
-    if ((err = _server_command(pmh, CP_EXPRANGE, NULL, NULL)) != PM_ESUCCESS) {
+                                ? PF_INET6 : PF_UNSPEC)) != PM_ESUCCESS)
+        goto cleanup;
+    if ((err = _server_recv_response(pmh, NULL)) != PM_ESUCCESS)
+        goto cleanup;
+    if ((err = _server_command(pmh, CP_EXPRANGE, NULL, NULL)) != PM_ESUCCESS)
+        goto cleanup;
+    if ((flags & PM_CONN_TAGGED)
+            && (err = _server_tagged_mode(pmh)) != PM_ESUCCESS)
+        goto cleanup;
+    *pmhp = pmh;
+    return PM_ESUCCESS;
+cleanup:
+    if (pmh->pmh_fd >= 0)
         (void)close(pmh->pmh_fd);
-        free(pmh);
-        return err;
-    }
-    if (err == PM_ESUCCESS)
-        *pmhp = pmh;
-    else
-        free(pmh);
+    if (pmh->pmh_buf)
+        free(pmh->pmh_buf);
+    free(pmh);
     return err;
 }
 
@@ -416,6 +751,7 @@ pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip)
         return err;
     if ((err = _server_command(pmh, CP_NODES, NULL, &resp)) != PM_ESUCCESS) {
         pm_node_iterator_destroy(pmi);
+        _list_free(&resp);
         return err;
     }
     for (lp = resp; lp != NULL; lp = lp->next) {
@@ -459,41 +795,93 @@ pm_node_iterator_reset(pm_node_iterator_t pmi)
 
 
 /* Disconnect from server handle [pmh] and free the handle.
+ * Requests that are still outstanding fail with PM_ESERVEREOF,
+ * but must still be destroyed by the caller.
  */
 void
 pm_disconnect(pm_handle_t pmh)
 {
+    pm_request_t req;
+
     if (pmh != NULL) {
         (void)_server_command(pmh, CP_QUIT, NULL, NULL); /* PM_ESERVEREOF */
         (void)close(pmh->pmh_fd);
+        while ((req = pmh->pmh_reqs) != NULL) {
+            if (!req->req_complete) {
+                req->req_err = PM_ESERVEREOF;
+                req->req_complete = 1;
+            }
+            _request_unlink(req);
+        }
+        if (pmh->pmh_buf)
+            free(pmh->pmh_buf);
+        _list_free(&pmh->pmh_events);
         free(pmh);
     }
 }
 
+/* Split response [line] of the form "<code> node: state", where [code]
+ * includes the trailing space, into the node name at [nodep] of length
+ * [lenp] and its state.  Returns false if [line] does not match.
+ */
+static int
+_parse_node_state(char *line, char *code, char **nodep, int *lenp,
+                  pm_node_state_t *statep)
+{
+    char *p;
+
+    if (strncmp(line, code, strlen(code)) != 0)
+        return 0;
+    line += strlen(code);
+    if (!(p = strstr(line, ": ")))
+        return 0;
+    *nodep = line;
+    *lenp = p - line;
+    p += strlen(": ");
+    if (!strncmp(p, "on" CP_EOL, strlen("on" CP_EOL)))
+        *statep = PM_ON;
+    else if (!strncmp(p, "off" CP_EOL, strlen("off" CP_EOL)))
+        *statep = PM_OFF;
+    else
+        *statep = PM_UNKNOWN;
+    return 1;
+}
+
+/* Scan status response [resp] for the state of [node].
+ */
+static pm_node_state_t
+_resp_node_state(struct list_struct *resp, char *node)
+{
+    pm_node_state_t state;
+    char *name;
+    int len, nodelen = strlen(node);
+
+    for (; resp != NULL; resp = resp->next) {
+        if (_parse_node_state(resp->data, "303 ", &name, &len, &state)
+                && len == nodelen && !memcmp(name, node, len))
+            return state;
+    }
+    return PM_UNKNOWN;
+}
+
 /* Query server [pmh] for the power status of [node], and store it
  * in [statep].
  */
 pm_err_t
 pm_node_status(pm_handle_t pmh, char *node, pm_node_state_t *statep)
 {
-    char offstr[CP_LINEMAX], onstr[CP_LINEMAX];
     pm_err_t err;
     struct list_struct *resp;
     pm_node_state_t state;
 
     if (pmh == NULL)
         return PM_EBADHAND;
-    if ((err = _server_command(pmh, CP_STATUS, node, &resp)) != PM_ESUCCESS)
+    if ((err = _server_command(pmh, CP_STATUS, node, &resp)) != PM_ESUCCESS) {
+        _list_free(&resp);
         return err;
+    }
 
-    snprintf(offstr, sizeof(offstr), CP_INFO_XSTATUS, node, "off");
-    snprintf(onstr,  sizeof(onstr),  CP_INFO_XSTATUS, node, "on");
-    if (_list_search(resp, offstr))
-        state = PM_OFF;
-    else if (_list_search(resp, onstr))
-        state = PM_ON;
-    else
-        state = PM_UNKNOWN;
+    state = _resp_node_state(resp, node);
     _list_free(&resp);
 
     if (statep)
@@ -531,6 +919,280 @@ pm_node_cycle(pm_handle_t pmh, char *node)
     return _server_command(pmh, CP_CYCLE, node, NULL);
 }
 
+/* Query server [pmh] for the power status of each of [nodes] (all nodes
+ * if NULL), returning an array of [countp] results in [resultsp] which
+ * the caller must free with pm_results_free().  If some nodes could not
+ * be queried, PM_EQUERY is returned along with the results.
+ */
+pm_err_t
+pm_nodes_status(pm_handle_t pmh, char *nodes, pm_node_result_t **resultsp,
+                int *countp)
+{
+    struct list_struct *resp = NULL;
+    pm_err_t err, rerr = PM_ESUCCESS;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (resultsp == NULL || countp == NULL)
+        return PM_EBADARG;
+    *resultsp = NULL;
+    *countp = 0;
+    err = _server_command(pmh, nodes ? CP_STATUS : CP_STATUS_ALL, nodes,
+                          &resp);
+    if (err == PM_ESUCCESS || err == PM_EQUERY)
+        rerr = _results_status(resp, err, resultsp, countp);
+    _list_free(&resp);
+    return rerr != PM_ESUCCESS ? rerr : err;
+}
+
+/* Free result array [results] of [count] elements.
+ */
+void
+pm_results_free(pm_node_result_t *results, int count)
+{
+    int i;
+
+    if (results != NULL) {
+        for (i = 0; i < count; i++)
+            if (results[i].node)
+                free(results[i].node);
+        free(results);
+    }
+}
+
+/* Send a request of [type] acting on [nodes] to server [pmh], which must
+ * have been connected with PM_CONN_TAGGED, without waiting for the response.
+ * [nodes] may be NULL for PM_REQ_STATUS to query all nodes.
+ */
+pm_err_t
+pm_request_send(pm_handle_t pmh, pm_request_type_t type, char *nodes,
+                pm_request_t *reqp)
+{
+    char *cmd;
+    pm_err_t err;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged || reqp == NULL || type < PM_REQ_STATUS
+                                         || type > PM_REQ_CYCLE)
+        return PM_EBADARG;
+    cmd = req_cmd[type];
+    if (nodes == NULL) {
+        if (type != PM_REQ_STATUS)
+            return PM_EBADARG;
+        cmd = CP_STATUS_ALL;
+    }
+    if ((err = _request_create(pmh, cmd, nodes, reqp)) != PM_ESUCCESS)
+        return err;
+    (*reqp)->req_type = type;
+    return PM_ESUCCESS;
+}
+
+/* Wait for any outstanding request on server [pmh] to complete and
+ * return it in [reqp].  Each request is returned only once.
+ */
+pm_err_t
+pm_request_wait(pm_handle_t pmh, pm_request_t *reqp)
+{
+    pm_request_t req;
+    pm_err_t err;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (reqp == NULL)
+        return PM_EBADARG;
+    if ((err = _request_wait(pmh, NULL, &req)) != PM_ESUCCESS)
+        return err;
+    _request_unlink(req);
+    *reqp = req;
+    return PM_ESUCCESS;
+}
+
+/* Return the file descriptor connected to server [pmh], so that the
+ * caller can wait for it to become readable in its own event loop and
+ * then call pm_request_poll().  The caller must not read from it.
+ */
+int
+pm_fd(pm_handle_t pmh)
+{
+    return pmh ? pmh->pmh_fd : -1;
+}
+
+/* Read whatever server [pmh], which must have been connected with
+ * PM_CONN_TAGGED, has sent so far, without blocking, and match it up
+ * with outstanding requests.  Completed requests can then be collected
+ * with pm_request_complete().
+ */
+pm_err_t
+pm_request_poll(pm_handle_t pmh)
+{
+    pm_err_t err;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged)
+        return PM_EBADARG;
+    if ((err = _server_read(pmh, MSG_DONTWAIT)) != PM_ESUCCESS)
+        return err;
+    return _request_dispatch_buffered(pmh);
+}
+
+/* Return a completed request on server [pmh] in [reqp] without blocking,
+ * or PM_EINPROGRESS if requests are outstanding but none has completed.
+ * Each request is returned only once.
+ */
+pm_err_t
+pm_request_complete(pm_handle_t pmh, pm_request_t *reqp)
+{
+    pm_request_t req;
+    pm_err_t err;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged || reqp == NULL)
+        return PM_EBADARG;
+    if ((err = _request_dispatch_buffered(pmh)) != PM_ESUCCESS)
+        return err;
+    for (req = pmh->pmh_reqs; req != NULL; req = req->req_next) {
+        if (req->req_complete) {
+            _request_unlink(req);
+            *reqp = req;
+            return PM_ESUCCESS;
+        }
+    }
+    return pmh->pmh_reqs ? PM_EINPROGRESS : PM_ENOREQUEST;
+}
+
+/* Return the result of request [req], or PM_EINPROGRESS if it
+ * has not completed.
+ */
+pm_err_t
+pm_request_result(pm_request_t req)
+{
+    if (req == NULL)
+        return PM_EBADARG;
+    return req->req_complete ? req->req_err : PM_EINPROGRESS;
+}
+
+/* Look up the power status of [node] in the response to completed
+ * status request [req] and store it in [statep].
+ */
+pm_err_t
+pm_request_node_status(pm_request_t req, char *node, pm_node_state_t *statep)
+{
+    if (req == NULL || node == NULL)
+        return PM_EBADARG;
+    if (!req->req_complete)
+        return PM_EINPROGRESS;
+    if (req->req_err != PM_ESUCCESS)
+        return req->req_err;
+    if (statep)
+        *statep = _resp_node_state(req->req_resp, node);
+    return PM_ESUCCESS;
+}
+
+/* Return the per-node results of completed status request [req] as for
+ * pm_nodes_status(), along with the result of the request.
+ */
+pm_err_t
+pm_request_results(pm_request_t req, pm_node_result_t **resultsp, int *countp)
+{
+    pm_err_t err, rerr = PM_ESUCCESS;
+
+    if (req == NULL || resultsp == NULL || countp == NULL
+                    || req->req_type != PM_REQ_STATUS)
+        return PM_EBADARG;
+    if (!req->req_complete)
+        return PM_EINPROGRESS;
+    *resultsp = NULL;
+    *countp = 0;
+    err = req->req_err;
+    if (err == PM_ESUCCESS || err == PM_EQUERY)
+        rerr = _results_status(req->req_resp, err, resultsp, countp);
+    return rerr != PM_ESUCCESS ? rerr : err;
+}
+
+/* Free request [req].  If it is still outstanding, its response is
+ * discarded when it arrives.
+ */
+void
+pm_request_destroy(pm_request_t req)
+{
+    if (req != NULL) {
+        _request_unlink(req);
+        _list_free(&req->req_resp);
+        free(req);
+    }
+}
+
+/* Ask server [pmh], which must have been connected with PM_CONN_TAGGED,
+ * to report changes in the power status of [nodes] (all nodes if NULL),
+ * replacing any nodes watched before.  See pm_event_wait().
+ */
+pm_err_t
+pm_watch(pm_handle_t pmh, char *nodes)
+{
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged)
+        return PM_EBADARG;
+    return _server_command(pmh, nodes ? CP_WATCH : CP_WATCH_ALL, nodes, NULL);
+}
+
+/* Ask server [pmh] to stop reporting power status changes.
+ * Events already received are still returned by pm_event_wait().
+ */
+pm_err_t
+pm_unwatch(pm_handle_t pmh)
+{
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged)
+        return PM_EBADARG;
+    return _server_command(pmh, CP_UNWATCH, NULL, NULL);
+}
+
+/* Wait for a change in the power status of a watched node on server [pmh],
+ * and store the node name in [node] (of size [len]) and its new state
+ * in [statep].  Responses to requests that arrive meanwhile are kept
+ * for pm_request_wait().
+ */
+pm_err_t
+pm_event_wait(pm_handle_t pmh, char *node, int len, pm_node_state_t *statep)
+{
+    struct list_struct *ev;
+    pm_node_state_t state;
+    char *line, *name;
+    int namelen;
+    pm_err_t err;
+
+    if (pmh == NULL)
+        return PM_EBADHAND;
+    if (!pmh->pmh_tagged || node == NULL || len <= 0)
+        return PM_EBADARG;
+    while (pmh->pmh_events == NULL) {
+        if ((err = _server_recv_line(pmh, &line)) != PM_ESUCCESS)
+            return err;
+        if ((err = _request_dispatch(pmh, line)) != PM_ESUCCESS)
+            return err;
+    }
+    ev = pmh->pmh_events;
+    pmh->pmh_events = ev->next;
+    ev->next = NULL;
+
+    if (!_parse_node_state(ev->data, "311 ", &name, &namelen, &state)
+                                                        || namelen >= len) {
+        _list_free(&ev);
+        return PM_ESERVERPARSE;
+    }
+    memcpy(node, name, namelen);
+    node[namelen] = '\0';
+    if (statep)
+        *statep = state;
+    _list_free(&ev);
+    return PM_ESUCCESS;
+}
+
 /* Convert error code to human readable string.
  */
 char *
@@ -564,6 +1226,9 @@ pm_strerror(pm_err_t err, char *str, int len)
         case PM_ESERVERPARSE:
             strncpy(str, "unexpected response from server", len);
             break;
+        case PM_ENOREQUEST:
+            strncpy(str, "no outstanding requests", len);
+            break;
         case PM_EUNKNOWN:
             strncpy(str, "server: unknown command", len);
             break;
@@ -17,6 +17,7 @@
 
 typedef struct pm_handle_struct         *pm_handle_t;
 typedef struct pm_node_iterator_struct  *pm_node_iterator_t;
+typedef struct pm_request_struct        *pm_request_t;
 
 typedef enum {
     PM_UNKNOWN      = 0,
@@ -34,6 +35,7 @@ typedef enum {
     PM_EBADARG      = 6,    /* bad argument */
     PM_ESERVEREOF   = 7,    /* received unexpected EOF from server */
     PM_ESERVERPARSE = 8,    /* unexpected response from server */
+    PM_ENOREQUEST   = 9,    /* no outstanding requests */
     PM_EUNKNOWN     = 201,  /* server: unknown command (201) */
     PM_EPARSE       = 202,  /* server: parse error (202) */
     PM_ETOOLONG     = 203,  /* server: command too long (203) */
@@ -46,9 +48,23 @@ typedef enum {
     PM_EUNIMPL      = 213,  /* server: not implemented by device (213) */
 } pm_err_t;
 
+typedef enum {
+    PM_REQ_STATUS   = 0,
+    PM_REQ_ON       = 1,
+    PM_REQ_OFF      = 2,
+    PM_REQ_CYCLE    = 3,
+} pm_request_type_t;
+
+typedef struct {
+    char *          node;
+    pm_node_state_t state;
+    pm_err_t        err;
+} pm_node_result_t;
+
 /* flags for pm_connect() */
 #define PM_CONN_INET6   1   /* connect using IPv6 only */
 #define PM_CONN_COPROC  2   /* unimplemented */
+#define PM_CONN_TAGGED  4   /* allow concurrent requests (pm_request_*) */
 
 pm_err_t pm_connect(char *server, void *arg, pm_handle_t *pmhp, int flags);
 void     pm_disconnect(pm_handle_t pmh);
@@ -58,11 +74,33 @@ pm_err_t pm_node_on(pm_handle_t pmh, char *node);
 pm_err_t pm_node_off(pm_handle_t pmh, char *node);
 pm_err_t pm_node_cycle(pm_handle_t pmh, char *node);
 
+pm_err_t pm_nodes_status(pm_handle_t pmh, char *nodes,
+                         pm_node_result_t **resultsp, int *countp);
+void     pm_results_free(pm_node_result_t *results, int count);
+
 pm_err_t pm_node_iterator_create(pm_handle_t pmh, pm_node_iterator_t *pmip);
 char *   pm_node_next(pm_node_iterator_t pmi);
 void     pm_node_iterator_reset(pm_node_iterator_t pmi);
 void     pm_node_iterator_destroy(pm_node_iterator_t pmi);
 
+pm_err_t pm_request_send(pm_handle_t pmh, pm_request_type_t type,
+                         char *nodes, pm_request_t *reqp);
+pm_err_t pm_request_wait(pm_handle_t pmh, pm_request_t *reqp);
+int      pm_fd(pm_handle_t pmh);
+pm_err_t pm_request_poll(pm_handle_t pmh);
+pm_err_t pm_request_complete(pm_handle_t pmh, pm_request_t *reqp);
+pm_err_t pm_request_result(pm_request_t req);
+pm_err_t pm_request_node_status(pm_request_t req, char *node,
+                                pm_node_state_t *statep);
+pm_err_t pm_request_results(pm_request_t req, pm_node_result_t **resultsp,
+                            int *countp);
+void     pm_request_destroy(pm_request_t req);
+
+pm_err_t pm_watch(pm_handle_t pmh, char *nodes);
+pm_err_t pm_unwatch(pm_handle_t pmh);
+pm_err_t pm_event_wait(pm_handle_t pmh, char *node, int len,
+                       pm_node_state_t *statep);
+
 char *   pm_strerror(pm_err_t err, char *str, int len);
 
 #define PM_DFLT_PORT           "10101"
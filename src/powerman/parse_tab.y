@@ -33,6 +33,7 @@
 #include "xmalloc.h"
 #include "xpoll.h"
 #include "xregex.h"
+#include "xtimer.h"
 #include "pluglist.h"
 #include "arglist.h"
 #include "device_private.h"
@@ -59,21 +60,25 @@ typedef List PreScript;
 
 /*
  * Unprocessed Protocol (used during parsing).
- * This data will be copied for each instantiation of a device.
+ * This data will be copied for each instantiation of a device, except for
+ * the scripts, which are compiled once and shared.
  */
 typedef struct {
     char *name;                 /* specification name, e.g. "icebox" */
     struct timeval timeout;     /* timeout for this device */
     struct timeval ping_period; /* ping period for this device 0.0 = none */
+    struct timeval refresh_period; /* status refresh period 0.0 = none */
     List plugs;                 /* list of plug names (e.g. "1" thru "10") */
     PreScript prescripts[NUM_SCRIPTS];  /* array of PreScripts */
-} Spec;                                 /*   script may be NULL if undefined */
+                                        /*   script may be NULL if undefined */
+    ScriptSet *scripts;                 /* compiled when first device made */
+} Spec;
 
 /* powerman.conf */
 static void makeNode(char *nodestr, char *devstr, char *plugstr);
 static void makeAlias(char *namestr, char *hostsstr);
-static Stmt *makeStmt(PreStmt *p);
-static void destroyStmt(Stmt *stmt);
+static int countStmts(List prestmts);
+static int compileStmts(Script *script, List prestmts, int pc, int depth);
 static void makeDevice(char *devstr, char *specstr, char *hoststr,
                         char *portstr);
 
@@ -125,10 +130,12 @@ static Spec current_spec;             /* Holds a Spec as it is built */
 /* other device configuration stuff */
 %token TOK_OFF_STRING TOK_ON_STRING
 %token TOK_MAX_PLUG_COUNT TOK_TIMEOUT TOK_DEV_TIMEOUT TOK_PING_PERIOD
+%token TOK_REFRESH_PERIOD
 %token TOK_PLUG_NAME TOK_SCRIPT
 
 /* powerman.conf stuff */
 %token TOK_DEVICE TOK_NODE TOK_ALIAS TOK_TCP_WRAPPERS TOK_LISTEN TOK_PLUG_LOG_LEVEL
+%token TOK_STATUS_CACHE_TTL
 
 /* general */
 %token TOK_MATCHPOS TOK_STRING_VAL TOK_NUMERIC_VAL TOK_YES TOK_NO
@@ -151,6 +158,7 @@ config_list     : config_list config_item
 config_item     : listen
                 | TCP_wrappers
                 | plug_log_level
+                | status_cache_ttl
                 | device
                 | node
                 | alias
@@ -169,6 +177,13 @@ plug_log_level          : TOK_PLUG_LOG_LEVEL TOK_STRING_VAL {
     conf_set_plug_log_level($2);
 }
 ;
+status_cache_ttl        : TOK_STATUS_CACHE_TTL TOK_NUMERIC_VAL {
+    struct timeval tv;
+
+    _doubletotv(&tv, _strtodouble($2));
+    conf_set_status_cache_ttl(&tv);
+}
+;
 listen          : TOK_LISTEN TOK_STRING_VAL {
     conf_add_listen($2);
 }
@@ -204,6 +219,7 @@ spec_item_list  : spec_item_list spec_item
 ;
 spec_item       : spec_timeout
                 | spec_ping_period
+                | spec_refresh_period
                 | spec_plug_list
                 | spec_script_list
 ;
@@ -215,6 +231,10 @@ spec_ping_period: TOK_PING_PERIOD TOK_NUMERIC_VAL {
     _doubletotv(&current_spec.ping_period, _strtodouble($2));
 }
 ;
+spec_refresh_period: TOK_REFRESH_PERIOD TOK_NUMERIC_VAL {
+    _doubletotv(&current_spec.refresh_period, _strtodouble($2));
+}
+;
 string_list     : string_list TOK_STRING_VAL {
     list_append((List)$1, xstrdup($2));
     $$ = $1;
@@ -393,6 +413,8 @@ int parse_config_file (char *filename)
     yyparse();
     fclose(yyin);
 
+    dev_index_nodes();
+
     scanner_fini();
 
     list_destroy(device_specs);
@@ -476,6 +498,8 @@ static void destroySpec(Spec * spec)
     for (i = 0; i < NUM_SCRIPTS; i++)
         if (spec->prescripts[i])
             list_destroy(spec->prescripts[i]);
+    if (spec->scripts)
+        dev_scriptset_unlink(spec->scripts);
     xfree(spec);
 }
 
@@ -576,94 +600,102 @@ static List copyResultInterpList(List il)
  ** Powerman.conf stuff.
  **/
 
-static void destroyStmt(Stmt *stmt)
+/* Return the number of compiled stmts needed for a list of PreStmts.
+ */
+static int countStmts(List prestmts)
 {
-    assert(stmt != NULL);
-
-    switch (stmt->type) {
-    case STMT_SEND:
-        xfree(stmt->u.send.fmt);
-        break;
-    case STMT_EXPECT:
-        xregex_destroy(stmt->u.expect.exp);
-        break;
-    case STMT_DELAY:
-        break;
-    case STMT_SETPLUGSTATE:
-        list_destroy(stmt->u.setplugstate.interps);
-        xfree (stmt->u.setplugstate.plug_name);
-        break;
-    case STMT_SETRESULT:
-        list_destroy(stmt->u.setresult.interps);
-        break;
-    case STMT_FOREACHNODE:
-    case STMT_FOREACHPLUG:
-        list_destroy(stmt->u.foreach.stmts);
-        break;
-    case STMT_IFON:
-    case STMT_IFOFF:
-        list_destroy(stmt->u.ifonoff.stmts);
-        break;
-    default:
-        break;
+    ListIterator itr;
+    PreStmt *p;
+    int count = 0;
+
+    itr = list_iterator_create(prestmts);
+    while ((p = list_next(itr))) {
+        count++;
+        switch (p->type) {
+        case STMT_FOREACHNODE:
+        case STMT_FOREACHPLUG:
+            count += countStmts(p->prestmts) + 1;   /* block + loop */
+            break;
+        case STMT_IFON:
+        case STMT_IFOFF:
+            count += countStmts(p->prestmts);
+            break;
+        default:
+            break;
+        }
     }
-    xfree(stmt);
+    list_iterator_destroy(itr);
+
+    return count;
 }
 
-static Stmt *makeStmt(PreStmt *p)
+/* Compile a list of PreStmts into script->stmts starting at index 'pc'.
+ * 'depth' is the number of foreach blocks enclosing the list.
+ * Return the index following the last stmt compiled.
+ */
+static int compileStmts(Script *script, List prestmts, int pc, int depth)
 {
-    Stmt *stmt;
-    PreStmt *subp;
     ListIterator itr;
-
-    stmt = (Stmt *) xmalloc(sizeof(Stmt));
-    stmt->type = p->type;
-    switch (p->type) {
-    case STMT_SEND:
-        stmt->u.send.fmt = xstrdup(p->str);
-        break;
-    case STMT_EXPECT:
-        stmt->u.expect.exp = xregex_create();
-        xregex_compile(stmt->u.expect.exp, p->str, true);
-        break;
-    case STMT_SETPLUGSTATE:
-        stmt->u.setplugstate.stat_mp = p->mp2;
-        if (p->str)
-            stmt->u.setplugstate.plug_name = xstrdup(p->str);
-        else
-            stmt->u.setplugstate.plug_mp = p->mp1;
-        stmt->u.setplugstate.interps = copyStateInterpList(p->state_interps);
-        break;
-    case STMT_SETRESULT:
-        stmt->u.setresult.stat_mp = p->mp2;
-        stmt->u.setresult.plug_mp = p->mp1;
-        stmt->u.setresult.interps = copyResultInterpList(p->result_interps);
-        break;
-    case STMT_DELAY:
-        stmt->u.delay.tv = p->tv;
-        break;
-    case STMT_FOREACHNODE:
-    case STMT_FOREACHPLUG:
-        stmt->u.foreach.stmts = list_create((ListDelF) destroyStmt);
-        itr = list_iterator_create(p->prestmts);
-        while((subp = list_next(itr))) {
-            list_append(stmt->u.foreach.stmts, makeStmt(subp));
-        }
-        list_iterator_destroy(itr);
-        break;
-    case STMT_IFON:
-    case STMT_IFOFF:
-        stmt->u.ifonoff.stmts = list_create((ListDelF) destroyStmt);
-        itr = list_iterator_create(p->prestmts);
-        while((subp = list_next(itr))) {
-            list_append(stmt->u.ifonoff.stmts, makeStmt(subp));
+    PreStmt *p;
+
+    itr = list_iterator_create(prestmts);
+    while ((p = list_next(itr))) {
+        Stmt *stmt = &script->stmts[pc];
+        int start = pc++;
+
+        assert(start < script->len);
+        stmt->type = p->type;
+        stmt->depth = depth;
+        switch (p->type) {
+        case STMT_SEND:
+            stmt->u.send.fmt = xstrdup(p->str);
+            break;
+        case STMT_EXPECT:
+            stmt->u.expect.exp = xregex_create();
+            xregex_compile(stmt->u.expect.exp, p->str, true);
+            break;
+        case STMT_SETPLUGSTATE:
+            stmt->u.setplugstate.stat_mp = p->mp2;
+            if (p->str)
+                stmt->u.setplugstate.plug_name = xstrdup(p->str);
+            else
+                stmt->u.setplugstate.plug_mp = p->mp1;
+            stmt->u.setplugstate.interps =
+                copyStateInterpList(p->state_interps);
+            break;
+        case STMT_SETRESULT:
+            stmt->u.setresult.stat_mp = p->mp2;
+            stmt->u.setresult.plug_mp = p->mp1;
+            stmt->u.setresult.interps =
+                copyResultInterpList(p->result_interps);
+            break;
+        case STMT_DELAY:
+            stmt->u.delay.tv = p->tv;
+            break;
+        case STMT_FOREACHNODE:
+        case STMT_FOREACHPLUG:
+            if (depth + 1 > script->depth)
+                script->depth = depth + 1;
+            pc = compileStmts(script, p->prestmts, pc, depth + 1);
+            assert(pc < script->len);
+            script->stmts[pc].type = STMT_LOOP;
+            script->stmts[pc].depth = depth;
+            script->stmts[pc].u.loop.start = start;
+            pc++;
+            stmt->u.foreach.end = pc;
+            break;
+        case STMT_IFON:
+        case STMT_IFOFF:
+            pc = compileStmts(script, p->prestmts, pc, depth);
+            stmt->u.ifonoff.end = pc;
+            break;
+        default:
+            break;
         }
-        list_iterator_destroy(itr);
-        break;
-    default:
-        break;
     }
-    return stmt;
+    list_iterator_destroy(itr);
+
+    return pc;
 }
 
 static void _parse_hoststr(Device *dev, char *hoststr, char *flagstr)
@@ -713,13 +745,33 @@ static void _parse_hoststr(Device *dev, char *hoststr, char *flagstr)
     }
 }
 
+/* Compile the scripts of a spec.  Devices share the result.
+ */
+static ScriptSet *makeScriptSet(Spec *spec)
+{
+    ScriptSet *scripts = dev_scriptset_create();
+    int i;
+
+    for (i = 0; i < NUM_SCRIPTS; i++) {
+        Script *script;
+
+        if (spec->prescripts[i] == NULL) {
+            scripts->script[i] = NULL;
+            continue; /* unimplemented script */
+        }
+
+        script = dev_script_create(countStmts(spec->prescripts[i]));
+        compileStmts(script, spec->prescripts[i], 0, 0);
+        scripts->script[i] = script;
+    }
+    return scripts;
+}
+
 static void makeDevice(char *devstr, char *specstr, char *hoststr,
                         char *flagstr)
 {
-    ListIterator itr;
     Device *dev;
     Spec *spec;
-    int i;
 
     /* find that spec */
     spec = findSpec(specstr);
@@ -731,30 +783,17 @@ static void makeDevice(char *devstr, char *specstr, char *hoststr,
     dev->specname = xstrdup(specstr);
     dev->timeout = spec->timeout;
     dev->ping_period = spec->ping_period;
+    dev->refresh_period = spec->refresh_period;
 
     _parse_hoststr(dev, hoststr, flagstr);
 
     /* create plugs (spec->plugs may be NULL) */
     dev->plugs = pluglist_create(spec->plugs);
 
-    /* transfer remaining info from the spec to the device */
-    for (i = 0; i < NUM_SCRIPTS; i++) {
-        PreStmt *p;
-
-        if (spec->prescripts[i] == NULL) {
-            dev->scripts[i] = NULL;
-            continue; /* unimplemented script */
-        }
-
-        dev->scripts[i] = list_create((ListDelF) destroyStmt);
-
-        /* copy the list of statements in each script */
-        itr = list_iterator_create(spec->prescripts[i]);
-        while((p = list_next(itr))) {
-            list_append(dev->scripts[i], makeStmt(p));
-        }
-        list_iterator_destroy(itr);
-    }
+    /* share the spec's compiled scripts with the device */
+    if (spec->scripts == NULL)
+        spec->scripts = makeScriptSet(spec);
+    dev->scripts = dev_scriptset_link(spec->scripts);
 
     dev_add(dev);
 }
@@ -38,6 +38,7 @@
 
 #include "list.h"
 #include "hostlist.h"
+#include "hash.h"
 #include "error.h"
 #include "parse_util.h"
 #include "xmalloc.h"
@@ -51,14 +52,26 @@ typedef struct {
     hostlist_t hl;
 } alias_t;
 
+typedef struct {
+    char *name;
+    int id;                     /* index into conf_nodetab */
+} node_t;
+
 static bool         conf_use_tcp_wrap = false;
 static int          conf_plug_log_level = LOG_DEBUG;    /* syslog level */
+static struct timeval conf_status_cache_ttl = { 0, 0 }; /* 0 = no cache */
 static List         conf_listen = NULL;     /* list of host:port strings */
 static hostlist_t   conf_nodes = NULL;
-static List         conf_aliases = NULL;    /* list of alias_t's */
+static hash_t       conf_nodeset = NULL;    /* node name -> node_t */
+static node_t     **conf_nodetab = NULL;    /* node ID -> node_t */
+static int          conf_nnodes = 0;
+static int          conf_nodetab_size = 0;
+static hash_t       conf_aliases = NULL;    /* alias name -> alias_t */
 
 static bool _validate_config(void);
 static void _alias_destroy(alias_t *a);
+static void _index_nodes(void);
+static void _node_destroy(node_t *n);
 
 extern int parse_config_file(char *filename); /* yacc/lex parser */
 
@@ -74,8 +87,11 @@ void conf_init(char *filename)
     conf_listen = list_create((ListDelF) xfree);
 
     conf_nodes = hostlist_create(NULL);
+    conf_nodeset = hash_create(0, (hash_key_f) hash_key_string,
+                               (hash_cmp_f) strcmp, (hash_del_f) NULL);
 
-    conf_aliases = list_create((ListDelF) _alias_destroy);
+    conf_aliases = hash_create(0, (hash_key_f) hash_key_string,
+                               (hash_cmp_f) strcmp, (hash_del_f) _alias_destroy);
 
     /* validate config file */
     if (stat(filename, &stbuf) < 0)
@@ -88,6 +104,7 @@ void conf_init(char *filename)
      * The parser builds 'dev_devices' (devices.c) and 'conf_*' (here).
      */
     parse_config_file(filename);
+    _index_nodes();
 
     valid = _validate_config();
 
@@ -99,7 +116,16 @@ void conf_init(char *filename)
 void conf_fini(void)
 {
     if (conf_aliases != NULL)
-        list_destroy(conf_aliases);
+        hash_destroy(conf_aliases);
+    if (conf_nodeset != NULL)
+        hash_destroy(conf_nodeset);
+    if (conf_nodetab != NULL) {
+        int i;
+
+        for (i = 0; i < conf_nnodes; i++)
+            _node_destroy(conf_nodetab[i]);
+        xfree(conf_nodetab);
+    }
     if (conf_nodes != NULL)
         hostlist_destroy(conf_nodes);
     if (conf_listen != NULL)
@@ -109,33 +135,34 @@ void conf_fini(void)
 /*
  * Check the config file and exit with error if any problems are found.
  */
+/* hash_for_each() helper for _validate_config() */
+static int _validate_alias(alias_t *a, bool *valid)
+{
+    hostlist_iterator_t hitr = hostlist_iterator_create(a->hl);
+    char *host;
+
+    if (hitr == NULL)
+        err_exit(false, "hostlist_iterator_create failed");
+    while ((host = hostlist_next(hitr)) != NULL) {
+        if (!conf_node_exists(host)) {
+            err(false, "alias '%s' references nonexistent node '%s'",
+                    a->name, host);
+            *valid = false;
+            free(host);
+            break;
+        } else
+            free(host);
+    }
+    hostlist_iterator_destroy(hitr);
+    return 0;
+}
+
 static bool _validate_config(void)
 {
-    ListIterator itr;
     bool valid = true;
-    alias_t *a;
 
     /* make sure aliases do not point to bogus node names */
-    itr = list_iterator_create(conf_aliases);
-    while ((a = list_next(itr)) != NULL) {
-        hostlist_iterator_t hitr = hostlist_iterator_create(a->hl);
-        char *host;
-
-        if (hitr == NULL)
-            err_exit(false, "hostlist_iterator_create failed");
-        while ((host = hostlist_next(hitr)) != NULL) {
-            if (!conf_node_exists(host)) {
-                err(false, "alias '%s' references nonexistent node '%s'",
-                        a->name, host);
-                valid = false;
-                free(host);
-                break;
-            } else
-                free(host);
-        }
-        hostlist_iterator_destroy(hitr);
-    }
-    list_iterator_destroy(itr);
+    hash_for_each(conf_aliases, (hash_arg_f) _validate_alias, &valid);
 
     /* make sure there is at least one node defined */
     if (hostlist_is_empty(conf_nodes)) {
@@ -154,15 +181,54 @@ static bool _validate_config(void)
 }
 
 /*
- * Node conf_nodes list.
+ * Node conf_nodes list.  Node names are interned into conf_nodetab so
+ * that other modules can refer to a node by a small integer ID, in the
+ * order nodes were defined.  The conf_nodeset hash makes lookups O(1).
  */
 
+static node_t *_node_create(char *name)
+{
+    node_t *n = (node_t *) xmalloc(sizeof(node_t));
+
+    if (conf_nnodes == conf_nodetab_size) {
+        conf_nodetab_size = conf_nodetab_size ? conf_nodetab_size * 2 : 64;
+        conf_nodetab = (node_t **) xrealloc((char *) conf_nodetab,
+                                    conf_nodetab_size * sizeof(node_t *));
+    }
+    n->name = xstrdup(name);
+    n->id = conf_nnodes++;
+    conf_nodetab[n->id] = n;
+
+    return n;
+}
+
+static void _node_destroy(node_t *n)
+{
+    xfree(n->name);
+    xfree(n);
+}
+
 bool conf_node_exists(char *node)
 {
-    int res;
+    return (hash_find(conf_nodeset, node) != NULL);
+}
+
+int conf_node_id(char *node)
+{
+    node_t *n = hash_find(conf_nodeset, node);
+
+    return n ? n->id : -1;
+}
+
+char *conf_node_name(int id)
+{
+    assert(id >= 0 && id < conf_nnodes);
+    return conf_nodetab[id]->name;
+}
 
-    res = hostlist_find(conf_nodes, node);
-    return (res == -1 ? false : true);
+int conf_node_count(void)
+{
+    return conf_nnodes;
 }
 
 bool conf_addnodes(char *nodelist)
@@ -178,7 +244,10 @@ bool conf_addnodes(char *nodelist)
             res = false;
             break;
         } else {
-            hostlist_push(conf_nodes, node);
+            node_t *n = _node_create(node);
+
+            hash_insert(conf_nodeset, n->name, n);
+            hostlist_push_host(conf_nodes, node);
             free(node);
         }
     }
@@ -188,6 +257,20 @@ bool conf_addnodes(char *nodelist)
     return res;
 }
 
+/* The hash table does not grow, so once the number of nodes is known,
+ * rebuild it with an appropriate size.
+ */
+static void _index_nodes(void)
+{
+    int i;
+
+    hash_destroy(conf_nodeset);
+    conf_nodeset = hash_create(conf_nnodes, (hash_key_f) hash_key_string,
+                               (hash_cmp_f) strcmp, (hash_del_f) NULL);
+    for (i = 0; i < conf_nnodes; i++)
+        hash_insert(conf_nodeset, conf_nodetab[i]->name, conf_nodetab[i]);
+}
+
 hostlist_t conf_getnodes(void)
 {
     return conf_nodes;
@@ -261,15 +344,20 @@ void conf_set_plug_log_level(char *level_string)
     conf_plug_log_level = level;
 }
 
-/*
- * Manage a list of nodename aliases.
- */
+void conf_get_status_cache_ttl(struct timeval *tv)
+{
+    *tv = conf_status_cache_ttl;
+}
 
-static int _alias_match(alias_t *a, char *name)
+void conf_set_status_cache_ttl(struct timeval *tv)
 {
-    return (strcmp(a->name, name) == 0);
+    conf_status_cache_ttl = *tv;
 }
 
+/*
+ * Manage a list of nodename aliases.
+ */
+
 /* Expand any aliases present in hostlist.
  * N.B. Aliases cannot contain other aliases.
  */
@@ -280,7 +368,7 @@ void conf_exp_aliases(hostlist_t hl)
     char *host;
 
     /* Put the expansion of any aliases in the hostlist into 'newhosts',
-     * deleting the original reference from the hostlist.
+     * deleting the original reference from the hostlist in the same pass.
      */
     if (newhosts == NULL)
         err_exit(false, "hostlist_create failed");
@@ -289,12 +377,9 @@ void conf_exp_aliases(hostlist_t hl)
     while ((host = hostlist_next(itr)) != NULL) {
         alias_t *a;
 
-        a = list_find_first(conf_aliases, (ListFindF) _alias_match, host);
-        if (a) {
-            hostlist_delete_host(hl, host);
+        if ((a = hash_find(conf_aliases, host))) {
+            hostlist_remove(itr);
             hostlist_push_list(newhosts, a->hl);
-            hostlist_iterator_reset(itr); /* not sure of itr position after
-                                             insertion/deletion so reset */
         }
         free(host);
     }
@@ -318,7 +403,7 @@ static alias_t *_alias_create(char *name, char *hosts)
 {
     alias_t *a = NULL;
 
-    if (!list_find_first(conf_aliases, (ListFindF) _alias_match, name)) {
+    if (!hash_find(conf_aliases, name)) {
         a = (alias_t *)xmalloc(sizeof(alias_t));
         a->name= xstrdup(name);
         a->hl = hostlist_create(hosts);
@@ -338,7 +423,7 @@ bool conf_add_alias(char *name, char *hosts)
     alias_t *a;
 
     if ((a = _alias_create(name, hosts))) {
-        list_push(conf_aliases, a);
+        hash_insert(conf_aliases, a->name, a);
         return true;
     }
     return false;
@@ -18,6 +18,9 @@ void conf_fini(void);
 
 bool conf_addnodes(char *nodelist);
 bool conf_node_exists(char *node);
+int conf_node_id(char *node);
+char *conf_node_name(int id);
+int conf_node_count(void);
 hostlist_t conf_getnodes(void);
 
 bool conf_get_use_tcp_wrappers(void);
@@ -26,6 +29,9 @@ void conf_set_use_tcp_wrappers(bool val);
 int conf_get_plug_log_level(void);
 void conf_set_plug_log_level(char *level);
 
+void conf_get_status_cache_ttl(struct timeval *tv);
+void conf_set_status_cache_ttl(struct timeval *tv);
+
 List conf_get_listen(void);
 void conf_add_listen(char *hostport);
 
@@ -30,14 +30,21 @@
 #include "pluglist.h"
 
 struct pluglist_iterator {
-    ListIterator    itr;
+    PlugList        pl;
+    int             pos;
 };
 
+/* Plugs are kept in an array so they can be visited by position.
+ */
 struct pluglist {
-    List	        pluglist;
+    Plug            **plugs;
+    int             count;
+    int             size;
     bool            hardwired;
 };
 
+#define PLUGLIST_CHUNK 16
+
 static Plug *_create_plug(char *name)
 {
     Plug *plug = (Plug *) xmalloc(sizeof(Plug));
@@ -46,6 +53,7 @@ static Plug *_create_plug(char *name)
 
     plug->name = xstrdup(name);
     plug->node = NULL;
+    plug->nodeid = -1;
 
     return plug;
 }
@@ -58,6 +66,7 @@ static Plug *_copy_plug(Plug *p)
 
     plug->name = p->name ? xstrdup(p->name) : NULL;
     plug->node = p->node ? xstrdup(p->node) : NULL;
+    plug->nodeid = p->nodeid;
 
     return plug;
 }
@@ -72,13 +81,39 @@ static void _destroy_plug(Plug *plug)
     xfree(plug);
 }
 
-PlugList pluglist_create(List plugnames)
+static PlugList _pluglist_alloc(void)
 {
     PlugList pl = (PlugList) xmalloc(sizeof(struct pluglist));
 
-    pl->pluglist = list_create((ListDelF)_destroy_plug);
+    pl->plugs = NULL;
+    pl->count = 0;
+    pl->size = 0;
     pl->hardwired = false;
 
+    return pl;
+}
+
+/* Insert 'plug' at the end of the PlugList, or at the front if 'front'.
+ */
+static void _pluglist_insert(PlugList pl, Plug *plug, bool front)
+{
+    if (pl->count == pl->size) {
+        pl->size += PLUGLIST_CHUNK;
+        pl->plugs = (Plug **)xrealloc((char *)pl->plugs,
+                                      pl->size * sizeof(Plug *));
+    }
+    if (front) {
+        memmove(&pl->plugs[1], &pl->plugs[0], pl->count * sizeof(Plug *));
+        pl->plugs[0] = plug;
+    } else
+        pl->plugs[pl->count] = plug;
+    pl->count++;
+}
+
+PlugList pluglist_create(List plugnames)
+{
+    PlugList pl = _pluglist_alloc();
+
     /* create plug for each element of plugnames list */
     if (plugnames) {
         ListIterator itr;
@@ -86,7 +121,7 @@ PlugList pluglist_create(List plugnames)
 
         itr = list_iterator_create(plugnames);
         while ((name = list_next(itr)))
-            list_append(pl->pluglist, _create_plug(name));
+            _pluglist_insert(pl, _create_plug(name), false);
         list_iterator_destroy(itr);
         pl->hardwired = true;
     }
@@ -96,10 +131,7 @@ PlugList pluglist_create(List plugnames)
 
 PlugList pluglist_copy_from_list(List plugs)
 {
-    PlugList pl = (PlugList) xmalloc(sizeof(struct pluglist));
-
-    pl->pluglist = list_create((ListDelF)_destroy_plug);
-    pl->hardwired = false;
+    PlugList pl = _pluglist_alloc();
 
     /* create plug from each plug in list */
     if (plugs) {
@@ -108,7 +140,7 @@ PlugList pluglist_copy_from_list(List plugs)
 
         itr = list_iterator_create(plugs);
         while ((p = list_next(itr))) {
-            list_append(pl->pluglist, _copy_plug(p));
+            _pluglist_insert(pl, _copy_plug(p), false);
         }
         list_iterator_destroy(itr);
         pl->hardwired = true;
@@ -119,24 +151,26 @@ PlugList pluglist_copy_from_list(List plugs)
 
 void pluglist_destroy(PlugList pl)
 {
+    int i;
+
     assert(pl != NULL);
 
-    list_destroy(pl->pluglist);
+    for (i = 0; i < pl->count; i++)
+        _destroy_plug(pl->plugs[i]);
+    if (pl->plugs)
+        xfree(pl->plugs);
     xfree(pl);
 }
 
 static Plug *_pluglist_find_any(PlugList pl, char *name)
 {
-    PlugListIterator itr = pluglist_iterator_create(pl);
-    Plug *plug;
+    int i;
 
-    while ((plug = pluglist_next(itr))) {
-        if (strcmp(plug->name, name) == 0)
-            break;
+    for (i = 0; i < pl->count; i++) {
+        if (strcmp(pl->plugs[i]->name, name) == 0)
+            return pl->plugs[i];
     }
-    pluglist_iterator_destroy(itr);
-
-    return plug;
+    return NULL;
 }
 
 /* Assign a node name to an existing Plug.
@@ -153,7 +187,7 @@ static pl_err_t _pluglist_map_one(PlugList pl, char *node, char *name)
             goto err;
         }
         plug = _create_plug(name);
-        list_push(pl->pluglist, plug);
+        _pluglist_insert(pl, plug, true);
     }
     if (plug->node) {
         res = EPL_DUPPLUG;
@@ -168,21 +202,15 @@ err:
  */
 static pl_err_t _pluglist_map_next(PlugList pl, char *node)
 {
-    Plug *plug;
-    PlugListIterator pitr;
-    pl_err_t res = EPL_NOPLUGS;
-
-    pitr = pluglist_iterator_create(pl);
-    while ((plug = pluglist_next(pitr))) {
-        if (plug->node == NULL) {
-            plug->node = xstrdup(node);
-            res = EPL_SUCCESS;
-            break;
+    int i;
+
+    for (i = 0; i < pl->count; i++) {
+        if (pl->plugs[i]->node == NULL) {
+            pl->plugs[i]->node = xstrdup(node);
+            return EPL_SUCCESS;
         }
     }
-    pluglist_iterator_destroy(pitr);
-
-    return res;
+    return EPL_NOPLUGS;
 }
 
 pl_err_t pluglist_map(PlugList pl, char *nodelist, char *pluglist)
@@ -254,7 +282,8 @@ PlugListIterator pluglist_iterator_create(PlugList pl)
 {
     PlugListIterator itr = (PlugListIterator)xmalloc(sizeof(struct pluglist_iterator));
 
-    itr->itr = list_iterator_create(pl->pluglist);
+    itr->pl = pl;
+    itr->pos = 0;
 
     return itr;
 }
@@ -262,7 +291,6 @@ PlugListIterator pluglist_iterator_create(PlugList pl)
 void pluglist_iterator_destroy(PlugListIterator itr)
 {
     assert(itr != NULL);
-    list_iterator_destroy(itr->itr);
     xfree(itr);
 }
 
@@ -270,7 +298,7 @@ Plug *pluglist_next(PlugListIterator itr)
 {
     assert(itr != NULL);
 
-    return (Plug *)list_next(itr->itr);
+    return pluglist_nth(itr->pl, itr->pos++);
 }
 
 Plug *pluglist_find(PlugList pl, char *name)
@@ -287,6 +315,22 @@ Plug *pluglist_find(PlugList pl, char *name)
     return plug;
 }
 
+int pluglist_count(PlugList pl)
+{
+    assert(pl != NULL);
+
+    return pl->count;
+}
+
+Plug *pluglist_nth(PlugList pl, int n)
+{
+    assert(pl != NULL);
+
+    if (n < 0 || n >= pl->count)
+        return NULL;
+    return pl->plugs[n];
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
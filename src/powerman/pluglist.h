@@ -19,6 +19,7 @@
 typedef struct {
     char *name;                 /* how the plug is known to the device */
     char *node;                 /* node name */
+    int nodeid;                 /* node ID (see conf_node_id()), or -1 */
 } Plug;
 
 typedef struct pluglist_iterator *PlugListIterator;
@@ -54,6 +55,15 @@ pl_err_t          pluglist_map(PlugList pl, char *nodelist, char *pluglist);
  */
 Plug *            pluglist_find(PlugList pl, char *name);
 
+/* Return the number of plugs in the PlugList.
+ */
+int               pluglist_count(PlugList pl);
+
+/* Return the Plug at position n (counting from zero) of the PlugList,
+ * or NULL if n is out of range.
+ */
+Plug *            pluglist_nth(PlugList pl, int n);
+
 /* An iterator interface for PlugLists, similar to the iterators in list.h.
  */
 PlugListIterator  pluglist_iterator_create(PlugList pl);
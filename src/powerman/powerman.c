@@ -56,7 +56,7 @@ static void _set_command (const char **command, const char *value);
 
 static char *prog;
 
-#define OPTIONS "01crfubqtldTxgh:VLR:H"
+#define OPTIONS "01crfubqtldaTxSgh:VLR:H"
 static const struct option longopts[] = {
     // command
     {"on",          no_argument,        0, '1'},
@@ -70,9 +70,11 @@ static const struct option longopts[] = {
     {"temp",        no_argument,        0, 't'},
     {"list",        no_argument,        0, 'l'},
     {"device",      no_argument,        0, 'd'},
+    {"latency",     no_argument,        0, 'a'},
     // options
     {"telemetry",   no_argument,        0, 'T'},
     {"exprange",    no_argument,        0, 'x'},
+    {"stream",      no_argument,        0, 'S'},
     {"genders",     no_argument,        0, 'g'},
     {"server-host", required_argument,  0, 'h'},
     {"version",     no_argument,        0, 'V'},
@@ -94,6 +96,7 @@ int main(int argc, char **argv)
     const char *command = NULL;
     bool telemetry = false;
     bool exprange = false;
+    bool stream = false;
     hostlist_t targets;
     bool targets_required = false;
 
@@ -145,6 +148,9 @@ int main(int argc, char **argv)
         case 'd':              /* --device */
             _set_command(&command, CP_DEVICE);
             break;
+        case 'a':              /* --latency */
+            _set_command(&command, CP_LATENCY);
+            break;
         case 'h':              /* --server-host host[:port] */
             if ((p = strchr(optarg, ':'))) {
                 *p++ = '\0';
@@ -166,6 +172,9 @@ int main(int argc, char **argv)
         case 'x':              /* --exprange */
             exprange = true;
             break;
+        case 'S':              /* --stream */
+            stream = true;
+            break;
         case 'g':              /* --genders */
 #if WITH_GENDERS
             genders = true;
@@ -241,6 +250,13 @@ int main(int argc, char **argv)
         if (res != 0)
             goto done;
     }
+    if (stream) {
+        hfdprintf(server_fd, "%s%s", CP_STREAM, CP_EOL);
+        res = _process_response(server_fd);
+        _expect(server_fd, CP_PROMPT);
+        if (res != 0)
+            goto done;
+    }
     /* Send the main command.
      * Use 'command' as the format string if it contains '%s' for an argument.
      */
@@ -280,6 +296,8 @@ static void _usage(void)
 "  -P,--temp            Query temperature on optional targets\n"
 "  -l,--list            List available targets\n"
 "  -d,--device          Show status of devices that control optional targets\n"
+"  -a,--latency         Show action latency of devices that control optional\n"
+"                       targets\n"
 "Options:\n"
 #if WITH_GENDERS
 "  -g,--genders         Interpret targets as attributes\n"
@@ -287,6 +305,7 @@ static void _usage(void)
 "  -h,--server-host host[:port]\n"
 "                       Connect to remote server\n"
 "  -x,--exprange        Expand host ranges in query response\n"
+"  -S,--stream          Show each node's query result as soon as it is known\n"
 "  -V,--version         Show powerman version\n"
 "  -L,--license         Show powerman license\n"
 "  -T,--telemtery       Show device conversation for debugging\n"
@@ -403,6 +422,8 @@ static bool _suppress(int num)
         return true;
     if (strtol(CP_RSP_EXPRANGE, NULL, 10) == num)
         return true;
+    if (strtol(CP_RSP_STREAM, NULL, 10) == num)
+        return true;
     return false;
 }
 
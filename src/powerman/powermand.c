@@ -44,11 +44,13 @@ static void _usage(char *prog);
 static void _version(void);
 static void _noop_handler(int signum);
 static void _exit_handler(int signum);
-static void _select_loop(void);
+static void _select_loop(xpollfd_t pfd);
 
 static int exitpipe[2];
 
-#define OPTIONS "c:hd:VsY"
+#define MAX_THREADS 256
+
+#define OPTIONS "c:hd:VsYt:"
 static const struct option longopts[] = {
     {"conf",            required_argument,  0, 'c'},
     {"help",            no_argument,        0, 'h'},
@@ -56,6 +58,7 @@ static const struct option longopts[] = {
     {"version",         no_argument,        0, 'V'},
     {"stdio",           no_argument,        0, 's'},
     {"short-circuit-delay", no_argument,    0, 'Y'},
+    {"threads",         required_argument,  0, 't'},
     {0, 0, 0, 0}
 };
 
@@ -65,6 +68,8 @@ int main(int argc, char **argv)
     char *config_filename = NULL;
     bool use_stdio = false;
     bool short_circuit_delay = false;
+    int nthreads = 0;
+    xpollfd_t pfd;
 
     /* parse command line options */
     err_init(argv[0]);
@@ -73,6 +78,17 @@ int main(int argc, char **argv)
         case 'Y': /* --short-circuit-delay */
             short_circuit_delay = true;
             break;
+        case 't': /* --threads */
+            {
+                char *endptr;
+                long val = strtol(optarg, &endptr, 10);
+
+                if (*optarg == '\0' || *endptr != '\0'
+                                     || val < 0 || val > MAX_THREADS)
+                    err_exit(false, "--threads must be 0-%d", MAX_THREADS);
+                nthreads = val;
+            }
+            break;
         case 'c': /* --conf */
             if (!config_filename)
                 config_filename = xstrdup(optarg);
@@ -111,8 +127,9 @@ int main(int argc, char **argv)
         config_filename = hsprintf("%s/%s/%s", X_SYSCONFDIR,
                                    "powerman", "powerman.conf");
 
-    dev_init(short_circuit_delay);
-    cli_init();
+    pfd = xpollfd_create();
+    dev_init(pfd, short_circuit_delay, nthreads);
+    cli_init(pfd);
 
     conf_init(config_filename);
     xfree(config_filename);
@@ -126,14 +143,16 @@ int main(int argc, char **argv)
 
     /* We now have a socket at listener fd running in listen mode */
     /* and a file descriptor for communicating with each device */
-    _select_loop();
+    _select_loop(pfd);
 
+    xpollfd_del(pfd, exitpipe[0]);
     (void)close (exitpipe[0]);
     (void)close (exitpipe[1]);
 
     cli_fini();
     dev_fini();
     conf_fini();
+    xpollfd_destroy(pfd);
     return 0;
 }
 
@@ -143,6 +162,7 @@ static void _usage(char *prog)
     printf("  -c,--conf=PATH            Specify config file path\n");
     printf("  -s,--stdio                Talk to client on stdin/stdout\n");
     printf("  -Y,--short-circuit-delay  Change all device delays to zero\n");
+    printf("  -t,--threads=N            Run devices in N worker threads\n");
     printf("  -d,--debug=MASK           Enable debug logging\n");
     printf("  -V,--version              Report powerman version\n");
     printf("  -h,--help                 Display help\n");
@@ -155,10 +175,9 @@ static void _version(void)
     exit(0);
 }
 
-static void _select_loop(void)
+static void _select_loop(xpollfd_t pfd)
 {
     struct timeval tmout;
-    xpollfd_t pfd = xpollfd_create();
 
     timerclear(&tmout);
 
@@ -167,13 +186,13 @@ static void _select_loop(void)
      */
     dev_initial_connect();
 
-    while (1) {
-        xpollfd_zero(pfd);
-
-        cli_pre_poll(pfd);
-        dev_pre_poll(pfd);
-        xpollfd_set(pfd, exitpipe[0], XPOLLIN);
+    /* Client and device fd's register themselves with pfd as they are
+     * opened and update their poll interest as it changes, so the set
+     * is not rebuilt on each pass through the loop.
+     */
+    xpollfd_add(pfd, exitpipe[0], XPOLLIN, NULL, NULL);
 
+    while (1) {
         xpoll(pfd, timerisset(&tmout) ? &tmout : NULL);
         timerclear(&tmout);
 
@@ -185,13 +204,12 @@ static void _select_loop(void)
          * If a device requires a timeout, for example to reconnect or
          * to process a scripted delay, tmout is updated.
          */
-        cli_post_poll(pfd);
-        dev_post_poll(pfd, &tmout);
+        xpollfd_dispatch(pfd);
+        dev_post_poll(&tmout);
 
         if (cli_server_done())
             break;
     }
-    xpollfd_destroy(pfd);
 }
 
 static void _noop_handler(int signum)
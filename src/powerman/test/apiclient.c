@@ -12,10 +12,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 
 #include "libpowerman.h"
 
 static pm_err_t list_nodes(pm_handle_t pm);
+static pm_err_t query_nodes(pm_handle_t pm, char **nodes, int count);
+static pm_err_t watch_nodes(pm_handle_t pm, char *nodes, int count);
+static pm_err_t batch_nodes(pm_handle_t pm, char op, char *nodes);
+static pm_err_t poll_nodes(pm_handle_t pm, char **nodes, int count);
 static void usage(void);
 
 #define statstr(s) ((s) == PM_ON ? "on" : (s) == PM_OFF ? "off" : "unknown")
@@ -30,18 +35,34 @@ main(int argc, char *argv[])
     char *server, *node = NULL;
     char cmd;
 
-    if (argc < 3 || argc > 4)
+    if (argc < 3)
         usage();
     server = argv[1];
     cmd = argv[2][0];
-    if (argc == 3 && cmd != 'l')
-        usage();
-    if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q')
-        usage();
-    if (argc == 4)
+    if (cmd == 'Q' || cmd == 'P') {
+        if (argc < 4)
+            usage();
+    } else if (cmd == 'B') {
+        if (argc != 5)
+            usage();
+    } else if (cmd == 'W') {
+        if (argc != 5)
+            usage();
+    } else {
+        if (argc > 4)
+            usage();
+        if (argc == 3 && cmd != 'l')
+            usage();
+        if (argc == 4 && cmd != '1' && cmd != '0' && cmd != 'c' && cmd != 'q')
+            usage();
+    }
+    if (argc >= 4)
         node = argv[3];
 
-    if ((err = pm_connect(server, NULL, &pm, 0)) != PM_ESUCCESS) {
+    if ((err = pm_connect(server, NULL, &pm,
+                          cmd == 'Q' || cmd == 'W' || cmd == 'P'
+                          ? PM_CONN_TAGGED : 0))
+                                                            != PM_ESUCCESS) {
         fprintf(stderr, "%s: %s\n", server,
                 pm_strerror(err, ebuf, sizeof(ebuf)));
         exit(1);
@@ -65,6 +86,18 @@ main(int argc, char *argv[])
             if ((err = pm_node_status(pm, node, &ns)) == PM_ESUCCESS)
                 printf("%s: %s\n", node, statstr(ns));
             break;
+        case 'Q':
+            err = query_nodes(pm, &argv[3], argc - 3);
+            break;
+        case 'W':
+            err = watch_nodes(pm, node, atoi(argv[4]));
+            break;
+        case 'B':
+            err = batch_nodes(pm, argv[3][0], argv[4]);
+            break;
+        case 'P':
+            err = poll_nodes(pm, &argv[3], argc - 3);
+            break;
     }
 
     if (err != PM_ESUCCESS) {
@@ -93,10 +126,150 @@ list_nodes(pm_handle_t pm)
     return err;
 }
 
+/* Query all nodes concurrently, printing results as they complete.
+ */
+static pm_err_t
+query_nodes(pm_handle_t pm, char **nodes, int count)
+{
+    pm_request_t *reqs, req;
+    pm_node_state_t ns;
+    pm_err_t err = PM_ESUCCESS;
+    int i, n;
+
+    if (!(reqs = calloc(count, sizeof(pm_request_t))))
+        return PM_ENOMEM;
+    for (n = 0; n < count; n++) {
+        if ((err = pm_request_send(pm, PM_REQ_STATUS, nodes[n], &reqs[n]))
+                                                            != PM_ESUCCESS)
+            break;
+    }
+    while (err == PM_ESUCCESS
+            && (err = pm_request_wait(pm, &req)) == PM_ESUCCESS) {
+        for (i = 0; i < n; i++)
+            if (reqs[i] == req)
+                break;
+        if ((err = pm_request_node_status(req, nodes[i], &ns)) == PM_ESUCCESS)
+            printf("%s: %s\n", nodes[i], statstr(ns));
+    }
+    if (err == PM_ENOREQUEST)
+        err = PM_ESUCCESS;
+    for (i = 0; i < n; i++)
+        pm_request_destroy(reqs[i]);
+    free(reqs);
+    return err;
+}
+
+/* Watch nodes, printing the first [count] power status changes.
+ */
+static pm_err_t
+watch_nodes(pm_handle_t pm, char *nodes, int count)
+{
+    pm_node_state_t ns;
+    pm_err_t err;
+    char node[64];
+
+    if ((err = pm_watch(pm, nodes)) != PM_ESUCCESS)
+        return err;
+    printf("watching %s\n", nodes);
+    fflush(stdout);
+    while (count-- > 0) {
+        if ((err = pm_event_wait(pm, node, sizeof(node), &ns)) != PM_ESUCCESS)
+            return err;
+        printf("%s: %s\n", node, statstr(ns));
+        fflush(stdout);
+    }
+    return pm_unwatch(pm);
+}
+
+static void
+print_results(pm_node_result_t *results, int count)
+{
+    char ebuf[64];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (results[i].err != PM_ESUCCESS)
+            printf("%s: %s (%s)\n", results[i].node, statstr(results[i].state),
+                   pm_strerror(results[i].err, ebuf, sizeof(ebuf)));
+        else
+            printf("%s: %s\n", results[i].node, statstr(results[i].state));
+    }
+}
+
+/* Run [op] on host range [nodes] with one call, printing per-node
+ * results of a query.
+ */
+static pm_err_t
+batch_nodes(pm_handle_t pm, char op, char *nodes)
+{
+    pm_node_result_t *results;
+    pm_err_t err;
+    int count;
+
+    switch (op) {
+        case '1':
+            return pm_node_on(pm, nodes);
+        case '0':
+            return pm_node_off(pm, nodes);
+        case 'c':
+            return pm_node_cycle(pm, nodes);
+        case 'q':
+            err = pm_nodes_status(pm, nodes, &results, &count);
+            break;
+        default:
+            usage();
+            return PM_EBADARG;
+    }
+    print_results(results, count);
+    pm_results_free(results, count);
+    return err;
+}
+
+/* Query each hostlist in [nodes] concurrently, driving the requests
+ * from a poll(2) loop and printing results as they complete.
+ */
+static pm_err_t
+poll_nodes(pm_handle_t pm, char **nodes, int count)
+{
+    pm_node_result_t *results;
+    pm_request_t req;
+    pm_err_t err = PM_ESUCCESS;
+    struct pollfd pfd;
+    int i, n;
+
+    for (i = 0; i < count; i++) {
+        if ((err = pm_request_send(pm, PM_REQ_STATUS, nodes[i], &req))
+                                                            != PM_ESUCCESS)
+            return err;
+    }
+    pfd.fd = pm_fd(pm);
+    pfd.events = POLLIN;
+    for (;;) {
+        while ((err = pm_request_complete(pm, &req)) == PM_ESUCCESS) {
+            err = pm_request_results(req, &results, &n);
+            if (err == PM_ESUCCESS || err == PM_EQUERY)
+                print_results(results, n);
+            pm_results_free(results, n);
+            pm_request_destroy(req);
+        }
+        if (err != PM_EINPROGRESS)
+            break;
+        if (poll(&pfd, 1, -1) < 0)
+            return PM_ERRNOVALID;
+        if ((err = pm_request_poll(pm)) != PM_ESUCCESS)
+            return err;
+    }
+    return err == PM_ENOREQUEST ? PM_ESUCCESS : err;
+}
+
 static void
 usage(void)
 {
     fprintf(stderr, "Usage: cli host:port 0|1|q node\n");
+    fprintf(stderr, "       cli host:port Q node...\n");
+    fprintf(stderr, "       cli host:port W nodes count\n");
+    fprintf(stderr, "       cli host:port B 0|1|c|q nodes\n");
+    fprintf(stderr, "       cli host:port P nodes...\n");
     fprintf(stderr, "       cli host:port l\n");
     exit(1);
 }
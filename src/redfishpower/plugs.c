@@ -27,6 +27,8 @@ struct plugs {
     hostlist_t plugs;
     /* map plug names to plug_data */
     zhashx_t *plug_map;
+    /* map plug names to hostlist of direct children */
+    zhashx_t *children_map;
 };
 
 static struct plug_data *plug_data_create(const char *plugname,
@@ -52,6 +54,7 @@ static void plug_data_destroy(struct plug_data *pd)
         xfree(pd->onpostdata);
         xfree(pd->off);
         xfree(pd->offpostdata);
+        xfree(pd->statcollection);
         xfree(pd);
     }
 }
@@ -63,6 +66,39 @@ static void plug_data_destroy_wrapper(void **data)
     plug_data_destroy(pd);
 }
 
+/* zhashx_destructor_fn */
+static void children_destroy_wrapper(void **data)
+{
+    hostlist_t children = *data;
+    hostlist_destroy(children);
+}
+
+static void children_add(plugs_t *p, const char *parent, const char *plugname)
+{
+    hostlist_t children;
+
+    if (!(children = zhashx_lookup(p->children_map, parent))) {
+        if (!(children = hostlist_create(NULL)))
+            err_exit(false, "hostlist_create failed");
+        zhashx_insert(p->children_map, parent, children);
+    }
+    if (hostlist_find(children, plugname) < 0) {
+        if (hostlist_push(children, plugname) == 0)
+            err_exit(false, "hostlist_push failed");
+    }
+}
+
+static void children_remove(plugs_t *p, const char *parent, const char *plugname)
+{
+    hostlist_t children;
+
+    if ((children = zhashx_lookup(p->children_map, parent))) {
+        hostlist_delete(children, plugname);
+        if (hostlist_count(children) == 0)
+            zhashx_delete(p->children_map, parent);
+    }
+}
+
 plugs_t *plugs_create(void)
 {
     plugs_t *p = (plugs_t *)xmalloc(sizeof(*p));
@@ -74,6 +110,10 @@ plugs_t *plugs_create(void)
         goto cleanup;
     zhashx_set_destructor(p->plug_map, plug_data_destroy_wrapper);
 
+    if (!(p->children_map = zhashx_new()))
+        goto cleanup;
+    zhashx_set_destructor(p->children_map, children_destroy_wrapper);
+
     return p;
 
 cleanup:
@@ -86,6 +126,7 @@ void plugs_destroy(plugs_t *p)
     if (p) {
         hostlist_destroy(p->plugs);
         zhashx_destroy(&p->plug_map);
+        zhashx_destroy(&p->children_map);
         xfree(p);
     }
 }
@@ -100,12 +141,19 @@ void plugs_add(plugs_t *p,
         if (hostlist_push(p->plugs, plugname) == 0)
             err_exit(false, "hostlist_push failed");
     }
+    if ((pd = zhashx_lookup(p->plug_map, plugname)) && pd->parent)
+        children_remove(p, pd->parent, plugname);
     pd = plug_data_create(plugname, hostname, parent);
     zhashx_update(p->plug_map, plugname, pd);
+    if (parent)
+        children_add(p, parent, plugname);
 }
 
 void plugs_remove(plugs_t *p, const char *plugname)
 {
+    struct plug_data *pd;
+    if ((pd = zhashx_lookup(p->plug_map, plugname)) && pd->parent)
+        children_remove(p, pd->parent, plugname);
     zhashx_delete(p->plug_map, plugname);
     hostlist_delete(p->plugs, plugname);
 }
@@ -149,6 +197,9 @@ int plugs_update_path(plugs_t *p,
         cmdptr = &pd->off;
         postdataptr = &pd->offpostdata;
     }
+    else if (strcmp(cmd, CMD_STATCOLLECTION) == 0) {
+        cmdptr = &pd->statcollection;
+    }
     else
         return -1;
 
@@ -192,6 +243,11 @@ char *plugs_find_root_parent(plugs_t *p, const char *plugname)
     return NULL;
 }
 
+hostlist_t plugs_children(plugs_t *p, const char *plugname)
+{
+    return zhashx_lookup(p->children_map, plugname);
+}
+
 int plugs_is_descendant(plugs_t *p,
                         const char *plugname,
                         const char *ancestor)
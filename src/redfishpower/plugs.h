@@ -26,6 +26,7 @@ struct plug_data {
     char *offpostdata;
     char *cycle;
     char *cyclepostdata;
+    char *statcollection;       /* NULL if not in a collection */
 };
 
 typedef struct plugs plugs_t;
@@ -62,6 +63,11 @@ int plugs_name_valid(plugs_t *p, const char *plugname);
 /* find deepest ancestor parent for this plugname */
 char *plugs_find_root_parent(plugs_t *p, const char *plugname);
 
+/* direct children of plugname, NULL if none.  Owned by plugs_t and
+ * only valid until the next plugs_add() or plugs_remove().
+ */
+hostlist_t plugs_children(plugs_t *p, const char *plugname);
+
 /* is plugname a descendant of ancestor */
 int plugs_is_descendant(plugs_t *p,
                         const char *plugname,
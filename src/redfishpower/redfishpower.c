@@ -19,7 +19,7 @@
 #include <stdlib.h>
 #include <jansson.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <limits.h>
 #include <sys/time.h>
 #include <ctype.h>
@@ -38,6 +38,7 @@
 #include "hostlist.h"
 #include "error.h"
 #include "argv.h"
+#include "xtimer.h"
 
 static hostlist_t hosts = NULL;
 static plugs_t *plugs = NULL;
@@ -62,28 +63,79 @@ static zlistx_t *activecmds = NULL;
 /* delayedcmds - power ops waiting to be sent
  * - typically holds status polling ops after an on / off, we wait to
  *   send at a later time.
+ * - delayq orders them by when they are due, each power op's
+ *   delaytimer moves it to activecmds on expiration.
  */
 static zlistx_t *delayedcmds = NULL;
+static xtimerq_t delayq = NULL;
 /* waitcmds - power ops waiting for a parent check to be completed */
 static zlistx_t *waitcmds = NULL;
 
+/* indexes so parent checks need not scan the lists above
+ * - activeplugs - plugname to list of power ops on activecmds or a
+ *   host queue
+ * - waiters - direct parent plugname to list of power ops on waitcmds
+ */
+static zhashx_t *activeplugs = NULL;
+static zhashx_t *waiters = NULL;
+
 static int test_mode = 0;
 static hostlist_t test_fail_power_cmd_hosts;
 static zhashx_t *test_power_status;
 
 static zhashx_t *resolve_hosts_cache = NULL;
 
+/* hostname/path of collections found not to report PowerState for
+ * their members, plugs in them are stat-ed individually
+ */
+static zhashx_t *unsupported_collections = NULL;
+
+/* connection, DNS, and TLS session caches shared by all easy handles,
+ * so a new message to a BMC can reuse an earlier message's connection
+ */
+static CURLSH *share = NULL;
+
+/* per host idle easy handles, held back power ops, and connection
+ * statistics
+ */
+struct hostconn {
+    zlistx_t *idle;                 /* easy handles ready for reuse */
+    zlistx_t *queue;                /* power ops waiting for a free slot */
+    int inflight;                   /* power ops on activecmds */
+    int peak;                       /* most power ops on activecmds */
+    unsigned long requests;         /* completed requests */
+    unsigned long reused;           /* requests sent on an existing connection */
+    unsigned long handles;          /* easy handles created */
+};
+static zhashx_t *hostconns = NULL;
+
+/* max power ops in progress per host, 0 for no limit */
+static int max_inflight = 0;
+
+/* epoll instance watching stdin and the sockets curl asks us to watch */
+static int epfd = -1;
+/* stdin is a regular file, which epoll can't watch but is always ready */
+static int stdin_is_file = 0;
+/* when curl next wants curl_multi_socket_action() called on timeout
+ * (monotonic clock, see xtimer_gettime()), not set if it doesn't
+ */
+static struct timeval curl_deadline;
+
 /* in seconds */
 #define MESSAGE_TIMEOUT_DEFAULT    10
 #define CMD_TIMEOUT_DEFAULT        60
 
-/* Per documentation, wait incremental time then proceed if timeout < 0 */
-#define INCREMENTAL_WAIT           500
+/* max events retrieved per epoll_wait() */
+#define EPOLL_EVENTS_MAX          64
+
+/* max idle easy handles kept per host */
+#define EASY_POOL_MAX             16
 
 /* in usec */
 #define STATUS_POLLING_INTERVAL_DEFAULT  1000000
 
 #define MS_IN_SEC                1000
+#define USEC_IN_SEC              1000000
 
 #define STATUS_ON           "on"
 #define STATUS_OFF          "off"
@@ -130,15 +182,25 @@ struct powermsg {
      *
      * timeout - when the overall power command times out
      *
-     * delaystart - if message should be sent after a wait
+     * delaytimer - if message should be sent after a wait, NULL if not
      *
      * poll_count - number of poll attempts
+     *
+     * times are from the monotonic clock, see xtimer_gettime()
      */
     struct timeval start;
     struct timeval timeout;
-    struct timeval delaystart;
+    xtimer_t delaytimer;
     int poll_count;
 
+    /* collection - for a stat of a collection resource, the plugs
+     * it reports on, NULL if not a collection stat
+     *
+     * collection_path - the collection resource path
+     */
+    hostlist_t collection;
+    char *collection_path;
+
     /* zlistx handle */
     void *handle;
 };
@@ -150,7 +212,7 @@ struct powermsg {
             err_exit(false, "curl_easy_setopt: %s", curl_easy_strerror(_ec));  \
     } while(0)
 
-#define OPTIONS "h:A:H:S:O:F:P:G:m:TEv"
+#define OPTIONS "h:A:H:S:O:F:P:G:m:M:TEv"
 static struct option longopts[] = {
         {"hostname", required_argument, 0, 'h' },
         {"header", required_argument, 0, 'H' },
@@ -161,6 +223,7 @@ static struct option longopts[] = {
         {"onpostdata", required_argument, 0, 'P' },
         {"offpostdata", required_argument, 0, 'G' },
         {"message-timeout", required_argument, 0, 'm' },
+        {"max-inflight", required_argument, 0, 'M' },
         {"resolve-hosts", no_argument, 0, 'o' },
         {"test-mode", no_argument, 0, 'T' },
         {"test-fail-power-cmd-hosts", required_argument, 0, 'E' },
@@ -185,7 +248,9 @@ void help(void)
     printf("  setoffpath path [postdata]\n");
     printf("  setplugs plugnames hostindices [<parentplug]]\n");
     printf("  setpath plugnames cmd path [postdata]\n");
+    printf("  setpath plugnames statcollection path\n");
     printf("  settimeout seconds\n");
+    printf("  connstats\n");
     printf("  stat [plugs]\n");
     printf("  on [plugs]\n");
     printf("  off [plugs]\n");
@@ -274,16 +339,58 @@ static size_t output_cb(void *contents, size_t size, size_t nmemb, void *userp)
     return realsize;
 }
 
+static void cleanup_powermsg(void **x);
+
+static void hostconn_destroy(void **item)
+{
+    if (item) {
+        struct hostconn *hc = *item;
+        CURL *eh;
+        while ((eh = zlistx_detach(hc->idle, NULL)))
+            curl_easy_cleanup(eh);
+        zlistx_destroy(&hc->idle);
+        zlistx_destroy(&hc->queue);
+        free(hc);
+        *item = NULL;
+    }
+}
+
+static struct hostconn *hostconn_get(const char *hostname)
+{
+    struct hostconn *hc;
+
+    if (!(hc = zhashx_lookup(hostconns, hostname))) {
+        hc = (struct hostconn *)xmalloc(sizeof(*hc));
+        if (!(hc->idle = zlistx_new()))
+            err_exit(true, "zlistx_new");
+        if (!(hc->queue = zlistx_new()))
+            err_exit(true, "zlistx_new");
+        zlistx_set_destructor(hc->queue, cleanup_powermsg);
+        if (zhashx_insert(hostconns, hostname, hc) < 0)
+            err_exit(false, "zhashx_insert failure");
+    }
+    return hc;
+}
+
 /* called before putting powermsg on activecmds list */
 static void powermsg_init_curl(struct powermsg *pm)
 {
+    struct hostconn *hc;
     CURLMcode mc;
 
     if (test_mode)
         return;
 
-    if ((pm->eh = curl_easy_init()) == NULL)
-        err_exit(false, "curl_easy_init failed");
+    /* A reset handle keeps its connection and session caches */
+    hc = hostconn_get(pm->hostname);
+    if ((pm->eh = zlistx_detach(hc->idle, NULL)))
+        curl_easy_reset(pm->eh);
+    else {
+        if ((pm->eh = curl_easy_init()) == NULL)
+            err_exit(false, "curl_easy_init failed");
+        hc->handles++;
+    }
+    Curl_easy_setopt((pm->eh, CURLOPT_SHARE, share));
 
     /* Per documentation, CURLOPT_TIMEOUT overrides
      * CURLOPT_CONNECTTIMEOUT */
@@ -329,6 +436,98 @@ static void powermsg_init_curl(struct powermsg *pm)
         Curl_easy_setopt((pm->eh, CURLOPT_HTTPGET, 1));
 }
 
+/* zhashx_destructor_fn for index lists, which do not own their powermsgs */
+static void index_list_destroy(void **item)
+{
+    zlistx_t *l = *item;
+    zlistx_destroy(&l);
+}
+
+static void index_add(zhashx_t *index, const char *key, struct powermsg *pm)
+{
+    zlistx_t *l;
+
+    if (!(l = zhashx_lookup(index, key))) {
+        if (!(l = zlistx_new()))
+            err_exit(true, "zlistx_new");
+        zhashx_insert(index, key, l);
+    }
+    if (!zlistx_add_end(l, pm))
+        err_exit(true, "zlistx_add_end");
+}
+
+static void index_remove(zhashx_t *index, const char *key, struct powermsg *pm)
+{
+    zlistx_t *l;
+    struct powermsg *tmp;
+
+    if (!(l = zhashx_lookup(index, key)))
+        return;
+    tmp = zlistx_first(l);
+    while (tmp) {
+        if (tmp == pm) {
+            zlistx_detach_cur(l);
+            break;
+        }
+        tmp = zlistx_next(l);
+    }
+    if (zlistx_size(l) == 0)
+        zhashx_delete(index, key);
+}
+
+/* Put powermsg on activecmds, or if its host already has max_inflight
+ * power ops in progress, hold it on the host's queue until one completes.
+ */
+static void activecmds_send(struct powermsg *pm)
+{
+    struct hostconn *hc = hostconn_get(pm->hostname);
+
+    if (max_inflight > 0 && hc->inflight >= max_inflight) {
+        if (!(pm->handle = zlistx_add_end(hc->queue, pm)))
+            err_exit(true, "zlistx_add_end");
+        if (verbose > 1)
+            fprintf(stderr,
+                    "DEBUG: %s hostname=%s plugname=%s queued\n",
+                    pm->cmd, pm->hostname, pm->plugname);
+        return;
+    }
+    powermsg_init_curl(pm);
+    if (!(pm->handle = zlistx_add_end(activecmds, pm)))
+        err_exit(true, "zlistx_add_end");
+    if (++hc->inflight > hc->peak)
+        hc->peak = hc->inflight;
+}
+
+static void activecmds_add(struct powermsg *pm)
+{
+    index_add(activeplugs, pm->plugname, pm);
+    activecmds_send(pm);
+}
+
+/* Delete completed powermsg from activecmds and release power ops
+ * held for its host.
+ */
+static void activecmds_delete(struct powermsg *pm)
+{
+    struct hostconn *hc = hostconn_get(pm->hostname);
+    struct powermsg *next;
+
+    index_remove(activeplugs, pm->plugname, pm);
+    if (zlistx_delete(activecmds, pm->handle) < 0)
+        err_exit(false, "zlistx_delete failed to delete");
+    hc->inflight--;
+    while ((max_inflight == 0 || hc->inflight < max_inflight)
+           && (next = zlistx_detach(hc->queue, NULL)))
+        activecmds_send(next);
+}
+
+static void waitcmds_add(struct powermsg *pm)
+{
+    if (!(pm->handle = zlistx_add_end(waitcmds, pm)))
+        err_exit(true, "zlistx_add_end");
+    index_add(waiters, pm->parent, pm);
+}
+
 static char *resolve_hosts_url(const char *hostname, const char *path)
 {
     char *url;
@@ -398,6 +597,15 @@ out:
     return url;
 }
 
+/* xtimer_cb_f - delayed power op is due, send it */
+static void delayedcmds_send(void *arg)
+{
+    struct powermsg *pm = arg;
+
+    zlistx_detach(delayedcmds, pm->handle);
+    activecmds_add(pm);
+}
+
 static struct powermsg *powermsg_create(CURLM *mh,
                                         const char *hostname,
                                         const char *plugname,
@@ -412,8 +620,6 @@ static struct powermsg *powermsg_create(CURLM *mh,
                                         int state)
 {
     struct powermsg *pm = calloc(1, sizeof(*pm));
-    struct timeval now;
-    struct timeval waitdelay = { 0 };
 
     if (!pm)
         err_exit(true, "calloc");
@@ -444,7 +650,7 @@ static struct powermsg *powermsg_create(CURLM *mh,
         pm->start.tv_usec = start->tv_usec;
     }
     else
-        gettimeofday(&pm->start, NULL);
+        xtimer_gettime(&pm->start);
 
     if (cmd_timeout > (LONG_MAX - pm->start.tv_sec))
         err_exit(false, "cmd_timeout overflow");
@@ -453,9 +659,11 @@ static struct powermsg *powermsg_create(CURLM *mh,
     pm->timeout.tv_usec = pm->start.tv_usec;
 
     if (delay_usec) {
-        gettimeofday(&now, NULL);
-        waitdelay.tv_usec = delay_usec;
-        timeradd(&now, &waitdelay, &pm->delaystart);
+        struct timeval waitdelay;
+        waitdelay.tv_sec = delay_usec / USEC_IN_SEC;
+        waitdelay.tv_usec = delay_usec % USEC_IN_SEC;
+        pm->delaytimer = xtimer_create(delayq, delayedcmds_send, pm);
+        xtimer_arm(pm->delaytimer, &waitdelay);
     }
 
     pm->poll_count = poll_count;
@@ -466,22 +674,33 @@ static struct powermsg *powermsg_create(CURLM *mh,
 static void powermsg_destroy(struct powermsg *pm)
 {
     if (pm) {
-        xfree(pm->cmd);
-        xfree(pm->hostname);
-        xfree(pm->plugname);
-        xfree(pm->parent);
-        xfree(pm->url);
-        xfree(pm->postdata);
-        free(pm->output);
         if (!test_mode && pm->eh) {
+            struct hostconn *hc;
             CURLMcode mc;
             Curl_easy_setopt((pm->eh, CURLOPT_URL, ""));
             if ((mc = curl_multi_remove_handle(pm->mh, pm->eh)) != CURLM_OK)
                 err_exit(false,
                          "curl_multi_remove_handle: %s",
                          curl_multi_strerror(mc));
-            curl_easy_cleanup(pm->eh);
+            hc = hostconn_get(pm->hostname);
+            if (zlistx_size(hc->idle) < EASY_POOL_MAX) {
+                if (!zlistx_add_end(hc->idle, pm->eh))
+                    err_exit(true, "zlistx_add_end");
+            }
+            else
+                curl_easy_cleanup(pm->eh);
         }
+        if (pm->delaytimer)
+            xtimer_destroy(pm->delaytimer);
+        hostlist_destroy(pm->collection);
+        xfree(pm->collection_path);
+        xfree(pm->cmd);
+        xfree(pm->hostname);
+        xfree(pm->plugname);
+        xfree(pm->parent);
+        xfree(pm->url);
+        xfree(pm->postdata);
+        free(pm->output);
         free(pm);
     }
 }
@@ -534,16 +753,19 @@ static struct powermsg *stat_cmd_plug(CURLM * mh,
  */
 static int plugname_active(const char *plugname, const char *cmd)
 {
-    struct powermsg *pm = zlistx_first(activecmds);
+    zlistx_t *l = zhashx_lookup(activeplugs, plugname);
+    struct powermsg *pm;
+
+    if (!l)
+        return 0;
+    pm = zlistx_first(l);
     while (pm) {
-        if (strcmp(pm->plugname, plugname) == 0) {
-            if (strcmp(pm->cmd, CMD_STAT) == 0)
-                return 1;
-            else if (strcmp(cmd, CMD_OFF) == 0
-                     && strcmp(pm->cmd, CMD_OFF) == 0)
-                return 1;
-        }
-        pm = zlistx_next(activecmds);
+        if (strcmp(pm->cmd, CMD_STAT) == 0)
+            return 1;
+        else if (strcmp(cmd, CMD_OFF) == 0
+                 && strcmp(pm->cmd, CMD_OFF) == 0)
+            return 1;
+        pm = zlistx_next(l);
     }
     return 0;
 }
@@ -567,9 +789,7 @@ static void send_initial_parent_queries(CURLM *mh)
             rootpm = stat_cmd_plug(mh, root_plugname, NO_OUTPUT);
             if (!rootpm)
                 goto next;
-            powermsg_init_curl(rootpm);
-            if (!(rootpm->handle = zlistx_add_end(activecmds, rootpm)))
-                err_exit(true, "zlistx_add_end");
+            activecmds_add(rootpm);
             if (verbose > 1)
                 fprintf(stderr,
                         "DEBUG: parent query hostname=%s plugname=%s\n",
@@ -580,12 +800,182 @@ static void send_initial_parent_queries(CURLM *mh)
     }
 }
 
+/*
+ * Wrapped hostlist_ranged_string() with internal buffer allocation,
+ * which caller must xfree().
+ */
+#define CHUNKSIZE 80
+static char *xhostlist_ranged_string(hostlist_t hl)
+{
+    int size = 0;
+    char *str = NULL;
+
+    do {
+        str = (size == 0) ? xmalloc(CHUNKSIZE) : xrealloc(str, size+CHUNKSIZE);
+        size += CHUNKSIZE;
+    } while (hostlist_ranged_string(hl, size, str) == -1);
+
+    return str;
+}
+
+/* resource path without leading/trailing slashes or query, caller
+ * must xfree()
+ */
+static char *path_normalize(const char *path)
+{
+    char *tmp;
+    char *ptr;
+    size_t len;
+
+    while (*path == '/')
+        path++;
+    tmp = xstrdup(path);
+    if ((ptr = strchr(tmp, '?')))
+        *ptr = '\0';
+    len = strlen(tmp);
+    while (len > 0 && tmp[len - 1] == '/')
+        tmp[--len] = '\0';
+    return tmp;
+}
+
+static char *collection_key(const char *hostname, const char *path)
+{
+    char *key = xmalloc(strlen(hostname) + strlen(path) + 2);
+    sprintf(key, "%s/%s", hostname, path);
+    return key;
+}
+
+/* zhashx_destructor_fn */
+static void collection_destroy(void **item)
+{
+    hostlist_t hl = *item;
+    hostlist_destroy(hl);
+}
+
+/* If plugname has a statcollection path, add it to the plugs to be
+ * stat-ed through that collection and return 1, else return 0.  Plugs
+ * with a parent or children take part in parent checks, which need
+ * each of them stat-ed on its own.
+ */
+static int stat_collection_add(zhashx_t *collections, const char *plugname)
+{
+    struct plug_data *pd = plugs_get_data(plugs, plugname);
+    hostlist_t hl;
+    char *path;
+    char *key;
+
+    if (!pd
+        || !pd->statcollection
+        || pd->parent
+        || plugs_children(plugs, plugname))
+        return 0;
+
+    path = calc_path(pd->statcollection, plugname);
+    key = collection_key(pd->hostname, path);
+    if (zhashx_lookup(unsupported_collections, key)) {
+        free(path);
+        free(key);
+        return 0;
+    }
+    if (!(hl = zhashx_lookup(collections, key))) {
+        if (!(hl = hostlist_create(NULL)))
+            err_exit(true, "hostlist_create");
+        zhashx_insert(collections, key, hl);
+    }
+    if (hostlist_push(hl, plugname) == 0)
+        err_exit(false, "hostlist_push failed");
+    free(path);
+    free(key);
+    return 1;
+}
+
+static void stat_plug(CURLM *mh, char *plugname)
+{
+    struct powermsg *pm;
+
+    if ((pm = stat_cmd_plug(mh, plugname, OUTPUT_RESULT)))
+        activecmds_add(pm);
+}
+
+/* Send a stat of each collection, or of the plug itself if it is the
+ * only one in its collection.
+ */
+static void stat_collection_send(CURLM *mh, zhashx_t *collections)
+{
+    hostlist_t hl = zhashx_first(collections);
+
+    while (hl) {
+        char *plugname = hostlist_nth(hl, 0);
+
+        if (hostlist_count(hl) > 1) {
+            struct plug_data *pd = plugs_get_data(plugs, plugname);
+            char *path = calc_path(pd->statcollection, plugname);
+            char *plugnames = xhostlist_ranged_string(hl);
+            struct powermsg *pm;
+
+            pm = powermsg_create(mh,
+                                 pd->hostname,
+                                 plugnames,
+                                 NULL,
+                                 CMD_STAT,
+                                 path,
+                                 NULL,
+                                 NULL,
+                                 0,
+                                 0,
+                                 OUTPUT_RESULT,
+                                 STATE_SEND_POWERCMD);
+            if (!(pm->collection = hostlist_copy(hl)))
+                err_exit(true, "hostlist_copy");
+            pm->collection_path = path;
+            activecmds_add(pm);
+            if (verbose > 1)
+                printf("DEBUG: %s hostname=%s plugname=%s path=%s\n",
+                       CMD_STAT, pd->hostname, plugnames, path);
+            xfree(plugnames);
+        }
+        else
+            stat_plug(mh, plugname);
+        free(plugname);
+        hl = zhashx_next(collections);
+    }
+}
+
+/* Collection stat failed, so stat its plugs individually.  If the
+ * collection is unsupported, don't try it again.
+ */
+static void stat_collection_fallback(struct powermsg *pm, int unsupported)
+{
+    hostlist_iterator_t itr;
+    char *plugname;
+
+    if (unsupported) {
+        char *key = collection_key(pm->hostname, pm->collection_path);
+        zhashx_insert(unsupported_collections,
+                      key,
+                      xstrdup(pm->collection_path));
+        if (verbose)
+            printf("%s: statcollection %s unsupported\n",
+                   pm->plugname, pm->collection_path);
+        free(key);
+    }
+
+    if (!(itr = hostlist_iterator_create(pm->collection)))
+        err_exit(true, "hostlist_iterator_create");
+    while ((plugname = hostlist_next(itr))) {
+        stat_plug(pm->mh, plugname);
+        free(plugname);
+    }
+    hostlist_iterator_destroy(itr);
+}
+
 static void stat_cmd(CURLM *mh, char **av)
 {
     hostlist_iterator_t itr;
     char *plugname;
     hostlist_t *plugsptr;
     hostlist_t lplugs = NULL;
+    zhashx_t *collections;
 
     if (av[0]) {
         if (!(lplugs = hostlist_create(av[0]))) {
@@ -600,6 +990,11 @@ static void stat_cmd(CURLM *mh, char **av)
     if (!(itr = hostlist_iterator_create(*plugsptr)))
         err_exit(true, "hostlist_iterator_create");
 
+    /* hostname/path of collection to plugs to stat through it */
+    if (!(collections = zhashx_new()))
+        err_exit(false, "zhashx_new error");
+    zhashx_set_destructor(collections, collection_destroy);
+
     while ((plugname = hostlist_next(itr))) {
         struct powermsg *pm;
         if (!plugs_name_valid(plugs, plugname)) {
@@ -607,22 +1002,24 @@ static void stat_cmd(CURLM *mh, char **av)
             free(plugname);
             continue;
         }
-        if (!(pm = stat_cmd_plug(mh, plugname, OUTPUT_RESULT))) {
+        if (stat_collection_add(collections, plugname)) {
             free(plugname);
             continue;
         }
-        if (pm->parent) {
-            if (!(pm->handle = zlistx_add_end(waitcmds, pm)))
-                err_exit(true, "zlistx_add_end");
-        }
-        else {
-            powermsg_init_curl(pm);
-            if (!(pm->handle = zlistx_add_end(activecmds, pm)))
-                err_exit(true, "zlistx_add_end");
+        if (!(pm = stat_cmd_plug(mh, plugname, OUTPUT_RESULT))) {
+            free(plugname);
+            continue;
         }
+        if (pm->parent)
+            waitcmds_add(pm);
+        else
+            activecmds_add(pm);
         free(plugname);
     }
 
+    stat_collection_send(mh, collections);
+    zhashx_destroy(&collections);
+
     if (zlistx_size(waitcmds) > 0)
         send_initial_parent_queries(mh);
 
@@ -633,6 +1030,40 @@ static void stat_cmd(CURLM *mh, char **av)
 /* status_strp - on, off, unknown
  * rstatus_strp - on, off, paused, poweringoff, poweringon, unknown
  */
+/* str - Redfish PowerState */
+static void parse_powerstate(const char *plugname,
+                             const char *str,
+                             const char **status_strp,
+                             const char **rstatus_strp)
+{
+    if (strcasecmp(str, "On") == 0) {
+        (*status_strp) = STATUS_ON;
+        if (rstatus_strp)
+            (*rstatus_strp) = STATUS_ON;
+    }
+    else if (strcasecmp(str, "Off") == 0) {
+        (*status_strp) = STATUS_OFF;
+        if (rstatus_strp)
+            (*rstatus_strp) = STATUS_OFF;
+    }
+    else {
+        (*status_strp) = STATUS_UNKNOWN;
+        if (rstatus_strp) {
+            if (strcasecmp(str, "Paused") == 0)
+                (*rstatus_strp) = STATUS_PAUSED;
+            else if (strcasecmp(str, "PoweringOff") == 0)
+                (*rstatus_strp) = STATUS_POWERING_OFF;
+            else if (strcasecmp(str, "PoweringOn") == 0)
+                (*rstatus_strp) = STATUS_POWERING_ON;
+            else
+                (*rstatus_strp) = STATUS_UNKNOWN;
+        }
+        if (verbose)
+            printf("%s: unknown status - %s\n",
+                   plugname, str);
+    }
+}
+
 static void parse_onoff_response(struct powermsg *pm,
                                  const char **status_strp,
                                  const char **rstatus_strp)
@@ -657,35 +1088,11 @@ static void parse_onoff_response(struct powermsg *pm,
                 if (verbose)
                     printf("%s: no PowerState\n", pm->plugname);
             }
-            else {
-                const char *str = json_string_value(val);
-                if (strcasecmp(str, "On") == 0) {
-                    (*status_strp) = STATUS_ON;
-                    if (rstatus_strp)
-                        (*rstatus_strp) = STATUS_ON;
-                }
-                else if (strcasecmp(str, "Off") == 0) {
-                    (*status_strp) = STATUS_OFF;
-                    if (rstatus_strp)
-                        (*rstatus_strp) = STATUS_OFF;
-                }
-                else {
-                    (*status_strp) = STATUS_UNKNOWN;
-                    if (rstatus_strp) {
-                        if (strcasecmp(str, "Paused") == 0)
-                            (*rstatus_strp) = STATUS_PAUSED;
-                        else if (strcasecmp(str, "PoweringOff") == 0)
-                            (*rstatus_strp) = STATUS_POWERING_OFF;
-                        else if (strcasecmp(str, "PoweringOn") == 0)
-                            (*rstatus_strp) = STATUS_POWERING_ON;
-                        else
-                            (*rstatus_strp) = STATUS_UNKNOWN;
-                    }
-                    if (verbose)
-                        printf("%s: unknown status - %s\n",
-                               pm->plugname, str);
-                }
-            }
+            else
+                parse_powerstate(pm->plugname,
+                                 json_string_value(val),
+                                 status_strp,
+                                 rstatus_strp);
         }
         json_decref(o);
     }
@@ -711,95 +1118,92 @@ static void parse_onoff(struct powermsg *pm,
     }
 }
 
-static void process_waiters(CURLM *mh,
-                            const char *ancestor,
-                            const char *status_str)
+/* Ancestor is off/unknown/error, so waiters on plugname and on all of
+ * its descendants are done.
+ */
+static void finish_waiters(const char *ancestor,
+                           const char *plugname,
+                           const char *status_str)
 {
-    struct powermsg *pm;
+    hostlist_t children;
+    zlistx_t *l;
 
-    /* first pass - deal with descendants that will be removed from
-     * waitcmds (either removed outright or moved to activecmds)
-     */
-    pm = zlistx_first(waitcmds);
-    while (pm) {
-        int descendant = plugs_is_descendant(plugs, pm->plugname, ancestor);
-        if (descendant) {
-            if (strcmp(status_str, STATUS_ON) != 0) {
-                if (verbose > 1)
-                    fprintf(stderr,
-                            "DEBUG: descendant: "
-                            "%s hostname=%s plugname=%s status=%s\n",
-                            pm->cmd, pm->hostname, pm->plugname, status_str);
-
-                if (pm->output_result) {
-                    /* for stat if ancestor is off/unknown/error, the child is
-                     * defined as off/unknown/error
-                     *
-                     * for off, if ancestor is off, we consider
-                     * operation a success
-                     *
-                     * otherwise can't do operation
-                     */
-                    if (strcmp(pm->cmd, CMD_STAT) == 0)
-                        printf("%s: %s\n", pm->plugname, status_str);
-                    else if (strcmp(pm->cmd, CMD_OFF) == 0
-                             && strcmp(status_str, STATUS_OFF) == 0)
-                        printf("%s: %s\n", pm->plugname, "ok");
-                    else {
-                        struct plug_data *pd = plugs_get_data(plugs, ancestor);
-                        printf("%s: cannot perform %s, dependency %s"
-                               " (host=%s plug=%s)\n",
-                               pm->plugname,
-                               pm->cmd,
-                               status_str,
-                               pd->hostname,
-                               pd->plugname);
-                    }
-                }
+    if (zlistx_size(waitcmds) == 0)
+        return;
 
-                /* this power op is now done */
-                zlistx_detach_cur(waitcmds);
-                powermsg_destroy(pm);
-            }
-            else {
-                /* if ancestor is direct parent, move waiter to active list */
-                if (strcmp(pm->parent, ancestor) == 0) {
-                    if (verbose > 1)
-                        fprintf(stderr,
-                                "DEBUG: %s hostname=%s plugname=%s "
-                                "moved to activecmds\n",
-                                pm->cmd, pm->hostname, pm->plugname);
-                    zlistx_detach_cur(waitcmds);
-                    powermsg_init_curl(pm);
-                    if (!(pm->handle = zlistx_add_end(activecmds, pm)))
-                        err_exit(true, "zlistx_add_end");
+    if ((l = zhashx_lookup(waiters, plugname))) {
+        struct powermsg *pm;
+        while ((pm = zlistx_detach(l, NULL))) {
+            if (verbose > 1)
+                fprintf(stderr,
+                        "DEBUG: descendant: "
+                        "%s hostname=%s plugname=%s status=%s\n",
+                        pm->cmd, pm->hostname, pm->plugname, status_str);
+
+            if (pm->output_result) {
+                /* for stat if ancestor is off/unknown/error, the child is
+                 * defined as off/unknown/error
+                 *
+                 * for off, if ancestor is off, we consider
+                 * operation a success
+                 *
+                 * otherwise can't do operation
+                 */
+                if (strcmp(pm->cmd, CMD_STAT) == 0)
+                    printf("%s: %s\n", pm->plugname, status_str);
+                else if (strcmp(pm->cmd, CMD_OFF) == 0
+                         && strcmp(status_str, STATUS_OFF) == 0)
+                    printf("%s: %s\n", pm->plugname, "ok");
+                else {
+                    struct plug_data *pd = plugs_get_data(plugs, ancestor);
+                    printf("%s: cannot perform %s, dependency %s"
+                           " (host=%s plug=%s)\n",
+                           pm->plugname,
+                           pm->cmd,
+                           status_str,
+                           pd->hostname,
+                           pd->plugname);
                 }
             }
+
+            /* this power op is now done */
+            zlistx_detach(waitcmds, pm->handle);
+            powermsg_destroy(pm);
         }
-        pm = zlistx_next(waitcmds);
+        zhashx_delete(waiters, plugname);
     }
 
-    /* second loop only deals w/ STATUS_ON, so we can give up now if
-     * not on */
-    if (strcmp(status_str, STATUS_ON) != 0)
+    if ((children = plugs_children(plugs, plugname))) {
+        hostlist_iterator_t itr;
+        char *child;
+
+        if (!(itr = hostlist_iterator_create(children)))
+            err_exit(true, "hostlist_iterator_create");
+        while ((child = hostlist_next(itr))) {
+            finish_waiters(ancestor, child, status_str);
+            free(child);
+        }
+        hostlist_iterator_destroy(itr);
+    }
+}
+
+/* Waiters on plugname and its descendants are below child, a direct
+ * child of an ancestor that is on, so status query child unless that
+ * is already being done.
+ */
+static void query_for_waiters(CURLM *mh,
+                              char *child,
+                              const char *plugname)
+{
+    hostlist_t children;
+    zlistx_t *l;
+
+    if (zlistx_size(waitcmds) == 0)
         return;
 
-    /* second pass - remaining descendants on waitcmds do not have
-     * direct parent == ancestor, so we have to status query
-     * the child of that ancestor.
-     *
-     * This has to be done as a second pass because we need to
-     * previous loop to finish moving all possible power ops on
-     * waitcmds to the activecmds list before we scan it with
-     * plugname_active().
-     */
-    pm = zlistx_first(waitcmds);
-    while (pm) {
-        int descendant = plugs_is_descendant(plugs, pm->plugname, ancestor);
-        if (descendant) {
-            /* status query the child of that ancestor */
-            char *child = plugs_child_of_ancestor(plugs, pm->plugname, ancestor);
-            assert(child);
+    if ((l = zhashx_lookup(waiters, plugname))) {
+        struct powermsg *pm = zlistx_first(l);
+        while (pm) {
             int is_active = plugname_active(child, pm->cmd);
             /* if not active, that means no active attempts to on/off/stat
              * the child plugname, so we need to stat it now
@@ -810,25 +1214,226 @@ static void process_waiters(CURLM *mh,
                  * is only to determine if we should perform power op
                  */
                 childpm = stat_cmd_plug(mh, child, NO_OUTPUT);
-                if (!childpm)
-                    goto next;
-                powermsg_init_curl(childpm);
-                if (!(childpm->handle = zlistx_add_end(activecmds, childpm)))
-                    err_exit(true, "zlistx_add_end");
-                if (verbose > 1)
-                    fprintf(stderr,
-                            "DEBUG: parent query hostname=%s plugname=%s\n",
-                            childpm->hostname, childpm->plugname);
+                if (childpm) {
+                    activecmds_add(childpm);
+                    if (verbose > 1)
+                        fprintf(stderr,
+                                "DEBUG: parent query hostname=%s plugname=%s\n",
+                                childpm->hostname, childpm->plugname);
+                }
             }
+            pm = zlistx_next(l);
         }
-    next:
-        pm = zlistx_next(waitcmds);
+    }
+
+    if ((children = plugs_children(plugs, plugname))) {
+        hostlist_iterator_t itr;
+        char *tmp;
+
+        if (!(itr = hostlist_iterator_create(children)))
+            err_exit(true, "hostlist_iterator_create");
+        while ((tmp = hostlist_next(itr))) {
+            query_for_waiters(mh, child, tmp);
+            free(tmp);
+        }
+        hostlist_iterator_destroy(itr);
     }
 }
 
+static void process_waiters(CURLM *mh,
+                            const char *ancestor,
+                            const char *status_str)
+{
+    hostlist_t children;
+    zlistx_t *l;
+
+    if (strcmp(status_str, STATUS_ON) != 0) {
+        finish_waiters(ancestor, ancestor, status_str);
+        return;
+    }
+
+    /* waiters with direct parent == ancestor move to active list */
+    if ((l = zhashx_lookup(waiters, ancestor))) {
+        struct powermsg *pm;
+        while ((pm = zlistx_detach(l, NULL))) {
+            if (verbose > 1)
+                fprintf(stderr,
+                        "DEBUG: %s hostname=%s plugname=%s "
+                        "moved to activecmds\n",
+                        pm->cmd, pm->hostname, pm->plugname);
+            zlistx_detach(waitcmds, pm->handle);
+            activecmds_add(pm);
+        }
+        zhashx_delete(waiters, ancestor);
+    }
+
+    /* remaining descendants on waitcmds do not have direct parent ==
+     * ancestor, so we have to status query the child of that
+     * ancestor.
+     *
+     * This is done after the loop above, which must finish moving all
+     * possible power ops to the activecmds list before we check it
+     * with plugname_active().
+     */
+    if ((children = plugs_children(plugs, ancestor))) {
+        hostlist_iterator_t itr;
+        char *child;
+
+        if (!(itr = hostlist_iterator_create(children)))
+            err_exit(true, "hostlist_iterator_create");
+        while ((child = hostlist_next(itr))) {
+            query_for_waiters(mh, child, child);
+            free(child);
+        }
+        hostlist_iterator_destroy(itr);
+    }
+}
+
+/* In test mode, make up the collection's response from the test
+ * status of its plugs.  Plugs whose stat path is not under the
+ * collection path are not members.
+ */
+static void stat_collection_test_output(struct powermsg *pm)
+{
+    char *base = path_normalize(pm->collection_path);
+    size_t baselen = strlen(base);
+    hostlist_iterator_t itr;
+    char *plugname;
+    json_t *o;
+    json_t *members;
+
+    if (!(o = json_object()) || !(members = json_array()))
+        err_exit(false, "json_object/json_array");
+    if (!(itr = hostlist_iterator_create(pm->collection)))
+        err_exit(true, "hostlist_iterator_create");
+    while ((plugname = hostlist_next(itr))) {
+        char *status = zhashx_lookup(test_power_status, plugname);
+        char *path = NULL;
+        char *id;
+
+        get_path(CMD_STAT, plugname, &path, NULL);
+        id = path_normalize(path);
+        if (status
+            && strncmp(id, base, baselen) == 0
+            && id[baselen] == '/') {
+            json_t *member;
+            char *odataid = xmalloc(strlen(id) + 2);
+            sprintf(odataid, "/%s", id);
+            if (!(member = json_object())
+                || json_object_set_new(member,
+                                       "@odata.id",
+                                       json_string(odataid)) < 0
+                || json_object_set_new(member,
+                                       "PowerState",
+                                       json_string(strcmp(status, STATUS_ON) == 0
+                                                   ? "On" : "Off")) < 0
+                || json_array_append_new(members, member) < 0)
+                err_exit(false, "json member");
+            xfree(odataid);
+        }
+        xfree(id);
+        free(path);
+        free(plugname);
+    }
+    hostlist_iterator_destroy(itr);
+    if (json_object_set_new(o, "Members", members) < 0)
+        err_exit(false, "json_object_set_new");
+    if (!(pm->output = json_dumps(o, 0)))
+        err_exit(false, "json_dumps");
+    pm->output_len = strlen(pm->output);
+    json_decref(o);
+    xfree(base);
+}
+
+/* Fan PowerState of the collection's members out to its plugs,
+ * matching each member's @odata.id against the plug's stat path.
+ * Plugs with no matching member are stat-ed individually.
+ */
+static void stat_collection_process(struct powermsg *pm)
+{
+    hostlist_iterator_t itr;
+    char *plugname;
+    zhashx_t *states;
+    json_error_t error;
+    json_t *o = NULL;
+    json_t *members;
+    size_t i;
+
+    if (test_mode)
+        stat_collection_test_output(pm);
+
+    if (!pm->output
+        || !(o = json_loads(pm->output, 0, &error))
+        || !json_is_array(members = json_object_get(o, "Members"))) {
+        json_decref(o);
+        stat_collection_fallback(pm, 1);
+        return;
+    }
+
+    /* member path to PowerState */
+    if (!(states = zhashx_new()))
+        err_exit(false, "zhashx_new error");
+    for (i = 0; i < json_array_size(members); i++) {
+        json_t *member = json_array_get(members, i);
+        json_t *id = json_object_get(member, "@odata.id");
+        json_t *state = json_object_get(member, "PowerState");
+        if (json_is_string(id) && json_is_string(state)) {
+            char *path = path_normalize(json_string_value(id));
+            zhashx_update(states, path, (void *)json_string_value(state));
+            xfree(path);
+        }
+    }
+
+    /* members without PowerState, e.g. $expand not supported */
+    if (zhashx_size(states) == 0) {
+        zhashx_destroy(&states);
+        json_decref(o);
+        stat_collection_fallback(pm, 1);
+        return;
+    }
+
+    if (!(itr = hostlist_iterator_create(pm->collection)))
+        err_exit(true, "hostlist_iterator_create");
+    while ((plugname = hostlist_next(itr))) {
+        const char *str;
+        char *path = NULL;
+        char *key;
+
+        get_path(CMD_STAT, plugname, &path, NULL);
+        key = path_normalize(path);
+        if ((str = zhashx_lookup(states, key))) {
+            const char *status_str;
+            parse_powerstate(plugname, str, &status_str, NULL);
+            printf("%s: %s\n", plugname, status_str);
+            if (verbose > 1)
+                fprintf(stderr,
+                        "DEBUG: %s hostname=%s plugname=%s status=%s\n",
+                        pm->cmd, pm->hostname, plugname, status_str);
+            process_waiters(pm->mh, plugname, status_str);
+        }
+        else {
+            if (verbose)
+                printf("%s: not in statcollection %s\n",
+                       plugname, pm->collection_path);
+            stat_plug(pm->mh, plugname);
+        }
+        xfree(key);
+        free(path);
+        free(plugname);
+    }
+    hostlist_iterator_destroy(itr);
+    zhashx_destroy(&states);
+    json_decref(o);
+}
+
 static void stat_process(struct powermsg *pm)
 {
     const char *status_str;
+
+    if (pm->collection) {
+        stat_collection_process(pm);
+        return;
+    }
     parse_onoff(pm, &status_str, NULL);
     if (pm->output_result)
         printf("%s: %s\n", pm->plugname, status_str);
@@ -908,6 +1513,7 @@ static void phased_power_on_check(const char *cmd)
 {
     struct powermsg **allpm;
     struct powermsg *pm;
+    struct hostconn *hc;
     int total = 0;
     int i = 0;
     int cancel = 0;
@@ -917,6 +1523,11 @@ static void phased_power_on_check(const char *cmd)
 
     total += zlistx_size(activecmds);
     total += zlistx_size(waitcmds);
+    hc = zhashx_first(hostconns);
+    while (hc) {
+        total += zlistx_size(hc->queue);
+        hc = zhashx_next(hostconns);
+    }
 
     assert(total > 0);
 
@@ -942,6 +1553,16 @@ static void phased_power_on_check(const char *cmd)
         pm = zlistx_next(waitcmds);
     }
 
+    hc = zhashx_first(hostconns);
+    while (hc) {
+        pm = zlistx_first(hc->queue);
+        while (pm) {
+            allpm[i++] = pm;
+            pm = zlistx_next(hc->queue);
+        }
+        hc = zhashx_next(hostconns);
+    }
+
     for (i = 0; i < (total - 1); i++) {
         struct powermsg *pm1 = allpm[i];
         for (int j = i + 1; j < total; j++) {
@@ -962,6 +1583,7 @@ static void phased_power_on_check(const char *cmd)
             pm = zlistx_next(activecmds);
         }
         zlistx_purge(activecmds);
+        zhashx_purge(activeplugs);
 
         pm = zlistx_first(waitcmds);
         while (pm) {
@@ -969,6 +1591,19 @@ static void phased_power_on_check(const char *cmd)
             pm = zlistx_next(waitcmds);
         }
         zlistx_purge(waitcmds);
+        zhashx_purge(waiters);
+
+        hc = zhashx_first(hostconns);
+        while (hc) {
+            pm = zlistx_first(hc->queue);
+            while (pm) {
+                printf("%s: %s\n", pm->plugname, "cannot turn on parent and child");
+                pm = zlistx_next(hc->queue);
+            }
+            zlistx_purge(hc->queue);
+            hc->inflight = 0;
+            hc = zhashx_next(hostconns);
+        }
     }
 
     free(allpm);
@@ -1008,15 +1643,10 @@ static void power_cmd(CURLM *mh,
             free(plugname);
             continue;
         }
-        if (pm->parent) {
-            if (!(pm->handle = zlistx_add_end(waitcmds, pm)))
-                err_exit(true, "zlistx_add_end");
-        }
-        else {
-            powermsg_init_curl(pm);
-            if (!(pm->handle = zlistx_add_end(activecmds, pm)))
-                err_exit(true, "zlistx_add_end");
-        }
+        if (pm->parent)
+            waitcmds_add(pm);
+        else
+            activecmds_add(pm);
         free(plugname);
     }
 
@@ -1160,7 +1790,7 @@ static void on_off_process(struct powermsg *pm)
         }
 
         /* check if we've timed out */
-        gettimeofday(&now, NULL);
+        xtimer_gettime(&now);
         if (timercmp(&now, &pm->timeout, >)) {
             /* if target is not what it should be, this is unexpected, likely
              * hardware problem */
@@ -1432,7 +2062,8 @@ static void setpath(char **av)
 
     if (strcmp(av[1], CMD_STAT) != 0
         && strcmp(av[1], CMD_ON) != 0
-        && strcmp(av[1], CMD_OFF) != 0) {
+        && strcmp(av[1], CMD_OFF) != 0
+        && strcmp(av[1], CMD_STATCOLLECTION) != 0) {
         printf("setpath: invalid command specified\n");
         return;
     }
@@ -1473,6 +2104,27 @@ static void settimeout(char **av)
     }
 }
 
+static void connstats(char **av)
+{
+    hostlist_iterator_t itr;
+    char *hostname;
+
+    if (!(itr = hostlist_iterator_create(hosts)))
+        err_exit(true, "hostlist_iterator_create");
+    while ((hostname = hostlist_next(itr))) {
+        struct hostconn *hc = hostconn_get(hostname);
+        printf("%s: requests %lu reused %lu (%lu%%) handles %lu peak %d\n",
+               hostname,
+               hc->requests,
+               hc->reused,
+               hc->requests ? hc->reused * 100 / hc->requests : 0,
+               hc->handles,
+               hc->peak);
+        free(hostname);
+    }
+    hostlist_iterator_destroy(itr);
+}
+
 static void process_cmd(CURLM *mh, char **av, int *exitflag)
 {
     if (av[0] != NULL) {
@@ -1496,6 +2148,8 @@ static void process_cmd(CURLM *mh, char **av, int *exitflag)
             setpath(av + 1);
         else if (strcmp(av[0], "settimeout") == 0)
             settimeout(av + 1);
+        else if (strcmp(av[0], "connstats") == 0)
+            connstats(av + 1);
         else if (strcmp(av[0], CMD_STAT) == 0)
             stat_cmd(mh, av + 1);
         else if (strcmp(av[0], CMD_ON) == 0)
@@ -1520,124 +2174,290 @@ static void cleanup_powermsg(void **x)
     }
 }
 
+/* curl socket callback - keep epoll in sync with the sockets curl
+ * wants watched.  socketp is non-NULL once the socket has been added.
+ */
+static int socket_cb(CURL *eh,
+                     curl_socket_t s,
+                     int what,
+                     void *userp,
+                     void *socketp)
+{
+    CURLM *mh = userp;
+    struct epoll_event ev = {0};
+    CURLMcode mc;
+
+    if (what == CURL_POLL_REMOVE) {
+        /* socket may already be closed, which removes it from epoll */
+        if (socketp)
+            (void)epoll_ctl(epfd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+
+    if (what & CURL_POLL_IN)
+        ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = s;
+
+    if (socketp) {
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev) < 0)
+            err_exit(true, "epoll_ctl");
+    }
+    else {
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+            err_exit(true, "epoll_ctl");
+        if ((mc = curl_multi_assign(mh, s, &epfd)) != CURLM_OK)
+            err_exit(false, "curl_multi_assign: %s", curl_multi_strerror(mc));
+    }
+    return 0;
+}
+
+/* curl timer callback - remember when curl wants to be called back */
+static int timer_cb(CURLM *mh, long timeout_ms, void *userp)
+{
+    struct timeval now, delay;
+
+    if (timeout_ms < 0) {
+        timerclear(&curl_deadline);
+        return 0;
+    }
+    xtimer_gettime(&now);
+    delay.tv_sec = timeout_ms / MS_IN_SEC;
+    delay.tv_usec = (timeout_ms % MS_IN_SEC) * (USEC_IN_SEC / MS_IN_SEC);
+    timeradd(&now, &delay, &curl_deadline);
+    return 0;
+}
+
+/* milliseconds until curl_deadline, rounded up, 0 if it has passed */
+static int curl_timeleft(void)
+{
+    struct timeval now, left;
+
+    xtimer_gettime(&now);
+    if (!timercmp(&now, &curl_deadline, <))
+        return 0;
+    timersub(&curl_deadline, &now, &left);
+    return left.tv_sec * MS_IN_SEC
+        + (left.tv_usec + MS_IN_SEC - 1) / MS_IN_SEC;
+}
+
+static void socket_action(CURLM *mh, curl_socket_t s, int ev_bitmask)
+{
+    CURLMcode mc;
+    int running;
+
+    if ((mc = curl_multi_socket_action(mh,
+                                       s,
+                                       ev_bitmask,
+                                       &running)) != CURLM_OK)
+        err_exit(false,
+                 "curl_multi_socket_action: %s",
+                 curl_multi_strerror(mc));
+}
+
+/* Only watch stdin when no power ops are outstanding */
+static void watch_stdin(int *watched, int watch)
+{
+    struct epoll_event ev = {0};
+
+    if (stdin_is_file || *watched == watch)
+        return;
+    ev.events = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    if (epoll_ctl(epfd,
+                  watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                  STDIN_FILENO,
+                  &ev) < 0) {
+        if (watch && errno == EPERM) {
+            stdin_is_file = 1;
+            return;
+        }
+        err_exit(true, "epoll_ctl");
+    }
+    *watched = watch;
+}
+
+/* process completed transfers */
+static void process_multi_info(CURLM *mh)
+{
+    struct CURLMsg *cmsg;
+    int msgq = 0;
+
+    do {
+        cmsg = curl_multi_info_read(mh, &msgq);
+        if(cmsg && (cmsg->msg == CURLMSG_DONE)) {
+            struct powermsg *pm = NULL;
+            CURL *eh = cmsg->easy_handle;
+            struct hostconn *hc;
+            long connects;
+            CURLcode ec;
+
+            if ((ec = curl_easy_getinfo(eh,
+                                        CURLINFO_PRIVATE,
+                                        (char **)&pm)) != CURLE_OK)
+                err_exit(false,
+                         "curl_easy_getinfo: %s",
+                         curl_easy_strerror(ec));
+
+            if (!pm)
+                err_exit(false, "private data not set in easy handle");
+
+            hc = hostconn_get(pm->hostname);
+            hc->requests++;
+            if (curl_easy_getinfo(eh,
+                                  CURLINFO_NUM_CONNECTS,
+                                  &connects) == CURLE_OK
+                && connects == 0)
+                hc->reused++;
+
+            if (cmsg->data.result != 0 && pm->collection) {
+                /* an error response means the BMC can't stat the
+                 * collection, any other failure may be transient
+                 */
+                if (verbose)
+                    printf("%s: %s\n", pm->plugname,
+                           curl_easy_strerror(cmsg->data.result));
+                stat_collection_fallback(pm,
+                                         cmsg->data.result
+                                         == CURLE_HTTP_RETURNED_ERROR);
+            }
+            else if (cmsg->data.result != 0) {
+                if (cmsg->data.result == CURLE_HTTP_RETURNED_ERROR) {
+                    /* N.B. curl returns this error code for all response
+                     * codes >= 400.  So gotta dig in more.
+                     */
+                    long code;
+
+                    if (curl_easy_getinfo(cmsg->easy_handle,
+                                          CURLINFO_RESPONSE_CODE,
+                                          &code) != CURLE_OK)
+                        printf("%s: %s\n", pm->plugname, "http error");
+                    if (code == 400)
+                        printf("%s: %s\n", pm->plugname, "bad request");
+                    else if (code == 401)
+                        printf("%s: %s\n", pm->plugname, "unauthorized");
+                    else if (code == 404)
+                        printf("%s: %s\n", pm->plugname, "not found");
+                    else
+                        printf("%s: %s (%ld)\n",
+                               pm->plugname,
+                               "http error",
+                               code);
+                }
+                else
+                    printf("%s: %s\n",
+                           pm->plugname,
+                           curl_easy_strerror(cmsg->data.result));
+                if (verbose)
+                    printf("%s: %s\n", pm->plugname,
+                           curl_easy_strerror(cmsg->data.result));
+
+                process_waiters(mh,
+                                pm->plugname,
+                                STATUS_ERROR);
+            }
+            else
+                power_cmd_process(pm);
+            fflush(stdout);
+            activecmds_delete(pm);
+        }
+    } while (cmsg);
+}
+
 static void shell(CURLM *mh)
 {
     int exitflag = 0;
+    int stdin_watched = 0;
 
     while (exitflag == 0) {
-        CURLMcode mc;
-        fd_set fdread;
-        fd_set fdwrite;
-        fd_set fderror;
-        struct timeval timeout = {0};
-        struct timeval *timeoutptr = NULL;
-        int maxfd = -1;
-
-        FD_ZERO(&fdread);
-        FD_ZERO(&fdwrite);
-        FD_ZERO(&fderror);
+        struct epoll_event events[EPOLL_EVENTS_MAX];
+        int timeout = -1;
+        int stdin_ready = 0;
+        int idle = 0;
+        int n, i;
 
         if (!zlistx_size(activecmds)
             && !zlistx_size(delayedcmds)
             && !zlistx_size(waitcmds)) {
             printf("redfishpower> ");
             fflush(stdout);
-
-            FD_SET(STDIN_FILENO, &fdread);
-            timeoutptr = NULL;
-            maxfd = STDIN_FILENO;
+            idle = 1;
         }
         else {
-            struct timeval curl_timeout;
-            long curl_timeout_ms;
-
-            /* First check if there are any delayedcmds to send or are
-             * waiting.  If there are some ready to send, put to
-             * activecmds.  If not, setup timeout accordingly if one
-             * is waiting */
+            /* First move any delayedcmds that are due to activecmds,
+             * then setup timeout for the next one due, if any.
+             */
             if (zlistx_size(delayedcmds) > 0) {
-                struct powermsg *delaypm = zlistx_first(delayedcmds);
                 struct timeval delaytimeout;
-                struct timeval now;
-                gettimeofday(&now, NULL);
-                while (delaypm) {
-                    if (timercmp(&delaypm->delaystart, &now, >))
-                        break;
-                    zlistx_detach_cur(delayedcmds);
-                    powermsg_init_curl(delaypm);
-                    if (!(delaypm->handle = zlistx_add_end(activecmds,
-                                                           delaypm)))
-                        err_exit(true, "zlistx_add_end");
-                    delaypm = zlistx_next(delayedcmds);
-                }
 
-                delaypm = zlistx_first(delayedcmds);
-                if (delaypm) {
-                    timersub(&delaypm->delaystart, &now, &delaytimeout);
-                    timeout.tv_sec = delaytimeout.tv_sec;
-                    timeout.tv_usec = delaytimeout.tv_usec;
-                    timeoutptr = &timeout;
+                xtimerq_run(delayq);
+                if (xtimerq_next(delayq, &delaytimeout)) {
+                    /* round up, otherwise we'd spin until it's due */
+                    timeout = delaytimeout.tv_sec * MS_IN_SEC
+                        + (delaytimeout.tv_usec + MS_IN_SEC - 1) / MS_IN_SEC;
                 }
             }
 
             if (!test_mode) {
-                if ((mc = curl_multi_timeout(mh, &curl_timeout_ms)) != CURLM_OK)
-                    err_exit(false,
-                             "curl_multi_timeout: %s",
-                             curl_multi_strerror(mc));
-                /* Per documentation, wait incremental time then
-                 * proceed if timeout < 0 */
-                if (curl_timeout_ms < 0)
-                    curl_timeout_ms = INCREMENTAL_WAIT;
-                curl_timeout.tv_sec = curl_timeout_ms / MS_IN_SEC;
-                curl_timeout.tv_usec = (curl_timeout_ms % MS_IN_SEC) * MS_IN_SEC;
-
-                /* if timeout previously set, must compare */
-                if (timeoutptr) {
-                    /* only compare if curl_timeout_ms > 0, otherwise
-                     * we'd spin
-                     */
-                    if (curl_timeout_ms > 0) {
-                        if (timercmp(&curl_timeout, timeoutptr, <)) {
-                            timeoutptr->tv_sec = curl_timeout.tv_sec;
-                            timeoutptr->tv_usec = curl_timeout.tv_usec;
-                        }
-                    }
-                }
-                else {
-                    timeout.tv_sec = curl_timeout.tv_sec;
-                    timeout.tv_usec = curl_timeout.tv_usec;
-                    timeoutptr = &timeout;
-                }
+                /* curl_deadline is kept current by timer_cb() */
+                if (timerisset(&curl_deadline)) {
+                    int curl_timeout = curl_timeleft();
 
-                if ((mc = curl_multi_fdset(mh,
-                                           &fdread,
-                                           &fdwrite,
-                                           &fderror,
-                                           &maxfd)) != CURLM_OK)
-                    err_exit(false, "curl_multi_fdset: %s", curl_multi_strerror(mc));
+                    if (timeout < 0 || curl_timeout < timeout)
+                        timeout = curl_timeout;
+                }
             }
             else {
                 /* in test-mode assume active cmds complete
                  * "immediately" by setting timeout to 0
                  *
                  * otherwise wait delayedcmds timeout or wait forever
-                 * (timeoutptr initialized to NULL)
                  */
-                if (zlistx_size(activecmds) > 0) {
-                    timeout.tv_sec = 0;
-                    timeout.tv_usec = 0;
-                    timeoutptr = &timeout;
-                }
+                if (zlistx_size(activecmds) > 0)
+                    timeout = 0;
             }
         }
 
-        /* XXX: use curl_multi_poll/wait on newer versions of curl */
+        watch_stdin(&stdin_watched, idle);
+        if (idle && stdin_is_file) {
+            stdin_ready = 1;
+            timeout = 0;
+        }
+
+        if ((n = epoll_wait(epfd, events, EPOLL_EVENTS_MAX, timeout)) < 0) {
+            if (errno == EINTR)
+                continue;
+            err_exit(true, "epoll_wait");
+        }
 
-        if (select(maxfd+1, &fdread, &fdwrite, &fderror, timeoutptr) < 0)
-            err_exit(true, "select");
+        for (i = 0; i < n; i++) {
+            int ev_bitmask = 0;
+
+            if (events[i].data.fd == STDIN_FILENO) {
+                stdin_ready = 1;
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+                ev_bitmask |= CURL_CSELECT_IN;
+            if (events[i].events & EPOLLOUT)
+                ev_bitmask |= CURL_CSELECT_OUT;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                ev_bitmask |= CURL_CSELECT_ERR;
+            socket_action(mh, events[i].data.fd, ev_bitmask);
+        }
 
-        if (FD_ISSET(STDIN_FILENO, &fdread)) {
+        /* curl's timer is one-shot, timer_cb() sets a new deadline
+         * if curl wants one
+         */
+        if (!test_mode
+            && timerisset(&curl_deadline)
+            && curl_timeleft() == 0) {
+            timerclear(&curl_deadline);
+            socket_action(mh, CURL_SOCKET_TIMEOUT, 0);
+        }
+
+        if (stdin_ready) {
             char buf[256];
             if (fgets(buf, sizeof(buf), stdin)) {
                 char **av;
@@ -1653,76 +2473,8 @@ static void shell(CURLM *mh)
         if (zlistx_size(activecmds) == 0)
             continue;
 
-        if (!test_mode) {
-            struct CURLMsg *cmsg;
-            int msgq = 0;
-            int stillrunning;
-
-            if ((mc = curl_multi_perform(mh, &stillrunning)) != CURLM_OK)
-                err_exit(false,
-                         "curl_multi_perform: %s",
-                         curl_multi_strerror(mc));
-
-            do {
-                cmsg = curl_multi_info_read(mh, &msgq);
-                if(cmsg && (cmsg->msg == CURLMSG_DONE)) {
-                    struct powermsg *pm = NULL;
-                    CURL *eh = cmsg->easy_handle;
-                    CURLcode ec;
-
-                    if ((ec = curl_easy_getinfo(eh,
-                                                CURLINFO_PRIVATE,
-                                                (char **)&pm)) != CURLE_OK)
-                        err_exit(false,
-                                 "curl_easy_getinfo: %s",
-                                 curl_easy_strerror(ec));
-
-                    if (!pm)
-                        err_exit(false, "private data not set in easy handle");
-
-                    if (cmsg->data.result != 0) {
-                        if (cmsg->data.result == CURLE_HTTP_RETURNED_ERROR) {
-                            /* N.B. curl returns this error code for all response
-                             * codes >= 400.  So gotta dig in more.
-                             */
-                            long code;
-
-                            if (curl_easy_getinfo(cmsg->easy_handle,
-                                                  CURLINFO_RESPONSE_CODE,
-                                                  &code) != CURLE_OK)
-                                printf("%s: %s\n", pm->plugname, "http error");
-                            if (code == 400)
-                                printf("%s: %s\n", pm->plugname, "bad request");
-                            else if (code == 401)
-                                printf("%s: %s\n", pm->plugname, "unauthorized");
-                            else if (code == 404)
-                                printf("%s: %s\n", pm->plugname, "not found");
-                            else
-                                printf("%s: %s (%ld)\n",
-                                       pm->plugname,
-                                       "http error",
-                                       code);
-                        }
-                        else
-                            printf("%s: %s\n",
-                                   pm->plugname,
-                                   curl_easy_strerror(cmsg->data.result));
-                        if (verbose)
-                            printf("%s: %s\n", pm->plugname,
-                                   curl_easy_strerror(cmsg->data.result));
-
-                        process_waiters(mh,
-                                        pm->plugname,
-                                        STATUS_ERROR);
-                    }
-                    else
-                        power_cmd_process(pm);
-                    fflush(stdout);
-                    if (zlistx_delete(activecmds, pm->handle) < 0)
-                        err_exit(false, "zlistx_delete failed to delete");
-                }
-            } while (cmsg);
-        }
+        if (!test_mode)
+            process_multi_info(mh);
         else {
             /* in test mode we assume all activecmds complete immediately */
 
@@ -1748,11 +2500,16 @@ static void shell(CURLM *mh)
 
             pm = zlistx_first(cpy);
             while (pm) {
+                hostconn_get(pm->hostname)->requests++;
                 if (hostlist_find(test_fail_power_cmd_hosts, pm->hostname) >= 0) {
-                    printf("%s: %s\n", pm->plugname, "error");
-                    process_waiters(mh,
-                                    pm->plugname,
-                                    STATUS_ERROR);
+                    if (pm->collection)
+                        stat_collection_fallback(pm, 0);
+                    else {
+                        printf("%s: %s\n", pm->plugname, "error");
+                        process_waiters(mh,
+                                        pm->plugname,
+                                        STATUS_ERROR);
+                    }
                 }
                 else
                     power_cmd_process(pm);
@@ -1762,8 +2519,7 @@ static void shell(CURLM *mh)
 
             pm = zlistx_first(cpy);
             while (pm) {
-                if (zlistx_delete(activecmds, pm->handle) < 0)
-                    err_exit(false, "zlistx_delete failed to delete");
+                activecmds_delete(pm);
                 pm = zlistx_next(cpy);
             }
 
@@ -1784,6 +2540,7 @@ static void usage(void)
       "  -P, --onpostdata      Set on post data\n"
       "  -G, --offpostdata     Set off post data\n"
       "  -m, --message-timeout Set message timeout\n"
+      "  -M, --max-inflight    Set max requests in progress per host\n"
       "  -o, --resolve-hosts   Resolve host to IP before passing to libcurl\n"
       "  -v, --verbose         Increase output verbosity\n"
     );
@@ -1813,10 +2570,20 @@ static void init_redfishpower(char *argv[])
         err_exit(true, "zlistx_new");
     zlistx_set_destructor(delayedcmds, cleanup_powermsg);
 
+    delayq = xtimerq_create();
+
     if (!(waitcmds = zlistx_new()))
         err_exit(true, "zlistx_new");
     zlistx_set_destructor(waitcmds, cleanup_powermsg);
 
+    if (!(activeplugs = zhashx_new ()))
+        err_exit(false, "zhashx_new error");
+    zhashx_set_destructor(activeplugs, index_list_destroy);
+
+    if (!(waiters = zhashx_new ()))
+        err_exit(false, "zhashx_new error");
+    zhashx_set_destructor(waiters, index_list_destroy);
+
     if (!(test_fail_power_cmd_hosts = hostlist_create(NULL)))
         err_exit(true, "hostlist_create error");
 
@@ -1829,6 +2596,17 @@ static void init_redfishpower(char *argv[])
     if (!(resolve_hosts_cache = zhashx_new ()))
         err_exit(false, "zhashx_new error");
     zhashx_set_destructor(resolve_hosts_cache, free_wrapper);
+
+    if (!(unsupported_collections = zhashx_new ()))
+        err_exit(false, "zhashx_new error");
+    zhashx_set_destructor(unsupported_collections, free_wrapper);
+
+    if (!(hostconns = zhashx_new ()))
+        err_exit(false, "zhashx_new error");
+    zhashx_set_destructor(hostconns, hostconn_destroy);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        err_exit(true, "epoll_create1");
 }
 
 static void cleanup_redfishpower(void)
@@ -1845,6 +2623,8 @@ static void cleanup_redfishpower(void)
     zlistx_destroy(&activecmds);
     zlistx_destroy(&delayedcmds);
     zlistx_destroy(&waitcmds);
+    zhashx_destroy(&activeplugs);
+    zhashx_destroy(&waiters);
 
     hostlist_destroy(test_fail_power_cmd_hosts);
     zhashx_destroy(&test_power_status);
@@ -1852,6 +2632,17 @@ static void cleanup_redfishpower(void)
     plugs_destroy(plugs);
 
     zhashx_destroy(&resolve_hosts_cache);
+    zhashx_destroy(&unsupported_collections);
+
+    /* after cmd lists, which return easy handles to the pools */
+    zhashx_destroy(&hostconns);
+    if (share)
+        curl_share_cleanup(share);
+
+    /* after cmd lists, which destroy their delay timers */
+    xtimerq_destroy(delayq);
+
+    close(epfd);
 }
 
 static void setup_hosts(void)
@@ -1895,6 +2686,8 @@ int main(int argc, char *argv[])
 {
     CURLM *mh = NULL;
     CURLcode ec;
+    CURLMcode mc;
+    CURLSHcode sc;
     int c;
     char *endptr;
 
@@ -1937,6 +2730,14 @@ int main(int argc, char *argv[])
                     || message_timeout <= 0)
                     err_exit(false, "invalid message timeout specified\n");
                 break;
+            case 'M': /* --max-inflight */
+                errno = 0;
+                max_inflight = strtol(optarg, &endptr, 10);
+                if (errno
+                    || endptr[0] != '\0'
+                    || max_inflight < 0)
+                    err_exit(false, "invalid max inflight specified\n");
+                break;
             case 'o': /* --resolve_hosts */
                 resolve_hosts = 1;
                 break;
@@ -1969,6 +2770,30 @@ int main(int argc, char *argv[])
 
         if (!(mh = curl_multi_init()))
             err_exit(false, "curl_multi_init failed");
+
+        if ((mc = curl_multi_setopt(mh,
+                                    CURLMOPT_SOCKETFUNCTION,
+                                    socket_cb)) != CURLM_OK
+            || (mc = curl_multi_setopt(mh,
+                                       CURLMOPT_SOCKETDATA,
+                                       mh)) != CURLM_OK
+            || (mc = curl_multi_setopt(mh,
+                                       CURLMOPT_TIMERFUNCTION,
+                                       timer_cb)) != CURLM_OK)
+            err_exit(false, "curl_multi_setopt: %s", curl_multi_strerror(mc));
+
+        if (!(share = curl_share_init()))
+            err_exit(false, "curl_share_init failed");
+        if ((sc = curl_share_setopt(share,
+                                    CURLSHOPT_SHARE,
+                                    CURL_LOCK_DATA_CONNECT)) != CURLSHE_OK
+            || (sc = curl_share_setopt(share,
+                                       CURLSHOPT_SHARE,
+                                       CURL_LOCK_DATA_DNS)) != CURLSHE_OK
+            || (sc = curl_share_setopt(share,
+                                       CURLSHOPT_SHARE,
+                                       CURL_LOCK_DATA_SSL_SESSION)) != CURLSHE_OK)
+            err_exit(false, "curl_share_setopt: %s", curl_share_strerror(sc));
     }
     else {
         /* All hosts initially are off for testing */
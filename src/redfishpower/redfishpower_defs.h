@@ -15,6 +15,11 @@
 #define CMD_ON         "on"
 #define CMD_OFF        "off"
 
+/* setpath of a collection resource whose members report the
+ * PowerState of several plugs at once
+ */
+#define CMD_STATCOLLECTION "statcollection"
+
 #endif /* REDFISHPOWER_DEFS_H */
 
 /*
@@ -163,6 +163,21 @@ static void path_tests(void)
        "blade1 has correct off path");
     ok(pd->offpostdata == NULL,
        "blade1 has no off postdata");
+    ok(pd->statcollection == NULL,
+       "blade1 has no statcollection path");
+
+    ret = plugs_update_path(p,
+                            "blade1",
+                            "statcollection",
+                            "statcollectionpath",
+                            NULL);
+    ok(ret == 0,
+       "plugs_update_path of statcollection path works on blade1");
+    pd = plugs_get_data(p, "blade1");
+    ok(strcmp(pd->statcollection, "statcollectionpath") == 0,
+       "blade1 has correct statcollection path");
+    ok(strcmp(pd->stat, "statpath1") == 0,
+       "blade1 stat path unchanged by statcollection path");
 
     plugs_destroy(p);
 }
@@ -172,6 +187,7 @@ static void hierarchy_tests(void)
     plugs_t *p;
     struct plug_data *pd;
     char *plug;
+    hostlist_t children;
     int ret;
 
     p = plugs_create();
@@ -295,6 +311,43 @@ static void hierarchy_tests(void)
     ok(strcmp(plug, "node2") == 0,
        "plugs_child_of_ancestor child of node0 starting from node5 is node2");
 
+    /* plugs_children tests */
+
+    children = plugs_children(p, "node0");
+    ok(children != NULL && hostlist_count(children) == 2,
+       "plugs_children node0 has 2 children");
+    ok(hostlist_find(children, "node1") >= 0
+       && hostlist_find(children, "node2") >= 0,
+       "plugs_children node0 children are node1 and node2");
+    children = plugs_children(p, "node1");
+    ok(children != NULL && hostlist_count(children) == 2,
+       "plugs_children node1 has 2 children");
+    ok(hostlist_find(children, "node3") >= 0
+       && hostlist_find(children, "node4") >= 0,
+       "plugs_children node1 children are node3 and node4");
+    children = plugs_children(p, "node3");
+    ok(children == NULL,
+       "plugs_children node3 has no children");
+    children = plugs_children(p, "bad");
+    ok(children == NULL,
+       "plugs_children bad plug has no children");
+
+    /* re-parent node3 under node2 */
+    plugs_add(p, "node3", "foo3", "node2");
+    children = plugs_children(p, "node1");
+    ok(children != NULL && hostlist_count(children) == 1
+       && hostlist_find(children, "node4") >= 0,
+       "plugs_children node1 loses node3 after re-parent");
+    children = plugs_children(p, "node2");
+    ok(children != NULL && hostlist_count(children) == 3
+       && hostlist_find(children, "node3") >= 0,
+       "plugs_children node2 gains node3 after re-parent");
+
+    plugs_remove(p, "node4");
+    children = plugs_children(p, "node1");
+    ok(children == NULL,
+       "plugs_children node1 has no children after node4 removed");
+
     plugs_destroy(p);
 }
 
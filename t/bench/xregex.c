@@ -0,0 +1,431 @@
+/************************************************************\
+ * Copyright (C) 2001 The Regents of the University of California.
+ * (c.f. DISCLAIMER, COPYING)
+ *
+ * This file is part of PowerMan, a remote power management program.
+ * For details, see https://github.com/chaos/powerman.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+\************************************************************/
+
+/* Benchmark xregex_exec() against plain regexec() using the expect and
+ * interp regexes found in device files, and check that both give the
+ * same results.
+ *
+ * For each device file, every regex is run against a simulated status
+ * dump (which most prompts don't match), and against the dump followed
+ * by the text of each regex in the file (which literal prompts do match).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <regex.h>
+
+#include "xmalloc.h"
+#include "xregex.h"
+#include "xtimer.h"
+
+#define MAX_MATCH   20
+
+typedef struct {
+    char *str;                  /* regex as seen by xregex_compile() */
+    bool withsub;               /* expect (true) or interp (false) */
+    xregex_t xre;
+    regex_t preg;
+} Regex;
+
+static void usage(void);
+static int _extract(char *path, Regex **rxp);
+static char *_make_dump(int lines);
+
+static char *prog;
+static int nregex = 0;
+static int nmismatch = 0;
+#define NUM_METHODS 6
+static int methods[NUM_METHODS];
+static double method_xtime[NUM_METHODS];
+static double method_ptime[NUM_METHODS];
+static const char *method_names[] = {
+    "literal", "anchored", "greedy", "prefix", "filter", "posix",
+};
+
+#define OPTIONS "n:l:v"
+static const struct option longopts[] = {
+    {"iterations", required_argument, 0, 'n'},
+    {"lines", required_argument, 0, 'l'},
+    {"verbose", no_argument, 0, 'v'},
+    {0, 0, 0, 0},
+};
+
+/* Read file into a NULL terminated string.
+ */
+static char *
+_read_file(char *path)
+{
+    FILE *f;
+    char *buf = NULL;
+    int size = 0, len = 0, n;
+
+    if (!(f = fopen(path, "r"))) {
+        perror(path);
+        exit(1);
+    }
+    do {
+        if (len + 4096 + 1 > size) {
+            size += 65536;
+            buf = xrealloc(buf, size);
+        }
+        n = fread(buf + len, 1, 4096, f);
+        len += n;
+    } while (n > 0);
+    fclose(f);
+    buf[len] = '\0';
+    return buf;
+}
+
+/* Scan a quoted string starting at 'p' (just past the opening quote),
+ * handling escapes as the config file lexer does.
+ */
+static char *
+_unquote(char *p)
+{
+    char *str = xmalloc(strlen(p) + 1);
+    char *q = str;
+
+    while (*p && *p != '"' && *p != '\n') {
+        if (*p == '\\' && p[1]) {
+            p++;
+            switch (*p) {
+                case 'a': *q++ = '\a'; break;
+                case 'b': *q++ = '\b'; break;
+                case 'e': *q++ = '\033'; break;
+                case 'f': *q++ = '\f'; break;
+                case 'n': *q++ = '\n'; break;
+                case 'r': *q++ = '\r'; break;
+                case 't': *q++ = '\t'; break;
+                case 'v': *q++ = '\v'; break;
+                default:
+                    if (p[0] >= '0' && p[0] <= '7' && p[1] && p[2]) {
+                        char oct[4] = { p[0], p[1], p[2], '\0' };
+
+                        *q++ = strtol(oct, NULL, 8);
+                        p += 2;
+                    } else
+                        *q++ = *p;
+                    break;
+            }
+            p++;
+        } else
+            *q++ = *p++;
+    }
+    *q = '\0';
+    return str;
+}
+
+/* Substitute the strings "\r" and "\n" as xregex_compile() does.
+ */
+static void
+_subst(char *s)
+{
+    char *p, *q;
+
+    for (p = q = s; *p; p++) {
+        if (p[0] == '\\' && (p[1] == 'r' || p[1] == 'n')) {
+            *q++ = p[1] == 'r' ? '\r' : '\n';
+            p++;
+        } else
+            *q++ = *p;
+    }
+    *q = '\0';
+}
+
+static int
+_method(xregex_t xre)
+{
+    int i;
+
+    for (i = 0; i < NUM_METHODS - 1; i++) {
+        if (!strcmp(xregex_method(xre), method_names[i]))
+            break;
+    }
+    return i;
+}
+
+static void
+_add_regex(Regex **rxp, int *count, char *str, bool withsub)
+{
+    Regex *rx;
+    char *cpy;
+    int i;
+
+    for (i = 0; i < *count; i++) {
+        if (!strcmp((*rxp)[i].str, str) && (*rxp)[i].withsub == withsub) {
+            xfree(str);
+            return;
+        }
+    }
+    *rxp = (Regex *)xrealloc((char *)*rxp, sizeof(Regex) * (*count + 1));
+    rx = &(*rxp)[(*count)++];
+    rx->str = str;
+    rx->withsub = withsub;
+    rx->xre = xregex_create();
+    xregex_compile(rx->xre, str, withsub);
+
+    cpy = xstrdup(str);
+    _subst(cpy);
+    if (regcomp(&rx->preg, cpy, REG_EXTENDED | (withsub ? 0 : REG_NOSUB))) {
+        fprintf(stderr, "%s: regcomp %s failed\n", prog, str);
+        exit(1);
+    }
+    xfree(cpy);
+
+    methods[_method(rx->xre)]++;
+    nregex++;
+}
+
+/* Find expect "..." and on="..." off="..." success="..." strings.
+ */
+static int
+_extract(char *path, Regex **rxp)
+{
+    char *buf = _read_file(path);
+    char *p = buf;
+    int count = 0;
+
+    *rxp = NULL;
+    while (*p) {
+        if (*p == '#') {
+            while (*p && *p != '\n')
+                p++;
+            continue;
+        }
+        if (!strncmp(p, "expect", 6) && (p == buf || p[-1] == '\t'
+                                         || p[-1] == ' ')) {
+            char *q = p + 6;
+
+            while (*q == ' ' || *q == '\t')
+                q++;
+            if (*q == '"') {
+                _add_regex(rxp, &count, _unquote(q + 1), true);
+                p = q + 1;
+                continue;
+            }
+        }
+        if (*p == '=' && p[1] == '"') {
+            _add_regex(rxp, &count, _unquote(p + 2), false);
+            p += 2;
+            continue;
+        }
+        if (*p == '"') {                    /* skip over other strings */
+            p++;
+            while (*p && *p != '"' && *p != '\n') {
+                if (*p == '\\' && p[1])
+                    p++;
+                p++;
+            }
+        }
+        if (*p)
+            p++;
+    }
+    xfree(buf);
+    return count;
+}
+
+static char *
+_make_dump(int lines)
+{
+    char *buf = xmalloc(lines * 64 + 1);
+    int i;
+
+    for (i = 0; i < lines; i++)
+        sprintf(buf + strlen(buf), "  %3d- Outlet %-3d %26s\r\n", i + 1,
+                i + 1, i % 3 ? "ON" : "OFF");
+    return buf;
+}
+
+/* Compare xregex_exec() with regexec() for one regex and input.
+ */
+static void
+_compare(char *path, Regex *rx, char *input, xregex_match_t xm,
+         bool verbose)
+{
+    regmatch_t pmatch[MAX_MATCH + 1];
+    bool xres, pres, same;
+    int i;
+
+    xregex_match_recycle(xm);
+    xres = xregex_exec(rx->xre, input, rx->withsub ? xm : NULL);
+    pres = regexec(&rx->preg, input, MAX_MATCH + 1, pmatch, REG_NOTEOL) == 0;
+
+    same = (xres == pres);
+    if (same && pres && rx->withsub) {
+        same = (xregex_match_strlen(xm) == pmatch[0].rm_eo);
+        for (i = 0; same && i <= MAX_MATCH; i++) {
+            char *sub;
+
+            /* xregex_match_sub_strdup() doesn't allow empty matches */
+            if (pmatch[i].rm_so == pmatch[i].rm_eo)
+                continue;
+            sub = xregex_match_sub_strdup(xm, i);
+            same = (sub != NULL
+                    && strlen(sub) == pmatch[i].rm_eo - pmatch[i].rm_so
+                    && !strncmp(sub, input + pmatch[i].rm_so, strlen(sub)));
+            if (sub)
+                xfree(sub);
+        }
+    }
+    if (!same) {
+        nmismatch++;
+        if (verbose)
+            fprintf(stderr, "%s: %s: regex '%s' (%s) differs from regexec\n",
+                    prog, path, rx->str, xregex_method(rx->xre));
+    }
+}
+
+static double
+_elapsed(struct timeval *start)
+{
+    struct timeval now, diff;
+
+    xtimer_gettime(&now);
+    timersub(&now, start, &diff);
+    return diff.tv_sec + diff.tv_usec / 1E6;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c, i, j, k, f;
+    int iterations = 100;
+    int lines = 24;
+    bool verbose = false;
+    double xtime = 0, ptime = 0;
+    long ninputs = 0;
+    char *dump;
+    xregex_match_t xm;
+
+    prog = basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, OPTIONS, longopts, NULL)) != -1) {
+        switch (c) {
+            case 'n':   /* --iterations n */
+                iterations = strtol(optarg, NULL, 10);
+                break;
+            case 'l':   /* --lines n */
+                lines = strtol(optarg, NULL, 10);
+                break;
+            case 'v':   /* --verbose */
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc)
+        usage();
+
+    dump = _make_dump(lines);
+    xm = xregex_match_create(MAX_MATCH);
+
+    for (f = optind; f < argc; f++) {
+        Regex *rx;
+        int count = _extract(argv[f], &rx);
+        char **inputs = (char **)xmalloc(sizeof(char *) * (count + 1));
+        int len = strlen(dump);
+        struct timeval start;
+
+        /* dump alone, then dump + text of each regex */
+        inputs[0] = xstrdup(dump);
+        for (i = 0; i < count; i++) {
+            inputs[i + 1] = xmalloc(len + strlen(rx[i].str) + 1);
+            strcpy(inputs[i + 1], dump);
+            strcat(inputs[i + 1], rx[i].str);
+            _subst(inputs[i + 1] + len);
+        }
+
+        for (i = 0; i < count; i++) {
+            for (j = 0; j <= count; j++)
+                _compare(argv[f], &rx[i], inputs[j], xm, verbose);
+        }
+
+        for (i = 0; i < count; i++) {
+            regmatch_t pmatch[MAX_MATCH + 1];
+            int m = _method(rx[i].xre);
+            double t;
+
+            xtimer_gettime(&start);
+            for (k = 0; k < iterations; k++) {
+                for (j = 0; j <= count; j++) {
+                    xregex_match_recycle(xm);
+                    xregex_exec(rx[i].xre, inputs[j],
+                                rx[i].withsub ? xm : NULL);
+                }
+            }
+            t = _elapsed(&start);
+            xtime += t;
+            method_xtime[m] += t;
+
+            xtimer_gettime(&start);
+            for (k = 0; k < iterations; k++) {
+                for (j = 0; j <= count; j++)
+                    regexec(&rx[i].preg, inputs[j], MAX_MATCH + 1, pmatch,
+                            REG_NOTEOL);
+            }
+            t = _elapsed(&start);
+            ptime += t;
+            method_ptime[m] += t;
+        }
+        ninputs += (long)count * (count + 1);
+
+        for (i = 0; i <= count; i++)
+            xfree(inputs[i]);
+        xfree(inputs);
+        for (i = 0; i < count; i++) {
+            xregex_destroy(rx[i].xre);
+            regfree(&rx[i].preg);
+            xfree(rx[i].str);
+        }
+        if (rx)
+            xfree(rx);
+    }
+
+    printf("%d files, %d regexes:", argc - optind, nregex);
+    for (i = 0; i < NUM_METHODS; i++)
+        printf(" %d %s%s", methods[i], method_names[i],
+               i < NUM_METHODS - 1 ? "," : "\n");
+    printf("%ld matches x %d iterations: xregex %.3fs, regexec %.3fs",
+           ninputs, iterations, xtime, ptime);
+    printf(" (%.1fx)\n", xtime > 0 ? ptime / xtime : 0);
+    for (i = 0; i < NUM_METHODS; i++) {
+        printf("  %-8s xregex %.3fs, regexec %.3fs\n", method_names[i],
+               method_xtime[i], method_ptime[i]);
+    }
+    printf("%d mismatches\n", nmismatch);
+
+    xregex_match_destroy(xm);
+    xfree(dump);
+
+    exit(nmismatch > 0 ? 1 : 0);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-l lines] [-v] file.dev...\n",
+            prog);
+    exit(1);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
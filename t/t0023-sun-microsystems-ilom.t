@@ -93,6 +93,20 @@ test_expect_success 'powerman -q shows all off' '
 	makeoutput "" "t[0-5]" "" >query4.exp &&
 	test_cmp query4.exp query4.out
 '
+test_expect_success 'powerman -q accepts aliases mixed with node ranges' '
+	$powerman -h $testaddr -q t[3-4],iloms,t5 >query5.out &&
+	makeoutput "" "t[0-5]" "" >query5.exp &&
+	test_cmp query5.exp query5.out
+'
+test_expect_success 'powerman -q accepts multiple aliases' '
+	$powerman -h $testaddr -q loms,iloms >query6.out &&
+	makeoutput "" "t[0-5]" "" >query6.exp &&
+	test_cmp query6.exp query6.out
+'
+test_expect_success 'powerman -q rejects unknown node next to alias' '
+	test_must_fail $powerman -h $testaddr -q iloms,t6 >query7.out &&
+	grep "No such nodes: t6" query7.out
+'
 test_expect_success 'powerman -r loms fails' '
 	test_must_fail $powerman -h $testaddr -r loms
 '
@@ -677,6 +677,43 @@ test_expect_success 'stop powerman daemon (parents3Lbad)' '
 	wait
 '
 
+#
+# redfishpower statcollection coverage
+#
+
+test_expect_success 'create powerman.conf for 16 redfish nodes (statcollection)' '
+	cat >powerman_statcollection.conf <<-EOT
+	listen "$testaddr"
+	include "$testdevicesdir/redfishpower-statcollection.dev"
+	device "d0" "redfishpower-statcollection" "$redfishdir/redfishpower -h bmc0 --test-mode |&"
+	node "t[0-15]" "d0" "Node[0-15]"
+	EOT
+'
+test_expect_success 'start powerman daemon and wait for it to start (statcollection)' '
+	$powermand -Y -c powerman_statcollection.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'powerman -q shows all off' '
+	$powerman -h $testaddr -q >test_statcollection_query.out &&
+	makeoutput "" "t[0-15]" "" >test_statcollection_query.exp &&
+	test_cmp test_statcollection_query.exp test_statcollection_query.out
+'
+test_expect_success 'powerman -1 t[0-3,12-13] works' '
+	$powerman -h $testaddr -1 t[0-3,12-13] >test_statcollection_on.out &&
+	echo Command completed successfully >test_statcollection_on.exp &&
+	test_cmp test_statcollection_on.exp test_statcollection_on.out
+'
+test_expect_success 'powerman -q shows t[0-3,12-13] on' '
+	$powerman -h $testaddr -q >test_statcollection_query2.out &&
+	makeoutput "t[0-3,12-13]" "t[4-11,14-15]" "" >test_statcollection_query2.exp &&
+	test_cmp test_statcollection_query2.exp test_statcollection_query2.out
+'
+test_expect_success 'stop powerman daemon (statcollection)' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
 #
 # options
 #
@@ -744,6 +781,85 @@ test_expect_success HAVE_VALGRIND 'create redfishpower test input' '
 	EOT
 '
 
+test_expect_success 'redfishpower connstats counts requests per host' '
+	cat >connstats.in <<-EOT &&
+	setstatpath redfish/v1/Systems/1
+	setonpath redfish/v1/Systems/1/Actions/ComputerSystem.Reset {\"ResetType\":\"On\"}
+	stat
+	on t0
+	connstats
+	EOT
+	$redfishdir/redfishpower -h t[0-1] --test-mode <connstats.in >connstats.out &&
+	grep "t0: requests 3 reused 0 (0%) handles 0" connstats.out &&
+	grep "t1: requests 1 reused 0 (0%) handles 0" connstats.out
+'
+
+test_expect_success 'create redfishpower input with many plugs on one host' '
+	cat >maxinflight.in <<-EOT
+	setplugs Node[0-7] 0
+	setpath Node[0-7] stat redfish/v1/Systems/{{plug}}
+	setpath Node[0-7] on redfish/v1/Systems/{{plug}}/Actions/ComputerSystem.Reset {\"ResetType\":\"On\"}
+	stat
+	on
+	stat
+	connstats
+	EOT
+'
+test_expect_success 'redfishpower sends all requests to a host at once by default' '
+	$redfishdir/redfishpower -h bmc0 --test-mode \
+		<maxinflight.in >maxinflight0.out &&
+	grep "bmc0: requests 32 .* peak 8" maxinflight0.out
+'
+test_expect_success 'redfishpower --max-inflight limits requests in progress' '
+	$redfishdir/redfishpower -h bmc0 --test-mode --max-inflight=2 \
+		<maxinflight.in >maxinflight2.out &&
+	grep "bmc0: requests 32 .* peak 2" maxinflight2.out &&
+	test $(grep -c "Node[0-7]: off" maxinflight2.out) -eq 8 &&
+	test $(grep -c "Node[0-7]: ok" maxinflight2.out) -eq 8 &&
+	test $(grep -c "Node[0-7]: on" maxinflight2.out) -eq 8
+'
+test_expect_success 'redfishpower --max-inflight rejects bad values' '
+	test_must_fail $redfishdir/redfishpower -h bmc0 --max-inflight=-1 \
+		</dev/null
+'
+
+test_expect_success 'create redfishpower input with a statcollection path' '
+	cat >statcollection.in <<-EOT
+	setplugs Node[0-7] 0
+	setplugs Chassis0 0
+	setpath Node[0-7] stat redfish/v1/Systems/{{plug}}
+	setpath Node[0-7] on redfish/v1/Systems/{{plug}}/Actions/ComputerSystem.Reset {\"ResetType\":\"On\"}
+	setpath Chassis0 stat redfish/v1/Chassis/Enclosure
+	setpath Node[0-7],Chassis0 statcollection redfish/v1/Systems?\$expand=.(\$levels=1)
+	stat
+	on Node[0-3]
+	stat
+	connstats
+	EOT
+'
+# 2 requests per stat, the collection and Chassis0 which is not a
+# member of it, and 8 for on
+test_expect_success 'redfishpower stats plugs through their collection' '
+	$redfishdir/redfishpower -h bmc0 --test-mode \
+		<statcollection.in >statcollection.out &&
+	grep "bmc0: requests 12 " statcollection.out &&
+	test $(grep -c "Node[0-7]: off" statcollection.out) -eq 12 &&
+	test $(grep -c "Node[0-3]: on" statcollection.out) -eq 4 &&
+	test $(grep -c "Chassis0: off" statcollection.out) -eq 2
+'
+test_expect_success 'redfishpower -v shows plugs not in collection' '
+	$redfishdir/redfishpower -h bmc0 --test-mode -v \
+		<statcollection.in >statcollection_v.out &&
+	grep "Chassis0: not in statcollection" statcollection_v.out
+'
+test_expect_success 'redfishpower stats plugs individually if collection fails' '
+	$redfishdir/redfishpower -h bmc0 --test-mode \
+		--test-fail-power-cmd-hosts=bmc0 \
+		<statcollection.in >statcollection_fail.out &&
+	test $(grep -c "Node[0-7]: error" statcollection_fail.out) -eq 20 &&
+	test $(grep -c "Chassis0: error" statcollection_fail.out) -eq 2
+'
+
 test_expect_success HAVE_VALGRIND 'run redfishpower under valgrind' '
 	cat redfishpower.in | valgrind --tool=memcheck --leak-check=full \
 	    --error-exitcode=1 --gen-suppressions=all \
@@ -0,0 +1,146 @@
+#!/bin/sh
+
+test_description='Test powermand with devices run by worker threads'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11040
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+test_expect_success 'powermand --threads rejects a bad value' '
+	test_must_fail $powermand --threads=foo -c /dev/null 2>badthreads.err &&
+	grep "threads must be" badthreads.err
+'
+test_expect_success 'create test powerman.conf with five devices' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	device "test2" "vpc" "$vpcd |&"
+	device "test3" "vpc" "$vpcd |&"
+	device "test4" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	node "t[32-47]" "test2"
+	node "t[48-63]" "test3"
+	node "t[64-79]" "test4"
+	EOT
+'
+test_expect_success 'start powerman daemon with three threads' '
+	$powermand -c powerman.conf --threads=3 &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'powerman -q shows all off' '
+	$powerman -h $testaddr -q >query.out &&
+	makeoutput "" "t[0-79]" "" >query.exp &&
+	test_cmp query.exp query.out
+'
+test_expect_success 'powerman -1 works on nodes spanning all devices' '
+	$powerman -h $testaddr -1 t[10-70] >on.out &&
+	echo Command completed successfully >on.exp &&
+	test_cmp on.exp on.out
+'
+test_expect_success 'powerman -q shows nodes on' '
+	$powerman -h $testaddr -q >query2.out &&
+	makeoutput "t[10-70]" "t[0-9,71-79]" "" >query2.exp &&
+	test_cmp query2.exp query2.out
+'
+test_expect_success 'powerman -c works' '
+	$powerman -h $testaddr -c t[0-79] >cycle.out &&
+	echo Command completed successfully >cycle.exp &&
+	test_cmp cycle.exp cycle.out
+'
+test_expect_success 'powerman -q shows all on' '
+	$powerman -h $testaddr -q >query3.out &&
+	makeoutput "t[0-79]" "" "" >query3.exp &&
+	test_cmp query3.exp query3.out
+'
+test_expect_success 'powerman -0 works on one node' '
+	$powerman -h $testaddr -0 t42 >off.out &&
+	echo Command completed successfully >off.exp &&
+	test_cmp off.exp off.out
+'
+test_expect_success 'powerman -q t[40-43] shows one node off' '
+	$powerman -h $testaddr -q t[40-43] >query4.out &&
+	makeoutput "t[40-41,43]" "t42" "" >query4.exp &&
+	test_cmp query4.exp query4.out
+'
+test_expect_success 'powerman -q -T includes telemetry from each device' '
+	$powerman -h $testaddr -q -T >tel.out &&
+	for i in 0 1 2 3 4; do \
+		grep -q "recv(test$i):" tel.out || return 1; \
+	done
+'
+test_expect_success 'concurrent clients get consistent results' '
+	pids="" &&
+	for i in 1 2 3 4; do \
+		$powerman -h $testaddr -q >concurrent.$i.out & \
+		pids="$pids $!"; \
+	done &&
+	wait $pids &&
+	for i in 1 2 3 4; do \
+		grep -q "^off: *t42$" concurrent.$i.out || return 1; \
+	done
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+test_expect_success 'create test powerman.conf with a broken device' '
+	cat >powerman2.conf <<-EOT
+	include "$vpcdev"
+	specification "vpcbroke" {
+	    timeout 	2.0
+	    plug name { "0" "1" "2" "3" "4" "5" "6" "7" "8"
+	                "9" "10" "11" "12" "13" "14" "15" }
+	    script login {
+	        send "login\n"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script status_all {
+	        send "stat *\n"
+	        expect "WONTGETTHIS"
+	    }
+	}
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpcbroke" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success 'start powerman daemon with two threads' '
+	$powermand -c powerman2.conf --threads=2 &
+	echo $! >powermand2.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'powerman -q reports the timeout from the worker thread' '
+	test_must_fail $powerman -h $testaddr -q >query5.out &&
+	echo test1: action timed out waiting for expected response >query5.exp &&
+	makeoutput "" "t[0-15]" "t[16-31]" >>query5.exp &&
+	echo Query completed with errors >>query5.exp &&
+	test_cmp query5.exp query5.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand2.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
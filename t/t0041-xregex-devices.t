@@ -0,0 +1,25 @@
+#!/bin/sh
+
+test_description='Check xregex matching methods against regexec for device files'
+
+. `dirname $0`/sharness.sh
+
+bench=$SHARNESS_BUILD_DIRECTORY/t/bench/xregex
+devicesdir=$SHARNESS_TEST_SRCDIR/../etc/devices
+
+test_expect_success 'xregex benchmark requires device files' '
+	test_must_fail $bench
+'
+test_expect_success 'xregex agrees with regexec on all shipped device files' '
+	$bench --verbose --iterations=1 --lines=8 $devicesdir/*.dev >bench.out &&
+	cat bench.out &&
+	grep "^0 mismatches" bench.out
+'
+test_expect_success 'most shipped device regexes avoid regexec' '
+	posix=$(sed -n "s/.* \([0-9]*\) posix$/\1/p" bench.out) &&
+	total=$(sed -n "s/.* \([0-9]*\) regexes:.*/\1/p" bench.out) &&
+	test $posix -lt $(($total / 2))
+'
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,155 @@
+#!/bin/sh
+
+test_description='Test device scripts with nested foreachplug and ifon/ifoff'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11042
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+# on/off only switch plugs that need it, like phantom.dev
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	specification "vpcblocks" {
+	    timeout 5.0
+	    plug name { "0" "1" "2" "3" "4" "5" "6" "7" }
+	    script login {
+	        send "login\n"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script logout {
+	        send "logoff\n"
+	        expect "[0-9]* OK\n"
+	    }
+	    script status_all {
+	        send "stat *\n"
+	        foreachplug {
+	            expect "plug ([0-9]+): (ON|OFF|ERROR)\n"
+	            setplugstate \$1 \$2 on="ON" off="OFF"
+	        }
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script on {
+	        send "stat %s\n"
+	        expect "plug ([0-9]+): (ON|OFF)\n"
+	        setplugstate \$1 \$2 on="ON" off="OFF"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	        ifoff {
+	            send "on %s\n"
+	            expect "([0-9]+): (OK|ERROR)\n"
+	            setresult \$1 \$2 success="OK"
+	            expect "[0-9]* OK\n"
+	            expect "[0-9]* vpc> "
+	        }
+	    }
+	    script on_ranged {
+	        foreachplug {
+	            send "stat %s\n"
+	            expect "plug ([0-9]+): (ON|OFF)\n"
+	            setplugstate \$1 \$2 on="ON" off="OFF"
+	            expect "[0-9]* OK\n"
+	            expect "[0-9]* vpc> "
+	            ifoff {
+	                send "on %s\n"
+	                expect "([0-9]+): (OK|ERROR)\n"
+	                setresult \$1 \$2 success="OK"
+	                expect "[0-9]* OK\n"
+	                expect "[0-9]* vpc> "
+	            }
+	        }
+	    }
+	    script off {
+	        send "stat %s\n"
+	        expect "plug ([0-9]+): (ON|OFF)\n"
+	        setplugstate \$1 \$2 on="ON" off="OFF"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	        ifon {
+	            send "off %s\n"
+	            expect "([0-9]+): (OK|ERROR)\n"
+	            setresult \$1 \$2 success="OK"
+	            expect "[0-9]* OK\n"
+	            expect "[0-9]* vpc> "
+	        }
+	    }
+	    script off_all {
+	        foreachplug {
+	            foreachplug {
+	                send "off %s\n"
+	                expect "([0-9]+): (OK|ERROR)\n"
+	                expect "[0-9]* OK\n"
+	                expect "[0-9]* vpc> "
+	            }
+	        }
+	    }
+	}
+	listen "$testaddr"
+	device "test0" "vpcblocks" "$vpcd |&"
+	node "t[0-7]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'powerman -1 t3 turns on an off plug' '
+	$powerman -h $testaddr -T -1 t3 >on.out &&
+	grep "send(test0): .on 3" on.out &&
+	$powerman -h $testaddr -q >query.out &&
+	makeoutput "t3" "t[0-2,4-7]" "" >query.exp &&
+	test_cmp query.exp query.out
+'
+test_expect_success 'ifoff block is skipped for a plug that is on' '
+	$powerman -h $testaddr -T -1 t3 >on2.out &&
+	grep "send(test0): .stat 3" on2.out &&
+	test_must_fail grep "send(test0): .on 3" on2.out
+'
+test_expect_success 'ranged on runs ifoff block within foreachplug' '
+	$powerman -h $testaddr -T -1 t[2-5] >on3.out &&
+	grep "send(test0): .stat [2-5]" on3.out >stat3.out &&
+	test $(wc -l <stat3.out) -eq 4 &&
+	grep "send(test0): .on [2-5]" on3.out >on3.sends &&
+	test $(wc -l <on3.sends) -eq 3 &&
+	test_must_fail grep "send(test0): .on 3" on3.out &&
+	$powerman -h $testaddr -q >query3.out &&
+	makeoutput "t[2-5]" "t[0-1,6-7]" "" >query3.exp &&
+	test_cmp query3.exp query3.out
+'
+test_expect_success 'ifon block runs for a plug that is on' '
+	$powerman -h $testaddr -T -0 t4 >off.out &&
+	grep "send(test0): .off 4" off.out &&
+	$powerman -h $testaddr -q >query4.out &&
+	makeoutput "t[2-3,5]" "t[0-1,4,6-7]" "" >query4.exp &&
+	test_cmp query4.exp query4.out
+'
+test_expect_success 'nested foreachplug blocks run the inner block per plug' '
+	$powerman -h $testaddr -T -0 t[0-7] >off2.out &&
+	grep "send(test0): .off [0-7]" off2.out >off2.sends &&
+	test $(wc -l <off2.sends) -eq 64 &&
+	$powerman -h $testaddr -q >query5.out &&
+	makeoutput "" "t[0-7]" "" >query5.exp &&
+	test_cmp query5.exp query5.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,110 @@
+#!/bin/sh
+
+test_description='Test powermand status cache'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11043
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+test_expect_success 'create test powerman.conf with a long cache TTL' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	status_cache_ttl 600
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'first query runs the status scripts' '
+	$powerman -h $testaddr -T -q >query.out &&
+	grep "send(test0): .stat \*" query.out &&
+	grep "send(test1): .stat \*" query.out &&
+	makeoutput "" "t[0-31]" "" >query.exp &&
+	tail -3 query.out >query.tail &&
+	test_cmp query.exp query.tail
+'
+test_expect_success 'second query is answered from the cache' '
+	$powerman -h $testaddr -T -q >query2.out &&
+	test_must_fail grep "send(" query2.out &&
+	makeoutput "" "t[0-31]" "" >query2.exp &&
+	test_cmp query2.exp query2.out
+'
+test_expect_success 'powerman -1 t[0-3] works' '
+	$powerman -h $testaddr -1 t[0-3] >on.out &&
+	echo Command completed successfully >on.exp &&
+	test_cmp on.exp on.out
+'
+test_expect_success 'query re-runs the status script for changed nodes only' '
+	$powerman -h $testaddr -T -q >query3.out &&
+	grep "send(test0): .stat \*" query3.out &&
+	test_must_fail grep "send(test1)" query3.out &&
+	makeoutput "t[0-3]" "t[4-31]" "" >query3.exp &&
+	tail -3 query3.out >query3.tail &&
+	test_cmp query3.exp query3.tail
+'
+test_expect_success 'query of a subset is answered from the cache' '
+	$powerman -h $testaddr -T -q t[2-5] >query4.out &&
+	test_must_fail grep "send(" query4.out &&
+	makeoutput "t[2-3]" "t[4-5]" "" >query4.exp &&
+	test_cmp query4.exp query4.out
+'
+test_expect_success 'temperature queries are cached separately' '
+	$powerman -h $testaddr -T -t t0 >temp.out &&
+	grep "send(test0): .temp \*" temp.out &&
+	$powerman -h $testaddr -T -t t0 >temp2.out &&
+	test_must_fail grep "send(" temp2.out &&
+	tail -1 temp.out >temp.tail &&
+	test_cmp temp.tail temp2.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+test_expect_success 'create test powerman.conf with a short cache TTL' '
+	cat >powerman2.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	status_cache_ttl 0.5
+	device "test0" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman2.conf &
+	echo $! >powermand2.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'query is not answered from an expired cache' '
+	$powerman -h $testaddr -q >/dev/null &&
+	sleep 1 &&
+	$powerman -h $testaddr -T -q >query5.out &&
+	grep "send(test0): .stat \*" query5.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand2.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='Test that identical in-flight queries share one device action'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11044
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'queries issued during a slow command are coalesced' '
+	$powerman -h $testaddr -c t[0-15] >cycle.out &
+	cycle_pid=$!
+	sleep 0.3
+	$powerman -h $testaddr -T -q >query1.out &
+	q1=$!
+	$powerman -h $testaddr -T -q >query2.out &
+	q2=$!
+	$powerman -h $testaddr -T -q >query3.out &
+	q3=$!
+	wait $cycle_pid && wait $q1 && wait $q2 && wait $q3
+'
+test_expect_success 'each query saw the status command sent once' '
+	for i in 1 2 3; do
+		grep -c "send(test0): .stat \*" query$i.out >count$i.out &&
+		echo 1 >count$i.exp &&
+		test_cmp count$i.exp count$i.out || return 1
+	done
+'
+test_expect_success 'all queries got the same device response' '
+	grep "recv(test0): .[0-9]* OK" query1.out >recv1.out &&
+	grep "recv(test0): .[0-9]* OK" query2.out >recv2.out &&
+	grep "recv(test0): .[0-9]* OK" query3.out >recv3.out &&
+	test_cmp recv1.out recv2.out &&
+	test_cmp recv1.out recv3.out
+'
+test_expect_success 'all queries report the correct status' '
+	makeoutput "t[0-15]" "" "" >query.exp &&
+	for i in 1 2 3; do
+		tail -3 query$i.out >query$i.tail &&
+		test_cmp query.exp query$i.tail || return 1
+	done
+'
+test_expect_success 'a later query runs the status script again' '
+	$powerman -h $testaddr -T -q >query4.out &&
+	grep "recv(test0): .[0-9]* OK" query4.out >recv4.out &&
+	test_must_fail test_cmp recv1.out recv4.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='Test background refresh of the powermand status cache'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11045
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+test_expect_success 'create vpc specification with a refresh period' '
+	sed -e "s/specification \"vpc\"/specification \"vpc-refresh\"/" \
+	    -e "s/^\ttimeout.*/&\n\trefreshperiod 0.5/" \
+	    $vpcdev >vpc-refresh.dev &&
+	grep "refreshperiod 0.5" vpc-refresh.dev
+'
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "vpc-refresh.dev"
+	listen "$testaddr"
+	status_cache_ttl 1.5
+	device "test0" "vpc-refresh" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'query is answered from the refreshed cache' '
+	sleep 2 &&
+	$powerman -h $testaddr -T -q >query.out &&
+	test_must_fail grep "send(" query.out &&
+	makeoutput "" "t[0-15]" "" >query.exp &&
+	test_cmp query.exp query.out
+'
+test_expect_success 'query is still answered from the cache after the TTL' '
+	sleep 2 &&
+	$powerman -h $testaddr -T -q >query2.out &&
+	test_must_fail grep "send(" query2.out &&
+	test_cmp query.exp query2.out
+'
+test_expect_success 'powerman -1 t[0-3] works' '
+	$powerman -h $testaddr -1 t[0-3] >on.out &&
+	echo Command completed successfully >on.exp &&
+	test_cmp on.exp on.out
+'
+test_expect_success 'refresh picks up the new state' '
+	sleep 1 &&
+	$powerman -h $testaddr -T -q >query3.out &&
+	test_must_fail grep "send(" query3.out &&
+	makeoutput "t[0-3]" "t[4-15]" "" >query3.exp &&
+	test_cmp query3.exp query3.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+test_expect_success 'create test powerman.conf with a slow per-plug refresh' '
+	cat >powerman2.conf <<-EOT
+	specification "vpc-slowstat" {
+	    timeout 5
+	    refreshperiod 0.5
+	    plug name { "0" "1" "2" "3" "4" "5" "6" "7" "8"
+	                "9" "10" "11" "12" "13" "14" "15" }
+	    script login {
+	        send "login\n"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script status {
+	        delay 0.2
+	        send "stat %s\n"
+	        expect "plug ([0-9]+): (ON|OFF|ERROR)\n"
+	        setplugstate \$1 \$2 on="ON" off="OFF"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	}
+	listen "$testaddr"
+	status_cache_ttl 1.5
+	device "test0" "vpc-slowstat" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman2.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'query does not wait behind a queued refresh' '
+	sleep 0.5 &&
+	$powerman -h $testaddr -q t15 >query4.out &&
+	$powerman -h $testaddr -a t15 >latency.out &&
+	makeoutput "" "t15" "" >query4.exp &&
+	test_cmp query4.exp query4.out &&
+	grep "^test0: class=query actions=1 " latency.out &&
+	bg=$(sed -n "s/^test0: class=background actions=\([0-9]*\) .*/\1/p" \
+		latency.out) &&
+	test $bg -lt 15
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
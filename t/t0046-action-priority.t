@@ -0,0 +1,69 @@
+#!/bin/sh
+
+test_description='Test priority classes in the device action queue'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11046
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'start powerman daemon' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'powerman -1 t[0-15] works' '
+	$powerman -h $testaddr -1 t[0-15] >on.out &&
+	echo Command completed successfully >on.exp &&
+	test_cmp on.exp on.out
+'
+test_expect_success 'power off queued behind a query runs first' '
+	$powerman -h $testaddr -c t0 >cycle.out &
+	cycle_pid=$!
+	sleep 0.3
+	$powerman -h $testaddr -q >query.out &
+	query_pid=$!
+	sleep 0.3
+	$powerman -h $testaddr -0 t1 >off.out &&
+	wait $cycle_pid && wait $query_pid &&
+	makeoutput "t[0,2-15]" "t1" "" >query.exp &&
+	test_cmp query.exp query.out
+'
+test_expect_success 'powerman --latency reports each priority class' '
+	$powerman -h $testaddr --latency >latency.out &&
+	grep "^test0: class=control actions=3 " latency.out &&
+	grep "^test0: class=query actions=1 " latency.out &&
+	grep "^test0: class=background actions=" latency.out
+'
+test_expect_success 'powerman --latency accepts targets' '
+	$powerman -h $testaddr -a t0 >latency2.out &&
+	test $(wc -l <latency2.out) -eq 3
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='Test cancellation of device actions of departed clients'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11047
+
+makeoutput() {
+	printf "on:      %s\n" $1
+	printf "off:     %s\n" $2
+	printf "unknown: %s\n" $3
+}
+
+# send stdin to the server, half-close the connection, and print the response
+halfclose() {
+	perl -MIO::Socket::INET -e '
+		my $s = IO::Socket::INET->new(PeerAddr => $ARGV[0]) or die "$!\n";
+		print $s $_ while (<STDIN>);
+		shutdown($s, 1);
+		print while (<$s>);
+	' "$testaddr"
+}
+
+# send stdin to the server, wait $1 seconds, and reset the connection
+depart() {
+	perl -MIO::Socket::INET -MSocket -e '
+		my $s = IO::Socket::INET->new(PeerAddr => $ARGV[0]) or die "$!\n";
+		print $s $_ while (<STDIN>);
+		select(undef, undef, undef, $ARGV[1]);
+		setsockopt($s, SOL_SOCKET, SO_LINGER, pack("ii", 1, 0));
+		close($s);
+	' "$testaddr" "$1"
+}
+
+for threads in 0 2; do
+
+test_expect_success "create test powerman.conf (threads=$threads)" '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success "start powerman daemon (threads=$threads)" '
+	$powermand -c powerman.conf --threads=$threads &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'query of a departed client is cancelled' '
+	printf "tagged\r\nc1 cycle t0\r\nq1 status\r\n" | depart 0.3 &&
+	$powerman -h $testaddr -1 t0 >on0.out &&
+	$powerman -h $testaddr -a t0 >latency.out &&
+	grep "^test0: class=control actions=2 " latency.out &&
+	grep "^test0: class=query actions=0 " latency.out
+'
+test_expect_success 'query of the departed client ran on the idle device' '
+	$powerman -h $testaddr -a t16 >latency2.out &&
+	grep "^test1: class=query actions=1 " latency2.out
+'
+test_expect_success 'power control of a departed client is not cancelled' '
+	printf "tagged\r\nc1 cycle t0\r\nc2 on t1\r\n" | depart 0.3 &&
+	$powerman -h $testaddr -q t1 >query.out &&
+	makeoutput "t1" "" "" >query.exp &&
+	test_cmp query.exp query.out
+'
+test_expect_success 'power control response arrives after half-close' '
+	$powerman -h $testaddr -c t0 >cycle3.out &
+	cycle_pid=$!
+	sleep 0.3
+	printf "on t2\r\n" | halfclose | tr -d "\r" >halfclose.out &&
+	wait $cycle_pid &&
+	grep "102 Command completed successfully" halfclose.out &&
+	$powerman -h $testaddr -q t2 >query2.out &&
+	makeoutput "t2" "" "" >query2.exp &&
+	test_cmp query2.exp query2.out
+'
+test_expect_success 'query response arrives after half-close' '
+	$powerman -h $testaddr -c t0 >cycle4.out &
+	cycle_pid=$!
+	sleep 0.3
+	printf "status t4\r\n" | halfclose | tr -d "\r" >halfclose2.out &&
+	wait $cycle_pid &&
+	grep "^302 off: *t4$" halfclose2.out &&
+	grep "^103 Query complete" halfclose2.out
+'
+test_expect_success 'tagged power control response arrives after quit' '
+	printf "tagged\r\nc1 on t3\r\nc2 quit\r\n" | halfclose \
+		| tr -d "\r" >quit.out &&
+	grep "^c2 101 Goodbye" quit.out &&
+	grep "^c1 102 Command completed successfully" quit.out
+'
+test_expect_success 'tagged query response arrives after quit' '
+	$powerman -h $testaddr -c t0 >cycle5.out &
+	cycle_pid=$!
+	sleep 0.3
+	printf "tagged\r\nc1 status t5\r\nc2 quit\r\n" | halfclose \
+		| tr -d "\r" >quit2.out &&
+	wait $cycle_pid &&
+	grep "^c2 101 Goodbye" quit2.out &&
+	grep "^c1 302 off: *t5$" quit2.out &&
+	grep "^c1 103 Query complete" quit2.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+done
+
+test_done
+
+# vi: set ft=sh
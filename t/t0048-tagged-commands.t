@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='Test concurrent tagged commands on one connection'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+test_apiclient=$SHARNESS_BUILD_DIRECTORY/src/powerman/test_apiclient
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11048
+
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success 'tagged mode can be toggled' '
+	printf "tagged\r\nx1 tagged\r\nquit\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" \
+		| sed -n "/Tagged mode ON/,\$p" >toggle.out &&
+	cat >toggle.exp <<-EOT &&
+	powerman> 106 Tagged mode ON
+	x1 106 Tagged mode OFF
+	powerman> 101 Goodbye
+	EOT
+	test_cmp toggle.exp toggle.out
+'
+test_expect_success 'each response line is tagged and there is no prompt' '
+	printf "tagged\r\n\r\nn1 nodes\r\nn2 bogus\r\nn3 exprange\r\nn4 status t[0-1]\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" \
+		| sed -n "/Tagged mode ON/,\$p" >tags.out &&
+	cat >tags.exp <<-EOT &&
+	powerman> 106 Tagged mode ON
+	n1 306 t[0-31]
+	n1 103 Query complete
+	n2 201 Unknown command
+	n3 105 Hostrange expansion ON
+	n4 303 t0: off
+	n4 303 t1: off
+	n4 103 Query complete
+	EOT
+	test_cmp tags.exp tags.out
+'
+test_expect_success 'responses complete out of order' '
+	printf "tagged\r\nc1 cycle t0\r\nq2 status t16\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >order.out &&
+	grep -n "^c1 102 Command completed successfully" order.out \
+		| cut -d: -f1 >c1.line &&
+	grep -n "^q2 103 Query complete" order.out | cut -d: -f1 >q2.line &&
+	test $(cat q2.line) -lt $(cat c1.line)
+'
+test_expect_success 'an untagged command waits for tagged commands' '
+	printf "tagged\r\nc1 cycle t0\r\nc2 tagged\r\nstatus t0\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >busy.out &&
+	grep "^powerman> 208 Command in progress" busy.out &&
+	grep "^c1 102 Command completed successfully" busy.out
+'
+test_expect_success 'start powerman daemon and wait for it to start' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'turn on t1 and t17' '
+	$powerman -h $testaddr -1 t1,t17 >/dev/null
+'
+test_expect_success 'API can query nodes concurrently' '
+	$test_apiclient $testaddr Q t0 t1 t16 t17 >query.out &&
+	LC_ALL=C sort query.out >query.sorted &&
+	cat >query.exp <<-EOT &&
+	t0: off
+	t16: off
+	t17: on
+	t1: on
+	EOT
+	test_cmp query.exp query.sorted
+'
+test_expect_success 'API reports an error for a bad node' '
+	test_must_fail $test_apiclient $testaddr Q t0 bogus
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
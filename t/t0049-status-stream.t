@@ -0,0 +1,118 @@
+#!/bin/sh
+
+test_description='Test streaming of query results as devices answer'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11049
+
+# test1 takes a second to answer a query, test2 never answers
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	specification "vpcslow" {
+	    timeout	2
+	    plug name { "0" "1" "2" "3" "4" "5" "6" "7" "8"
+	                "9" "10" "11" "12" "13" "14" "15" }
+	    script login {
+	        send "login\n"
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script status_all {
+	        delay 1
+	        send "stat *\n"
+	        foreachplug {
+	            expect "plug ([0-9]+): (ON|OFF|ERROR)\n"
+	            setplugstate \$1 \$2 on="ON" off="OFF"
+	        }
+	        expect "[0-9]* OK\n"
+	        expect "[0-9]* vpc> "
+	    }
+	    script status_temp_all {
+	        send "temp *\n"
+	        expect "never"
+	    }
+	}
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpcslow" "$vpcd |&"
+	device "test2" "vpcslow" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	node "t[32-47]" "test2"
+	EOT
+'
+test_expect_success 'start powerman daemon and wait for it to start' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'without streaming, results are in target order' '
+	$powerman -h $testaddr -x -q t16,t0 >query.out &&
+	cat >query.exp <<-EOT &&
+	t16: off
+	t0: off
+	EOT
+	test_cmp query.exp query.out
+'
+test_expect_success 'with streaming, results are in order of arrival' '
+	$powerman -h $testaddr -S -q t16,t0 >stream.out &&
+	cat >stream.exp <<-EOT &&
+	t0: off
+	t16: off
+	EOT
+	test_cmp stream.exp stream.out
+'
+test_expect_success 'results of a device that times out follow at the end' '
+	test_must_fail $powerman -h $testaddr -S -t t0,t32 >temp.out &&
+	head -1 temp.out | grep "^t0: " &&
+	grep "^test2: action timed out" temp.out &&
+	tail -2 temp.out | head -1 | grep "^t32: unknown" &&
+	tail -1 temp.out | grep "^Query completed with errors"
+'
+test_expect_success 'streaming can be toggled in the protocol' '
+	printf "stream\r\nstream\r\nstream\r\nstatus t0\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >proto.out &&
+	grep "^powerman> 107 Result streaming ON" proto.out &&
+	grep "^powerman> 107 Result streaming OFF" proto.out &&
+	grep -A1 "303 t0: off" proto.out | grep "^103 Query complete"
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+test_expect_success 'create test powerman.conf with a status cache' '
+	sed "s/^listen/status_cache_ttl 600\nlisten/" powerman.conf >powerman2.conf
+'
+test_expect_success 'start powerman daemon and wait for it to start' '
+	$powermand -c powerman2.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'cache the status of a slow node' '
+	$powerman -h $testaddr -q t16
+'
+test_expect_success 'cached results are streamed before device results' '
+	$powerman -h $testaddr -S -q t0,t16 >cache.out &&
+	cat >cache.exp <<-EOT &&
+	t16: off
+	t0: off
+	EOT
+	test_cmp cache.exp cache.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='Test notification of power state changes to watching clients'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+test_apiclient=$SHARNESS_BUILD_DIRECTORY/src/powerman/test_apiclient
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11050
+
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success 'watch reports changes made by power control' '
+	(printf "watch t[0-1]\r\n"; sleep 0.5; printf "on t0\r\n"; sleep 0.5;
+	 printf "on t0\r\n"; sleep 0.5; printf "off t0,t16\r\n"; sleep 0.5) \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >control.out &&
+	cat >control.exp <<-EOT &&
+	powerman> 108 Watching t[0-1]
+	powerman> 311 t0: on
+	102 Command completed successfully
+	powerman> 102 Command completed successfully
+	powerman> 311 t0: off
+	102 Command completed successfully
+	powerman> 
+	EOT
+	sed -n "/Watching/,\$p" control.out >control.trim &&
+	echo >>control.trim &&
+	test_cmp control.exp control.trim
+'
+test_expect_success 'watch reports changes seen by queries' '
+	(printf "watch\r\n"; sleep 0.5; printf "status t1,t16\r\n"; sleep 0.5) \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >query.out &&
+	grep "^powerman> 108 Watching t\[0-31\]" query.out &&
+	grep "311 t1: off" query.out &&
+	grep "311 t16: off" query.out
+'
+test_expect_success 'unwatch stops the reports' '
+	(printf "watch t0\r\n"; sleep 0.5; printf "unwatch\r\n"; sleep 0.5;
+	 printf "on t0\r\n"; sleep 0.5) \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >unwatch.out &&
+	grep "^powerman> 109 Watch cancelled" unwatch.out &&
+	test_must_fail grep "311" unwatch.out
+'
+test_expect_success 'watch reports carry the tag of the watch command' '
+	(printf "tagged\r\nw1 watch t0\r\n"; sleep 0.5; printf "c1 on t0\r\n";
+	 sleep 0.5) \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >tagged.out &&
+	grep "^w1 108 Watching t0" tagged.out &&
+	grep "^w1 311 t0: on" tagged.out &&
+	grep "^c1 102 Command completed successfully" tagged.out
+'
+test_expect_success 'watch rejects unknown nodes' '
+	printf "watch t[0-1],bogus\r\n" \
+		| $powermand -c powerman.conf --stdio | tr -d "\r" >bogus.out &&
+	grep "^powerman> 209 No such nodes: bogus" bogus.out
+'
+test_expect_success 'create vpc specification with a refresh period' '
+	sed -e "s/specification \"vpc\"/specification \"vpc-refresh\"/" \
+	    -e "s/^\ttimeout.*/&\n\trefreshperiod 0.5/" \
+	    $vpcdev >vpc-refresh.dev &&
+	grep "refreshperiod 0.5" vpc-refresh.dev
+'
+test_expect_success 'create test powerman.conf with background refresh' '
+	cat >powerman2.conf <<-EOT
+	include "vpc-refresh.dev"
+	listen "$testaddr"
+	status_cache_ttl 10
+	device "test0" "vpc-refresh" "$vpcd |&"
+	node "t[0-15]" "test0"
+	EOT
+'
+test_expect_success 'watch reports changes seen by background refresh' '
+	(printf "watch t[2-3]\r\n"; sleep 1.5) \
+		| $powermand -c powerman2.conf --stdio | tr -d "\r" >refresh.out &&
+	grep "311 t2: off" refresh.out &&
+	grep "311 t3: off" refresh.out
+'
+test_expect_success 'start powerman daemon and wait for it to start' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'API client can wait for power state changes' '
+	$test_apiclient $testaddr W t[4-5] 2 >api.out &
+	echo $! >api.pid &&
+	for i in $(seq 1 50); do
+		grep -q watching api.out && break
+		sleep 0.1
+	done &&
+	$powerman -h $testaddr -1 t4 &&
+	$powerman -h $testaddr -q t5 &&
+	wait $(cat api.pid) &&
+	cat >api.exp <<-EOT &&
+	watching t[4-5]
+	t4: on
+	t5: off
+	EOT
+	test_cmp api.exp api.out
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='Test libpowerman batch and non-blocking calls'
+
+. `dirname $0`/sharness.sh
+
+powermand=$SHARNESS_BUILD_DIRECTORY/src/powerman/powermand
+powerman=$SHARNESS_BUILD_DIRECTORY/src/powerman/powerman
+vpcd=$SHARNESS_BUILD_DIRECTORY/t/simulators/vpcd
+vpcdev=$SHARNESS_TEST_SRCDIR/etc/vpc.dev
+test_apiclient=$SHARNESS_BUILD_DIRECTORY/src/powerman/test_apiclient
+
+# Use port = 11000 + test number
+# That way there won't be port conflicts with make -j
+testaddr=localhost:11051
+
+test_expect_success 'create test powerman.conf' '
+	cat >powerman.conf <<-EOT
+	include "$vpcdev"
+	listen "$testaddr"
+	device "test0" "vpc" "$vpcd |&"
+	device "test1" "vpc" "$vpcd |&"
+	node "t[0-15]" "test0"
+	node "t[16-31]" "test1"
+	EOT
+'
+test_expect_success 'start powerman daemon and wait for it to start' '
+	$powermand -c powerman.conf &
+	echo $! >powermand.pid &&
+	$powerman --retry-connect=100 --server-host=$testaddr -d
+'
+test_expect_success 'batch status returns one result per node' '
+	$test_apiclient $testaddr B q t[0-2],t16 >status.out &&
+	cat >status.exp <<-EOT &&
+	t0: off
+	t1: off
+	t2: off
+	t16: off
+	EOT
+	test_cmp status.exp status.out
+'
+test_expect_success 'on accepts a host range' '
+	$test_apiclient $testaddr B 1 t[1-2],t17 >on.out &&
+	test_must_be_empty on.out
+'
+test_expect_success 'batch status reflects the change' '
+	$test_apiclient $testaddr B q t[0-2],t17 >status2.out &&
+	cat >status2.exp <<-EOT &&
+	t0: off
+	t1: on
+	t2: on
+	t17: on
+	EOT
+	test_cmp status2.exp status2.out
+'
+test_expect_success 'off and cycle accept a host range' '
+	$test_apiclient $testaddr B 0 t[1-2] &&
+	$test_apiclient $testaddr B c t17 &&
+	$test_apiclient $testaddr B q t[1-2],t17 >status3.out &&
+	cat >status3.exp <<-EOT &&
+	t1: off
+	t2: off
+	t17: on
+	EOT
+	test_cmp status3.exp status3.out
+'
+test_expect_success 'batch call reports unknown nodes' '
+	test_must_fail $test_apiclient $testaddr B q t0,bogus 2>bogus.err &&
+	grep "no such nodes" bogus.err
+'
+test_expect_success 'non-blocking requests complete from a poll loop' '
+	$test_apiclient $testaddr P t[0-1] t[16-17] t5 >poll.out &&
+	LC_ALL=C sort poll.out >poll.sorted &&
+	cat >poll.exp <<-EOT &&
+	t0: off
+	t16: off
+	t17: on
+	t1: off
+	t5: off
+	EOT
+	test_cmp poll.exp poll.sorted
+'
+test_expect_success 'stop powerman daemon' '
+	kill -15 $(cat powermand.pid) &&
+	wait
+'
+
+test_done
+
+# vi: set ft=sh